@@ -0,0 +1,1761 @@
+#include "bimap.h"
+#include "bimap_diff.h"
+#include "btree_bimap.h"
+#include "change_stream.h"
+#include "constexpr_bimap.h"
+#include "epoch_reclaimer.h"
+#include "flat_bimap.h"
+#include "flat_combining_bimap.h"
+#include "learned_bimap.h"
+#include "lsm_bimap.h"
+#include "mapped_bimap.h"
+#include "lockfree_bimap.h"
+#include "lru_eviction.h"
+#include "optimistic_bimap.h"
+#include "paged_bimap.h"
+#include "perfect_hash_bimap.h"
+#include "persistent_bimap.h"
+#include "replicated_bimap.h"
+#include "small_bimap.h"
+#include "snapshot.h"
+#include "static_bimap.h"
+#include "ttl_eviction.h"
+#include "wal_bimap.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#ifdef __GLIBC__
+#include <malloc.h>
+#endif
+
+// Usage: benchmark [case-name-prefix] [scale]
+// Every case prints one line per measured configuration. The scale argument
+// multiplies default data set sizes, so that large runs don't need rebuilds.
+
+namespace {
+
+using bench_clock = std::chrono::steady_clock;
+
+double scale = 1;
+
+size_t scaled(size_t n) { return static_cast<size_t>(n * scale); }
+
+double seconds_since(bench_clock::time_point start) {
+  return std::chrono::duration<double>(bench_clock::now() - start).count();
+}
+
+std::vector<unsigned> thread_counts() {
+  unsigned max = std::max(2u, std::thread::hardware_concurrency());
+  std::vector<unsigned> counts;
+  for (unsigned n = 1; n <= max; n *= 2) {
+    counts.push_back(n);
+  }
+  return counts;
+}
+
+void report(std::string const &name, std::string const &config,
+            double value, char const *unit) {
+  std::cout << name << " " << config << ": " << value << " " << unit
+            << std::endl;
+}
+
+// Runs reader threads against one writer thread for the given duration and
+// returns total reads per second. Read and write take the map by reference.
+template <typename Read, typename Write>
+double reads_under_writes(unsigned readers, Read const &read,
+                          Write const &write) {
+  std::atomic<bool> stop(false);
+  std::atomic<size_t> total(0);
+  std::thread writer([&] {
+    std::mt19937 e(1);
+    while (!stop.load(std::memory_order_relaxed)) {
+      write(e);
+    }
+  });
+  std::vector<std::thread> threads;
+  auto start = bench_clock::now();
+  for (unsigned i = 0; i < readers; i++) {
+    threads.emplace_back([&, i] {
+      std::mt19937 e(i + 2);
+      size_t done = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int j = 0; j < 256; j++) {
+          read(e);
+        }
+        done += 256;
+      }
+      total += done;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  stop = true;
+  for (auto &t : threads) {
+    t.join();
+  }
+  writer.join();
+  return total / seconds_since(start);
+}
+
+void optimistic_read_scaling() {
+  size_t const n = scaled(1 << 20);
+  optimistic_bimap<uint32_t, uint32_t> optimistic;
+  bimap<uint32_t, uint32_t> locked;
+  std::mutex mutex;
+  for (uint32_t i = 0; i < n; i++) {
+    optimistic.insert(i * 2, i * 3);
+    locked.insert(i * 2, i * 3);
+  }
+  auto key = [n](std::mt19937 &e) { return static_cast<uint32_t>(e() % n); };
+
+  for (unsigned readers : thread_counts()) {
+    double optimistic_rate = reads_under_writes(
+        readers,
+        [&](std::mt19937 &e) { optimistic.find_left(key(e) * 2); },
+        [&](std::mt19937 &e) {
+          uint32_t k = key(e);
+          optimistic.erase_left(k * 2);
+          optimistic.insert(k * 2, k * 3);
+        });
+    report("optimistic_read_scaling",
+           "optimistic_bimap readers=" + std::to_string(readers),
+           optimistic_rate / 1e6, "Mreads/s");
+
+    double locked_rate = reads_under_writes(
+        readers,
+        [&](std::mt19937 &e) {
+          std::lock_guard<std::mutex> lock(mutex);
+          locked.find_left(key(e) * 2);
+        },
+        [&](std::mt19937 &e) {
+          uint32_t k = key(e);
+          std::lock_guard<std::mutex> lock(mutex);
+          locked.erase_left(k * 2);
+          locked.insert(k * 2, k * 3);
+        });
+    report("optimistic_read_scaling",
+           "mutex+bimap readers=" + std::to_string(readers),
+           locked_rate / 1e6, "Mreads/s");
+  }
+}
+
+// Binds the calling thread to one core, so that per-core data stays local.
+void pin_to_cpu(unsigned cpu) {
+#ifdef __linux__
+  cpu_set_t set;
+  CPU_ZERO(&set);
+  CPU_SET(cpu % std::max(1u, std::thread::hardware_concurrency()), &set);
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+  (void)cpu;
+#endif
+}
+
+// Runs the same operation on every thread for the given duration and returns
+// total operations per second. Pinned threads are bound to consecutive cores.
+template <typename Operation>
+double throughput(unsigned threads, Operation const &operation,
+                  bool pinned = false) {
+  std::atomic<bool> stop(false);
+  std::atomic<size_t> total(0);
+  std::vector<std::thread> workers;
+  auto start = bench_clock::now();
+  for (unsigned i = 0; i < threads; i++) {
+    workers.emplace_back([&, i] {
+      if (pinned) {
+        pin_to_cpu(i);
+      }
+      std::mt19937 e(i + 1);
+      size_t done = 0;
+      while (!stop.load(std::memory_order_relaxed)) {
+        for (int j = 0; j < 256; j++) {
+          operation(e);
+        }
+        done += 256;
+      }
+      total += done;
+    });
+  }
+  std::this_thread::sleep_for(std::chrono::milliseconds(500));
+  stop = true;
+  for (auto &w : workers) {
+    w.join();
+  }
+  return total / seconds_since(start);
+}
+
+void lockfree_write_throughput() {
+  size_t const n = scaled(1 << 18);
+  auto key = [n](std::mt19937 &e) { return static_cast<uint32_t>(e() % n); };
+
+  for (unsigned threads : thread_counts()) {
+    // Every operation is an insert or an erase of a random key, so roughly
+    // half of the key space is occupied in the steady state.
+    lockfree_bimap<uint32_t, uint32_t> lockfree;
+    double lockfree_rate = throughput(threads, [&](std::mt19937 &e) {
+      uint32_t k = key(e);
+      if (e() % 2 == 0) {
+        lockfree.insert(k, k ^ 0x5555);
+      } else {
+        lockfree.erase_left(k);
+      }
+    });
+    report("lockfree_write_throughput",
+           "lockfree_bimap threads=" + std::to_string(threads),
+           lockfree_rate / 1e6, "Mops/s");
+
+    bimap<uint32_t, uint32_t> locked;
+    std::mutex mutex;
+    double locked_rate = throughput(threads, [&](std::mt19937 &e) {
+      uint32_t k = key(e);
+      std::lock_guard<std::mutex> lock(mutex);
+      if (e() % 2 == 0) {
+        locked.insert(k, k ^ 0x5555);
+      } else {
+        locked.erase_left(k);
+      }
+    });
+    report("lockfree_write_throughput",
+           "mutex+bimap threads=" + std::to_string(threads),
+           locked_rate / 1e6, "Mops/s");
+  }
+}
+
+// Every thread pins, retires a node-sized object and unpins in a loop. Reports
+// the cost per retire, the delay until the object is actually freed and the
+// peak memory held by retired but not yet freed objects.
+void reclaimer_latency() {
+  struct retired_object {
+    bench_clock::time_point retired_at;
+    char payload[48];
+  };
+  static std::atomic<size_t> freed(0);
+  static std::atomic<uint64_t> total_delay_ns(0), max_delay_ns(0);
+
+  for (unsigned threads : thread_counts()) {
+    size_t const per_thread = scaled(1 << 18);
+    epoch_reclaimer reclaimer;
+    freed = 0;
+    total_delay_ns = 0;
+    max_delay_ns = 0;
+    std::atomic<size_t> peak_pending(0);
+    std::atomic<bool> done(false);
+    std::thread sampler([&] {
+      while (!done) {
+        size_t pending = reclaimer.pending();
+        if (pending > peak_pending) {
+          peak_pending = pending;
+        }
+        std::this_thread::sleep_for(std::chrono::microseconds(100));
+      }
+    });
+    std::vector<std::thread> workers;
+    auto start = bench_clock::now();
+    for (unsigned t = 0; t < threads; t++) {
+      workers.emplace_back([&] {
+        for (size_t i = 0; i < per_thread; i++) {
+          auto guard = reclaimer.pin();
+          auto object = new retired_object{bench_clock::now(), {}};
+          reclaimer.retire(
+              object,
+              [](void *object, void *) {
+                auto retired = static_cast<retired_object *>(object);
+                uint64_t delay = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                     bench_clock::now() - retired->retired_at)
+                                     .count();
+                total_delay_ns += delay;
+                uint64_t max = max_delay_ns;
+                while (delay > max &&
+                       !max_delay_ns.compare_exchange_weak(max, delay)) {
+                }
+                freed++;
+                delete retired;
+              },
+              nullptr);
+        }
+      });
+    }
+    for (auto &w : workers) {
+      w.join();
+    }
+    double elapsed = seconds_since(start);
+    done = true;
+    sampler.join();
+    size_t retired = per_thread * threads;
+    std::string config = "threads=" + std::to_string(threads);
+    report("reclaimer_latency", config + " pin+retire",
+           elapsed * 1e9 * threads / retired, "ns/op");
+    report("reclaimer_latency", config + " mean retire-to-free",
+           freed == 0 ? 0.0 : total_delay_ns / 1e3 / freed, "us");
+    report("reclaimer_latency", config + " max retire-to-free",
+           max_delay_ns / 1e3, "us");
+    report("reclaimer_latency", config + " peak pending",
+           peak_pending * (sizeof(retired_object) + 3 * sizeof(void *)) /
+               1024.0,
+           "KiB");
+  }
+}
+
+// Half lookups, a quarter inserts and a quarter erases over a shared key
+// space, from 2 to 64 threads regardless of the number of cores.
+void flat_combining_throughput() {
+  size_t const n = scaled(1 << 16);
+  auto key = [n](std::mt19937 &e) { return static_cast<uint32_t>(e() % n); };
+
+  for (unsigned threads = 2; threads <= 64; threads *= 2) {
+    flat_combining_bimap<uint32_t, uint32_t> combining;
+    double combining_rate = throughput(threads, [&](std::mt19937 &e) {
+      uint32_t k = key(e);
+      switch (e() % 4) {
+      case 0:
+        combining.insert(k, ~k);
+        break;
+      case 1:
+        combining.erase_left(k);
+        break;
+      default:
+        combining.find_left(k);
+      }
+    });
+    report("flat_combining_throughput",
+           "flat_combining_bimap threads=" + std::to_string(threads),
+           combining_rate / 1e6, "Mops/s");
+
+    bimap<uint32_t, uint32_t> locked;
+    std::mutex mutex;
+    double locked_rate = throughput(threads, [&](std::mt19937 &e) {
+      uint32_t k = key(e);
+      unsigned op = e() % 4;
+      std::lock_guard<std::mutex> lock(mutex);
+      switch (op) {
+      case 0:
+        locked.insert(k, ~k);
+        break;
+      case 1:
+        locked.erase_left(k);
+        break;
+      default:
+        locked.find_left(k);
+      }
+    });
+    report("flat_combining_throughput",
+           "mutex+bimap threads=" + std::to_string(threads),
+           locked_rate / 1e6, "Mops/s");
+  }
+}
+
+// Nine lookups per update over a shared key space with threads pinned to
+// cores, one replica per four cores against a single locked bimap.
+void replicated_read_scaling() {
+  size_t const n = scaled(1 << 16);
+  auto key = [n](std::mt19937 &e) { return static_cast<uint32_t>(e() % n); };
+
+  for (unsigned threads : thread_counts()) {
+    replicated_bimap<uint32_t, uint32_t> replicated;
+    for (uint32_t i = 0; i < n; i += 2) {
+      replicated.insert(i, ~i);
+    }
+    double replicated_rate = throughput(
+        threads,
+        [&](std::mt19937 &e) {
+          uint32_t k = key(e);
+          switch (e() % 20) {
+          case 0:
+            replicated.insert(k, ~k);
+            break;
+          case 1:
+            replicated.erase_left(k);
+            break;
+          default:
+            replicated.find_left(k);
+          }
+        },
+        true);
+    report("replicated_read_scaling",
+           "replicated_bimap replicas=" +
+               std::to_string(replicated.replicas_size()) +
+               " threads=" + std::to_string(threads),
+           replicated_rate / 1e6, "Mops/s");
+
+    bimap<uint32_t, uint32_t> locked;
+    std::mutex mutex;
+    for (uint32_t i = 0; i < n; i += 2) {
+      locked.insert(i, ~i);
+    }
+    double locked_rate = throughput(
+        threads,
+        [&](std::mt19937 &e) {
+          uint32_t k = key(e);
+          unsigned op = e() % 20;
+          std::lock_guard<std::mutex> lock(mutex);
+          switch (op) {
+          case 0:
+            locked.insert(k, ~k);
+            break;
+          case 1:
+            locked.erase_left(k);
+            break;
+          default:
+            locked.find_left(k);
+          }
+        },
+        true);
+    report("replicated_read_scaling",
+           "mutex+bimap threads=" + std::to_string(threads),
+           locked_rate / 1e6, "Mops/s");
+  }
+}
+
+// Bytes currently allocated on the heap, or 0 where the allocator can't tell.
+size_t heap_in_use() {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || __GLIBC_MINOR__ >= 33)
+  struct mallinfo2 info = mallinfo2();
+  return info.uordblks + info.hblkhd;
+#else
+  return 0;
+#endif
+}
+
+// Resident set size of this process, or 0 where it can't be read.
+size_t resident_bytes() {
+#ifdef __linux__
+  std::ifstream statm("/proc/self/statm");
+  size_t pages = 0;
+  size_t resident = 0;
+  statm >> pages >> resident;
+  return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+// Drops the cached pages of a file, so that the next reads go to the disk.
+void evict_from_page_cache(std::string const &path) {
+#ifdef __linux__
+  int descriptor = open(path.c_str(), O_RDONLY);
+  if (descriptor >= 0) {
+    fdatasync(descriptor);
+    posix_fadvise(descriptor, 0, 0, POSIX_FADV_DONTNEED);
+    close(descriptor);
+  }
+#endif
+}
+
+// Memory per pair and random successful lookups of the splay tree against
+// its frozen copy.
+void frozen_lookup() {
+  for (size_t n : {scaled(1 << 10), scaled(1 << 16), scaled(1 << 22)}) {
+    std::mt19937 e(1);
+    std::vector<uint32_t> keys;
+    size_t before = heap_in_use();
+    bimap<uint32_t, uint64_t> tree;
+    while (tree.size() < n) {
+      uint32_t k = e();
+      if (tree.insert(k, uint64_t(k) * 3) != tree.end_left()) {
+        keys.push_back(k);
+      }
+    }
+    size_t tree_bytes = heap_in_use() - before - keys.capacity() * sizeof(uint32_t);
+    before = heap_in_use();
+    flat_bimap<uint32_t, uint64_t> flat = tree.freeze();
+    size_t flat_bytes = heap_in_use() - before;
+    std::string config = "n=" + std::to_string(n);
+    report("frozen_lookup", config + " bimap memory",
+           double(tree_bytes) / n, "bytes/pair");
+    report("frozen_lookup", config + " flat_bimap memory",
+           double(flat_bytes) / n, "bytes/pair");
+
+    size_t const lookups = scaled(1 << 22);
+    uint64_t sum = 0;
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      sum += tree.at_left(keys[e() % keys.size()]);
+    }
+    report("frozen_lookup", config + " bimap",
+           lookups / seconds_since(start) / 1e6, "Mlookups/s");
+    start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      sum += flat.at_left(keys[e() % keys.size()]);
+    }
+    report("frozen_lookup", config + " flat_bimap",
+           lookups / seconds_since(start) / 1e6, "Mlookups/s");
+    if (sum == 42) {
+      std::cout << std::endl;
+    }
+  }
+}
+
+// Random inserts, successful lookups and memory per pair at 1M and 16M pairs
+// by default; scale 32 reaches 500M pairs for the B+-tree.
+template <typename Map>
+void btree_scale_run(char const *name, size_t n) {
+  std::mt19937 e(1);
+  std::vector<uint32_t> keys;
+  keys.reserve(n);
+  size_t before = heap_in_use();
+  auto map = std::make_unique<Map>();
+  auto start = bench_clock::now();
+  while (map->size() < n) {
+    uint32_t k = e();
+    if (map->insert(k, uint64_t(k) << 1) != map->end_left()) {
+      keys.push_back(k);
+    }
+  }
+  double insert_rate = n / seconds_since(start);
+  size_t bytes = heap_in_use() - before - keys.capacity() * sizeof(uint32_t);
+
+  size_t const lookups = scaled(1 << 22);
+  uint64_t sum = 0;
+  start = bench_clock::now();
+  for (size_t i = 0; i < lookups; i++) {
+    sum += map->at_left(keys[e() % n]);
+  }
+  double lookup_rate = lookups / seconds_since(start);
+  std::string config = std::string(name) + " n=" + std::to_string(n);
+  report("btree_scale", config + " insert", insert_rate / 1e6, "Mops/s");
+  report("btree_scale", config + " lookup", lookup_rate / 1e6, "Mops/s");
+  report("btree_scale", config + " memory", double(bytes) / n, "bytes/pair");
+  if (sum == 42) {
+    std::cout << std::endl;
+  }
+}
+
+void btree_scale() {
+  for (size_t n : {scaled(1 << 20), scaled(1 << 24)}) {
+    btree_scale_run<btree_bimap<uint32_t, uint64_t>>("btree_bimap", n);
+    btree_scale_run<bimap<uint32_t, uint64_t>>("bimap", n);
+  }
+}
+
+// Successful lookups by left key: learned index against binary search over the
+// same sorted keys, the Eytzinger layout and the splay tree. Uniform keys are
+// the easy case for a linear model, clustered ids with random gaps the usual.
+void learned_lookup() {
+  for (size_t n : {scaled(1 << 16), scaled(1 << 22)}) {
+    for (bool clustered : {false, true}) {
+      std::mt19937_64 e(1);
+      bimap<uint64_t, uint64_t> tree;
+      uint64_t next = 0;
+      while (tree.size() < n) {
+        uint64_t k = clustered ? (next += 1 + (e() % 64 == 0 ? e() % 100000 : e() % 4)) : e();
+        tree.insert(k, k * 3);
+      }
+      std::vector<uint64_t> keys;
+      keys.reserve(n);
+      for (auto it = tree.begin_left(); it != tree.end_left(); ++it) {
+        keys.push_back(*it);
+      }
+      learned_bimap<uint64_t, uint64_t> learned(tree);
+      flat_bimap<uint64_t, uint64_t> flat = tree.freeze();
+      std::vector<uint64_t> queries;
+      size_t const lookups = scaled(1 << 22);
+      for (size_t i = 0; i < lookups; i++) {
+        queries.push_back(keys[e() % n]);
+      }
+      std::string config = std::string(clustered ? "clustered" : "uniform") +
+                           " n=" + std::to_string(n);
+      report("learned_lookup", config + " learned index",
+             double(learned.index_bytes()) / n, "bytes/pair");
+
+      uint64_t sum = 0;
+      auto start = bench_clock::now();
+      for (uint64_t q : queries) {
+        sum += learned.at_left(q);
+      }
+      report("learned_lookup", config + " learned_bimap",
+             lookups / seconds_since(start) / 1e6, "Mlookups/s");
+      start = bench_clock::now();
+      for (uint64_t q : queries) {
+        sum += *std::lower_bound(keys.begin(), keys.end(), q);
+      }
+      report("learned_lookup", config + " binary search",
+             lookups / seconds_since(start) / 1e6, "Mlookups/s");
+      start = bench_clock::now();
+      for (uint64_t q : queries) {
+        sum += flat.at_left(q);
+      }
+      report("learned_lookup", config + " flat_bimap",
+             lookups / seconds_since(start) / 1e6, "Mlookups/s");
+      start = bench_clock::now();
+      for (uint64_t q : queries) {
+        sum += tree.at_left(q);
+      }
+      report("learned_lookup", config + " bimap",
+             lookups / seconds_since(start) / 1e6, "Mlookups/s");
+      if (sum == 42) {
+        std::cout << std::endl;
+      }
+    }
+  }
+}
+
+// Build time, memory and lookups of perfect_hash_bimap against the splay tree
+// and flat_bimap, the frozen sorted arrays. Memory counts the pairs and the
+// index, not the allocator's overhead; scale 4 gives 16M pairs.
+void perfect_hash_lookup() {
+  for (size_t n : {scaled(1 << 16), scaled(1 << 22)}) {
+    std::mt19937_64 e(1);
+    auto start = bench_clock::now();
+    bimap<uint64_t, uint64_t> tree;
+    while (tree.size() < n) {
+      tree.insert(e(), e());
+    }
+    std::string config = "n=" + std::to_string(n);
+    report("perfect_hash_lookup", config + " bimap build",
+           seconds_since(start) * 1e3, "ms");
+    start = bench_clock::now();
+    flat_bimap<uint64_t, uint64_t> flat = tree.freeze();
+    report("perfect_hash_lookup", config + " flat_bimap build",
+           seconds_since(start) * 1e3, "ms");
+    start = bench_clock::now();
+    perfect_hash_bimap<uint64_t, uint64_t> single(tree, 1);
+    report("perfect_hash_lookup", config + " perfect_hash_bimap build threads=1",
+           seconds_since(start) * 1e3, "ms");
+    size_t threads = perfect_hash_bimap<uint64_t, uint64_t>::default_threads();
+    start = bench_clock::now();
+    perfect_hash_bimap<uint64_t, uint64_t> hashed(tree, threads);
+    report("perfect_hash_lookup",
+           config + " perfect_hash_bimap build threads=" +
+               std::to_string(threads),
+           seconds_since(start) * 1e3, "ms");
+
+    size_t const pair_bytes = 2 * sizeof(uint64_t);
+    report("perfect_hash_lookup", config + " bimap memory",
+           6 * sizeof(void *) + pair_bytes, "bytes/pair");
+    report("perfect_hash_lookup", config + " flat_bimap memory",
+           pair_bytes + 2 * sizeof(uint32_t), "bytes/pair");
+    report("perfect_hash_lookup", config + " perfect_hash_bimap memory",
+           pair_bytes + 2 * sizeof(uint32_t) + double(hashed.index_bytes()) / n,
+           "bytes/pair");
+    report("perfect_hash_lookup", config + " perfect_hash_bimap index",
+           hashed.index_bytes() * 8.0 / (2 * n), "bits/value");
+
+    std::vector<std::pair<uint64_t, uint64_t>> pairs;
+    pairs.reserve(n);
+    for (auto it = tree.begin_left(); it != tree.end_left(); ++it) {
+      pairs.emplace_back(*it, *it.flip());
+    }
+    size_t const lookups = scaled(1 << 22);
+    std::vector<size_t> picks(lookups);
+    for (auto &p : picks) {
+      p = e() % n;
+    }
+    auto look_up = [&](auto const &map, char const *name) {
+      uint64_t sum = 0;
+      auto start = bench_clock::now();
+      for (size_t p : picks) {
+        sum += map.at_left(pairs[p].first);
+      }
+      report("perfect_hash_lookup", config + " " + name + " by left",
+             lookups / seconds_since(start) / 1e6, "Mlookups/s");
+      start = bench_clock::now();
+      for (size_t p : picks) {
+        sum += map.at_right(pairs[p].second);
+      }
+      report("perfect_hash_lookup", config + " " + name + " by right",
+             lookups / seconds_since(start) / 1e6, "Mlookups/s");
+      if (sum == 42) {
+        std::cout << std::endl;
+      }
+    };
+    look_up(hashed, "perfect_hash_bimap");
+    look_up(flat, "flat_bimap");
+    look_up(tree, "bimap");
+  }
+}
+
+// Restart from a snapshot against rebuilding by inserts. One million pairs by
+// default; scales 10, 100 and 500 give the 10M, 100M and 500M pair runs.
+void snapshot_restart() {
+  size_t const n = scaled(1000000);
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-benchmark.snapshot")
+          .string();
+  std::mt19937_64 e(1);
+  auto start = bench_clock::now();
+  auto map = std::make_unique<bimap<uint64_t, uint64_t>>();
+  while (map->size() < n) {
+    map->insert(e(), e());
+  }
+  double insert_seconds = seconds_since(start);
+  start = bench_clock::now();
+  map->save(path);
+  double save_seconds = seconds_since(start);
+  map.reset();
+  start = bench_clock::now();
+  auto loaded = std::make_unique<bimap<uint64_t, uint64_t>>(
+      bimap<uint64_t, uint64_t>::load(path));
+  double load_seconds = seconds_since(start);
+  double bytes = static_cast<double>(std::filesystem::file_size(path));
+  std::filesystem::remove(path);
+
+  std::string config = "n=" + std::to_string(n);
+  report("snapshot_restart", config + " rebuild by inserts", insert_seconds, "s");
+  report("snapshot_restart", config + " save", save_seconds, "s");
+  report("snapshot_restart", config + " load", load_seconds, "s");
+  report("snapshot_restart", config + " file", bytes / n, "bytes/pair");
+  report("snapshot_restart", config + " file", bytes / (1 << 20), "MiB");
+}
+
+// Opening a snapshot by mapping it, with a cold page cache: open latency,
+// latency of the first lookup and resident memory after the first lookup and
+// after 1M random lookups, then loading the same snapshot for reference.
+void mapped_open() {
+  size_t const n = scaled(1 << 20);
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-benchmark.snapshot")
+          .string();
+  std::vector<uint64_t> keys;
+  {
+    std::mt19937_64 e(1);
+    bimap<uint64_t, uint64_t> map;
+    while (map.size() < n) {
+      uint64_t k = e();
+      if (map.insert(k, e()) != map.end_left()) {
+        keys.push_back(k);
+      }
+    }
+    map.save(path);
+  }
+  std::string config = "n=" + std::to_string(n);
+  std::mt19937 e(2);
+  uint64_t sum = 0;
+
+  using warm_up = mapped_bimap<uint64_t, uint64_t>::warm_up;
+  std::pair<warm_up, char const *> const modes[] = {
+      {warm_up::none, "lazy"},
+      {warm_up::advise, "madvise"},
+      {warm_up::populate, "populate"}};
+  for (auto const &mode : modes) {
+    evict_from_page_cache(path);
+    size_t resident = resident_bytes();
+    auto start = bench_clock::now();
+    mapped_bimap<uint64_t, uint64_t> mapped(path, mode.first);
+    report("mapped_open", config + " " + mode.second + " open",
+           seconds_since(start) * 1e6, "us");
+    start = bench_clock::now();
+    sum += mapped.at_left(keys[e() % n]);
+    report("mapped_open", config + " " + mode.second + " first lookup",
+           seconds_since(start) * 1e6, "us");
+    report("mapped_open", config + " " + mode.second + " first lookup rss",
+           (double(resident_bytes()) - double(resident)) / (1 << 20), "MiB");
+    size_t const lookups = 1 << 20;
+    start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      sum += mapped.at_left(keys[e() % n]);
+    }
+    report("mapped_open", config + " " + mode.second + " lookups",
+           lookups / seconds_since(start) / 1e6, "Mlookups/s");
+    report("mapped_open", config + " " + mode.second + " lookups rss",
+           (double(resident_bytes()) - double(resident)) / (1 << 20), "MiB");
+  }
+  evict_from_page_cache(path);
+  auto start = bench_clock::now();
+  {
+    auto loaded = bimap<uint64_t, uint64_t>::load(path);
+    report("mapped_open", config + " load", seconds_since(start) * 1e6, "us");
+    sum += loaded.at_left(keys[0]);
+  }
+  std::filesystem::remove(path);
+  if (sum == 42) {
+    std::cout << std::endl;
+  }
+}
+
+// Restarting a persistent bimap: building it by inserts with the nodes in a
+// mapped file, reopening the file with a cold page cache and its first
+// lookups, against loading a snapshot of the same pairs.
+void persistent_reopen() {
+  size_t const n = scaled(1000000);
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-benchmark.persistent")
+          .string();
+  std::string snapshot_path =
+      (std::filesystem::temp_directory_path() / "bimap-benchmark.snapshot")
+          .string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  std::string config = "n=" + std::to_string(n);
+  std::vector<uint64_t> keys;
+  {
+    std::mt19937_64 e(1);
+    auto start = bench_clock::now();
+    persistent_bimap<uint64_t, uint64_t> map(path);
+    while (map.size() < n) {
+      uint64_t k = e();
+      if (map.insert(k, e()) != map.end_left()) {
+        keys.push_back(k);
+      }
+    }
+    map.sync();
+    report("persistent_reopen", config + " build", seconds_since(start), "s");
+  }
+  {
+    bimap<uint64_t, uint64_t> map;
+    std::mt19937_64 e(1);
+    while (map.size() < n) {
+      uint64_t k = e();
+      map.insert(k, e());
+    }
+    map.save(snapshot_path);
+  }
+  std::mt19937 e(2);
+  uint64_t sum = 0;
+  size_t const lookups = 1000;
+
+  evict_from_page_cache(path);
+  auto start = bench_clock::now();
+  {
+    persistent_bimap<uint64_t, uint64_t> map(path);
+    report("persistent_reopen", config + " reopen", seconds_since(start) * 1e6,
+           "us");
+    start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      sum += map.at_left(keys[e() % n]);
+    }
+    report("persistent_reopen",
+           config + " first " + std::to_string(lookups) + " lookups",
+           seconds_since(start) * 1e3, "ms");
+  }
+  report("persistent_reopen", config + " file",
+         double(std::filesystem::file_size(path)) / n, "bytes/pair");
+
+  evict_from_page_cache(snapshot_path);
+  start = bench_clock::now();
+  {
+    auto loaded = bimap<uint64_t, uint64_t>::load(snapshot_path);
+    report("persistent_reopen", config + " snapshot load",
+           seconds_since(start) * 1e6, "us");
+    sum += loaded.at_left(keys[0]);
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  std::filesystem::remove(snapshot_path);
+  if (sum == 42) {
+    std::cout << std::endl;
+  }
+}
+
+// Insert throughput of a write-ahead logged bimap with every sync mode, for
+// 1 to 16 writer threads running for about one second each.
+void wal_throughput() {
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "bimap-benchmark-wal";
+  std::pair<wal::sync_mode, char const *> const modes[] = {
+      {wal::sync_mode::per_operation, "fsync per op"},
+      {wal::sync_mode::group_commit, "group commit"},
+      {wal::sync_mode::none, "no sync"}};
+  for (auto const &mode : modes) {
+    for (unsigned threads_count : {1u, 4u, 16u}) {
+      std::filesystem::remove_all(directory);
+      std::filesystem::create_directory(directory);
+      std::atomic<uint64_t> total(0);
+      double seconds;
+      {
+        wal w((directory / "map").string(), mode.first);
+        auto start = bench_clock::now();
+        std::vector<std::thread> threads;
+        for (unsigned t = 0; t < threads_count; t++) {
+          threads.emplace_back([&, t] {
+            std::mt19937_64 e(t);
+            uint64_t done = 0;
+            while (seconds_since(start) < scaled(1000) / 1000.0) {
+              for (int i = 0; i < 16; i++) {
+                uint64_t k = e();
+                done += w.insert(k, e());
+              }
+            }
+            total += done;
+          });
+        }
+        for (auto &thread : threads) {
+          thread.join();
+        }
+        w.sync();
+        seconds = seconds_since(start);
+      }
+      report("wal_throughput",
+             std::string(mode.second) + " threads=" + std::to_string(threads_count),
+             total / seconds / 1e3, "Kops/s");
+    }
+  }
+  std::filesystem::remove_all(directory);
+}
+
+// Latency of single inserts by one writer into a map of n pairs: without a
+// checkpoint, while checkpoint_async() saves the map from its own thread, and
+// with a blocking save, which the writer has to wait for once.
+void checkpoint_latency() {
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "bimap-benchmark-checkpoint";
+  std::string const target = (directory / "checkpoint").string();
+  size_t const n = scaled(1 << 21);
+  char const *const modes[] = {"no checkpoint", "checkpoint_async", "blocking save"};
+  for (int mode = 0; mode < 3; mode++) {
+    std::filesystem::remove_all(directory);
+    std::filesystem::create_directory(directory);
+    wal w((directory / "map").string(), wal::sync_mode::none, uint64_t(1) << 40);
+    std::mt19937_64 e(42);
+    for (size_t i = 0; i < n; i++) {
+      uint64_t k = e();
+      w.insert(k, e());
+    }
+    std::vector<double> latencies;
+    std::atomic<bool> done(false);
+    std::thread checkpointer;
+    auto start = bench_clock::now();
+    if (mode == 1) {
+      checkpointer = std::thread([&] {
+        w.checkpoint_async(target);
+        w.wait_for_checkpoint();
+        done = true;
+      });
+    }
+    if (mode == 2) {
+      w.checkpoint_async(target);
+      w.wait_for_checkpoint();
+      latencies.push_back(seconds_since(start));
+    }
+    while (latencies.size() < n / 8 || (mode == 1 && !done)) {
+      uint64_t k = e(), v = e();
+      auto before = bench_clock::now();
+      w.insert(k, v);
+      latencies.push_back(seconds_since(before));
+    }
+    if (checkpointer.joinable()) {
+      checkpointer.join();
+    }
+    double elapsed = seconds_since(start);
+    std::sort(latencies.begin(), latencies.end());
+    std::string config = std::string(modes[mode]) + " n=" + std::to_string(n);
+    report("checkpoint_latency", config + " p50",
+           latencies[latencies.size() / 2] * 1e6, "us");
+    report("checkpoint_latency", config + " p99",
+           latencies[latencies.size() * 99 / 100] * 1e6, "us");
+    report("checkpoint_latency", config + " max", latencies.back() * 1e6, "us");
+    report("checkpoint_latency", config + " inserts",
+           latencies.size() / elapsed / 1e3, "Kops/s");
+  }
+  std::filesystem::remove_all(directory);
+}
+
+// Replicating a master bimap into a replica through a pipe: the master
+// records its changes and writes a frame of every 4096 changes, a thread
+// reads the frames and applies them to the replica. Reports the master alone
+// without an observer, the whole pipeline until the replica caught up, the
+// share of operations, which changed something, and the encoded bytes per
+// change.
+void replication_pipe() {
+  using master_t = bimap<uint64_t, uint64_t, std::less<>, std::less<>,
+                         heap_storage, change_recorder<uint64_t, uint64_t>>;
+  size_t const n = scaled(1 << 21);
+  uint64_t const keys = scaled(1 << 18);
+  size_t const batch_changes = 4096;
+  auto change = [&](auto &map, std::mt19937_64 &e) {
+    uint64_t left = e() % keys, right = e() % keys;
+    if (e() % 4 == 0) {
+      map.erase_left(left);
+    }
+    else {
+      map.insert(left, right);
+    }
+  };
+  std::string config = "changes=" + std::to_string(n);
+  {
+    bimap<uint64_t, uint64_t> plain;
+    std::mt19937_64 e(1);
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      change(plain, e);
+    }
+    report("replication_pipe", config + " master without observer",
+           n / seconds_since(start) / 1e3, "Kops/s");
+  }
+  int ends[2];
+  if (pipe(ends) != 0) {
+    return;
+  }
+  auto write_all = [](int descriptor, char const *data, size_t size) {
+    while (size > 0) {
+      ssize_t written = write(descriptor, data, size);
+      if (written <= 0) {
+        std::abort();
+      }
+      data += written;
+      size -= static_cast<size_t>(written);
+    }
+  };
+  auto read_all = [](int descriptor, char *data, size_t size) {
+    while (size > 0) {
+      ssize_t done = read(descriptor, data, size);
+      if (done <= 0) {
+        return false;
+      }
+      data += done;
+      size -= static_cast<size_t>(done);
+    }
+    return true;
+  };
+  bimap<uint64_t, uint64_t> replica;
+  bool consistent = true;
+  auto start = bench_clock::now();
+  std::thread applier_thread([&] {
+    change_applier<uint64_t, uint64_t> applier;
+    std::vector<char> frame(sizeof(change_frame_header));
+    while (read_all(ends[0], frame.data(), sizeof(change_frame_header))) {
+      change_frame_header header;
+      std::memcpy(&header, frame.data(), sizeof(header));
+      frame.resize(sizeof(header) + header.length);
+      read_all(ends[0], frame.data() + sizeof(header), header.length);
+      consistent &= applier.apply(replica, frame);
+    }
+  });
+  change_batch<uint64_t, uint64_t> batch;
+  master_t master{std::less<>(), std::less<>(), heap_storage(),
+                  change_recorder<uint64_t, uint64_t>(&batch)};
+  std::mt19937_64 e(1);
+  uint64_t bytes = 0, recorded = 0;
+  for (size_t i = 0; i < n; i++) {
+    change(master, e);
+    if (batch.size() >= batch_changes || (i + 1 == n && !batch.empty())) {
+      recorded += batch.size();
+      std::vector<char> frame = batch.encode();
+      bytes += frame.size();
+      write_all(ends[1], frame.data(), frame.size());
+    }
+  }
+  close(ends[1]);
+  applier_thread.join();
+  close(ends[0]);
+  double seconds = seconds_since(start);
+  bool same = consistent && replica.size() == master.size();
+  auto other = replica.begin_left();
+  for (auto it = master.begin_left(); same && it != master.end_left();
+       ++it, ++other) {
+    same = (*other == *it && *other.flip() == *it.flip());
+  }
+  if (!same) {
+    std::cerr << "replication_pipe: the replica differs from the master"
+              << std::endl;
+  }
+  report("replication_pipe", config + " master with replica",
+         n / seconds / 1e3, "Kops/s");
+  report("replication_pipe", config + " recorded",
+         static_cast<double>(recorded) / n * 100, "% of operations");
+  report("replication_pipe", config + " encoded",
+         static_cast<double>(bytes) / recorded, "bytes/change");
+}
+
+// Reconciling two large maps, which differ in 0.1% and in 20% of their pairs:
+// a third of the differences is removed, added and changed pairs each.
+// Reports the diff by merging both left orders, applying the patch to a copy
+// of the first map, pair by pair for the small patch and in bulk for the
+// large one, and operator== walking the patched copy and the second map.
+void diff_patch_at(size_t per_mille) {
+  size_t const n = scaled(1 << 21);
+  std::string config = "n=" + std::to_string(n) + " differing=" +
+                       std::to_string(per_mille) + "/1000";
+  std::mt19937_64 e(1);
+  bimap<uint64_t, uint64_t> a;
+  std::vector<uint64_t> keys;
+  while (a.size() < n) {
+    uint64_t k = e();
+    if (a.insert(k, e()) != a.end_left()) {
+      keys.push_back(k);
+    }
+  }
+  bimap<uint64_t, uint64_t> b = a;
+  for (size_t i = 0; i < n * per_mille / 1000; i++) {
+    uint64_t left = keys[e() % keys.size()];
+    switch (i % 3) {
+    case 0:
+      b.erase_left(left);
+      break;
+    case 1: {
+      uint64_t k = e();
+      b.insert(k, e());
+      break;
+    }
+    default:
+      if (b.erase_left(left)) {
+        b.insert(left, e());
+      }
+    }
+  }
+  auto start = bench_clock::now();
+  auto patch = diff(a, b);
+  double diff_seconds = seconds_since(start);
+  bimap<uint64_t, uint64_t> patched = a;
+  start = bench_clock::now();
+  bool applied = apply_patch(patched, patch);
+  double apply_seconds = seconds_since(start);
+  start = bench_clock::now();
+  bool equal = (patched == b);
+  double equal_seconds = seconds_since(start);
+  if (!applied || !equal || !diff(patched, b).empty()) {
+    std::cerr << "diff_patch: the patch doesn't reproduce the second map"
+              << std::endl;
+  }
+  report("diff_patch", config + " differences", patch.size(), "pairs");
+  report("diff_patch", config + " diff", diff_seconds * 1e3, "ms");
+  report("diff_patch", config + " diff per pair", diff_seconds * 1e9 / n,
+         "ns");
+  report("diff_patch", config + " operator== walk", equal_seconds * 1e3, "ms");
+  report("diff_patch", config + " apply_patch", apply_seconds * 1e3, "ms");
+}
+
+void diff_patch() {
+  diff_patch_at(1);
+  diff_patch_at(200);
+}
+
+// Comparing replicas: operator== rejects maps with different fingerprints in
+// O(1) time, here one partner differs near the end of the left order, and
+// only walks both maps if they hold the same pairs.
+void replica_equality() {
+  size_t const n = scaled(1 << 21);
+  std::string config = "n=" + std::to_string(n);
+  std::mt19937_64 e(1);
+  bimap<uint64_t, uint64_t> a;
+  while (a.size() < n) {
+    uint64_t k = e();
+    a.insert(k, e());
+  }
+  bimap<uint64_t, uint64_t> same = a;
+  bimap<uint64_t, uint64_t> other = a;
+  uint64_t last = *--other.end_left();
+  other.erase_left(last);
+  other.insert(last, e());
+  size_t const rounds = 1000000;
+  size_t equal = 0;
+  auto start = bench_clock::now();
+  for (size_t i = 0; i < rounds; i++) {
+    equal += (a == other);
+  }
+  report("replica_equality", config + " different",
+         seconds_since(start) * 1e9 / rounds, "ns");
+  start = bench_clock::now();
+  equal += (a == same);
+  report("replica_equality", config + " equal", seconds_since(start) * 1e3,
+         "ms");
+  if (equal != 1) {
+    std::cerr << "replica_equality: wrong result" << std::endl;
+  }
+}
+
+// Out-of-core map with a buffer pool standing in for RAM: random inserts until
+// the file is 2, 10 and 50 times the pool, then random successful lookups and
+// a full scan with the file evicted from the page cache. Page reads per
+// operation don't depend on the device, the rates do.
+void paged_scale() {
+  size_t const pool_pages = scaled(256);
+  using paged = paged_bimap<uint64_t, uint64_t>;
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-bench.paged").string();
+  for (size_t ratio : {2, 10, 50}) {
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + ".journal");
+    std::string config =
+        "pool=" + std::to_string(pool_pages * paged::page_size >> 20) +
+        "MiB file=" + std::to_string(ratio) + "x";
+    std::mt19937_64 e(1);
+    std::vector<uint64_t> keys;
+    auto map = std::make_unique<paged>(path, pool_pages);
+    auto start = bench_clock::now();
+    while (map->file_size() < ratio * pool_pages * paged::page_size) {
+      uint64_t k = e();
+      if (map->insert(k, e()) != map->end_left()) {
+        keys.push_back(k);
+      }
+    }
+    double insert_rate = keys.size() / seconds_since(start);
+    paged::statistics_t before = map->statistics();
+    map->sync();
+    map.reset();
+    evict_from_page_cache(path);
+    map = std::make_unique<paged>(path, pool_pages);
+
+    size_t const lookups = scaled(1 << 16);
+    uint64_t sum = 0;
+    start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      sum += map->at_left(keys[e() % keys.size()]);
+    }
+    double lookup_rate = lookups / seconds_since(start);
+    paged::statistics_t after_lookups = map->statistics();
+    start = bench_clock::now();
+    size_t scanned = 0;
+    for (auto it = map->begin_right(); it != map->end_right(); ++it) {
+      sum += *it;
+      ++scanned;
+    }
+    double scan_rate = scanned / seconds_since(start);
+    if (scanned != keys.size()) {
+      std::cerr << "paged_scale: the scan missed pairs" << std::endl;
+    }
+    config += " n=" + std::to_string(keys.size());
+    report("paged_scale", config + " insert", insert_rate / 1e3, "Kops/s");
+    report("paged_scale", config + " insert page reads",
+           double(before.reads) / keys.size(), "per op");
+    report("paged_scale", config + " insert page writes",
+           double(before.writes) / keys.size(), "per op");
+    report("paged_scale", config + " lookup", lookup_rate / 1e3, "Kops/s");
+    report("paged_scale", config + " lookup page reads",
+           double(after_lookups.reads) / lookups, "per op");
+    report("paged_scale", config + " right scan", scan_rate / 1e6, "Mpairs/s");
+    if (sum == 42) {
+      std::cout << std::endl;
+    }
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+// Sustained random inserts into the LSM map against the splay tree: the rate
+// over all inserts and over the last quarter, when flushing and merging run
+// behind. Then lookups of present and absent left values, with the runs
+// searched per lookup (read amplification) and the runs their filters skip,
+// while merges may still run and after flush() has merged what was due.
+void lsm_ingest() {
+  size_t const n = scaled(1 << 21);
+  std::string config = "n=" + std::to_string(n);
+  std::mt19937_64 e(1);
+  std::vector<std::pair<uint64_t, uint64_t>> pairs(n);
+  for (auto &pair : pairs) {
+    pair.first = e();
+    pair.second = e();
+  }
+  auto ingest = [&](auto &map, char const *name) {
+    auto start = bench_clock::now();
+    auto last_quarter = start;
+    for (size_t i = 0; i < n; i++) {
+      if (i == n - n / 4) {
+        last_quarter = bench_clock::now();
+      }
+      map.insert(pairs[i].first, pairs[i].second);
+    }
+    double total = seconds_since(start);
+    report("lsm_ingest", config + " " + name + " insert", n / total / 1e6,
+           "Mops/s");
+    report("lsm_ingest", config + " " + name + " insert last quarter",
+           n / 4 / seconds_since(last_quarter) / 1e6, "Mops/s");
+  };
+  {
+    bimap<uint64_t, uint64_t> tree;
+    ingest(tree, "bimap");
+  }
+  lsm_bimap<uint64_t, uint64_t> lsm;
+  ingest(lsm, "lsm_bimap");
+  report("lsm_ingest", config + " lsm_bimap insert stalls",
+         lsm.statistics().stalls, "freezes");
+  size_t const lookups = scaled(1 << 20);
+  auto look_up = [&](std::string const &stage) {
+    for (bool present : {true, false}) {
+      auto before = lsm.statistics();
+      uint64_t sum = 0;
+      auto start = bench_clock::now();
+      for (size_t i = 0; i < lookups; i++) {
+        uint64_t key = present ? pairs[e() % n].first : e();
+        auto found = lsm.find_left(key);
+        sum += found ? *found : 1;
+      }
+      double rate = lookups / seconds_since(start);
+      auto after = lsm.statistics();
+      std::string kind = stage + (present ? " present" : " absent");
+      report("lsm_ingest", config + kind + " lookup", rate / 1e6, "Mops/s");
+      report("lsm_ingest", config + kind + " runs searched",
+             double(after.run_probes - before.run_probes) / lookups,
+             "per lookup");
+      report("lsm_ingest", config + kind + " runs filtered",
+             double(after.filtered - before.filtered) / lookups,
+             "per lookup");
+      if (sum == 42) {
+        std::cout << std::endl;
+      }
+    }
+  };
+  report("lsm_ingest", config + " after ingest runs", lsm.runs(), "runs");
+  look_up(" after ingest");
+  lsm.flush();
+  report("lsm_ingest", config + " after flush runs", lsm.runs(), "runs");
+  look_up(" after flush");
+}
+
+// Draws ranks of a Zipfian distribution over n values, rank 0 the most
+// popular, by binary search in the precomputed cumulative distribution.
+class zipf_distribution {
+  std::vector<double> cumulative;
+
+public:
+  zipf_distribution(size_t n, double exponent) : cumulative(n) {
+    double sum = 0;
+    for (size_t i = 0; i < n; i++) {
+      sum += 1 / std::pow(double(i + 1), exponent);
+      cumulative[i] = sum;
+    }
+    for (double &c : cumulative) {
+      c /= sum;
+    }
+  }
+
+  template <typename Engine> size_t operator()(Engine &e) const {
+    double u = std::uniform_real_distribution<double>()(e);
+    size_t rank = std::lower_bound(cumulative.begin(), cumulative.end(), u) -
+                  cumulative.begin();
+    return std::min(rank, cumulative.size() - 1);
+  }
+};
+
+// A read-through cache on Zipfian traces over 1M keys: every access looks up
+// the key and inserts it on a miss. Hit rate and accesses per second of
+// lru_bimap for cache sizes of 1%, 5% and 20% of the keys, next to an
+// unbounded bimap on the same trace, which holds every key after its first
+// miss and pays nothing for recency. Ranks are scattered over the key space,
+// so popular keys aren't neighbours in either tree.
+void lru_cache() {
+  size_t const keys = 1 << 20;
+  size_t const accesses = scaled(1 << 22);
+  for (double exponent : {0.8, 0.99, 1.2}) {
+    zipf_distribution zipf(keys, exponent);
+    std::mt19937_64 e(1);
+    std::vector<uint64_t> trace(accesses);
+    for (auto &key : trace) {
+      key = zipf(e) * 0x9E3779B97F4A7C15ull;
+    }
+    std::string config = "s=" + std::to_string(exponent).substr(0, 4);
+    auto run = [&](auto &map, std::string const &name) {
+      size_t hits = 0;
+      auto start = bench_clock::now();
+      for (uint64_t key : trace) {
+        if (map.find_left(key) != map.end_left()) {
+          ++hits;
+        } else {
+          map.insert(key, ~key);
+        }
+      }
+      double rate = accesses / seconds_since(start);
+      report("lru_cache", config + " " + name + " hit rate",
+             100.0 * hits / accesses, "%");
+      report("lru_cache", config + " " + name + " throughput", rate / 1e6,
+             "Maccesses/s");
+      return hits;
+    };
+    for (size_t percent : {1, 5, 20}) {
+      size_t capacity = keys * percent / 100;
+      lru_bimap<uint64_t, uint64_t> cache{
+          std::less<>(), std::less<>(), heap_storage(), no_observer(),
+          lru_eviction<uint64_t, uint64_t>(capacity)};
+      size_t hits = run(cache, "lru_bimap " + std::to_string(percent) + "%");
+      auto const &statistics = cache.eviction().statistics();
+      if (statistics.hits != hits || cache.size() > capacity) {
+        std::cerr << "lru_cache: counters don't match the trace" << std::endl;
+      }
+    }
+    bimap<uint64_t, uint64_t> unbounded;
+    run(unbounded, "bimap unbounded");
+  }
+}
+
+// Simulated time for ttl_churn, so that the trace doesn't depend on the
+// speed of the machine.
+struct simulated_clock {
+  using duration = std::chrono::microseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<simulated_clock>;
+  static constexpr bool is_steady = true;
+
+  static inline time_point current{};
+
+  static time_point now() { return current; }
+};
+
+// Session churn: every simulated millisecond inserts 10 pairs with a time
+// to live of 10 seconds and expires what is due, so about 100k pairs live.
+// ttl_bimap expiring through its timing wheel against a plain bimap with a
+// separate deadline queue, erasing by erase_left per expired pair. Then
+// lookups of live pairs, where ttl_bimap checks every found deadline against
+// std::chrono::steady_clock::now().
+void ttl_churn() {
+  using namespace std::chrono_literals;
+  size_t const n = scaled(1 << 21);
+  size_t const per_tick = 10;
+  std::string config = "n=" + std::to_string(n);
+  std::mt19937_64 e(1);
+  std::vector<std::pair<uint64_t, uint64_t>> pairs(n);
+  for (auto &pair : pairs) {
+    pair.first = e();
+    pair.second = e();
+  }
+  {
+    simulated_clock::current = simulated_clock::time_point();
+    ttl_bimap<uint64_t, uint64_t, std::less<>, std::less<>, simulated_clock>
+        map{std::less<>(), std::less<>(), heap_storage(), no_observer(),
+            ttl_eviction<uint64_t, uint64_t, simulated_clock>(10s)};
+    size_t expired = 0;
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      map.insert(pairs[i].first, pairs[i].second);
+      if (i % per_tick == per_tick - 1) {
+        simulated_clock::current += 1ms;
+        expired += map.expire(simulated_clock::now());
+      }
+    }
+    double rate = n / seconds_since(start);
+    report("ttl_churn", config + " ttl_bimap insert+expire", rate / 1e6,
+           "Mops/s");
+    report("ttl_churn", config + " ttl_bimap live", map.size(), "pairs");
+    report("ttl_churn", config + " ttl_bimap cascaded",
+           double(map.eviction().statistics().cascaded) / n, "per pair");
+    if (expired + map.size() != n) {
+      std::cerr << "ttl_churn: pairs went missing" << std::endl;
+    }
+  }
+  {
+    bimap<uint64_t, uint64_t> map;
+    std::multimap<std::chrono::milliseconds, uint64_t> deadlines;
+    std::chrono::milliseconds now(0);
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < n; i++) {
+      if (map.insert(pairs[i].first, pairs[i].second) != map.end_left()) {
+        deadlines.emplace(now + 10s, pairs[i].first);
+      }
+      if (i % per_tick == per_tick - 1) {
+        now += 1ms;
+        while (!deadlines.empty() && deadlines.begin()->first <= now) {
+          map.erase_left(deadlines.begin()->second);
+          deadlines.erase(deadlines.begin());
+        }
+      }
+    }
+    double rate = n / seconds_since(start);
+    report("ttl_churn", config + " bimap+deadline queue insert+expire",
+           rate / 1e6, "Mops/s");
+  }
+  size_t const live = 100000;
+  size_t const lookups = scaled(1 << 22);
+  auto look_up = [&](auto &map, char const *name) {
+    for (size_t i = 0; i < live; i++) {
+      map.insert(pairs[i].first, pairs[i].second);
+    }
+    uint64_t sum = 0;
+    auto start = bench_clock::now();
+    for (size_t i = 0; i < lookups; i++) {
+      auto it = map.find_left(pairs[e() % live].first);
+      sum += (it != map.end_left() ? *it.flip() : 1);
+    }
+    report("ttl_churn", std::string(name) + " lookup",
+           lookups / seconds_since(start) / 1e6, "Mops/s");
+    if (sum == 42) {
+      std::cout << std::endl;
+    }
+  };
+  {
+    ttl_bimap<uint64_t, uint64_t> map{
+        std::less<>(), std::less<>(), heap_storage(), no_observer(),
+        ttl_eviction<uint64_t, uint64_t>(std::chrono::hours(1))};
+    look_up(map, "ttl_bimap steady_clock");
+  }
+  {
+    bimap<uint64_t, uint64_t> map;
+    look_up(map, "bimap");
+  }
+}
+
+// Many small maps of 0 to 64 pairs each: heap bytes per map, including the
+// map objects, and the rates of filling every map and of random lookups.
+// small_bimap keeps up to 16 pairs inline, beyond it holds a bimap too.
+void small_maps() {
+  size_t const maps = scaled(1 << 14);
+  size_t const lookups = scaled(1 << 22);
+  for (size_t pairs : {0, 1, 2, 4, 8, 16, 17, 32, 64}) {
+    std::string config = "pairs=" + std::to_string(pairs);
+    auto run = [&](auto tag, char const *name) {
+      using map_t = decltype(tag);
+      std::mt19937_64 e(1);
+      size_t before = heap_in_use();
+      auto start = bench_clock::now();
+      std::vector<map_t> all(maps);
+      std::vector<uint64_t> keys;
+      keys.reserve(maps * pairs);
+      for (auto &map : all) {
+        while (map.size() < pairs) {
+          uint64_t k = e();
+          if (map.insert(k, e()) != map.end_left()) {
+            keys.push_back(k);
+          }
+        }
+      }
+      double fill_rate = maps * std::max<size_t>(pairs, 1) /
+                         seconds_since(start);
+      report("small_maps", config + " " + name + " memory",
+             double(heap_in_use() - before -
+                    keys.capacity() * sizeof(uint64_t)) /
+                 maps,
+             "bytes/map");
+      report("small_maps", config + " " + name + " fill", fill_rate / 1e6,
+             "Mpairs/s");
+      if (pairs == 0) {
+        return;
+      }
+      uint64_t sum = 0;
+      start = bench_clock::now();
+      for (size_t i = 0; i < lookups; i++) {
+        size_t key = e() % keys.size();
+        sum += *all[key / pairs].find_left(keys[key]).flip();
+      }
+      report("small_maps", config + " " + name + " lookup",
+             lookups / seconds_since(start) / 1e6, "Mops/s");
+      if (sum == 42) {
+        std::cout << std::endl;
+      }
+    };
+    run(bimap<uint64_t, uint64_t>(), "bimap");
+    run(small_bimap<uint64_t, uint64_t, 16>(), "small_bimap<16>");
+  }
+}
+
+// Latency of single operations on a map holding about 32768 of 65000 possible
+// pairs: every round inserts a pair, looks up a present key and erases the
+// oldest (sequential keys) or a random present pair (random keys). Reports the
+// median, 99.9th percentile and maximum per operation, timing included, for
+// bimap, whose splay trees are amortized, and static_bimap with both policies.
+void static_latency() {
+  size_t const rounds = scaled(1 << 20);
+  size_t const half = 32768;
+  for (bool sequential : {false, true}) {
+    std::string config = sequential ? "keys=sequential" : "keys=random";
+    auto run = [&](auto &map, char const *name) {
+      std::mt19937_64 e(1);
+      std::vector<uint64_t> present;
+      present.reserve(2 * half);
+      size_t oldest = 0;
+      uint64_t next = 0;
+      auto fresh = [&] { return sequential ? next++ : e(); };
+      while (present.size() < half) {
+        uint64_t k = fresh();
+        if (map.insert(k, k) != map.end_left()) {
+          present.push_back(k);
+        }
+      }
+      std::vector<double> latencies[3];
+      for (auto &l : latencies) {
+        l.reserve(rounds);
+      }
+      uint64_t sum = 0;
+      auto total = bench_clock::now();
+      for (size_t i = 0; i < rounds; i++) {
+        uint64_t k = fresh();
+        auto start = bench_clock::now();
+        bool inserted = map.insert(k, k) != map.end_left();
+        latencies[0].push_back(seconds_since(start));
+        if (inserted) {
+          present.push_back(k);
+        }
+        uint64_t wanted = present[oldest + e() % (present.size() - oldest)];
+        start = bench_clock::now();
+        sum += *map.find_left(wanted).flip();
+        latencies[1].push_back(seconds_since(start));
+        size_t victim = sequential ? oldest++
+                                   : oldest + e() % (present.size() - oldest);
+        start = bench_clock::now();
+        map.erase_left(present[victim]);
+        latencies[2].push_back(seconds_since(start));
+        if (!sequential) {
+          present[victim] = present.back();
+          present.pop_back();
+        } else if (oldest == half) {
+          present.erase(present.begin(), present.begin() + oldest);
+          oldest = 0;
+        }
+      }
+      double elapsed = seconds_since(total);
+      char const *operations[] = {"insert", "find", "erase"};
+      for (size_t op = 0; op < 3; op++) {
+        auto &l = latencies[op];
+        std::sort(l.begin(), l.end());
+        std::string prefix = config + " " + name + " " + operations[op];
+        report("static_latency", prefix + " p50", l[l.size() / 2] * 1e9, "ns");
+        report("static_latency", prefix + " p99.9",
+               l[l.size() * 999 / 1000] * 1e9, "ns");
+        report("static_latency", prefix + " max", l.back() * 1e9, "ns");
+      }
+      report("static_latency", config + " " + name + " rounds",
+             rounds / elapsed / 1e6, "M/s");
+      if (sum == 42) {
+        std::cout << std::endl;
+      }
+    };
+    {
+      bimap<uint64_t, uint64_t> map;
+      run(map, "bimap");
+    }
+    {
+      auto map = std::make_unique<static_bimap<uint64_t, uint64_t, 65000>>();
+      run(*map, "static_bimap<avl>");
+    }
+    {
+      auto map = std::make_unique<static_bimap<
+          uint64_t, uint64_t, 65000, std::less<>, std::less<>, splay_tree>>();
+      run(*map, "static_bimap<splay>");
+    }
+  }
+}
+
+// An enum <-> name style table of HTTP status codes: building it at startup
+// with bimap inserts and with bimap::freeze(), against constexpr_bimap, which
+// is static data built by the compiler, and lookups by code and by name.
+constexpr std::pair<int, std::string_view> http_statuses[] = {
+    {200, "OK"},
+    {201, "Created"},
+    {202, "Accepted"},
+    {204, "No Content"},
+    {206, "Partial Content"},
+    {301, "Moved Permanently"},
+    {302, "Found"},
+    {303, "See Other"},
+    {304, "Not Modified"},
+    {307, "Temporary Redirect"},
+    {308, "Permanent Redirect"},
+    {400, "Bad Request"},
+    {401, "Unauthorized"},
+    {403, "Forbidden"},
+    {404, "Not Found"},
+    {405, "Method Not Allowed"},
+    {406, "Not Acceptable"},
+    {408, "Request Timeout"},
+    {409, "Conflict"},
+    {410, "Gone"},
+    {413, "Content Too Large"},
+    {415, "Unsupported Media Type"},
+    {429, "Too Many Requests"},
+    {500, "Internal Server Error"},
+    {501, "Not Implemented"},
+    {502, "Bad Gateway"},
+    {503, "Service Unavailable"},
+    {504, "Gateway Timeout"},
+};
+
+constexpr auto http_status_names = constexpr_bimap<
+    int, std::string_view, std::size(http_statuses)>(http_statuses);
+
+void constexpr_table() {
+  size_t const builds = scaled(1 << 14);
+  size_t const lookups = scaled(1 << 22);
+  size_t const n = std::size(http_statuses);
+  auto build = [&] {
+    bimap<int, std::string_view> map;
+    for (auto const &p : http_statuses) {
+      map.insert(p.first, p.second);
+    }
+    return map;
+  };
+  auto start = bench_clock::now();
+  size_t sizes = 0;
+  for (size_t i = 0; i < builds; i++) {
+    sizes += build().size();
+  }
+  report("constexpr_table", "bimap build", seconds_since(start) / builds * 1e9,
+         "ns");
+  start = bench_clock::now();
+  for (size_t i = 0; i < builds; i++) {
+    sizes += build().freeze().size();
+  }
+  report("constexpr_table", "flat_bimap build",
+         seconds_since(start) / builds * 1e9, "ns");
+  report("constexpr_table", "constexpr_bimap build", 0, "ns");
+  auto look_up = [&](auto const &map, char const *name) {
+    std::mt19937 e(1);
+    std::vector<size_t> picks(lookups);
+    for (auto &p : picks) {
+      p = e() % n;
+    }
+    uint64_t sum = sizes;
+    auto start = bench_clock::now();
+    for (size_t p : picks) {
+      sum += map.at_left(http_statuses[p].first).size();
+    }
+    report("constexpr_table", std::string(name) + " by code",
+           lookups / seconds_since(start) / 1e6, "Mops/s");
+    start = bench_clock::now();
+    for (size_t p : picks) {
+      sum += map.at_right(http_statuses[p].second);
+    }
+    report("constexpr_table", std::string(name) + " by name",
+           lookups / seconds_since(start) / 1e6, "Mops/s");
+    if (sum == 42) {
+      std::cout << std::endl;
+    }
+  };
+  auto map = build();
+  look_up(map, "bimap");
+  look_up(map.freeze(), "flat_bimap");
+  look_up(http_status_names, "constexpr_bimap");
+}
+
+struct benchmark_case {
+  char const *name;
+  void (*run)();
+};
+
+benchmark_case const cases[] = {
+    {"optimistic_read_scaling", optimistic_read_scaling},
+    {"lockfree_write_throughput", lockfree_write_throughput},
+    {"reclaimer_latency", reclaimer_latency},
+    {"flat_combining_throughput", flat_combining_throughput},
+    {"replicated_read_scaling", replicated_read_scaling},
+    {"frozen_lookup", frozen_lookup},
+    {"btree_scale", btree_scale},
+    {"paged_scale", paged_scale},
+    {"lsm_ingest", lsm_ingest},
+    {"lru_cache", lru_cache},
+    {"ttl_churn", ttl_churn},
+    {"small_maps", small_maps},
+    {"static_latency", static_latency},
+    {"constexpr_table", constexpr_table},
+    {"learned_lookup", learned_lookup},
+    {"perfect_hash_lookup", perfect_hash_lookup},
+    {"snapshot_restart", snapshot_restart},
+    {"mapped_open", mapped_open},
+    {"persistent_reopen", persistent_reopen},
+    {"wal_throughput", wal_throughput},
+    {"checkpoint_latency", checkpoint_latency},
+    {"replication_pipe", replication_pipe},
+    {"diff_patch", diff_patch},
+    {"replica_equality", replica_equality},
+};
+
+} // namespace
+
+int main(int argc, char **argv) {
+  char const *filter = argc > 1 ? argv[1] : "";
+  if (argc > 2) {
+    scale = std::stod(argv[2]);
+  }
+  for (auto const &c : cases) {
+    if (std::strncmp(c.name, filter, std::strlen(filter)) == 0) {
+      c.run();
+    }
+  }
+}
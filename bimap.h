@@ -1,30 +1,167 @@
 #pragma once
 
-#include <algorithm>  // std::swap
-#include <cstddef>    // size_t
-#include <functional> // std::function
-#include <utility>    // std::forward, std::make_pair, std::move, std::pair
+#include <algorithm>   // std::binary_search, std::merge, std::sort, std::stable_sort, std::swap
+#include <cstddef>     // size_t
+#include <cstdint>     // uint64_t
+#include <functional>  // std::hash, std::less
+#include <iterator>    // std::back_inserter
+#include <stdexcept>   // std::out_of_range
+#include <string>      // std::string
+#include <type_traits> // std::enable_if_t, std::is_default_constructible
+#include <utility>     // std::declval, std::forward, std::make_pair, std::move, std::pair
+#include <vector>      // std::vector
+
+template <typename Left, typename Right, typename LeftComparator, typename RightComparator>
+class flat_bimap;
+
+/*
+ * Default storage policy: nodes are allocated on the heap and linked by raw pointers.
+ * A storage policy defines the link type stored in the nodes and creates and destroys nodes,
+ * links must be constructible from nullptr and node pointers and convertible back to node pointers.
+ */
+struct heap_storage
+{
+    template <typename Node>
+    using link = Node *;
+
+    template <typename Node, typename... Args>
+    Node * create(Args &&... args)
+    {
+        return new Node(std::forward<Args>(args)...);
+    }
+
+    template <typename Node>
+    void destroy(Node * node) noexcept
+    {
+        delete node;
+    }
+};
+
+/*
+ * Default observer policy: ignores every change, so a bimap without an observer pays nothing for the hooks.
+ * An observer is told about every pair the map inserts, by insert and at_*_or_default,
+ * and erases, by any erase_* and at_*_or_default, after the change, with both values of the pair.
+ * The hooks must be noexcept, as the trees have already changed when they run.
+ * Copying, moving and loading a map create no events.
+ */
+struct no_observer
+{
+    template <typename Left, typename Right>
+    void inserted(Left const &, Right const &) noexcept
+    {
+    }
+
+    template <typename Left, typename Right>
+    void erased(Left const &, Right const &) noexcept
+    {
+    }
+};
+
+/*
+ * Default eviction policy: never evicts, adds nothing to the nodes and pays nothing for the hooks.
+ * An eviction policy defines the hook every node derives from and is told about every node the map links,
+ * by insert and at_*_or_default, touches, by find_*, at_* and at_*_or_default finding it, and unlinks,
+ * before erasing it, and about every lookup of these which misses; search_* and iterating touch nothing.
+ * After every insert it may pick a victim, which the map reports by evicted() and erases like erase_* would;
+ * expire(now) advances the policy to now and erases every victim it picks then.
+ * A stale node, e.g. one past its deadline, is absent for find_*, at_* and at_*_or_default and is evicted
+ * by an insert of either of its values; size(), iterating, search_* and erase_* see it until it is erased.
+ * Copying and loading a map link its nodes in left order.
+ */
+struct no_eviction
+{
+    struct hook
+    {
+    };
+
+    template <typename Node>
+    void linked(Node *) noexcept
+    {
+    }
+
+    template <typename Node>
+    void touched(Node *) const noexcept
+    {
+    }
+
+    void missed() const noexcept
+    {
+    }
+
+    template <typename Node>
+    void unlinked(Node *) noexcept
+    {
+    }
+
+    template <typename Node>
+    bool stale(Node const *) const noexcept
+    {
+        return false;
+    }
+
+    template <typename Node>
+    Node * victim(size_t) const noexcept
+    {
+        return nullptr;
+    }
+
+    template <typename Left, typename Right>
+    void evicted(Left const &, Right const &) noexcept
+    {
+    }
+};
+
+/* Hash of a value for bimap::fingerprint(), std::hash where it is enabled; specialize it for other types */
+template <typename T, typename Enable = void>
+struct bimap_hash
+{
+    static constexpr bool enabled = false;
+};
+
+template <typename T>
+struct bimap_hash<T, std::enable_if_t<std::is_default_constructible<std::hash<T>>::value>>
+{
+    static constexpr bool enabled = true;
+
+    static uint64_t hash(T const & value)
+    {
+        return std::hash<T>()(value);
+    }
+};
 
 /*
  * Has splay tree based structure.
  * Requires O(log(size)) time on average for inserting, erasing or finding one element.
  * Requires ((6 * sizeof(pointer) + sizeof(Left) + sizeof(Right)) * size
- *          + 2 * sizeof(pointer) + sizeof(size_t)
+ *          + 2 * sizeof(pointer) + sizeof(size_t) + sizeof(uint64_t)
  *          + sizeof(LeftComparator) + sizeof(RightComparator)) bytes memory.
+ * Keeps a fingerprint of its pairs, the sum of a strong hash of every pair, updated in O(1) time by inserting
+ * and erasing, if bimap_hash is enabled for both value types; operator== compares it first.
  * Doesn't allocate any dynamic memory for any operation (except for exactly one allocation to inserting a new pair).
+ * Nodes are created and linked through the Storage policy, see heap_storage.
+ * Changes are reported to the Observer policy, see no_observer.
+ * The Eviction policy may bound the map, see no_eviction; its hook adds sizeof(Eviction::hook) bytes per pair.
  */
 
-template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
-class bimap
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>, typename Storage = heap_storage, typename Observer = no_observer, typename Eviction = no_eviction>
+class bimap : private Storage, private Observer, private Eviction
 {
-    /* Stores data of left and right trees in the same node */
-    struct node_t
+    struct node_t;
+
+    using link_t = typename Storage::template link<node_t>;
+
+    static_assert(noexcept(std::declval<Observer &>().inserted(std::declval<Left const &>(), std::declval<Right const &>()))
+            && noexcept(std::declval<Observer &>().erased(std::declval<Left const &>(), std::declval<Right const &>())),
+        "Observer hooks must be noexcept, they run after the map has changed");
+
+    /* Stores data of left and right trees in the same node, an empty eviction hook takes no space */
+    struct node_t : Eviction::hook
     {
         struct tree_node_t
         {
-            node_t * left;
-            node_t * right;
-            node_t * parent;
+            link_t left;
+            link_t right;
+            link_t parent;
 
             tree_node_t() noexcept
                 : left(nullptr)
@@ -49,32 +186,32 @@ class bimap
 
     struct left_descriptor_t
     {
-        static node_t *& left(node_t * node) noexcept
+        static link_t & left(node_t * node) noexcept
         {
             return node->left_tree_data.left;
         }
 
-        static node_t * const & left(node_t const * node) noexcept
+        static link_t const & left(node_t const * node) noexcept
         {
             return node->left_tree_data.left;
         }
 
-        static node_t *& right(node_t * node) noexcept
+        static link_t & right(node_t * node) noexcept
         {
             return node->left_tree_data.right;
         }
 
-        static node_t * const & right(node_t const * node) noexcept
+        static link_t const & right(node_t const * node) noexcept
         {
             return node->left_tree_data.right;
         }
 
-        static node_t *& parent(node_t * node) noexcept
+        static link_t & parent(node_t * node) noexcept
         {
             return node->left_tree_data.parent;
         }
 
-        static node_t * const & parent(node_t const * node) noexcept
+        static link_t const & parent(node_t const * node) noexcept
         {
             return node->left_tree_data.parent;
         }
@@ -88,36 +225,41 @@ class bimap
         {
             return node->left_value;
         }
+
+        static node_t const * root(bimap const * tree) noexcept
+        {
+            return tree->left_root;
+        }
     };
 
     struct right_descriptor_t
     {
-        static node_t *& left(node_t * node) noexcept
+        static link_t & left(node_t * node) noexcept
         {
             return node->right_tree_data.left;
         }
 
-        static node_t * const & left(node_t const * node) noexcept
+        static link_t const & left(node_t const * node) noexcept
         {
             return node->right_tree_data.left;
         }
 
-        static node_t *& right(node_t * node) noexcept
+        static link_t & right(node_t * node) noexcept
         {
             return node->right_tree_data.right;
         }
 
-        static node_t * const & right(node_t const * node) noexcept
+        static link_t const & right(node_t const * node) noexcept
         {
             return node->right_tree_data.right;
         }
 
-        static node_t *& parent(node_t * node) noexcept
+        static link_t & parent(node_t * node) noexcept
         {
             return node->right_tree_data.parent;
         }
 
-        static node_t * const & parent(node_t const * node) noexcept
+        static link_t const & parent(node_t const * node) noexcept
         {
             return node->right_tree_data.parent;
         }
@@ -131,15 +273,20 @@ class bimap
         {
             return node->right_value;
         }
+
+        static node_t const * root(bimap const * tree) noexcept
+        {
+            return tree->right_root;
+        }
     };
 
     template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
     class basic_iterator
     {
     protected:
-        friend class bimap<MainType, FlipType, LeftComparator, RightComparator>;
+        friend class bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction>;
 
-        using tree_t = bimap<MainType, FlipType, LeftComparator, RightComparator>;
+        using tree_t = bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction>;
 
         basic_iterator(tree_t const * tree, node_t const * node) noexcept
             : tree(tree)
@@ -155,7 +302,8 @@ class bimap
         void decrement() noexcept
         {
             if (node == nullptr) {
-                node = sink_right<MainDescriptor>(tree->left_root);
+                node_t const * root = MainDescriptor::root(tree);
+                node = (root != nullptr ? sink_right<MainDescriptor>(root) : nullptr);
             }
             else {
                 node = tree->previous<MainDescriptor>(node);
@@ -340,15 +488,17 @@ class bimap
     }
 
     template <typename Descriptor, typename Iterator, typename T, typename Comparator>
-    Iterator find_element(node_t *& root, T const & desired, Comparator const & compare) const
+    Iterator find_element(link_t & root, T const & desired, Comparator const & compare) const
     {
         node_t * found = find<Descriptor>(root, desired, compare);
         if (found != nullptr) {
             root = found;
-            if (Descriptor::value(root) == desired) {
+            if (Descriptor::value(root) == desired && !Eviction::stale(found)) {
+                Eviction::touched(found);
                 return Iterator(this, root);
             }
         }
+        Eviction::missed();
         return Iterator(this, nullptr);
     }
 
@@ -389,7 +539,7 @@ class bimap
     }
 
     template <typename Descriptor, typename Comparator>
-    static void insert(node_t *& root, node_t * new_node, Comparator const & compare)
+    static void insert(link_t & root, node_t * new_node, Comparator const & compare)
     {
         std::pair<node_t *, node_t *> p = split<Descriptor>(root, Descriptor::value(new_node), compare);
         root = new_node;
@@ -403,20 +553,53 @@ class bimap
     node_t * insert_by_values(L left, R right)
     {
         left_root = find<left_descriptor_t>(left_root, left, left_compare);
+        if (left_root != nullptr && left_descriptor_t::value(left_root) == left && !erase_stale_root<left_descriptor_t, right_descriptor_t>(left_root, right_root, left_compare, right_compare)) {
+            return nullptr;
+        }
         right_root = find<right_descriptor_t>(right_root, right, right_compare);
-        if ((left_root == nullptr || !(left_descriptor_t::value(left_root) == left)) && (right_root == nullptr || !(right_descriptor_t::value(right_root) == right))) {
-            node_t * new_node;
-            new_node = new node_t(std::forward<L>(left), std::forward<R>(right));
+        if (right_root == nullptr || !(right_descriptor_t::value(right_root) == right) || erase_stale_root<right_descriptor_t, left_descriptor_t>(right_root, left_root, right_compare, left_compare)) {
+            node_t * new_node = create_node(std::forward<L>(left), std::forward<R>(right));
             insert<left_descriptor_t>(left_root, new_node, left_compare);
             insert<right_descriptor_t>(right_root, new_node, right_compare);
             ++elements_count;
-            return left_root;
+            pairs_fingerprint += pair_fingerprint(new_node->left_value, new_node->right_value);
+            Observer::inserted(new_node->left_value, new_node->right_value);
+            Eviction::linked(new_node);
+            evict();
+            return new_node;
         }
         return nullptr;
     }
 
+    /* Erases the victim the eviction policy picks, if any, which is never the node linked last */
+    bool evict()
+    {
+        node_t * victim = Eviction::template victim<node_t>(elements_count);
+        if (victim == nullptr) {
+            return false;
+        }
+        left_root = splay<left_descriptor_t>(victim);
+        right_root = splay<right_descriptor_t>(victim);
+        Eviction::evicted(victim->left_value, victim->right_value);
+        erase_root<left_descriptor_t, right_descriptor_t>(left_root, right_root, left_compare, right_compare, elements_count);
+        return true;
+    }
+
+    /* Erases the pair at the root of the first tree if the eviction policy says it is stale */
+    template <typename FirstDescriptor, typename SecondDescriptor, typename FirstComparator, typename SecondComparator>
+    bool erase_stale_root(link_t & first_root, link_t & second_root, FirstComparator const & first_compare, SecondComparator const & second_compare)
+    {
+        if (!Eviction::stale(static_cast<node_t *>(first_root))) {
+            return false;
+        }
+        second_root = splay<SecondDescriptor>(first_root);
+        Eviction::evicted(first_root->left_value, first_root->right_value);
+        erase_root<FirstDescriptor, SecondDescriptor>(first_root, second_root, first_compare, second_compare, elements_count);
+        return true;
+    }
+
     template <typename Descriptor, typename Comparator>
-    static node_t * erase(node_t *& root, Comparator const & compare)
+    static node_t * erase(link_t & root, Comparator const & compare)
     {
         set_parent<Descriptor>(Descriptor::left(root), nullptr);
         set_parent<Descriptor>(Descriptor::right(root), nullptr);
@@ -427,16 +610,19 @@ class bimap
     }
 
     template <typename FirstDescriptor, typename SecondDescriptor, typename FirstComparator, typename SecondComparator>
-    static void erase_root(node_t *& first_root, node_t *& second_root, FirstComparator const & first_compare, SecondComparator const & second_compare, size_t & elements_count)
+    void erase_root(link_t & first_root, link_t & second_root, FirstComparator const & first_compare, SecondComparator const & second_compare, size_t & elements_count)
     {
         node_t * excess = erase<FirstDescriptor>(first_root, first_compare);
         erase<SecondDescriptor>(second_root, second_compare);
-        delete excess;
         --elements_count;
+        pairs_fingerprint -= pair_fingerprint(excess->left_value, excess->right_value);
+        Observer::erased(excess->left_value, excess->right_value);
+        Eviction::unlinked(excess);
+        destroy_node(excess);
     }
 
     template <typename FirstDescriptor, typename SecondDescriptor, typename T, typename FirstComparator, typename SecondComparator>
-    static void erase_element(node_t *& first_root, node_t *& second_root, T const & key, FirstComparator const & first_compare, SecondComparator const & second_compare, size_t & elements_count)
+    void erase_element(link_t & first_root, link_t & second_root, T const & key, FirstComparator const & first_compare, SecondComparator const & second_compare, size_t & elements_count)
     {
         first_root = find<FirstDescriptor>(first_root, key, first_compare);
         second_root = splay<SecondDescriptor>(first_root);
@@ -454,7 +640,7 @@ class bimap
 
         for (; Descriptor::parent(node) != nullptr; node = Descriptor::parent(node)) {
             if (Descriptor::left(Descriptor::parent(node)) == node) {
-                return const_cast<node_t *>(Descriptor::parent(node));
+                return Descriptor::parent(node);
             }
         }
 
@@ -465,12 +651,12 @@ class bimap
     static node_t * previous(node_t const * node) noexcept
     {
         if (Descriptor::left(node) != nullptr) {
-            return sink_right(Descriptor::left(node));
+            return sink_right<Descriptor>(Descriptor::left(node));
         }
 
         for (; Descriptor::parent(node) != nullptr; node = Descriptor::parent(node)) {
             if (Descriptor::right(Descriptor::parent(node)) == node) {
-                return const_cast<node_t *>(Descriptor::parent(node));
+                return Descriptor::parent(node);
             }
         }
 
@@ -479,11 +665,71 @@ class bimap
 
     void swap(bimap & other) noexcept
     {
+        std::swap(static_cast<Storage &>(*this), static_cast<Storage &>(other));
+        std::swap(static_cast<Observer &>(*this), static_cast<Observer &>(other));
+        std::swap(static_cast<Eviction &>(*this), static_cast<Eviction &>(other));
         std::swap(left_root, other.left_root);
         std::swap(right_root, other.right_root);
         std::swap(left_compare, other.left_compare);
         std::swap(right_compare, other.right_compare);
         std::swap(elements_count, other.elements_count);
+        std::swap(pairs_fingerprint, other.pairs_fingerprint);
+    }
+
+    template <typename L, typename R>
+    node_t * create_node(L left, R right)
+    {
+        return Storage::template create<node_t>(std::forward<L>(left), std::forward<R>(right));
+    }
+
+    void destroy_node(node_t * node) noexcept
+    {
+        Storage::destroy(node);
+    }
+
+    /* Links nodes, which are sorted by Descriptor, into a balanced tree in O(count) time and returns its root */
+    template <typename Descriptor>
+    static node_t * link_balanced(node_t * const * nodes, size_t count, node_t * parent) noexcept
+    {
+        if (count == 0) {
+            return nullptr;
+        }
+        size_t middle = count / 2;
+        node_t * root = nodes[middle];
+        Descriptor::parent(root) = parent;
+        Descriptor::left(root) = link_balanced<Descriptor>(nodes, middle, root);
+        Descriptor::right(root) = link_balanced<Descriptor>(nodes + middle + 1, count - middle - 1, root);
+        return root;
+    }
+
+    /* Finds the first node not before x (after x if Upper) by plain descent, without splaying or writing */
+    template <typename Descriptor, bool Upper, typename T, typename Comparator>
+    static node_t const * descend(node_t const * t, T const & x, Comparator const & compare, size_t * depth)
+    {
+        node_t const * result = nullptr;
+        while (t != nullptr) {
+            if (depth != nullptr) {
+                ++*depth;
+            }
+            if (Upper ? compare(x, Descriptor::value(t)) : !compare(Descriptor::value(t), x)) {
+                result = t;
+                t = Descriptor::left(t);
+            }
+            else {
+                t = Descriptor::right(t);
+            }
+        }
+        return result;
+    }
+
+    template <typename Descriptor, typename Iterator, typename T, typename Comparator>
+    Iterator search_element(node_t const * root, T const & desired, Comparator const & compare, size_t * depth) const
+    {
+        node_t const * found = descend<Descriptor, false>(root, desired, compare, depth);
+        if (found != nullptr && Descriptor::value(found) == desired) {
+            return Iterator(this, found);
+        }
+        return Iterator(this, nullptr);
     }
 
     template <typename Descriptor>
@@ -493,7 +739,7 @@ class bimap
     }
 
     template <typename Descriptor, typename T, typename Comparator>
-    static node_t * lower_bound(node_t *& root, T const & x, Comparator const & compare)
+    static node_t * lower_bound(link_t & root, T const & x, Comparator const & compare)
     {
         root = find<Descriptor>(root, x, compare);
         if (root != nullptr) {
@@ -509,7 +755,7 @@ class bimap
     }
 
     template <typename Descriptor, typename T, typename Comparator>
-    static node_t * upper_bound(node_t *& root, T const & x, Comparator const & compare)
+    static node_t * upper_bound(link_t & root, T const & x, Comparator const & compare)
     {
         root = find<Descriptor>(root, x, compare);
         if (root != nullptr) {
@@ -525,80 +771,132 @@ class bimap
     }
 
     template <typename FirstDescriptor, typename SecondDescriptor, typename FirstType, typename SecondType, typename Comparator>
-    static SecondType const & at_element(node_t *& root, FirstType const & key, Comparator const & compare)
+    SecondType const & at_element(link_t & root, FirstType const & key, Comparator const & compare) const
     {
         root = find<FirstDescriptor>(root, key, compare);
-        if (root == nullptr || !(FirstDescriptor::value(root) == key)) {
+        if (root == nullptr || !(FirstDescriptor::value(root) == key) || Eviction::stale(static_cast<node_t *>(root))) {
+            Eviction::missed();
             throw std::out_of_range("No matching element.");
         }
+        Eviction::touched(static_cast<node_t *>(root));
         return SecondDescriptor::value(root);
     }
 
     template <typename FirstDescriptor, typename SecondDescriptor, typename FirstType, typename SecondType, typename FirstComparator, typename SecondComparator, typename InsertFunction>
-    static SecondType const & at_element_or_default(node_t *& first_root, node_t *& second_root, FirstType const & key, FirstComparator const & first_compare, SecondComparator const & second_compare, InsertFunction const & insert_function, size_t & elements_count)
+    SecondType const & at_element_or_default(link_t & first_root, link_t & second_root, FirstType const & key, FirstComparator const & first_compare, SecondComparator const & second_compare, InsertFunction const & insert_function, size_t & elements_count)
     {
         first_root = find<FirstDescriptor>(first_root, key, first_compare);
-        if (first_root != nullptr && FirstDescriptor::value(first_root) == key) {
+        if (first_root != nullptr && FirstDescriptor::value(first_root) == key && !Eviction::stale(static_cast<node_t *>(first_root))) {
+            Eviction::touched(static_cast<node_t *>(first_root));
             return SecondDescriptor::value(first_root);
         }
         else {
+            Eviction::missed();
             SecondType default_value = SecondType();
             erase_element<SecondDescriptor, FirstDescriptor>(second_root, first_root, default_value, second_compare, first_compare, elements_count);
-            insert_function();
-            return SecondDescriptor::value(second_root);
+            return SecondDescriptor::value(insert_function());
+        }
+    }
+
+    static constexpr bool fingerprinted = (bimap_hash<Left>::enabled && bimap_hash<Right>::enabled);
+
+    static uint64_t mix(uint64_t x) noexcept
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+        return x ^ (x >> 31);
+    }
+
+    /* Distinguishes (a, b) from (b, a), sums of these are practically collision free */
+    static uint64_t pair_fingerprint(Left const & left, Right const & right)
+    {
+        if constexpr (fingerprinted) {
+            return mix(mix(bimap_hash<Left>::hash(left)) + bimap_hash<Right>::hash(right));
+        }
+        else {
+            return 0;
         }
     }
 
-    mutable node_t * left_root;
-    mutable node_t * right_root;
+    mutable link_t left_root;
+    mutable link_t right_root;
     LeftComparator left_compare;
     RightComparator right_compare;
     size_t elements_count;
+    uint64_t pairs_fingerprint;
 
 public:
-    explicit bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator()) noexcept
-        : left_root(nullptr)
+    explicit bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator(), Storage storage = Storage(), Observer observer = Observer(), Eviction eviction = Eviction()) noexcept
+        : Storage(std::move(storage))
+        , Observer(std::move(observer))
+        , Eviction(std::move(eviction))
+        , left_root(nullptr)
         , right_root(nullptr)
         , left_compare(std::move(left_compare))
         , right_compare(std::move(right_compare))
         , elements_count(0)
+        , pairs_fingerprint(0)
     {
     }
 
     bimap(bimap const & other)
-        : left_root(nullptr)
+        : Storage(other)
+        , Observer(other)
+        , Eviction(other)
+        , left_root(nullptr)
         , right_root(nullptr)
         , left_compare(other.left_compare)
         , right_compare(other.right_compare)
-        , elements_count(other.elements_count)
+        , elements_count(0)
+        , pairs_fingerprint(0)
     {
-        for (left_iterator it = other.begin_left(); it != other.end_left(); ++it) {
-            Left const & left = *it;
-            Right const & right = *it.flip();
-            left_root = find<left_descriptor_t>(left_root, left, left_compare);
-            right_root = find<right_descriptor_t>(right_root, right, right_compare);
-            node_t * new_node;
-            new_node = new node_t(std::move(left), std::move(right));
-            insert<left_descriptor_t>(left_root, new_node, left_compare);
-            insert<right_descriptor_t>(right_root, new_node, right_compare);
+        /* Both trees are linked balanced, inserting in left order would leave the left tree a path */
+        std::vector<node_t *> nodes;
+        nodes.reserve(other.elements_count);
+        try {
+            for (left_iterator it = other.begin_left(); it != other.end_left(); ++it) {
+                nodes.push_back(create_node(*it, *it.flip()));
+            }
+        }
+        catch (...) {
+            for (node_t * node : nodes) {
+                destroy_node(node);
+            }
+            throw;
+        }
+        left_root = link_balanced<left_descriptor_t>(nodes.data(), nodes.size(), nullptr);
+        for (node_t * node : nodes) {
+            Eviction::linked(node);
         }
+        std::sort(nodes.begin(), nodes.end(), [this](node_t const * a, node_t const * b) {
+            return right_compare(a->right_value, b->right_value);
+        });
+        right_root = link_balanced<right_descriptor_t>(nodes.data(), nodes.size(), nullptr);
+        elements_count = nodes.size();
+        pairs_fingerprint = other.pairs_fingerprint;
     }
 
     bimap(bimap && other) noexcept
-        : left_root(other.left_root)
+        : Storage(std::move(other))
+        , Observer(std::move(other))
+        , Eviction(std::move(other))
+        , left_root(other.left_root)
         , right_root(other.right_root)
         , left_compare(std::move(other.left_compare))
         , right_compare(std::move(other.right_compare))
         , elements_count(other.elements_count)
+        , pairs_fingerprint(other.pairs_fingerprint)
     {
         other.left_root = nullptr;
         other.right_root = nullptr;
         other.elements_count = 0;
+        other.pairs_fingerprint = 0;
     }
 
-    bimap & operator=(bimap other) noexcept
+    bimap & operator=(bimap const & other)
     {
-        swap(other);
+        bimap copy(other);
+        swap(copy);
         return *this;
     }
 
@@ -608,18 +906,23 @@ public:
         return *this;
     }
 
+    /* Destroys the nodes in O(size) time without recursion, rotating left children up, so paths of any depth are fine */
     ~bimap()
     {
-        std::function<void(node_t *)> dfs;
-        dfs = [&dfs](node_t * node) {
-            if (node == nullptr) {
-                return;
+        node_t * node = left_root;
+        while (node != nullptr) {
+            node_t * child = left_descriptor_t::left(node);
+            if (child != nullptr) {
+                left_descriptor_t::left(node) = left_descriptor_t::right(child);
+                left_descriptor_t::right(child) = node;
+                node = child;
             }
-            dfs(left_descriptor_t::left(node));
-            dfs(left_descriptor_t::right(node));
-            delete node;
-        };
-        dfs(left_root);
+            else {
+                node_t * next = left_descriptor_t::right(node);
+                destroy_node(node);
+                node = next;
+            }
+        }
     }
 
     using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
@@ -627,7 +930,7 @@ public:
 
     left_iterator begin_left() const noexcept
     {
-        return left_iterator(this, sink_left<left_descriptor_t>(left_root));
+        return left_iterator(this, (left_root != nullptr ? sink_left<left_descriptor_t>(left_root) : nullptr));
     }
 
     left_iterator end_left() const noexcept
@@ -637,7 +940,7 @@ public:
 
     right_iterator begin_right() const noexcept
     {
-        return right_iterator(this, sink_left<right_descriptor_t>(right_root));
+        return right_iterator(this, (right_root != nullptr ? sink_left<right_descriptor_t>(right_root) : nullptr));
     }
 
     right_iterator end_right() const noexcept
@@ -645,6 +948,28 @@ public:
         return right_iterator(this, nullptr);
     }
 
+    /* The observer policy, e.g. to attach it to another target after copying or loading */
+    Observer & observer() noexcept
+    {
+        return *this;
+    }
+
+    Observer const & observer() const noexcept
+    {
+        return *this;
+    }
+
+    /* The eviction policy, e.g. for its statistics */
+    Eviction & eviction() noexcept
+    {
+        return *this;
+    }
+
+    Eviction const & eviction() const noexcept
+    {
+        return *this;
+    }
+
     bool empty() const noexcept
     {
         return (elements_count == 0);
@@ -655,6 +980,13 @@ public:
         return elements_count;
     }
 
+    /* Equal for maps holding the same pairs, whatever their order of changes, and different otherwise almost surely */
+    uint64_t fingerprint() const noexcept
+    {
+        static_assert(fingerprinted, "fingerprint() requires bimap_hash for both value types");
+        return pairs_fingerprint;
+    }
+
     left_iterator find_left(Left const & desired) const
     {
         return find_element<left_descriptor_t, left_iterator>(left_root, desired, left_compare);
@@ -751,6 +1083,174 @@ public:
         return right_iterator(this, upper_bound<right_descriptor_t>(right_root, value, right_compare));
     }
 
+    /*
+     * Lookups which don't splay and write nothing, so concurrent calls need shared locking only.
+     * Require O(depth) time, which isn't bounded by the amortized splay guarantee, see rebalance().
+     * If depth isn't nullptr, the number of visited nodes is added to it.
+     */
+    left_iterator search_left(Left const & desired, size_t * depth = nullptr) const
+    {
+        return search_element<left_descriptor_t, left_iterator>(left_root, desired, left_compare, depth);
+    }
+
+    right_iterator search_right(Right const & desired, size_t * depth = nullptr) const
+    {
+        return search_element<right_descriptor_t, right_iterator>(right_root, desired, right_compare, depth);
+    }
+
+    left_iterator search_lower_bound_left(Left const & value, size_t * depth = nullptr) const
+    {
+        return left_iterator(this, descend<left_descriptor_t, false>(left_root, value, left_compare, depth));
+    }
+
+    left_iterator search_upper_bound_left(Left const & value, size_t * depth = nullptr) const
+    {
+        return left_iterator(this, descend<left_descriptor_t, true>(left_root, value, left_compare, depth));
+    }
+
+    right_iterator search_lower_bound_right(Right const & value, size_t * depth = nullptr) const
+    {
+        return right_iterator(this, descend<right_descriptor_t, false>(right_root, value, right_compare, depth));
+    }
+
+    right_iterator search_upper_bound_right(Right const & value, size_t * depth = nullptr) const
+    {
+        return right_iterator(this, descend<right_descriptor_t, true>(right_root, value, right_compare, depth));
+    }
+
+    /* Relinks both trees perfectly balanced in O(size) time, e.g. for lookups without splaying after sorted inserts */
+    void rebalance()
+    {
+        std::vector<node_t *> nodes;
+        nodes.reserve(elements_count);
+        for (node_t * node = (left_root != nullptr ? sink_left<left_descriptor_t>(left_root) : nullptr); node != nullptr; node = next<left_descriptor_t>(node)) {
+            nodes.push_back(node);
+        }
+        std::vector<node_t *> right_nodes;
+        right_nodes.reserve(elements_count);
+        for (node_t * node = (right_root != nullptr ? sink_left<right_descriptor_t>(right_root) : nullptr); node != nullptr; node = next<right_descriptor_t>(node)) {
+            right_nodes.push_back(node);
+        }
+        left_root = link_balanced<left_descriptor_t>(nodes.data(), nodes.size(), nullptr);
+        right_root = link_balanced<right_descriptor_t>(right_nodes.data(), right_nodes.size(), nullptr);
+    }
+
+    /*
+     * Erases the pairs of erased, then inserts the pairs of inserted, both sorted by left value, by merging them into
+     * both orders and relinking both trees balanced, in O(size + changes * log(changes)) time.
+     * Pairs the map doesn't hold and inserts colliding with a kept pair or an earlier insert are skipped, and make
+     * it return false; nodes kept stay where iterators point. Inserting evicts nothing, so stale nodes collide.
+     * Strong exception guarantee: the map is unchanged unless the new nodes and the orders could be allocated.
+     */
+    bool replace_sorted(std::vector<std::pair<Left, Right>> const & erased, std::vector<std::pair<Left, Right>> const & inserted)
+    {
+        bool consistent = true;
+        std::vector<node_t *> kept;
+        std::vector<node_t *> doomed;
+        kept.reserve(elements_count);
+        size_t e = 0;
+        for (node_t * node = (left_root != nullptr ? sink_left<left_descriptor_t>(left_root) : nullptr); node != nullptr; node = next<left_descriptor_t>(node)) {
+            for (; e < erased.size() && left_compare(erased[e].first, node->left_value); ++e) {
+                consistent = false;
+            }
+            if (e < erased.size() && !left_compare(node->left_value, erased[e].first)) {
+                if (node->right_value == erased[e].second) {
+                    doomed.push_back(node);
+                }
+                else {
+                    consistent = false;
+                    kept.push_back(node);
+                }
+                ++e;
+            }
+            else {
+                kept.push_back(node);
+            }
+        }
+        if (e < erased.size()) {
+            consistent = false;
+        }
+
+        /* Inserts not colliding by left value, in left order */
+        std::vector<size_t> accepted;
+        accepted.reserve(inserted.size());
+        size_t k = 0;
+        for (size_t i = 0; i < inserted.size(); ++i) {
+            for (; k < kept.size() && left_compare(kept[k]->left_value, inserted[i].first); ++k) {
+            }
+            if ((k < kept.size() && !left_compare(inserted[i].first, kept[k]->left_value)) || (!accepted.empty() && !left_compare(inserted[accepted.back()].first, inserted[i].first))) {
+                consistent = false;
+            }
+            else {
+                accepted.push_back(i);
+            }
+        }
+
+        /* Of these, the ones not colliding by right value either; the first in left order wins */
+        std::sort(doomed.begin(), doomed.end(), std::less<node_t *>());
+        std::vector<node_t *> kept_right;
+        kept_right.reserve(kept.size());
+        for (node_t * node = (right_root != nullptr ? sink_left<right_descriptor_t>(right_root) : nullptr); node != nullptr; node = next<right_descriptor_t>(node)) {
+            if (!std::binary_search(doomed.begin(), doomed.end(), node, std::less<node_t *>())) {
+                kept_right.push_back(node);
+            }
+        }
+        std::vector<size_t> by_right = accepted;
+        std::stable_sort(by_right.begin(), by_right.end(), [&](size_t a, size_t b) { return right_compare(inserted[a].second, inserted[b].second); });
+        std::vector<bool> rejected(inserted.size(), false);
+        k = 0;
+        for (size_t j = 0; j < by_right.size(); ++j) {
+            Right const & value = inserted[by_right[j]].second;
+            for (; k < kept_right.size() && right_compare(kept_right[k]->right_value, value); ++k) {
+            }
+            if ((k < kept_right.size() && !right_compare(value, kept_right[k]->right_value)) || (j > 0 && !right_compare(inserted[by_right[j - 1]].second, value))) {
+                consistent = false;
+                rejected[by_right[j]] = true;
+            }
+        }
+
+        std::vector<node_t *> created;
+        std::vector<node_t *> nodes;
+        std::vector<node_t *> right_nodes;
+        try {
+            created.reserve(accepted.size());
+            for (size_t i : accepted) {
+                if (!rejected[i]) {
+                    created.push_back(create_node(inserted[i].first, inserted[i].second));
+                }
+            }
+            std::vector<node_t *> created_right = created;
+            std::stable_sort(created_right.begin(), created_right.end(), [this](node_t const * a, node_t const * b) { return right_compare(a->right_value, b->right_value); });
+            nodes.reserve(kept.size() + created.size());
+            right_nodes.reserve(kept.size() + created.size());
+            std::merge(kept.begin(), kept.end(), created.begin(), created.end(), std::back_inserter(nodes), [this](node_t const * a, node_t const * b) { return left_compare(a->left_value, b->left_value); });
+            std::merge(kept_right.begin(), kept_right.end(), created_right.begin(), created_right.end(), std::back_inserter(right_nodes), [this](node_t const * a, node_t const * b) { return right_compare(a->right_value, b->right_value); });
+        }
+        catch (...) {
+            for (node_t * node : created) {
+                destroy_node(node);
+            }
+            throw;
+        }
+
+        left_root = link_balanced<left_descriptor_t>(nodes.data(), nodes.size(), nullptr);
+        right_root = link_balanced<right_descriptor_t>(right_nodes.data(), right_nodes.size(), nullptr);
+        for (node_t * node : doomed) {
+            --elements_count;
+            pairs_fingerprint -= pair_fingerprint(node->left_value, node->right_value);
+            Observer::erased(node->left_value, node->right_value);
+            Eviction::unlinked(node);
+            destroy_node(node);
+        }
+        for (node_t * node : created) {
+            ++elements_count;
+            pairs_fingerprint += pair_fingerprint(node->left_value, node->right_value);
+            Observer::inserted(node->left_value, node->right_value);
+            Eviction::linked(node);
+        }
+        return consistent;
+    }
+
     Right const & at_left(Left const & key) const
     {
         return at_element<left_descriptor_t, right_descriptor_t, Left, Right>(left_root, key, left_compare);
@@ -764,7 +1264,7 @@ public:
     Right const & at_left_or_default(Left const & key)
     {
         auto insert_function = [this, &key] {
-            insert_by_values(key, Right());
+            return insert_by_values(key, Right());
         };
         return at_element_or_default<left_descriptor_t, right_descriptor_t, Left, Right>(left_root, right_root, key, left_compare, right_compare, insert_function, elements_count);
     }
@@ -772,18 +1272,40 @@ public:
     Left const & at_right_or_default(Right const & key)
     {
         auto insert_function = [this, &key] {
-            insert_by_values(Left(), key);
+            return insert_by_values(Left(), key);
         };
         return at_element_or_default<right_descriptor_t, left_descriptor_t, Right, Left>(right_root, left_root, key, right_compare, left_compare, insert_function, elements_count);
     }
 
+    /* Advances the eviction policy to now, e.g. a ttl_eviction, and erases every victim it picks, returns their number */
+    template <typename Time>
+    size_t expire(Time const & now)
+    {
+        Eviction::advance(now);
+        size_t count = 0;
+        while (evict()) {
+            ++count;
+        }
+        return count;
+    }
+
+    /* Immutable copy for read-only phases, defined in flat_bimap.h */
+    flat_bimap<Left, Right, LeftComparator, RightComparator> freeze() const;
+
+    /* Binary snapshot of both sorted orders, defined in snapshot.h */
+    void save(std::string const & path) const;
+
+    /* Rebuilds a map saved with the same comparators in O(size) time, defined in snapshot.h */
+    static bimap load(std::string const & path, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator(), Storage storage = Storage());
+
+    /* Rejects by size and fingerprint in O(1) time, then compares both values of every pair in left order */
     bool operator==(bimap const & other) const
     {
-        if (size() != other.size()) {
+        if (size() != other.size() || pairs_fingerprint != other.pairs_fingerprint) {
             return false;
         }
         for (left_iterator first = begin_left(), second = other.begin_left(); first != end_left(); first++, second++) {
-            if (*first != *second) {
+            if (!(*first == *second) || !(*first.flip() == *second.flip())) {
                 return false;
             }
         }
@@ -0,0 +1,135 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <cstddef>     // size_t
+#include <functional>  // std::less
+#include <type_traits> // std::is_same
+#include <utility>     // std::pair
+#include <vector>      // std::vector
+
+/*
+ * Differences between two bimaps, by left value, and applying them.
+ * diff(a, b) merges both left orders in one pass and returns the pairs only b holds (added), the pairs only a holds
+ * (removed) and the left values both hold with different right partners (changed), each sorted by left value.
+ * Requires O(size(a) + size(b)) time, without splaying either map, and memory for the differences only.
+ * Two splay trees never share nodes, so no part of either map can be skipped unseen.
+ * apply_patch(map, patch) turns a map holding the pairs of a into one holding the pairs of b:
+ * it erases the removed pairs and the old partners of the changed ones, then inserts the added pairs and the new
+ * partners, so that no insert collides with a right value the patch frees.
+ * A patch of at least size(map) / 8 differences is applied in bulk by bimap::replace_sorted, which merges both
+ * sorted lists into both orders and relinks both trees balanced like load() in O(size + differences) time;
+ * a smaller one, or one for a map with an eviction policy, which must see every insert, one pair at a time
+ * in left order, in O(log(size)) time on average per difference.
+ */
+
+template <typename Left, typename Right>
+struct bimap_patch
+{
+    struct changed_t
+    {
+        Left left;
+        /* Partner in the first map */
+        Right from;
+        /* Partner in the second map */
+        Right to;
+    };
+
+    std::vector<std::pair<Left, Right>> added;
+    std::vector<std::pair<Left, Right>> removed;
+    std::vector<changed_t> changed;
+
+    bool empty() const noexcept
+    {
+        return (added.empty() && removed.empty() && changed.empty());
+    }
+
+    size_t size() const noexcept
+    {
+        return added.size() + removed.size() + changed.size();
+    }
+};
+
+/* Both maps must be ordered by left_compare */
+template <typename Left, typename Right, typename LeftComparator, typename RightComparator, typename FirstStorage, typename FirstObserver, typename FirstEviction, typename SecondStorage, typename SecondObserver, typename SecondEviction>
+bimap_patch<Left, Right> diff(bimap<Left, Right, LeftComparator, RightComparator, FirstStorage, FirstObserver, FirstEviction> const & a, bimap<Left, Right, LeftComparator, RightComparator, SecondStorage, SecondObserver, SecondEviction> const & b, LeftComparator left_compare = LeftComparator())
+{
+    bimap_patch<Left, Right> patch;
+    auto first = a.begin_left();
+    auto second = b.begin_left();
+    while (first != a.end_left() || second != b.end_left()) {
+        if (second == b.end_left() || (first != a.end_left() && left_compare(*first, *second))) {
+            patch.removed.emplace_back(*first, *first.flip());
+            ++first;
+        }
+        else if (first == a.end_left() || left_compare(*second, *first)) {
+            patch.added.emplace_back(*second, *second.flip());
+            ++second;
+        }
+        else {
+            if (!(*first.flip() == *second.flip())) {
+                patch.changed.push_back({*first, *first.flip(), *second.flip()});
+            }
+            ++first;
+            ++second;
+        }
+    }
+    return patch;
+}
+
+/* Merges both sorted lists of pairs, each one by left value, and appends pairs of the changed ones by from or to */
+template <typename Left, typename Right, typename Changed, typename LeftComparator>
+std::vector<std::pair<Left, Right>> merge_patch(std::vector<std::pair<Left, Right>> const & pairs, std::vector<Changed> const & changed, Right Changed::*partner, LeftComparator const & left_compare)
+{
+    std::vector<std::pair<Left, Right>> result;
+    result.reserve(pairs.size() + changed.size());
+    size_t i = 0;
+    size_t j = 0;
+    while (i < pairs.size() || j < changed.size()) {
+        if (j == changed.size() || (i < pairs.size() && left_compare(pairs[i].first, changed[j].left))) {
+            result.push_back(pairs[i++]);
+        }
+        else {
+            result.emplace_back(changed[j].left, changed[j].*partner);
+            ++j;
+        }
+    }
+    return result;
+}
+
+/* Returns false if map didn't hold a removed or changed pair or an insert collided, after applying what it could */
+template <typename Left, typename Right, typename LeftComparator, typename RightComparator, typename Storage, typename Observer, typename Eviction>
+bool apply_patch(bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction> & map, bimap_patch<Left, Right> const & patch, LeftComparator left_compare = LeftComparator())
+{
+    using changed_t = typename bimap_patch<Left, Right>::changed_t;
+    if (std::is_same<Eviction, no_eviction>::value && !patch.empty() && patch.size() >= map.size() / 8) {
+        return map.replace_sorted(merge_patch(patch.removed, patch.changed, &changed_t::from, left_compare), merge_patch(patch.added, patch.changed, &changed_t::to, left_compare));
+    }
+    bool consistent = true;
+    auto erase_pair = [&](Left const & left, Right const & right) {
+        auto it = map.find_left(left);
+        if (it == map.end_left() || !(*it.flip() == right)) {
+            consistent = false;
+            return;
+        }
+        map.erase_left(it);
+    };
+    auto insert_pair = [&](Left const & left, Right const & right) {
+        if (map.insert(left, right) == map.end_left()) {
+            consistent = false;
+        }
+    };
+    for (auto const & pair : patch.removed) {
+        erase_pair(pair.first, pair.second);
+    }
+    for (auto const & change : patch.changed) {
+        erase_pair(change.left, change.from);
+    }
+    for (auto const & change : patch.changed) {
+        insert_pair(change.left, change.to);
+    }
+    for (auto const & pair : patch.added) {
+        insert_pair(pair.first, pair.second);
+    }
+    return consistent;
+}
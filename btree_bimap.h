@@ -0,0 +1,1057 @@
+#pragma once
+
+#include <algorithm>   // std::copy, std::copy_backward, std::fill, std::lower_bound, std::upper_bound, std::min, std::max
+#include <cstddef>     // size_t
+#include <cstdint>     // uint32_t, int32_t, int64_t
+#include <functional>  // std::less
+#include <limits>      // std::numeric_limits
+#include <memory>      // std::unique_ptr
+#include <new>         // placement new
+#include <optional>    // std::optional
+#include <stdexcept>   // std::out_of_range, std::length_error
+#include <type_traits> // std::is_arithmetic, std::is_integral, std::is_same, std::is_signed
+#include <utility>     // std::forward, std::move, std::swap
+#include <vector>      // std::vector
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && defined(__SSE2__)
+#include <immintrin.h> // SSE2, SSE4.2 and AVX2 intrinsics
+#define BIMAP_BTREE_X86
+#endif
+
+/*
+ * Has B+-tree based structure: one tree of wide nodes per side, whose leaves refer to pairs by 32-bit ids.
+ * Every pair is stored once in a pool of fixed-size chunks, so references to values stay valid until the pair is erased.
+ * Nodes hold 16 to 64 keys depending on the key size; for arithmetic keys compared by std::less the keys of a node
+ * are counted with SSE2/AVX2 compares instead of being binary searched.
+ * Requires O(log(size)) time for inserting, erasing or finding one element, O(log(size)) time for flip().
+ * Requires about (sizeof(Left) + sizeof(Right) + (sizeof(Left) + sizeof(Right) + 2 * sizeof(uint32_t)) / fill) * size
+ * bytes memory, where the fill factor of nodes is between 1/2 and 1.
+ * Keys are copied into the nodes, so both types must be default constructible and copyable.
+ * Unlike bimap, inserting or erasing invalidates every iterator. Holds at most 2^32 - 2 pairs.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class btree_bimap
+{
+    using id_t = uint32_t;
+
+    struct pair_t
+    {
+        Left left;
+        Right right;
+    };
+
+    /* Keeps pairs at fixed addresses and recycles the ids of erased ones */
+    class pool_t
+    {
+        union slot_t
+        {
+            slot_t() noexcept
+            {
+            }
+
+            ~slot_t()
+            {
+            }
+
+            pair_t pair;
+            id_t next_free;
+        };
+
+        static constexpr size_t chunk_size = 1024;
+        static constexpr id_t none = std::numeric_limits<id_t>::max();
+
+        slot_t & slot(id_t id) const noexcept
+        {
+            return chunks[id / chunk_size][id % chunk_size];
+        }
+
+        std::vector<std::unique_ptr<slot_t[]>> chunks;
+        id_t used = 0;
+        id_t free_head = none;
+
+    public:
+        template <typename L, typename R>
+        id_t create(L && left, R && right)
+        {
+            id_t id = free_head;
+            if (id != none) {
+                free_head = slot(id).next_free;
+            }
+            else {
+                if (used == none) {
+                    throw std::length_error("Too many pairs.");
+                }
+                if (used % chunk_size == 0) {
+                    chunks.emplace_back(new slot_t[chunk_size]);
+                }
+                id = used++;
+            }
+            try {
+                new (&slot(id).pair) pair_t{std::forward<L>(left), std::forward<R>(right)};
+            }
+            catch (...) {
+                slot(id).next_free = free_head;
+                free_head = id;
+                throw;
+            }
+            return id;
+        }
+
+        void destroy(id_t id) noexcept
+        {
+            slot(id).pair.~pair_t();
+            slot(id).next_free = free_head;
+            free_head = id;
+        }
+
+        pair_t const & operator[](id_t id) const noexcept
+        {
+            return slot(id).pair;
+        }
+    };
+
+    /* Ordered index of one side, maps keys to pair ids */
+    template <typename Key, typename Comparator>
+    class tree_t
+    {
+    public:
+        /* Multiple of the widest vector, so that nodes are searched in whole vectors */
+        static constexpr size_t capacity = std::max<size_t>(16, std::min<size_t>(64, 256 / sizeof(Key))) / 8 * 8;
+
+        static constexpr bool vectorized = std::is_arithmetic<Key>::value && (std::is_same<Comparator, std::less<>>::value || std::is_same<Comparator, std::less<Key>>::value);
+
+    private:
+        static constexpr size_t leaf_minimum = capacity / 2;
+
+        /* Key of the unused slots, not ordered before any key: rank() clips counting it by the count of keys */
+        static constexpr Key padding() noexcept
+        {
+            return (std::numeric_limits<Key>::has_infinity ? std::numeric_limits<Key>::infinity() : std::numeric_limits<Key>::max());
+        }
+        static constexpr size_t inner_minimum = capacity / 2 - 1;
+
+        struct node_t
+        {
+            explicit node_t(bool leaf) noexcept
+                : count(0)
+                , leaf(leaf)
+            {
+                if constexpr (vectorized) {
+                    /* Unused keys compare after everything, so that the whole array can be counted */
+                    std::fill(keys, keys + capacity, padding());
+                }
+            }
+
+            size_t count;
+            bool leaf;
+            Key keys[capacity];
+        };
+
+        struct leaf_t : node_t
+        {
+            leaf_t() noexcept
+                : node_t(true)
+            {
+            }
+
+            id_t ids[capacity];
+            leaf_t * previous = nullptr;
+            leaf_t * next = nullptr;
+        };
+
+        /* Separator i is not greater than any key of child i + 1 and greater than every key of child i */
+        struct inner_t : node_t
+        {
+            inner_t() noexcept
+                : node_t(false)
+            {
+            }
+
+            node_t * children[capacity + 1];
+        };
+
+        static leaf_t * as_leaf(node_t * node) noexcept
+        {
+            return static_cast<leaf_t *>(node);
+        }
+
+        static inner_t * as_inner(node_t * node) noexcept
+        {
+            return static_cast<inner_t *>(node);
+        }
+
+        /* Number of keys ordered before x, or not after x if Inclusive, among all keys including the unused ones */
+        template <bool Inclusive>
+        static size_t vector_rank(Key const * keys, Key const & x) noexcept
+        {
+#ifdef BIMAP_BTREE_X86
+            if constexpr (std::is_integral<Key>::value && sizeof(Key) == 4) {
+                /* Unsigned keys are compared as signed ones with flipped sign bits */
+                int32_t const bias = (std::is_signed<Key>::value ? 0 : std::numeric_limits<int32_t>::min());
+#ifdef __AVX2__
+                __m256i const needle = _mm256_set1_epi32(static_cast<int32_t>(x) ^ bias);
+                size_t result = 0;
+                for (size_t i = 0; i < capacity; i += 8) {
+                    __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(keys + i)), _mm256_set1_epi32(bias));
+                    __m256i mask = (Inclusive ? _mm256_cmpgt_epi32(block, needle) : _mm256_cmpgt_epi32(needle, block));
+                    int matched = __builtin_popcount(_mm256_movemask_ps(_mm256_castsi256_ps(mask)));
+                    matched = (Inclusive ? 8 - matched : matched);
+                    result += matched;
+                    if (matched < 8) {
+                        break;
+                    }
+                }
+                return result;
+#else
+                __m128i const needle = _mm_set1_epi32(static_cast<int32_t>(x) ^ bias);
+                size_t result = 0;
+                for (size_t i = 0; i < capacity; i += 4) {
+                    __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i)), _mm_set1_epi32(bias));
+                    __m128i mask = (Inclusive ? _mm_cmpgt_epi32(block, needle) : _mm_cmpgt_epi32(needle, block));
+                    int matched = __builtin_popcount(_mm_movemask_ps(_mm_castsi128_ps(mask)));
+                    matched = (Inclusive ? 4 - matched : matched);
+                    result += matched;
+                    if (matched < 4) {
+                        break;
+                    }
+                }
+                return result;
+#endif
+            }
+#if defined(__AVX2__) || defined(__SSE4_2__)
+            if constexpr (std::is_integral<Key>::value && sizeof(Key) == 8) {
+                int64_t const bias = (std::is_signed<Key>::value ? 0 : std::numeric_limits<int64_t>::min());
+#ifdef __AVX2__
+                __m256i const needle = _mm256_set1_epi64x(static_cast<int64_t>(x) ^ bias);
+                size_t result = 0;
+                for (size_t i = 0; i < capacity; i += 4) {
+                    __m256i block = _mm256_xor_si256(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(keys + i)), _mm256_set1_epi64x(bias));
+                    __m256i mask = (Inclusive ? _mm256_cmpgt_epi64(block, needle) : _mm256_cmpgt_epi64(needle, block));
+                    int matched = __builtin_popcount(_mm256_movemask_pd(_mm256_castsi256_pd(mask)));
+                    matched = (Inclusive ? 4 - matched : matched);
+                    result += matched;
+                    if (matched < 4) {
+                        break;
+                    }
+                }
+                return result;
+#else
+                __m128i const needle = _mm_set1_epi64x(static_cast<int64_t>(x) ^ bias);
+                size_t result = 0;
+                for (size_t i = 0; i < capacity; i += 2) {
+                    __m128i block = _mm_xor_si128(_mm_loadu_si128(reinterpret_cast<__m128i const *>(keys + i)), _mm_set1_epi64x(bias));
+                    __m128i mask = (Inclusive ? _mm_cmpgt_epi64(block, needle) : _mm_cmpgt_epi64(needle, block));
+                    int matched = __builtin_popcount(_mm_movemask_pd(_mm_castsi128_pd(mask)));
+                    matched = (Inclusive ? 2 - matched : matched);
+                    result += matched;
+                    if (matched < 2) {
+                        break;
+                    }
+                }
+                return result;
+#endif
+            }
+#endif
+#endif
+            /* Branch-free, so that the compiler is free to vectorize it */
+            size_t result = 0;
+            for (size_t i = 0; i < capacity; ++i) {
+                result += (Inclusive ? !(x < keys[i]) : (keys[i] < x));
+            }
+            return result;
+        }
+
+        /* Number of keys of the node ordered before x, or not after x if Inclusive */
+        template <bool Inclusive>
+        size_t rank(node_t const * node, Key const & x) const
+        {
+            if constexpr (vectorized) {
+                return std::min(node->count, vector_rank<Inclusive>(node->keys, x));
+            }
+            else if constexpr (Inclusive) {
+                return (std::upper_bound(node->keys, node->keys + node->count, x, compare) - node->keys);
+            }
+            else {
+                return (std::lower_bound(node->keys, node->keys + node->count, x, compare) - node->keys);
+            }
+        }
+
+        static void truncate(node_t * node, size_t count) noexcept
+        {
+            if constexpr (vectorized) {
+                std::fill(node->keys + count, node->keys + node->count, padding());
+            }
+            node->count = count;
+        }
+
+        static void insert_entry(leaf_t * leaf, size_t index, Key const & key, id_t id)
+        {
+            std::copy_backward(leaf->keys + index, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+            std::copy_backward(leaf->ids + index, leaf->ids + leaf->count, leaf->ids + leaf->count + 1);
+            leaf->keys[index] = key;
+            leaf->ids[index] = id;
+            ++leaf->count;
+        }
+
+        static void remove_entry(leaf_t * leaf, size_t index)
+        {
+            std::copy(leaf->keys + index + 1, leaf->keys + leaf->count, leaf->keys + index);
+            std::copy(leaf->ids + index + 1, leaf->ids + leaf->count, leaf->ids + index);
+            truncate(leaf, leaf->count - 1);
+        }
+
+        /* Inserts separator at index and child right after it */
+        static void insert_child(inner_t * inner, size_t index, Key const & separator, node_t * child)
+        {
+            std::copy_backward(inner->keys + index, inner->keys + inner->count, inner->keys + inner->count + 1);
+            std::copy_backward(inner->children + index + 1, inner->children + inner->count + 1, inner->children + inner->count + 2);
+            inner->keys[index] = separator;
+            inner->children[index + 1] = child;
+            ++inner->count;
+        }
+
+        /* Removes separator at index and the child right after it */
+        static void remove_child(inner_t * inner, size_t index)
+        {
+            std::copy(inner->keys + index + 1, inner->keys + inner->count, inner->keys + index);
+            std::copy(inner->children + index + 2, inner->children + inner->count + 1, inner->children + index + 1);
+            truncate(inner, inner->count - 1);
+        }
+
+        leaf_t * split_leaf(leaf_t * leaf)
+        {
+            leaf_t * right = new leaf_t();
+            size_t middle = leaf->count / 2;
+            std::copy(leaf->keys + middle, leaf->keys + leaf->count, right->keys);
+            std::copy(leaf->ids + middle, leaf->ids + leaf->count, right->ids);
+            right->count = leaf->count - middle;
+            truncate(leaf, middle);
+            right->previous = leaf;
+            right->next = leaf->next;
+            if (leaf->next != nullptr) {
+                leaf->next->previous = right;
+            }
+            else {
+                tail = right;
+            }
+            leaf->next = right;
+            return right;
+        }
+
+        /* Returns the new right sibling of node if it was split, together with the separator between them */
+        node_t * insert_into(node_t * node, Key const & key, id_t id, Key & separator)
+        {
+            if (node->leaf) {
+                leaf_t * leaf = as_leaf(node);
+                size_t index = rank<false>(leaf, key);
+                if (leaf->count < capacity) {
+                    insert_entry(leaf, index, key, id);
+                    return nullptr;
+                }
+                leaf_t * right = split_leaf(leaf);
+                if (index <= leaf->count) {
+                    insert_entry(leaf, index, key, id);
+                }
+                else {
+                    insert_entry(right, index - leaf->count, key, id);
+                }
+                separator = right->keys[0];
+                return right;
+            }
+            inner_t * inner = as_inner(node);
+            size_t index = rank<true>(inner, key);
+            Key child_separator;
+            node_t * child_sibling = insert_into(inner->children[index], key, id, child_separator);
+            if (child_sibling == nullptr) {
+                return nullptr;
+            }
+            if (inner->count < capacity) {
+                insert_child(inner, index, child_separator, child_sibling);
+                return nullptr;
+            }
+            /* The middle separator moves up, the new child goes to the half which its left neighbour belongs to */
+            inner_t * right = new inner_t();
+            size_t middle = capacity / 2;
+            separator = inner->keys[middle];
+            std::copy(inner->keys + middle + 1, inner->keys + inner->count, right->keys);
+            std::copy(inner->children + middle + 1, inner->children + inner->count + 1, right->children);
+            right->count = inner->count - middle - 1;
+            truncate(inner, middle);
+            if (index <= middle) {
+                insert_child(inner, index, child_separator, child_sibling);
+            }
+            else {
+                insert_child(right, index - middle - 1, child_separator, child_sibling);
+            }
+            return right;
+        }
+
+        /* Merges child index + 1 of inner into child index */
+        void merge(inner_t * inner, size_t index)
+        {
+            node_t * left = inner->children[index];
+            node_t * right = inner->children[index + 1];
+            if (left->leaf) {
+                leaf_t * left_leaf = as_leaf(left);
+                leaf_t * right_leaf = as_leaf(right);
+                std::copy(right_leaf->keys, right_leaf->keys + right_leaf->count, left_leaf->keys + left_leaf->count);
+                std::copy(right_leaf->ids, right_leaf->ids + right_leaf->count, left_leaf->ids + left_leaf->count);
+                left_leaf->count += right_leaf->count;
+                left_leaf->next = right_leaf->next;
+                if (right_leaf->next != nullptr) {
+                    right_leaf->next->previous = left_leaf;
+                }
+                else {
+                    tail = left_leaf;
+                }
+                delete right_leaf;
+            }
+            else {
+                inner_t * left_inner = as_inner(left);
+                inner_t * right_inner = as_inner(right);
+                left_inner->keys[left_inner->count] = inner->keys[index];
+                std::copy(right_inner->keys, right_inner->keys + right_inner->count, left_inner->keys + left_inner->count + 1);
+                std::copy(right_inner->children, right_inner->children + right_inner->count + 1, left_inner->children + left_inner->count + 1);
+                left_inner->count += right_inner->count + 1;
+                delete right_inner;
+            }
+            remove_child(inner, index);
+        }
+
+        /* Refills child index of inner from a sibling if it has become underfull */
+        void rebalance(inner_t * inner, size_t index)
+        {
+            node_t * child = inner->children[index];
+            size_t minimum = (child->leaf ? leaf_minimum : inner_minimum);
+            if (child->count >= minimum) {
+                return;
+            }
+            node_t * left = (index > 0 ? inner->children[index - 1] : nullptr);
+            node_t * right = (index < inner->count ? inner->children[index + 1] : nullptr);
+            if (left != nullptr && left->count > minimum) {
+                if (child->leaf) {
+                    leaf_t * left_leaf = as_leaf(left);
+                    insert_entry(as_leaf(child), 0, left_leaf->keys[left_leaf->count - 1], left_leaf->ids[left_leaf->count - 1]);
+                    truncate(left_leaf, left_leaf->count - 1);
+                    inner->keys[index - 1] = child->keys[0];
+                }
+                else {
+                    inner_t * left_inner = as_inner(left);
+                    inner_t * child_inner = as_inner(child);
+                    std::copy_backward(child_inner->keys, child_inner->keys + child_inner->count, child_inner->keys + child_inner->count + 1);
+                    std::copy_backward(child_inner->children, child_inner->children + child_inner->count + 1, child_inner->children + child_inner->count + 2);
+                    child_inner->keys[0] = inner->keys[index - 1];
+                    child_inner->children[0] = left_inner->children[left_inner->count];
+                    ++child_inner->count;
+                    inner->keys[index - 1] = left_inner->keys[left_inner->count - 1];
+                    truncate(left_inner, left_inner->count - 1);
+                }
+            }
+            else if (right != nullptr && right->count > minimum) {
+                if (child->leaf) {
+                    leaf_t * right_leaf = as_leaf(right);
+                    insert_entry(as_leaf(child), child->count, right_leaf->keys[0], right_leaf->ids[0]);
+                    remove_entry(right_leaf, 0);
+                    inner->keys[index] = right_leaf->keys[0];
+                }
+                else {
+                    inner_t * right_inner = as_inner(right);
+                    inner_t * child_inner = as_inner(child);
+                    child_inner->keys[child_inner->count] = inner->keys[index];
+                    child_inner->children[child_inner->count + 1] = right_inner->children[0];
+                    ++child_inner->count;
+                    inner->keys[index] = right_inner->keys[0];
+                    std::copy(right_inner->keys + 1, right_inner->keys + right_inner->count, right_inner->keys);
+                    std::copy(right_inner->children + 1, right_inner->children + right_inner->count + 1, right_inner->children);
+                    truncate(right_inner, right_inner->count - 1);
+                }
+            }
+            else if (left != nullptr) {
+                merge(inner, index - 1);
+            }
+            else {
+                merge(inner, index);
+            }
+        }
+
+        bool erase_from(node_t * node, Key const & key, id_t & id)
+        {
+            if (node->leaf) {
+                leaf_t * leaf = as_leaf(node);
+                size_t index = rank<false>(leaf, key);
+                if (index == leaf->count || !(leaf->keys[index] == key)) {
+                    return false;
+                }
+                id = leaf->ids[index];
+                remove_entry(leaf, index);
+                return true;
+            }
+            inner_t * inner = as_inner(node);
+            size_t index = rank<true>(inner, key);
+            if (!erase_from(inner->children[index], key, id)) {
+                return false;
+            }
+            rebalance(inner, index);
+            return true;
+        }
+
+        static void destroy(node_t * node) noexcept
+        {
+            if (node->leaf) {
+                delete as_leaf(node);
+                return;
+            }
+            inner_t * inner = as_inner(node);
+            for (size_t index = 0; index <= inner->count; ++index) {
+                destroy(inner->children[index]);
+            }
+            delete inner;
+        }
+
+        leaf_t * find_leaf(Key const & key) const
+        {
+            node_t * node = root;
+            while (!node->leaf) {
+                node = as_inner(node)->children[rank<true>(node, key)];
+            }
+            return as_leaf(node);
+        }
+
+        node_t * root = nullptr;
+        leaf_t * head = nullptr;
+        leaf_t * tail = nullptr;
+        Comparator compare;
+
+    public:
+        /* Entry of a leaf, the end has no leaf */
+        struct position_t
+        {
+            leaf_t const * leaf;
+            size_t index;
+
+            bool operator==(position_t const & other) const noexcept
+            {
+                return (leaf == other.leaf && index == other.index);
+            }
+
+            id_t id() const noexcept
+            {
+                return leaf->ids[index];
+            }
+        };
+
+        explicit tree_t(Comparator compare)
+            : compare(std::move(compare))
+        {
+        }
+
+        tree_t(tree_t && other) noexcept
+            : root(other.root)
+            , head(other.head)
+            , tail(other.tail)
+            , compare(std::move(other.compare))
+        {
+            other.root = nullptr;
+            other.head = nullptr;
+            other.tail = nullptr;
+        }
+
+        tree_t(tree_t const &) = delete;
+        tree_t & operator=(tree_t const &) = delete;
+
+        ~tree_t()
+        {
+            if (root != nullptr) {
+                destroy(root);
+            }
+        }
+
+        void swap(tree_t & other) noexcept
+        {
+            std::swap(root, other.root);
+            std::swap(head, other.head);
+            std::swap(tail, other.tail);
+            std::swap(compare, other.compare);
+        }
+
+        Comparator const & comparator() const noexcept
+        {
+            return compare;
+        }
+
+        position_t begin() const noexcept
+        {
+            return position_t{head, 0};
+        }
+
+        position_t end() const noexcept
+        {
+            return position_t{nullptr, 0};
+        }
+
+        position_t next(position_t position) const noexcept
+        {
+            if (++position.index == position.leaf->count) {
+                return position_t{position.leaf->next, 0};
+            }
+            return position;
+        }
+
+        position_t previous(position_t position) const noexcept
+        {
+            if (position.leaf == nullptr) {
+                return (tail != nullptr ? position_t{tail, tail->count - 1} : end());
+            }
+            if (position.index == 0) {
+                leaf_t const * leaf = position.leaf->previous;
+                return (leaf != nullptr ? position_t{leaf, leaf->count - 1} : end());
+            }
+            --position.index;
+            return position;
+        }
+
+        /* First key not ordered before x, or after x if Inclusive */
+        template <bool Inclusive>
+        position_t bound(Key const & key) const
+        {
+            if (root == nullptr) {
+                return end();
+            }
+            leaf_t const * leaf = find_leaf(key);
+            size_t index = rank<Inclusive>(leaf, key);
+            return (index < leaf->count ? position_t{leaf, index} : position_t{leaf->next, 0});
+        }
+
+        position_t find(Key const & key) const
+        {
+            position_t position = bound<false>(key);
+            if (position.leaf != nullptr && position.leaf->keys[position.index] == key) {
+                return position;
+            }
+            return end();
+        }
+
+        /* Key must be absent */
+        void insert(Key const & key, id_t id)
+        {
+            if (root == nullptr) {
+                root = head = tail = new leaf_t();
+            }
+            Key separator;
+            node_t * sibling = insert_into(root, key, id, separator);
+            if (sibling != nullptr) {
+                inner_t * new_root = new inner_t();
+                new_root->keys[0] = separator;
+                new_root->children[0] = root;
+                new_root->children[1] = sibling;
+                new_root->count = 1;
+                root = new_root;
+            }
+        }
+
+        /* Returns false if the key is absent, otherwise the id of the erased entry */
+        bool erase(Key const & key, id_t & id)
+        {
+            if (root == nullptr || !erase_from(root, key, id)) {
+                return false;
+            }
+            if (root->count == 0) {
+                node_t * excess = root;
+                root = (root->leaf ? nullptr : as_inner(root)->children[0]);
+                if (root == nullptr) {
+                    head = tail = nullptr;
+                }
+                if (excess->leaf) {
+                    delete as_leaf(excess);
+                }
+                else {
+                    delete as_inner(excess);
+                }
+            }
+            return true;
+        }
+    };
+
+    using left_tree_t = tree_t<Left, LeftComparator>;
+    using right_tree_t = tree_t<Right, RightComparator>;
+
+    struct left_descriptor_t
+    {
+        using tree_type = left_tree_t;
+
+        static left_tree_t const & tree(btree_bimap const * map) noexcept
+        {
+            return map->left_tree;
+        }
+
+        static Left const & value(pair_t const & pair) noexcept
+        {
+            return pair.left;
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        using tree_type = right_tree_t;
+
+        static right_tree_t const & tree(btree_bimap const * map) noexcept
+        {
+            return map->right_tree;
+        }
+
+        static Right const & value(pair_t const & pair) noexcept
+        {
+            return pair.right;
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class btree_bimap<Left, Right, LeftComparator, RightComparator>;
+
+        using position_t = typename MainDescriptor::tree_type::position_t;
+
+        basic_iterator(btree_bimap const * map, position_t position) noexcept
+            : map(map)
+            , position(position)
+        {
+        }
+
+        btree_bimap const * map;
+        position_t position;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            position = MainDescriptor::tree(map).next(position);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            position = MainDescriptor::tree(map).previous(position);
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::value(map->pool[position.id()]);
+        }
+
+        /* Looks the partner up in the other tree */
+        auto flip() const
+        {
+            FlipType const & partner = FlipDescriptor::value(map->pool[position.id()]);
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, FlipDescriptor::tree(map).find(partner));
+        }
+    };
+
+    template <typename L, typename R>
+    typename left_tree_t::position_t insert_by_values(L && left, R && right)
+    {
+        if (!(left_tree.find(left) == left_tree.end()) || !(right_tree.find(right) == right_tree.end())) {
+            return left_tree.end();
+        }
+        id_t id = pool.create(std::forward<L>(left), std::forward<R>(right));
+        pair_t const & pair = pool[id];
+        left_tree.insert(pair.left, id);
+        right_tree.insert(pair.right, id);
+        ++elements_count;
+        return left_tree.find(pair.left);
+    }
+
+    template <typename FirstTree, typename SecondTree, typename SecondDescriptor, typename T>
+    bool erase_element(FirstTree & first_tree, SecondTree & second_tree, T const & key)
+    {
+        id_t id;
+        if (!first_tree.erase(key, id)) {
+            return false;
+        }
+        second_tree.erase(SecondDescriptor::value(pool[id]), id);
+        pool.destroy(id);
+        --elements_count;
+        return true;
+    }
+
+    template <typename Descriptor, typename FlipDescriptor, typename SecondType, typename Tree, typename T>
+    SecondType const & at_element(Tree const & tree, T const & key) const
+    {
+        auto position = tree.find(key);
+        if (position == tree.end()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return FlipDescriptor::value(pool[position.id()]);
+    }
+
+    void swap(btree_bimap & other) noexcept
+    {
+        std::swap(pool, other.pool);
+        left_tree.swap(other.left_tree);
+        right_tree.swap(other.right_tree);
+        std::swap(elements_count, other.elements_count);
+    }
+
+    void clear() noexcept
+    {
+        for (auto position = left_tree.begin(); position.leaf != nullptr; position = left_tree.next(position)) {
+            pool.destroy(position.id());
+        }
+    }
+
+    pool_t pool;
+    left_tree_t left_tree;
+    right_tree_t right_tree;
+    size_t elements_count;
+
+public:
+    explicit btree_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : left_tree(std::move(left_compare))
+        , right_tree(std::move(right_compare))
+        , elements_count(0)
+    {
+    }
+
+    btree_bimap(btree_bimap const & other)
+        : left_tree(other.left_tree.comparator())
+        , right_tree(other.right_tree.comparator())
+        , elements_count(0)
+    {
+        for (left_iterator it = other.begin_left(); it != other.end_left(); ++it) {
+            insert(*it, other.pool[it.position.id()].right);
+        }
+    }
+
+    btree_bimap(btree_bimap && other) noexcept
+        : pool(std::move(other.pool))
+        , left_tree(std::move(other.left_tree))
+        , right_tree(std::move(other.right_tree))
+        , elements_count(other.elements_count)
+    {
+        other.elements_count = 0;
+    }
+
+    btree_bimap & operator=(btree_bimap other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    ~btree_bimap()
+    {
+        clear();
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, left_tree.begin());
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, left_tree.end());
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, right_tree.begin());
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, right_tree.end());
+    }
+
+    bool empty() const noexcept
+    {
+        return (elements_count == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count;
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return left_iterator(this, left_tree.find(desired));
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return right_iterator(this, right_tree.find(desired));
+    }
+
+    left_iterator insert(Left const & left, Right const & right)
+    {
+        return left_iterator(this, insert_by_values(left, right));
+    }
+
+    left_iterator insert(Left const & left, Right && right)
+    {
+        return left_iterator(this, insert_by_values(left, std::move(right)));
+    }
+
+    left_iterator insert(Left && left, Right const & right)
+    {
+        return left_iterator(this, insert_by_values(std::move(left), right));
+    }
+
+    left_iterator insert(Left && left, Right && right)
+    {
+        return left_iterator(this, insert_by_values(std::move(left), std::move(right)));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return erase_element<left_tree_t, right_tree_t, right_descriptor_t>(left_tree, right_tree, key);
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return erase_element<right_tree_t, left_tree_t, left_descriptor_t>(right_tree, left_tree, key);
+    }
+
+    /* Returns the element following the erased one, found again since erasing invalidates iterators */
+    left_iterator erase_left(left_iterator const & it)
+    {
+        left_iterator last = it;
+        return erase_left(it, ++last);
+    }
+
+    right_iterator erase_right(right_iterator const & it)
+    {
+        right_iterator last = it;
+        return erase_right(it, ++last);
+    }
+
+    left_iterator erase_left(left_iterator first, left_iterator const & last)
+    {
+        std::vector<Left> keys;
+        for (; first != last; ++first) {
+            keys.push_back(*first);
+        }
+        std::optional<Left> following;
+        if (last != end_left()) {
+            following.emplace(*last);
+        }
+        for (Left const & key : keys) {
+            erase_left(key);
+        }
+        return (following ? find_left(*following) : end_left());
+    }
+
+    right_iterator erase_right(right_iterator first, right_iterator const & last)
+    {
+        std::vector<Right> keys;
+        for (; first != last; ++first) {
+            keys.push_back(*first);
+        }
+        std::optional<Right> following;
+        if (last != end_right()) {
+            following.emplace(*last);
+        }
+        for (Right const & key : keys) {
+            erase_right(key);
+        }
+        return (following ? find_right(*following) : end_right());
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        return left_iterator(this, left_tree.template bound<false>(value));
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        return left_iterator(this, left_tree.template bound<true>(value));
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        return right_iterator(this, right_tree.template bound<false>(value));
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        return right_iterator(this, right_tree.template bound<true>(value));
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        return at_element<left_descriptor_t, right_descriptor_t, Right>(left_tree, key);
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        return at_element<right_descriptor_t, left_descriptor_t, Left>(right_tree, key);
+    }
+
+    Right const & at_left_or_default(Left const & key)
+    {
+        auto position = left_tree.find(key);
+        if (position == left_tree.end()) {
+            erase_right(Right());
+            position = insert_by_values(key, Right());
+        }
+        return pool[position.id()].right;
+    }
+
+    Left const & at_right_or_default(Right const & key)
+    {
+        auto position = right_tree.find(key);
+        if (position == right_tree.end()) {
+            erase_left(Left());
+            insert_by_values(Left(), key);
+            position = right_tree.find(key);
+        }
+        return pool[position.id()].left;
+    }
+
+    bool operator==(btree_bimap const & other) const
+    {
+        if (size() != other.size()) {
+            return false;
+        }
+        for (left_iterator first = begin_left(), second = other.begin_left(); first != end_left(); ++first, ++second) {
+            if (*first != *second || pool[first.position.id()].right != other.pool[second.position.id()].right) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(btree_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
@@ -0,0 +1,327 @@
+#pragma once
+
+#include "bimap.h"
+#include "snapshot.h"
+
+#include <algorithm>  // std::stable_sort
+#include <cstddef>    // size_t
+#include <cstdint>    // uint8_t, uint32_t, uint64_t
+#include <cstring>    // std::memcmp, std::memcpy
+#include <functional> // std::less
+#include <stdexcept>  // std::runtime_error
+#include <utility>    // std::move
+#include <vector>     // std::vector
+
+/*
+ * Change stream for replicating a bimap incrementally into another one, e.g. in another process.
+ * change_recorder is an observer policy for bimap, which encodes every pair the master inserts or erases
+ * into a change_batch, with both values, by snapshot_codec. encode() turns the batch into a frame:
+ * a change_frame_header, which holds the number of changes, the payload length and its checksum, then the payload.
+ * If recording a change fails, e.g. out of memory, the map keeps the change and encode() throws instead,
+ * so the replica is copied in full rather than silently diverging.
+ * change_applier decodes a frame and applies it to a replica, which held the same pairs as the master
+ * before the changes: it reduces the changes to their net effect per left value, erases the pairs the frame removes
+ * and then inserts the pairs it adds, both in left order, so that splaying touches the replica sequentially
+ * and every insert finds its values free on both sides, whatever the order of the changes on the master was.
+ * Recording requires O(1) time per change plus the encoding, applying requires O(changes * log(changes))
+ * time for sorting and O(log(size)) time per net change, with O(changes) temporary memory.
+ */
+
+struct change_frame_header
+{
+    static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'C', 'H', 'G'};
+    static constexpr uint32_t current_version = 1;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint32_t left_size;
+    uint32_t right_size;
+    uint64_t count;
+    /* Bytes after this header */
+    uint64_t length;
+    uint64_t checksum;
+};
+
+enum class change_kind : uint8_t
+{
+    insert = 1,
+    erase = 2,
+};
+
+/* Changes encoded one after another, each as its kind, the left value and the right value */
+template <typename Left, typename Right>
+class change_batch
+{
+    /* Output for snapshot_codec */
+    struct writer_t
+    {
+        std::vector<char> & bytes;
+
+        void write(void const * data, size_t size)
+        {
+            char const * begin = static_cast<char const *>(data);
+            bytes.insert(bytes.end(), begin, begin + size);
+        }
+    };
+
+    std::vector<char> bytes;
+    uint64_t changes_count;
+    bool lost;
+
+public:
+    change_batch()
+        : bytes(sizeof(change_frame_header))
+        , changes_count(0)
+        , lost(false)
+    {
+    }
+
+    /* Runs after the map has changed, so it can't throw: a change it fails to encode marks the batch as lost */
+    void record(change_kind kind, Left const & left, Right const & right) noexcept
+    {
+        size_t size = bytes.size();
+        try {
+            bytes.push_back(static_cast<char>(kind));
+            writer_t out{bytes};
+            snapshot_codec<Left>::write(out, left);
+            snapshot_codec<Right>::write(out, right);
+            ++changes_count;
+        }
+        catch (...) {
+            bytes.resize(size);
+            lost = true;
+        }
+    }
+
+    bool empty() const noexcept
+    {
+        return (changes_count == 0 && !lost);
+    }
+
+    /* Whether a change failed to be recorded since the last encode(), then the replica needs a full copy */
+    bool complete() const noexcept
+    {
+        return !lost;
+    }
+
+    /* Changes recorded since the last encode() */
+    size_t size() const noexcept
+    {
+        return changes_count;
+    }
+
+    /* Returns the frame of the recorded changes and starts an empty batch, throws if a change was lost */
+    std::vector<char> encode()
+    {
+        if (lost) {
+            bytes.resize(sizeof(change_frame_header));
+            changes_count = 0;
+            lost = false;
+            throw std::runtime_error("Change batch lost a change, the replica needs a full copy.");
+        }
+        change_frame_header header = {};
+        std::memcpy(header.magic, change_frame_header::signature, sizeof(header.magic));
+        header.version = change_frame_header::current_version;
+        header.byte_order = snapshot_header::native_byte_order;
+        header.left_size = snapshot_codec<Left>::fixed_size;
+        header.right_size = snapshot_codec<Right>::fixed_size;
+        header.count = changes_count;
+        header.length = bytes.size() - sizeof(header);
+        snapshot_checksum checksum;
+        checksum.update(bytes.data() + sizeof(header), header.length);
+        header.checksum = checksum.value();
+        std::memcpy(bytes.data(), &header, sizeof(header));
+        std::vector<char> frame(sizeof(change_frame_header));
+        frame.swap(bytes);
+        changes_count = 0;
+        return frame;
+    }
+};
+
+/* Observer policy for bimap, which records every change into a change_batch, or nothing while detached */
+template <typename Left, typename Right>
+class change_recorder
+{
+    change_batch<Left, Right> * target;
+
+public:
+    explicit change_recorder(change_batch<Left, Right> * target = nullptr) noexcept
+        : target(target)
+    {
+    }
+
+    void attach(change_batch<Left, Right> * new_target) noexcept
+    {
+        target = new_target;
+    }
+
+    void inserted(Left const & left, Right const & right) noexcept
+    {
+        if (target != nullptr) {
+            target->record(change_kind::insert, left, right);
+        }
+    }
+
+    void erased(Left const & left, Right const & right) noexcept
+    {
+        if (target != nullptr) {
+            target->record(change_kind::erase, left, right);
+        }
+    }
+};
+
+/* Applies frames to a replica, keeps its buffers between frames */
+template <typename Left, typename Right, typename LeftComparator = std::less<>>
+class change_applier
+{
+    struct change_t
+    {
+        change_kind kind;
+        Left left;
+        Right right;
+    };
+
+    /* Input for snapshot_codec, reading the payload of one frame */
+    struct reader_t
+    {
+        char const * position;
+        char const * end;
+
+        void read(void * data, size_t size)
+        {
+            if (size > static_cast<size_t>(end - position)) {
+                throw std::runtime_error("Corrupted change frame.");
+            }
+            std::memcpy(data, position, size);
+            position += size;
+        }
+
+        uint64_t size() const noexcept
+        {
+            return static_cast<uint64_t>(end - position);
+        }
+    };
+
+    std::vector<change_t> changes;
+    /* Indices into changes of the pairs to erase and to insert */
+    std::vector<size_t> erased;
+    std::vector<size_t> inserted;
+    LeftComparator left_compare;
+
+    /* Decodes a frame into changes, in the order of the master */
+    void decode(char const * frame, size_t size)
+    {
+        change_frame_header header;
+        if (size < sizeof(header)) {
+            throw std::runtime_error("Corrupted change frame.");
+        }
+        std::memcpy(&header, frame, sizeof(header));
+        if (std::memcmp(header.magic, change_frame_header::signature, sizeof(header.magic)) != 0 || header.version != change_frame_header::current_version
+            || header.byte_order != snapshot_header::native_byte_order
+            || header.left_size != snapshot_codec<Left>::fixed_size || header.right_size != snapshot_codec<Right>::fixed_size) {
+            throw std::runtime_error("Change frame doesn't match the value types or is corrupted.");
+        }
+        if (header.length != size - sizeof(header) || header.count > header.length) {
+            throw std::runtime_error("Corrupted change frame.");
+        }
+        snapshot_checksum checksum;
+        checksum.update(frame + sizeof(header), header.length);
+        if (checksum.value() != header.checksum) {
+            throw std::runtime_error("Change frame checksum mismatch.");
+        }
+        reader_t in{frame + sizeof(header), frame + size};
+        changes.clear();
+        changes.reserve(header.count);
+        for (uint64_t i = 0; i < header.count; ++i) {
+            uint8_t kind;
+            in.read(&kind, sizeof(kind));
+            if (kind != static_cast<uint8_t>(change_kind::insert) && kind != static_cast<uint8_t>(change_kind::erase)) {
+                throw std::runtime_error("Corrupted change frame.");
+            }
+            Left left = snapshot_codec<Left>::read(in);
+            Right right = snapshot_codec<Right>::read(in);
+            changes.push_back(change_t{static_cast<change_kind>(kind), std::move(left), std::move(right)});
+        }
+        if (in.position != in.end) {
+            throw std::runtime_error("Corrupted change frame.");
+        }
+    }
+
+    /*
+     * At most one pair holds a left value at any time, so the changes of one left value, in master order,
+     * tell its pair before the frame (if they start with erasing it) and after the frame (if they end with inserting)
+     */
+    void reduce()
+    {
+        std::vector<size_t> order(changes.size());
+        for (size_t i = 0; i < order.size(); ++i) {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+            return left_compare(changes[a].left, changes[b].left);
+        });
+        erased.clear();
+        inserted.clear();
+        for (size_t first = 0, last = 0; first < order.size(); first = last) {
+            last = first + 1;
+            while (last < order.size() && !left_compare(changes[order[first]].left, changes[order[last]].left)) {
+                ++last;
+            }
+            change_t const & before = changes[order[first]];
+            change_t const & after = changes[order[last - 1]];
+            bool existed = (before.kind == change_kind::erase);
+            bool exists = (after.kind == change_kind::insert);
+            if (existed && exists && before.right == after.right) {
+                continue;
+            }
+            if (existed) {
+                erased.push_back(order[first]);
+            }
+            if (exists) {
+                inserted.push_back(order[last - 1]);
+            }
+        }
+    }
+
+public:
+    explicit change_applier(LeftComparator left_compare = LeftComparator())
+        : left_compare(std::move(left_compare))
+    {
+    }
+
+    /*
+     * Applies one frame from encode() to map, which must use the left comparator of the applier.
+     * Throws std::runtime_error, changing nothing, if the frame is corrupted;
+     * returns false if the replica didn't hold the pairs the master did, after applying what it could.
+     */
+    template <typename Map>
+    bool apply(Map & map, void const * frame, size_t size)
+    {
+        decode(static_cast<char const *>(frame), size);
+        reduce();
+        bool consistent = true;
+        for (size_t index : erased) {
+            change_t const & change = changes[index];
+            auto it = map.find_left(change.left);
+            if (it == map.end_left() || !(*it.flip() == change.right)) {
+                consistent = false;
+                continue;
+            }
+            map.erase_left(it);
+        }
+        for (size_t index : inserted) {
+            change_t & change = changes[index];
+            if (map.insert(std::move(change.left), std::move(change.right)) == map.end_left()) {
+                consistent = false;
+            }
+        }
+        return consistent;
+    }
+
+    template <typename Map>
+    bool apply(Map & map, std::vector<char> const & frame)
+    {
+        return apply(map, frame.data(), frame.size());
+    }
+};
@@ -0,0 +1,336 @@
+#pragma once
+
+#include <array>      // std::array
+#include <cstddef>    // size_t
+#include <cstdint>    // uint32_t
+#include <functional> // std::less
+#include <stdexcept>  // std::invalid_argument, std::out_of_range
+#include <utility>    // std::pair
+
+/*
+ * Immutable bimap built in constant expressions, for lookup tables like enum <-> name, which are then
+ * plain static data: no constructor runs at startup, so there is nothing to order between translation units.
+ * Both sides are arrays of values in the order of their comparator plus two arrays of 32-bit positions
+ * linking every value to its partner on the other side, all inside the object.
+ * Constructing takes O(N * log(N)) comparisons, by heap sort; a value present twice on either side throws
+ * std::invalid_argument, which makes a constexpr definition ill-formed, so duplicates fail to compile.
+ * Every member is constexpr; finding one element takes O(log(N)) comparisons, at_* of a missing value
+ * throws std::out_of_range, which fails to compile in a constant expression too.
+ * Requires ((sizeof(Left) + sizeof(Right) + 2 * sizeof(uint32_t)) * N
+ *          + sizeof(LeftComparator) + sizeof(RightComparator)) bytes memory.
+ * Both types and comparators must be literal types and both types default constructible and copy assignable;
+ * compare strings as std::string_view, std::less<> would compare the addresses of character pointers.
+ * Defined as
+ *     static constexpr auto names = make_constexpr_bimap<color, std::string_view>({{color::red, "red"}, {color::green, "green"}});
+ */
+
+template <typename Left, typename Right, size_t N, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class constexpr_bimap
+{
+    static_assert(N > 0 && N < 0xffffffffu, "constexpr_bimap holds 1 to 2^32 - 2 pairs");
+
+    /* Indices into the sorted arrays, N stands for the end */
+    using position_t = uint32_t;
+
+    struct left_descriptor_t
+    {
+        static constexpr Left const & value(constexpr_bimap const * map, position_t position) noexcept
+        {
+            return map->left_values[position];
+        }
+
+        static constexpr position_t partner(constexpr_bimap const * map, position_t position) noexcept
+        {
+            return map->left_partners[position];
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static constexpr Right const & value(constexpr_bimap const * map, position_t position) noexcept
+        {
+            return map->right_values[position];
+        }
+
+        static constexpr position_t partner(constexpr_bimap const * map, position_t position) noexcept
+        {
+            return map->right_partners[position];
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class constexpr_bimap<Left, Right, N, LeftComparator, RightComparator>;
+
+        constexpr basic_iterator(constexpr_bimap const * map, position_t position) noexcept
+            : map(map)
+            , position(position)
+        {
+        }
+
+        constexpr_bimap const * map;
+        position_t position;
+
+    public:
+        constexpr bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position);
+        }
+
+        constexpr bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        constexpr basic_iterator & operator++() noexcept
+        {
+            ++position;
+            return *this;
+        }
+
+        constexpr basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++position;
+            return copy;
+        }
+
+        constexpr basic_iterator & operator--() noexcept
+        {
+            --position;
+            return *this;
+        }
+
+        constexpr basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --position;
+            return copy;
+        }
+
+        constexpr MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::value(map, position);
+        }
+
+        constexpr auto flip() const noexcept
+        {
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, MainDescriptor::partner(map, position));
+        }
+    };
+
+public:
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+private:
+    std::array<Left, N> left_values;
+    std::array<Right, N> right_values;
+    std::array<position_t, N> left_partners;
+    std::array<position_t, N> right_partners;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+
+    /* std::sort and std::swap are constexpr only since C++20 */
+    template <typename Less>
+    static constexpr void sift_down(std::array<position_t, N> & order, size_t root, size_t end, Less const & less)
+    {
+        while (2 * root + 1 < end) {
+            size_t child = 2 * root + 1;
+            if (child + 1 < end && less(order[child], order[child + 1])) {
+                ++child;
+            }
+            if (!less(order[root], order[child])) {
+                return;
+            }
+            position_t top = order[root];
+            order[root] = order[child];
+            order[child] = top;
+            root = child;
+        }
+    }
+
+    /* Indices of pairs in the order of less */
+    template <typename Less>
+    static constexpr std::array<position_t, N> sorted_order(Less const & less)
+    {
+        std::array<position_t, N> order{};
+        for (size_t i = 0; i < N; ++i) {
+            order[i] = static_cast<position_t>(i);
+        }
+        for (size_t start = N / 2; start-- > 0;) {
+            sift_down(order, start, N, less);
+        }
+        for (size_t end = N; end-- > 1;) {
+            position_t top = order[0];
+            order[0] = order[end];
+            order[end] = top;
+            sift_down(order, 0, end, less);
+        }
+        return order;
+    }
+
+    /* First position whose value isn't less than x, or is greater than x if Upper; halves without branches */
+    template <typename Descriptor, bool Upper, typename T, typename Comparator>
+    constexpr position_t bound_position(T const & x, Comparator const & compare) const
+    {
+        position_t first = 0;
+        position_t length = N;
+        while (length > 1) {
+            position_t half = length / 2;
+            T const & value = Descriptor::value(this, first + half);
+            first = ((Upper ? !compare(x, value) : compare(value, x)) ? first + half : first);
+            length -= half;
+        }
+        T const & value = Descriptor::value(this, first);
+        return first + ((Upper ? !compare(x, value) : compare(value, x)) ? 1 : 0);
+    }
+
+    template <typename Descriptor, typename T, typename Comparator>
+    constexpr position_t find_position(T const & x, Comparator const & compare) const
+    {
+        position_t position = bound_position<Descriptor, false>(x, compare);
+        return (position < N && !compare(x, Descriptor::value(this, position)) ? position : position_t(N));
+    }
+
+public:
+    /* Throws std::invalid_argument if a value is present twice on either side */
+    constexpr explicit constexpr_bimap(std::pair<Left, Right> const (&pairs)[N], LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : left_values{}
+        , right_values{}
+        , left_partners{}
+        , right_partners{}
+        , left_compare(left_compare)
+        , right_compare(right_compare)
+    {
+        std::array<position_t, N> left_order = sorted_order([&](position_t a, position_t b) {
+            return left_compare(pairs[a].first, pairs[b].first);
+        });
+        std::array<position_t, N> right_order = sorted_order([&](position_t a, position_t b) {
+            return right_compare(pairs[a].second, pairs[b].second);
+        });
+        /* Positions of every pair on both sides */
+        std::array<position_t, N> left_ranks{};
+        std::array<position_t, N> right_ranks{};
+        for (size_t i = 0; i < N; ++i) {
+            left_ranks[left_order[i]] = static_cast<position_t>(i);
+            right_ranks[right_order[i]] = static_cast<position_t>(i);
+        }
+        for (size_t i = 0; i < N; ++i) {
+            left_values[i] = pairs[left_order[i]].first;
+            left_partners[i] = right_ranks[left_order[i]];
+            right_values[i] = pairs[right_order[i]].second;
+            right_partners[i] = left_ranks[right_order[i]];
+        }
+        for (size_t i = 1; i < N; ++i) {
+            if (!left_compare(left_values[i - 1], left_values[i])) {
+                throw std::invalid_argument("Duplicate left value.");
+            }
+            if (!right_compare(right_values[i - 1], right_values[i])) {
+                throw std::invalid_argument("Duplicate right value.");
+            }
+        }
+    }
+
+    constexpr left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, 0);
+    }
+
+    constexpr left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, N);
+    }
+
+    constexpr right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, 0);
+    }
+
+    constexpr right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, N);
+    }
+
+    constexpr bool empty() const noexcept
+    {
+        return false;
+    }
+
+    constexpr size_t size() const noexcept
+    {
+        return N;
+    }
+
+    constexpr left_iterator find_left(Left const & desired) const
+    {
+        return left_iterator(this, find_position<left_descriptor_t>(desired, left_compare));
+    }
+
+    constexpr right_iterator find_right(Right const & desired) const
+    {
+        return right_iterator(this, find_position<right_descriptor_t>(desired, right_compare));
+    }
+
+    constexpr left_iterator lower_bound_left(Left const & value) const
+    {
+        return left_iterator(this, bound_position<left_descriptor_t, false>(value, left_compare));
+    }
+
+    constexpr left_iterator upper_bound_left(Left const & value) const
+    {
+        return left_iterator(this, bound_position<left_descriptor_t, true>(value, left_compare));
+    }
+
+    constexpr right_iterator lower_bound_right(Right const & value) const
+    {
+        return right_iterator(this, bound_position<right_descriptor_t, false>(value, right_compare));
+    }
+
+    constexpr right_iterator upper_bound_right(Right const & value) const
+    {
+        return right_iterator(this, bound_position<right_descriptor_t, true>(value, right_compare));
+    }
+
+    constexpr Right const & at_left(Left const & key) const
+    {
+        position_t position = find_position<left_descriptor_t>(key, left_compare);
+        if (position == N) {
+            throw std::out_of_range("No matching element.");
+        }
+        return right_values[left_partners[position]];
+    }
+
+    constexpr Left const & at_right(Right const & key) const
+    {
+        position_t position = find_position<right_descriptor_t>(key, right_compare);
+        if (position == N) {
+            throw std::out_of_range("No matching element.");
+        }
+        return left_values[right_partners[position]];
+    }
+
+    constexpr bool operator==(constexpr_bimap const & other) const
+    {
+        for (size_t i = 0; i < N; ++i) {
+            if (left_values[i] != other.left_values[i] || right_values[left_partners[i]] != other.right_values[other.left_partners[i]]) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    constexpr bool operator!=(constexpr_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
+
+/* Deduces the number of pairs of a braced list, for constexpr definitions */
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>, size_t N>
+constexpr constexpr_bimap<Left, Right, N, LeftComparator, RightComparator> make_constexpr_bimap(std::pair<Left, Right> const (&pairs)[N], LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+{
+    return constexpr_bimap<Left, Right, N, LeftComparator, RightComparator>(pairs, left_compare, right_compare);
+}
@@ -0,0 +1,369 @@
+#pragma once
+
+#include <atomic>  // std::atomic, std::atomic_thread_fence
+#include <cstddef> // size_t
+#include <cstdint> // uint64_t
+#include <memory>  // std::shared_ptr, std::make_shared
+#include <utility> // std::swap
+#include <vector>  // std::vector
+
+/*
+ * Epoch based memory reclamation for concurrent maps, whose readers may still traverse nodes that a writer has removed.
+ * A thread pins the reclaimer for the duration of an operation; removed nodes are retired instead of deleted
+ * and are freed in batches once every pinned thread has passed two epochs after their retirement.
+ * Threads are registered on their first pin and unregistered when they exit, every thread keeps its own retire lists.
+ * Pinning costs two writes to a thread-owned cache line, retiring is amortized O(1).
+ * Guards belong to the thread that created them and may be nested and copied on that thread.
+ * Destroying the reclaimer frees every node that is still retired, so it must not run concurrently with any pinned thread.
+ *
+ * Defining BIMAP_SINGLE_THREADED compiles the reclaimer away: guards are empty and nodes are freed as soon as they are retired.
+ */
+
+#ifdef BIMAP_SINGLE_THREADED
+
+class epoch_reclaimer
+{
+public:
+    using deleter_t = void (*)(void * object, void * context);
+
+    class guard
+    {
+    };
+
+    guard pin() const noexcept
+    {
+        return guard();
+    }
+
+    template <typename T>
+    void retire(T * object) const noexcept
+    {
+        delete object;
+    }
+
+    void retire(void * object, deleter_t deleter, void * context) const
+    {
+        deleter(object, context);
+    }
+
+    void collect() const noexcept
+    {
+    }
+
+    size_t pending() const noexcept
+    {
+        return 0;
+    }
+};
+
+#else
+
+class epoch_reclaimer
+{
+public:
+    using deleter_t = void (*)(void * object, void * context);
+
+private:
+    struct retired_t
+    {
+        void * object;
+        deleter_t deleter;
+        void * context;
+    };
+
+    /* Epoch of a record that is not pinned */
+    static constexpr uint64_t inactive = ~uint64_t(0);
+
+    /* Number of retirements after which a thread tries to advance the epoch and free its old batches */
+    static constexpr size_t collect_threshold = 128;
+
+    /* Nodes retired in epoch e are kept in batch e % 3 until the global epoch reaches e + 2 */
+    static constexpr size_t batches_count = 3;
+
+    struct alignas(64) record_t
+    {
+        std::atomic<uint64_t> epoch{inactive};
+        std::atomic<bool> owned{true};
+        /* Written by the owning thread only, read by anyone */
+        std::atomic<size_t> pending{0};
+        record_t * next = nullptr;
+
+        /* Only accessed by the owning thread */
+        size_t nesting = 0;
+        size_t retired_since_collect = 0;
+        std::vector<retired_t> batches[batches_count];
+        uint64_t batch_epochs[batches_count] = {};
+    };
+
+    /* Outlives the reclaimer while some exited thread still refers to it */
+    struct domain_t
+    {
+        std::atomic<uint64_t> epoch{0};
+        std::atomic<record_t *> records{nullptr};
+
+        ~domain_t()
+        {
+            for (record_t * record = records.load(std::memory_order_relaxed); record != nullptr;) {
+                record_t * next = record->next;
+                delete record;
+                record = next;
+            }
+        }
+    };
+
+    /* Releases the record of an exiting thread, so that another thread can reuse it together with its retired nodes */
+    struct registration_t
+    {
+        registration_t(std::shared_ptr<domain_t> domain, record_t * record) noexcept
+            : domain(std::move(domain))
+            , record(record)
+        {
+        }
+
+        registration_t(registration_t && other) noexcept
+            : domain(std::move(other.domain))
+            , record(other.record)
+        {
+            other.record = nullptr;
+        }
+
+        registration_t & operator=(registration_t && other) noexcept
+        {
+            std::swap(domain, other.domain);
+            std::swap(record, other.record);
+            return *this;
+        }
+
+        ~registration_t()
+        {
+            if (record != nullptr) {
+                record->owned.store(false, std::memory_order_release);
+            }
+        }
+
+        std::shared_ptr<domain_t> domain;
+        record_t * record;
+    };
+
+    static record_t * acquire_record(domain_t & domain)
+    {
+        for (record_t * record = domain.records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            bool owned = false;
+            if (!record->owned.load(std::memory_order_relaxed) && record->owned.compare_exchange_strong(owned, true, std::memory_order_acquire)) {
+                return record;
+            }
+        }
+        record_t * record = new record_t();
+        record->next = domain.records.load(std::memory_order_relaxed);
+        while (!domain.records.compare_exchange_weak(record->next, record, std::memory_order_release, std::memory_order_relaxed)) {
+        }
+        return record;
+    }
+
+    record_t * record_of_this_thread() const
+    {
+        thread_local std::vector<registration_t> registrations;
+        for (registration_t const & registration : registrations) {
+            if (registration.domain == domain) {
+                return registration.record;
+            }
+        }
+        /* Forget reclaimers that are gone, nobody else can touch their records anymore */
+        for (size_t i = 0; i < registrations.size();) {
+            if (registrations[i].domain.use_count() == 1) {
+                registrations[i] = std::move(registrations.back());
+                registrations.pop_back();
+            }
+            else {
+                ++i;
+            }
+        }
+        registrations.emplace_back(domain, acquire_record(*domain));
+        return registrations.back().record;
+    }
+
+    static void enter(domain_t const & domain, record_t * record) noexcept
+    {
+        if (record->nesting++ == 0) {
+            uint64_t epoch = domain.epoch.load(std::memory_order_relaxed);
+            for (;;) {
+                record->epoch.store(epoch, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                uint64_t current = domain.epoch.load(std::memory_order_relaxed);
+                if (current == epoch) {
+                    break;
+                }
+                epoch = current;
+            }
+        }
+    }
+
+    static void leave(record_t * record) noexcept
+    {
+        if (--record->nesting == 0) {
+            record->epoch.store(inactive, std::memory_order_release);
+        }
+    }
+
+    /* Advances the global epoch if every pinned thread has already observed it */
+    bool try_advance() const noexcept
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = domain->epoch.load(std::memory_order_relaxed);
+        for (record_t * record = domain->records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            uint64_t observed = record->epoch.load(std::memory_order_acquire);
+            if (observed != inactive && observed != epoch) {
+                return false;
+            }
+        }
+        return domain->epoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_acq_rel);
+    }
+
+    static void free_batch(record_t * record, size_t index)
+    {
+        std::vector<retired_t> batch;
+        batch.swap(record->batches[index]);
+        record->pending.store(record->pending.load(std::memory_order_relaxed) - batch.size(), std::memory_order_relaxed);
+        for (retired_t const & retired : batch) {
+            retired.deleter(retired.object, retired.context);
+        }
+        /* Keep the capacity for the next batch of this epoch */
+        batch.clear();
+        if (record->batches[index].empty()) {
+            record->batches[index].swap(batch);
+        }
+    }
+
+    void collect(record_t * record) const
+    {
+        record->retired_since_collect = 0;
+        try_advance();
+        uint64_t epoch = domain->epoch.load(std::memory_order_acquire);
+        for (size_t index = 0; index < batches_count; ++index) {
+            if (!record->batches[index].empty() && record->batch_epochs[index] + 2 <= epoch) {
+                free_batch(record, index);
+            }
+        }
+    }
+
+    std::shared_ptr<domain_t> domain;
+
+public:
+    class guard
+    {
+        friend class epoch_reclaimer;
+
+        explicit guard(record_t * record) noexcept
+            : record(record)
+        {
+        }
+
+        record_t * record;
+
+    public:
+        /* Pins nothing */
+        guard() noexcept
+            : record(nullptr)
+        {
+        }
+
+        guard(guard const & other) noexcept
+            : record(other.record)
+        {
+            if (record != nullptr) {
+                ++record->nesting;
+            }
+        }
+
+        guard(guard && other) noexcept
+            : record(other.record)
+        {
+            other.record = nullptr;
+        }
+
+        guard & operator=(guard other) noexcept
+        {
+            std::swap(record, other.record);
+            return *this;
+        }
+
+        ~guard()
+        {
+            if (record != nullptr) {
+                leave(record);
+            }
+        }
+    };
+
+    epoch_reclaimer()
+        : domain(std::make_shared<domain_t>())
+    {
+    }
+
+    epoch_reclaimer(epoch_reclaimer const &) = delete;
+    epoch_reclaimer & operator=(epoch_reclaimer const &) = delete;
+
+    ~epoch_reclaimer()
+    {
+        for (record_t * record = domain->records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            for (size_t index = 0; index < batches_count; ++index) {
+                free_batch(record, index);
+            }
+        }
+    }
+
+    /* Nodes reachable after pinning stay allocated until the guard is destroyed */
+    guard pin() const
+    {
+        record_t * record = record_of_this_thread();
+        enter(*domain, record);
+        return guard(record);
+    }
+
+    template <typename T>
+    void retire(T * object) const
+    {
+        retire(
+            object, [](void * object, void *) {
+                delete static_cast<T *>(object);
+            },
+            nullptr);
+    }
+
+    /* Object must already be unreachable for threads that pin the reclaimer from now on */
+    void retire(void * object, deleter_t deleter, void * context) const
+    {
+        record_t * record = record_of_this_thread();
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        uint64_t epoch = domain->epoch.load(std::memory_order_relaxed);
+        size_t index = epoch % batches_count;
+        if (record->batch_epochs[index] != epoch) {
+            /* The batch holds nodes retired at least three epochs ago */
+            free_batch(record, index);
+            record->batch_epochs[index] = epoch;
+        }
+        record->batches[index].push_back(retired_t{object, deleter, context});
+        record->pending.store(record->pending.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        if (++record->retired_since_collect >= collect_threshold) {
+            collect(record);
+        }
+    }
+
+    /* Tries to advance the epoch and frees the batches of this thread that are old enough */
+    void collect() const
+    {
+        collect(record_of_this_thread());
+    }
+
+    /* Number of retired nodes not freed yet, summed over all threads */
+    size_t pending() const noexcept
+    {
+        size_t result = 0;
+        for (record_t * record = domain->records.load(std::memory_order_acquire); record != nullptr; record = record->next) {
+            result += record->pending.load(std::memory_order_relaxed);
+        }
+        return result;
+    }
+};
+
+#endif
@@ -0,0 +1,407 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>  // std::min, std::sort
+#include <cstddef>    // size_t
+#include <cstdint>    // uint32_t
+#include <functional> // std::less
+#include <numeric>    // std::iota
+#include <stdexcept>  // std::out_of_range, std::length_error
+#include <utility>    // std::move
+#include <vector>     // std::vector
+
+/*
+ * Immutable bimap, produced by bimap::freeze() for maps which are read-only for a long time.
+ * Both sides are arrays of values in Eytzinger (breadth-first) order of an implicit balanced search tree,
+ * so that the first levels of every lookup share a few cache lines, plus two arrays of 32-bit positions
+ * linking every value to its partner on the other side.
+ * Requires O(log(size)) time for finding one element without branch mispredictions, O(1) amortized for iterating.
+ * Requires ((sizeof(Left) + sizeof(Right) + 2 * sizeof(uint32_t)) * size
+ *          + 4 * sizeof(std::vector) + sizeof(LeftComparator) + sizeof(RightComparator)) bytes memory.
+ * Holds at most 2^32 - 1 pairs.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class flat_bimap
+{
+    /* Positions are 1-based indices of the implicit tree, 0 stands for the end */
+    using position_t = uint32_t;
+
+    struct left_descriptor_t
+    {
+        static Left const & value(flat_bimap const * map, position_t position) noexcept
+        {
+            return map->left_values[position - 1];
+        }
+
+        static position_t partner(flat_bimap const * map, position_t position) noexcept
+        {
+            return map->left_partners[position - 1];
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static Right const & value(flat_bimap const * map, position_t position) noexcept
+        {
+            return map->right_values[position - 1];
+        }
+
+        static position_t partner(flat_bimap const * map, position_t position) noexcept
+        {
+            return map->right_partners[position - 1];
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class flat_bimap<Left, Right, LeftComparator, RightComparator>;
+
+        template <typename, typename, typename, typename>
+        friend class basic_iterator;
+
+        basic_iterator(flat_bimap const * map, position_t position) noexcept
+            : map(map)
+            , position(position)
+        {
+        }
+
+        flat_bimap const * map;
+        position_t position;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            position = map->next(position);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            position = map->next(position);
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            position = map->previous(position);
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            position = map->previous(position);
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::value(map, position);
+        }
+
+        auto flip() const noexcept
+        {
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, MainDescriptor::partner(map, position));
+        }
+    };
+
+    /* In-order successor in the implicit tree */
+    position_t next(position_t position) const noexcept
+    {
+        if (2 * size_t(position) + 1 <= elements_count) {
+            position = 2 * position + 1;
+            while (2 * size_t(position) <= elements_count) {
+                position = 2 * position;
+            }
+            return position;
+        }
+        while ((position & 1) != 0) {
+            position >>= 1;
+        }
+        return (position >> 1);
+    }
+
+    /* In-order predecessor in the implicit tree, the predecessor of the end is the last position */
+    position_t previous(position_t position) const noexcept
+    {
+        if (position == 0) {
+            position = 1;
+            while (2 * size_t(position) + 1 <= elements_count) {
+                position = 2 * position + 1;
+            }
+            return position;
+        }
+        if (2 * size_t(position) <= elements_count) {
+            position = 2 * position;
+            while (2 * size_t(position) + 1 <= elements_count) {
+                position = 2 * position + 1;
+            }
+            return position;
+        }
+        while (position != 0 && (position & 1) == 0) {
+            position >>= 1;
+        }
+        return (position >> 1);
+    }
+
+    position_t first() const noexcept
+    {
+        if (elements_count == 0) {
+            return 0;
+        }
+        position_t position = 1;
+        while (2 * size_t(position) <= elements_count) {
+            position = 2 * position;
+        }
+        return position;
+    }
+
+    /* Descends the implicit tree going right while Descend holds, then returns the last position where it turned left */
+    template <typename Values, typename Descend>
+    position_t search(Values const & values, Descend const & descend) const
+    {
+        size_t position = 1;
+        while (position <= elements_count) {
+#if defined(__GNUC__)
+            /* Four levels below are sixteen consecutive positions */
+            __builtin_prefetch(values.data() + std::min<size_t>(16 * position, elements_count) - 1);
+#endif
+            position = 2 * position + (descend(values[position - 1]) ? 1 : 0);
+        }
+        /* Cancel the right turns taken after the last left one */
+        while ((position & 1) != 0) {
+            position >>= 1;
+        }
+        return static_cast<position_t>(position >> 1);
+    }
+
+    template <typename Descriptor, typename Iterator, typename Values, typename T, typename Comparator>
+    Iterator find_element(Values const & values, T const & desired, Comparator const & compare) const
+    {
+        position_t position = search(values, [&](auto const & value) {
+            return compare(value, desired);
+        });
+        if (position != 0 && Descriptor::value(this, position) == desired) {
+            return Iterator(this, position);
+        }
+        return Iterator(this, 0);
+    }
+
+    template <typename Descriptor, typename FlipDescriptor, typename FirstType, typename SecondType, typename Values, typename Comparator>
+    SecondType const & at_element(Values const & values, FirstType const & key, Comparator const & compare) const
+    {
+        position_t position = search(values, [&](auto const & value) {
+            return compare(value, key);
+        });
+        if (position == 0 || !(Descriptor::value(this, position) == key)) {
+            throw std::out_of_range("No matching element.");
+        }
+        return FlipDescriptor::value(this, Descriptor::partner(this, position));
+    }
+
+    /* Storage index of every in-order rank */
+    std::vector<position_t> positions_by_rank() const
+    {
+        std::vector<position_t> positions;
+        positions.reserve(elements_count);
+        for (position_t position = first(); position != 0; position = next(position)) {
+            positions.push_back(position);
+        }
+        return positions;
+    }
+
+    std::vector<Left> left_values;
+    std::vector<Right> right_values;
+    std::vector<position_t> left_partners;
+    std::vector<position_t> right_partners;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+    size_t elements_count;
+
+public:
+    explicit flat_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+        , elements_count(0)
+    {
+    }
+
+    /* Copies every pair of the map, requires O(size * log(size)) time */
+    template <typename Storage, typename Observer, typename Eviction>
+    explicit flat_bimap(bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction> const & map, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+        , elements_count(map.size())
+    {
+        if (elements_count >= size_t(position_t(-1))) {
+            throw std::length_error("Too many pairs to freeze.");
+        }
+        std::vector<Left> lefts;
+        std::vector<Right> rights;
+        lefts.reserve(elements_count);
+        rights.reserve(elements_count);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            lefts.push_back(*it);
+            rights.push_back(*it.flip());
+        }
+        /* Left rank of the partner of every right rank */
+        std::vector<position_t> partner_ranks(elements_count);
+        std::iota(partner_ranks.begin(), partner_ranks.end(), position_t(0));
+        std::sort(partner_ranks.begin(), partner_ranks.end(), [&](position_t a, position_t b) {
+            return this->right_compare(rights[a], rights[b]);
+        });
+
+        std::vector<position_t> positions = positions_by_rank();
+        std::vector<position_t> ranks(elements_count);
+        for (size_t rank = 0; rank < elements_count; ++rank) {
+            ranks[positions[rank] - 1] = static_cast<position_t>(rank);
+        }
+        left_values.reserve(elements_count);
+        right_values.reserve(elements_count);
+        left_partners.resize(elements_count);
+        right_partners.resize(elements_count);
+        for (size_t index = 0; index < elements_count; ++index) {
+            position_t rank = ranks[index];
+            left_values.push_back(std::move(lefts[rank]));
+            right_values.push_back(std::move(rights[partner_ranks[rank]]));
+            right_partners[index] = positions[partner_ranks[rank]];
+            left_partners[right_partners[index] - 1] = static_cast<position_t>(index + 1);
+        }
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, first());
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, 0);
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, first());
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, 0);
+    }
+
+    bool empty() const noexcept
+    {
+        return (elements_count == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count;
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return find_element<left_descriptor_t, left_iterator>(left_values, desired, left_compare);
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return find_element<right_descriptor_t, right_iterator>(right_values, desired, right_compare);
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        position_t position = search(left_values, [&](Left const & x) {
+            return left_compare(x, value);
+        });
+        return left_iterator(this, position);
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        position_t position = search(left_values, [&](Left const & x) {
+            return !left_compare(value, x);
+        });
+        return left_iterator(this, position);
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        position_t position = search(right_values, [&](Right const & x) {
+            return right_compare(x, value);
+        });
+        return right_iterator(this, position);
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        position_t position = search(right_values, [&](Right const & x) {
+            return !right_compare(value, x);
+        });
+        return right_iterator(this, position);
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        return at_element<left_descriptor_t, right_descriptor_t, Left, Right>(left_values, key, left_compare);
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        return at_element<right_descriptor_t, left_descriptor_t, Right, Left>(right_values, key, right_compare);
+    }
+
+    /* Copies every pair back into a mutable bimap, both trees linked balanced */
+    bimap<Left, Right, LeftComparator, RightComparator> thaw() const
+    {
+        bimap<Left, Right, LeftComparator, RightComparator> result(left_compare, right_compare);
+        for (left_iterator it = begin_left(); it != end_left(); ++it) {
+            result.insert(*it, *it.flip());
+        }
+        /* Inserting in left order leaves the left tree a path */
+        result.rebalance();
+        return result;
+    }
+
+    bool operator==(flat_bimap const & other) const
+    {
+        if (size() != other.size()) {
+            return false;
+        }
+        for (left_iterator first = begin_left(), second = other.begin_left(); first != end_left(); first++, second++) {
+            if (*first != *second || *first.flip() != *second.flip()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(flat_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
+
+template <typename Left, typename Right, typename LeftComparator, typename RightComparator, typename Storage, typename Observer, typename Eviction>
+flat_bimap<Left, Right, LeftComparator, RightComparator> bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction>::freeze() const
+{
+    return flat_bimap<Left, Right, LeftComparator, RightComparator>(*this, left_compare, right_compare);
+}
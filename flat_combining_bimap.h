@@ -0,0 +1,354 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>  // std::sort, std::push_heap, std::pop_heap
+#include <atomic>     // std::atomic
+#include <cstddef>    // size_t
+#include <exception>  // std::exception_ptr, std::current_exception, std::rethrow_exception
+#include <functional> // std::less, std::greater
+#include <mutex>      // std::mutex, std::lock_guard
+#include <optional>   // std::optional
+#include <stdexcept>  // std::out_of_range
+#include <thread>     // std::this_thread
+#include <utility>    // std::move
+#include <vector>     // std::vector
+
+/*
+ * Flat combining front end, which lets many threads share one bimap.
+ * A thread publishes its operation in its own slot; whichever thread acquires the combiner lock
+ * applies every published operation to the bimap in one batch and hands back the results.
+ * Batches are sorted by key, so that consecutive operations splay neighbouring nodes.
+ * Operations of one thread never overlap, so they are applied in program order.
+ * Threads beyond the number of slots fall back to taking the combiner lock for every operation.
+ * An exception thrown by an operation, e.g. by a comparator or when allocating, is caught by the combiner
+ * and rethrown by the thread which published the operation; the other operations of the batch are applied.
+ * Lookups return copies of the stored values.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class flat_combining_bimap
+{
+    enum class operation_t
+    {
+        insert,
+        erase_left,
+        erase_right,
+        find_left,
+        find_right,
+    };
+
+    enum slot_state_t : int
+    {
+        idle,
+        published,
+        completed,
+    };
+
+    struct alignas(64) slot_t
+    {
+        std::atomic<int> state{idle};
+        operation_t operation;
+        std::optional<Left> left;
+        std::optional<Right> right;
+        bool succeeded;
+        /* Thrown by the operation, rethrown in the thread owning the slot */
+        std::exception_ptr error;
+    };
+
+    static constexpr size_t slots_count = 128;
+
+    /* Hands out the smallest index not used by a running thread, so that indices of exited threads are reused */
+    class thread_indices_t
+    {
+    public:
+        size_t acquire()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            if (released.empty()) {
+                return next++;
+            }
+            std::pop_heap(released.begin(), released.end(), std::greater<>());
+            size_t index = released.back();
+            released.pop_back();
+            return index;
+        }
+
+        void release(size_t index)
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            released.push_back(index);
+            std::push_heap(released.begin(), released.end(), std::greater<>());
+        }
+
+    private:
+        std::mutex mutex;
+        std::vector<size_t> released;
+        size_t next = 0;
+    };
+
+    /* Every thread gets its own process-wide index, used to pick its slot in every combiner */
+    static size_t thread_index()
+    {
+        static thread_indices_t indices;
+        struct holder_t
+        {
+            holder_t()
+                : index(indices.acquire())
+            {
+            }
+
+            ~holder_t()
+            {
+                indices.release(index);
+            }
+
+            size_t index;
+        };
+        thread_local holder_t holder;
+        return holder.index;
+    }
+
+    /* Less comparator which groups operations by the tree they touch first, then orders them by key */
+    bool precedes(slot_t const * a, slot_t const * b) const
+    {
+        bool a_right = (a->operation == operation_t::erase_right || a->operation == operation_t::find_right);
+        bool b_right = (b->operation == operation_t::erase_right || b->operation == operation_t::find_right);
+        if (a_right != b_right) {
+            return b_right;
+        }
+        if (a_right) {
+            return right_compare(*a->right, *b->right);
+        }
+        return left_compare(*a->left, *b->left);
+    }
+
+    void apply(slot_t & slot)
+    {
+        switch (slot.operation) {
+        case operation_t::insert:
+            slot.succeeded = (map.insert(std::move(*slot.left), std::move(*slot.right)) != map.end_left());
+            break;
+        case operation_t::erase_left:
+            slot.succeeded = map.erase_left(*slot.left);
+            break;
+        case operation_t::erase_right:
+            slot.succeeded = map.erase_right(*slot.right);
+            break;
+        case operation_t::find_left: {
+            auto it = map.find_left(*slot.left);
+            slot.succeeded = (it != map.end_left());
+            if (slot.succeeded) {
+                slot.right.emplace(*it.flip());
+            }
+            break;
+        }
+        case operation_t::find_right: {
+            auto it = map.find_right(*slot.right);
+            slot.succeeded = (it != map.end_right());
+            if (slot.succeeded) {
+                slot.left.emplace(*it.flip());
+            }
+            break;
+        }
+        }
+    }
+
+    void collect()
+    {
+        batch.clear();
+        for (slot_t & slot : slots) {
+            if (slot.state.load(std::memory_order_acquire) == published) {
+                batch.push_back(&slot);
+            }
+        }
+    }
+
+    /* Called with combiner_mutex held; what an operation throws is handed to the thread owning its slot */
+    void combine()
+    {
+        collect();
+        try {
+            std::sort(batch.begin(), batch.end(), [this](slot_t const * a, slot_t const * b) {
+                return precedes(a, b);
+            });
+        }
+        catch (...) {
+            /* A throwing comparator may leave the batch no permutation, so it is applied as published */
+            collect();
+        }
+        for (slot_t * slot : batch) {
+            try {
+                apply(*slot);
+            }
+            catch (...) {
+                slot->error = std::current_exception();
+            }
+            slot->state.store(completed, std::memory_order_release);
+        }
+        elements_count.store(map.size(), std::memory_order_relaxed);
+    }
+
+    /* Publishes the operation in the slot of this thread and waits until some combiner has applied it */
+    template <typename Prepare, typename Finish>
+    auto execute(Prepare const & prepare, Finish const & finish)
+    {
+        size_t index = thread_index();
+        if (index >= slots_count) {
+            slot_t slot;
+            prepare(slot);
+            std::lock_guard<std::mutex> lock(combiner_mutex);
+            apply(slot);
+            elements_count.store(map.size(), std::memory_order_relaxed);
+            return finish(slot);
+        }
+        slot_t & slot = slots[index];
+        prepare(slot);
+        slot.state.store(published, std::memory_order_release);
+        for (size_t attempt = 0; slot.state.load(std::memory_order_acquire) != completed; ++attempt) {
+            if (combiner_mutex.try_lock()) {
+                std::lock_guard<std::mutex> lock(combiner_mutex, std::adopt_lock);
+                combine();
+            }
+            else if (attempt % 64 == 63) {
+                std::this_thread::yield();
+            }
+        }
+        std::exception_ptr error = std::move(slot.error);
+        slot.error = nullptr;
+        if (error) {
+            slot.left.reset();
+            slot.right.reset();
+            slot.state.store(idle, std::memory_order_relaxed);
+            std::rethrow_exception(error);
+        }
+        auto result = finish(slot);
+        slot.left.reset();
+        slot.right.reset();
+        slot.state.store(idle, std::memory_order_relaxed);
+        return result;
+    }
+
+    template <typename L, typename R>
+    bool insert_by_values(L && left, R && right)
+    {
+        return execute(
+            [&](slot_t & slot) {
+                slot.operation = operation_t::insert;
+                slot.left.emplace(std::forward<L>(left));
+                slot.right.emplace(std::forward<R>(right));
+            },
+            [](slot_t & slot) {
+                return slot.succeeded;
+            });
+    }
+
+    bimap<Left, Right, LeftComparator, RightComparator> map;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+    std::atomic<size_t> elements_count;
+    std::mutex combiner_mutex;
+    std::vector<slot_t *> batch;
+    slot_t slots[slots_count];
+
+public:
+    explicit flat_combining_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : map(left_compare, right_compare)
+        , left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+        , elements_count(0)
+    {
+        batch.reserve(slots_count);
+    }
+
+    flat_combining_bimap(flat_combining_bimap const &) = delete;
+    flat_combining_bimap & operator=(flat_combining_bimap const &) = delete;
+
+    bool empty() const noexcept
+    {
+        return (size() == 0);
+    }
+
+    /* Size after the latest combined batch */
+    size_t size() const noexcept
+    {
+        return elements_count.load(std::memory_order_relaxed);
+    }
+
+    /* Returns false if either value is already present */
+    bool insert(Left const & left, Right const & right)
+    {
+        return insert_by_values(left, right);
+    }
+
+    bool insert(Left && left, Right && right)
+    {
+        return insert_by_values(std::move(left), std::move(right));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return execute(
+            [&](slot_t & slot) {
+                slot.operation = operation_t::erase_left;
+                slot.left.emplace(key);
+            },
+            [](slot_t & slot) {
+                return slot.succeeded;
+            });
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return execute(
+            [&](slot_t & slot) {
+                slot.operation = operation_t::erase_right;
+                slot.right.emplace(key);
+            },
+            [](slot_t & slot) {
+                return slot.succeeded;
+            });
+    }
+
+    std::optional<Right> find_left(Left const & key)
+    {
+        return execute(
+            [&](slot_t & slot) {
+                slot.operation = operation_t::find_left;
+                slot.left.emplace(key);
+            },
+            [](slot_t & slot) {
+                return (slot.succeeded ? std::move(slot.right) : std::optional<Right>());
+            });
+    }
+
+    std::optional<Left> find_right(Right const & key)
+    {
+        return execute(
+            [&](slot_t & slot) {
+                slot.operation = operation_t::find_right;
+                slot.right.emplace(key);
+            },
+            [](slot_t & slot) {
+                return (slot.succeeded ? std::move(slot.left) : std::optional<Left>());
+            });
+    }
+
+    Right at_left(Left const & key)
+    {
+        std::optional<Right> found = find_left(key);
+        if (!found) {
+            throw std::out_of_range("No matching element.");
+        }
+        return std::move(*found);
+    }
+
+    Left at_right(Right const & key)
+    {
+        std::optional<Left> found = find_right(key);
+        if (!found) {
+            throw std::out_of_range("No matching element.");
+        }
+        return std::move(*found);
+    }
+};
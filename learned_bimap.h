@@ -0,0 +1,416 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>   // std::sort, std::min, std::max
+#include <cstddef>     // size_t
+#include <cstdint>     // uint32_t
+#include <limits>      // std::numeric_limits
+#include <numeric>     // std::iota
+#include <stdexcept>   // std::out_of_range, std::length_error
+#include <type_traits> // std::is_arithmetic, std::is_integral, std::make_unsigned
+#include <utility>     // std::move
+#include <vector>      // std::vector
+
+/*
+ * Immutable bimap of arithmetic values, an alternative to flat_bimap for keys with smooth distributions.
+ * Both sides are sorted arrays linked by 32-bit partner positions. Every side is indexed by a learned model:
+ * piecewise-linear segments, each predicting the position of a key within epsilon, fitted greedily in one pass,
+ * and recursively the same kind of model over the first keys of the segments, until one segment remains.
+ * A lookup evaluates one segment per level and searches 2 * epsilon + 1 positions around each prediction,
+ * so it touches O(levels) cache lines instead of O(log(size)).
+ * Requires ((sizeof(Left) + sizeof(Right) + 2 * sizeof(uint32_t)) * size + segments * sizeof(segment)) bytes memory,
+ * a segment takes 16 or 24 bytes depending on the key size.
+ * Values are ordered numerically, NaN is not supported. Holds at most 2^32 - 1 pairs.
+ */
+
+template <typename Left, typename Right>
+class learned_bimap
+{
+    static_assert(std::is_arithmetic<Left>::value && std::is_arithmetic<Right>::value, "learned_bimap requires arithmetic values");
+
+    using position_t = uint32_t;
+
+    template <typename Key>
+    struct segment_t
+    {
+        Key key;
+        double slope;
+        position_t position;
+    };
+
+    /* Distance from a to b, for a not greater than b, without overflowing the key type */
+    template <typename Key>
+    static double distance(Key a, Key b) noexcept
+    {
+        if constexpr (std::is_integral<Key>::value) {
+            using unsigned_t = std::make_unsigned_t<Key>;
+            return static_cast<double>(static_cast<unsigned_t>(static_cast<unsigned_t>(b) - static_cast<unsigned_t>(a)));
+        }
+        else {
+            return static_cast<double>(b) - static_cast<double>(a);
+        }
+    }
+
+    /* One model level together with the keys it indexes */
+    template <typename Key>
+    class side_t
+    {
+    public:
+        /* Greedily extends every segment while some slope keeps all of its keys within epsilon of their positions */
+        static std::vector<segment_t<Key>> fit(std::vector<Key> const & keys, size_t epsilon)
+        {
+            std::vector<segment_t<Key>> segments;
+            for (size_t start = 0; start < keys.size();) {
+                double lowest = 0;
+                double highest = std::numeric_limits<double>::infinity();
+                size_t end = start + 1;
+                for (; end < keys.size(); ++end) {
+                    double dx = distance(keys[start], keys[end]);
+                    double dy = static_cast<double>(end - start);
+                    if (dy > dx * highest || dy < dx * lowest) {
+                        break;
+                    }
+                    lowest = std::max(lowest, (dy - epsilon) / dx);
+                    highest = std::min(highest, (dy + epsilon) / dx);
+                }
+                double slope = (end - start > 1 ? (lowest + highest) / 2 : 0);
+                segments.push_back(segment_t<Key>{keys[start], slope, static_cast<position_t>(start)});
+                start = end;
+            }
+            return segments;
+        }
+
+        static size_t predict(segment_t<Key> const & segment, Key x, size_t limit) noexcept
+        {
+            if (!(segment.key < x)) {
+                return segment.position;
+            }
+            double predicted = segment.position + segment.slope * distance(segment.key, x);
+            return (predicted < static_cast<double>(limit) ? static_cast<size_t>(predicted) : limit);
+        }
+
+        /*
+         * Returns the first index in [0, count) for which Before doesn't hold, given that Before holds for a prefix.
+         * Searches epsilon positions around the prediction first and widens the window while it misses the answer,
+         * which can only happen because of rounding.
+         */
+        template <typename Before>
+        static size_t partition_point(size_t count, size_t predicted, size_t epsilon, Before const & before)
+        {
+            size_t low = (predicted > epsilon ? predicted - epsilon : 0);
+            size_t high = std::min(count, predicted + epsilon + 1);
+            for (size_t width = epsilon + 1; low > 0 && !before(low - 1); width *= 2) {
+                low = (low > width ? low - width : 0);
+            }
+            for (size_t width = epsilon + 1; high < count && before(high); width *= 2) {
+                high = std::min(count, high + width);
+            }
+            while (low < high) {
+                size_t middle = low + (high - low) / 2;
+                if (before(middle)) {
+                    low = middle + 1;
+                }
+                else {
+                    high = middle;
+                }
+            }
+            return low;
+        }
+
+        void build(std::vector<Key> sorted, size_t epsilon)
+        {
+            keys = std::move(sorted);
+            this->epsilon = epsilon;
+            levels.clear();
+            levels.push_back(fit(keys, epsilon));
+            while (levels.back().size() > 1) {
+                std::vector<Key> first_keys;
+                first_keys.reserve(levels.back().size());
+                for (segment_t<Key> const & segment : levels.back()) {
+                    first_keys.push_back(segment.key);
+                }
+                levels.push_back(fit(first_keys, epsilon));
+            }
+        }
+
+        /* First position whose key is not less than x, or greater than x if Inclusive */
+        template <bool Inclusive>
+        size_t rank(Key x) const noexcept
+        {
+            if (keys.empty()) {
+                return 0;
+            }
+            /* Last segment of every level starting at or before x */
+            size_t segment = 0;
+            for (size_t level = levels.size() - 1; level > 0; --level) {
+                std::vector<segment_t<Key>> const & below = levels[level - 1];
+                size_t predicted = predict(levels[level][segment], x, below.size());
+                size_t following = partition_point(below.size(), predicted, epsilon, [&](size_t index) {
+                    return !(x < below[index].key);
+                });
+                segment = (following > 0 ? following - 1 : 0);
+            }
+            size_t predicted = predict(levels[0][segment], x, keys.size());
+            return partition_point(keys.size(), predicted, epsilon, [&](size_t index) {
+                return (Inclusive ? !(x < keys[index]) : keys[index] < x);
+            });
+        }
+
+        size_t find(Key x) const noexcept
+        {
+            size_t position = rank<false>(x);
+            return (position < keys.size() && keys[position] == x ? position : keys.size());
+        }
+
+        size_t index_bytes() const noexcept
+        {
+            size_t result = 0;
+            for (std::vector<segment_t<Key>> const & level : levels) {
+                result += level.size() * sizeof(segment_t<Key>);
+            }
+            return result;
+        }
+
+        std::vector<Key> keys;
+        std::vector<position_t> partners;
+        std::vector<std::vector<segment_t<Key>>> levels;
+        size_t epsilon = 0;
+    };
+
+    struct left_descriptor_t
+    {
+        static side_t<Left> const & side(learned_bimap const * map) noexcept
+        {
+            return map->left_side;
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static side_t<Right> const & side(learned_bimap const * map) noexcept
+        {
+            return map->right_side;
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class learned_bimap<Left, Right>;
+
+        basic_iterator(learned_bimap const * map, size_t position) noexcept
+            : map(map)
+            , position(position)
+        {
+        }
+
+        learned_bimap const * map;
+        size_t position;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            ++position;
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++position;
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            --position;
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --position;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::side(map).keys[position];
+        }
+
+        auto flip() const noexcept
+        {
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, MainDescriptor::side(map).partners[position]);
+        }
+    };
+
+    template <typename Key, typename Value>
+    static Value const & at_element(side_t<Key> const & first, side_t<Value> const & second, Key key)
+    {
+        size_t position = first.find(key);
+        if (position == first.keys.size()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return second.keys[first.partners[position]];
+    }
+
+    side_t<Left> left_side;
+    side_t<Right> right_side;
+
+public:
+    static constexpr size_t default_epsilon = 32;
+
+    learned_bimap()
+    {
+        left_side.build({}, default_epsilon);
+        right_side.build({}, default_epsilon);
+    }
+
+    /* Copies every pair of the map, requires O(size * log(size)) time; larger epsilon means fewer segments */
+    template <typename LeftComparator, typename RightComparator, typename Storage, typename Observer, typename Eviction>
+    explicit learned_bimap(bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction> const & map, size_t epsilon = default_epsilon)
+    {
+        size_t count = map.size();
+        if (count >= size_t(std::numeric_limits<position_t>::max())) {
+            throw std::length_error("Too many pairs to freeze.");
+        }
+        std::vector<Left> lefts;
+        std::vector<Right> rights;
+        lefts.reserve(count);
+        rights.reserve(count);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            lefts.push_back(*it);
+            rights.push_back(*it.flip());
+        }
+        std::vector<position_t> left_order(count);
+        std::vector<position_t> right_order(count);
+        std::iota(left_order.begin(), left_order.end(), position_t(0));
+        std::iota(right_order.begin(), right_order.end(), position_t(0));
+        std::sort(left_order.begin(), left_order.end(), [&](position_t a, position_t b) {
+            return lefts[a] < lefts[b];
+        });
+        std::sort(right_order.begin(), right_order.end(), [&](position_t a, position_t b) {
+            return rights[a] < rights[b];
+        });
+
+        std::vector<Left> sorted_lefts(count);
+        std::vector<Right> sorted_rights(count);
+        std::vector<position_t> left_positions(count);
+        for (size_t rank = 0; rank < count; ++rank) {
+            sorted_lefts[rank] = lefts[left_order[rank]];
+            sorted_rights[rank] = rights[right_order[rank]];
+            left_positions[left_order[rank]] = static_cast<position_t>(rank);
+        }
+        left_side.partners.resize(count);
+        right_side.partners.resize(count);
+        for (size_t rank = 0; rank < count; ++rank) {
+            position_t left_position = left_positions[right_order[rank]];
+            right_side.partners[rank] = left_position;
+            left_side.partners[left_position] = static_cast<position_t>(rank);
+        }
+        left_side.build(std::move(sorted_lefts), epsilon);
+        right_side.build(std::move(sorted_rights), epsilon);
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, 0);
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, left_side.keys.size());
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, 0);
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, right_side.keys.size());
+    }
+
+    bool empty() const noexcept
+    {
+        return left_side.keys.empty();
+    }
+
+    size_t size() const noexcept
+    {
+        return left_side.keys.size();
+    }
+
+    /* Bytes taken by the segments of both sides, over all levels */
+    size_t index_bytes() const noexcept
+    {
+        return left_side.index_bytes() + right_side.index_bytes();
+    }
+
+    left_iterator find_left(Left const & desired) const noexcept
+    {
+        return left_iterator(this, left_side.find(desired));
+    }
+
+    right_iterator find_right(Right const & desired) const noexcept
+    {
+        return right_iterator(this, right_side.find(desired));
+    }
+
+    left_iterator lower_bound_left(Left const & value) const noexcept
+    {
+        return left_iterator(this, left_side.template rank<false>(value));
+    }
+
+    left_iterator upper_bound_left(Left const & value) const noexcept
+    {
+        return left_iterator(this, left_side.template rank<true>(value));
+    }
+
+    right_iterator lower_bound_right(Right const & value) const noexcept
+    {
+        return right_iterator(this, right_side.template rank<false>(value));
+    }
+
+    right_iterator upper_bound_right(Right const & value) const noexcept
+    {
+        return right_iterator(this, right_side.template rank<true>(value));
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        return at_element(left_side, right_side, key);
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        return at_element(right_side, left_side, key);
+    }
+
+    bool operator==(learned_bimap const & other) const noexcept
+    {
+        return (left_side.keys == other.left_side.keys && right_side.keys == other.right_side.keys && left_side.partners == other.left_side.partners);
+    }
+
+    bool operator!=(learned_bimap const & other) const noexcept
+    {
+        return !(*this == other);
+    }
+};
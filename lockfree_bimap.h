@@ -0,0 +1,692 @@
+#pragma once
+
+#include "epoch_reclaimer.h"
+
+#include <atomic>      // std::atomic
+#include <cstddef>     // size_t
+#include <cstdint>     // uint32_t, uintptr_t
+#include <functional>  // std::less
+#include <memory>      // std::unique_ptr
+#include <stdexcept>   // std::out_of_range
+#include <type_traits> // std::is_same_v
+#include <utility>     // std::forward, std::move
+
+/*
+ * Has lock-free skip list based structure: one skip list orders the pairs by left values, the other one by right values.
+ * Both lists consist of entries pointing to a shared pair node, so that every pair is stored once.
+ * Requires O(log(size)) expected time for inserting, erasing or finding one element, none of which ever blocks.
+ *
+ * A pair claims its left value by linking an entry into the left list while the pair is pending,
+ * then claims its right value by linking an entry into the right list, which makes it live.
+ * Any thread that meets a pending pair helps it to link its right entry, so an insertion never waits for another one.
+ * A pending pair, whose right value is taken by a live pair, becomes dead and its left entry is removed.
+ * Lookups, bounds and iteration only see live pairs.
+ *
+ * Every operation pins an epoch_reclaimer, removed entries and pairs are retired to it instead of deleted.
+ * Iterators keep the reclaimer pinned, so they stay dereferenceable while they exist,
+ * but must not be passed to another thread. Lookups by key return copies.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class lockfree_bimap
+{
+    static constexpr size_t max_height = 24;
+
+    struct node_t
+    {
+        enum state_t : int
+        {
+            pending,
+            live,
+            dead,
+            erased,
+        };
+
+        template <typename L, typename R>
+        explicit node_t(L left_value, R right_value)
+            : left_value(std::forward<L>(left_value))
+            , right_value(std::forward<R>(right_value))
+            , state(pending)
+            , references(1)
+        {
+        }
+
+        Left const left_value;
+        Right const right_value;
+        std::atomic<int> state;
+        /* Entries which point to this pair and are not retired yet */
+        std::atomic<size_t> references;
+    };
+
+    /* One skip list element, links have the lowest bit set once the entry is removed from that level */
+    struct entry_t
+    {
+        entry_t(node_t * pair, size_t height)
+            : pair(pair)
+            , height(height)
+            , next(new std::atomic<uintptr_t>[height])
+            , finished(0)
+        {
+            for (size_t level = 0; level < height; ++level) {
+                next[level].store(0, std::memory_order_relaxed);
+            }
+        }
+
+        node_t * const pair;
+        size_t const height;
+        std::unique_ptr<std::atomic<uintptr_t>[]> const next;
+        /* Entry is retired by the second of its linker and its remover to finish */
+        std::atomic<int> finished;
+    };
+
+    struct left_descriptor_t
+    {
+        static Left const & value(entry_t const * entry) noexcept
+        {
+            return entry->pair->left_value;
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static Right const & value(entry_t const * entry) noexcept
+        {
+            return entry->pair->right_value;
+        }
+    };
+
+    struct list_t
+    {
+        list_t() noexcept
+        {
+            for (std::atomic<uintptr_t> & link : head) {
+                link.store(0, std::memory_order_relaxed);
+            }
+        }
+
+        std::atomic<uintptr_t> head[max_height];
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+        friend class lockfree_bimap;
+
+        basic_iterator(lockfree_bimap const * map, epoch_reclaimer::guard guard, entry_t const * entry) noexcept
+            : map(map)
+            , guard(std::move(guard))
+            , entry(entry)
+        {
+        }
+
+        lockfree_bimap const * map;
+        epoch_reclaimer::guard guard;
+        entry_t const * entry;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (map == other.map && entry == other.entry);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            entry = next_live(pointer(entry->next[0].load(std::memory_order_acquire)));
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::value(entry);
+        }
+
+        /* Looks up the partner entry, so it takes O(log(size)) time */
+        auto flip() const
+        {
+            return map->template find_element<FlipDescriptor, basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>>(FlipDescriptor::value(entry));
+        }
+    };
+
+    static entry_t * pointer(uintptr_t link) noexcept
+    {
+        return reinterpret_cast<entry_t *>(link & ~uintptr_t(1));
+    }
+
+    static bool marked(uintptr_t link) noexcept
+    {
+        return (link & 1) != 0;
+    }
+
+    static uintptr_t link_to(entry_t const * entry) noexcept
+    {
+        return reinterpret_cast<uintptr_t>(entry);
+    }
+
+    static size_t random_height() noexcept
+    {
+        thread_local uint32_t state = static_cast<uint32_t>(reinterpret_cast<uintptr_t>(&state) >> 4) | 1;
+        /* xorshift32 */
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        size_t height = 1;
+        for (uint32_t bits = state; (bits & 1) != 0 && height < max_height; bits >>= 1) {
+            ++height;
+        }
+        return height;
+    }
+
+    static entry_t * next_live(entry_t * entry) noexcept
+    {
+        while (entry != nullptr) {
+            uintptr_t next = entry->next[0].load(std::memory_order_acquire);
+            if (!marked(next) && entry->pair->state.load(std::memory_order_acquire) == node_t::live) {
+                return entry;
+            }
+            entry = pointer(next);
+        }
+        return nullptr;
+    }
+
+    /*
+     * Finds predecessors and successors of x on every level, unlinking removed entries on the way.
+     * Returns true if the bottom level successor is equal to x.
+     */
+    template <typename Descriptor, typename T, typename Comparator>
+    static bool find(list_t & list, T const & x, Comparator const & compare, std::atomic<uintptr_t> ** preds, entry_t ** succs) noexcept
+    {
+        while (!try_find<Descriptor>(list, x, compare, preds, succs)) {
+        }
+        return (succs[0] != nullptr && !compare(x, Descriptor::value(succs[0])));
+    }
+
+    /* Fails if a removed entry could not be unlinked because its predecessor has changed */
+    template <typename Descriptor, typename T, typename Comparator>
+    static bool try_find(list_t & list, T const & x, Comparator const & compare, std::atomic<uintptr_t> ** preds, entry_t ** succs) noexcept
+    {
+        std::atomic<uintptr_t> * pred = list.head;
+        for (size_t level = max_height; level-- > 0;) {
+            entry_t * curr = pointer(pred[level].load(std::memory_order_acquire));
+            while (curr != nullptr) {
+                uintptr_t succ = curr->next[level].load(std::memory_order_acquire);
+                if (marked(succ)) {
+                    uintptr_t expected = link_to(curr);
+                    if (!pred[level].compare_exchange_strong(expected, succ & ~uintptr_t(1), std::memory_order_acq_rel, std::memory_order_acquire)) {
+                        return false;
+                    }
+                    curr = pointer(succ);
+                    continue;
+                }
+                if (!compare(Descriptor::value(curr), x)) {
+                    break;
+                }
+                pred = curr->next.get();
+                curr = pointer(succ);
+            }
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+        return true;
+    }
+
+    /* Finds the first entry not less than x (or greater than x, if strict) without modifying the list */
+    template <typename Descriptor, bool strict, typename T, typename Comparator>
+    static entry_t * bound(list_t const & list, T const & x, Comparator const & compare) noexcept
+    {
+        std::atomic<uintptr_t> const * pred = list.head;
+        entry_t * curr = nullptr;
+        for (size_t level = max_height; level-- > 0;) {
+            curr = pointer(pred[level].load(std::memory_order_acquire));
+            while (curr != nullptr) {
+                uintptr_t succ = curr->next[level].load(std::memory_order_acquire);
+                if (!marked(succ) && (strict ? compare(x, Descriptor::value(curr)) : !compare(Descriptor::value(curr), x))) {
+                    break;
+                }
+                if (!marked(succ)) {
+                    pred = curr->next.get();
+                }
+                curr = pointer(succ);
+            }
+        }
+        return curr;
+    }
+
+    /* Links entry unless an entry with an equal value is present, returns that entry instead */
+    template <typename Descriptor, typename Comparator>
+    entry_t * link(list_t & list, entry_t * entry, Comparator const & compare)
+    {
+        std::atomic<uintptr_t> * preds[max_height];
+        entry_t * succs[max_height];
+        for (;;) {
+            if (find<Descriptor>(list, Descriptor::value(entry), compare, preds, succs)) {
+                return succs[0];
+            }
+            for (size_t level = 0; level < entry->height; ++level) {
+                entry->next[level].store(link_to(succs[level]), std::memory_order_relaxed);
+            }
+            uintptr_t expected = link_to(succs[0]);
+            if (preds[0][0].compare_exchange_strong(expected, link_to(entry), std::memory_order_release, std::memory_order_relaxed)) {
+                break;
+            }
+        }
+        for (size_t level = 1; level < entry->height; ++level) {
+            for (;;) {
+                uintptr_t own = entry->next[level].load(std::memory_order_acquire);
+                if (marked(own)) {
+                    break;
+                }
+                if (own != link_to(succs[level]) && !entry->next[level].compare_exchange_strong(own, link_to(succs[level]), std::memory_order_acq_rel)) {
+                    continue;
+                }
+                uintptr_t expected = link_to(succs[level]);
+                if (preds[level][level].compare_exchange_strong(expected, link_to(entry), std::memory_order_acq_rel)) {
+                    break;
+                }
+                find<Descriptor>(list, Descriptor::value(entry), compare, preds, succs);
+                if (succs[0] != entry) {
+                    break;
+                }
+            }
+            if (marked(entry->next[level].load(std::memory_order_acquire))) {
+                /* Removed while being linked, make sure no level keeps it reachable */
+                find<Descriptor>(list, Descriptor::value(entry), compare, preds, succs);
+                break;
+            }
+        }
+        finish(entry);
+        return nullptr;
+    }
+
+    /* Removes entry from the list, returns false if it was already removed by someone else */
+    template <typename Descriptor, typename Comparator>
+    bool unlink(list_t & list, entry_t * entry, Comparator const & compare)
+    {
+        for (size_t level = entry->height; level-- > 1;) {
+            uintptr_t succ = entry->next[level].load(std::memory_order_acquire);
+            while (!marked(succ) && !entry->next[level].compare_exchange_weak(succ, succ | 1, std::memory_order_acq_rel)) {
+            }
+        }
+        uintptr_t succ = entry->next[0].load(std::memory_order_acquire);
+        do {
+            if (marked(succ)) {
+                return false;
+            }
+        } while (!entry->next[0].compare_exchange_weak(succ, succ | 1, std::memory_order_acq_rel));
+
+        std::atomic<uintptr_t> * preds[max_height];
+        entry_t * succs[max_height];
+        find<Descriptor>(list, Descriptor::value(entry), compare, preds, succs);
+        finish(entry);
+        return true;
+    }
+
+    /* Called once by the linker and once by the remover of a published entry */
+    void finish(entry_t * entry)
+    {
+        if (entry->finished.fetch_add(1, std::memory_order_acq_rel) == 1) {
+            node_t * pair = entry->pair;
+            retire(entry, release(pair) ? pair : nullptr);
+        }
+    }
+
+    /* Returns true if it dropped the last reference */
+    static bool release(node_t * pair) noexcept
+    {
+        return (pair->references.fetch_sub(1, std::memory_order_acq_rel) == 1);
+    }
+
+    /* Fails if the pair is no longer referenced by any entry, which means it is being retired */
+    static bool acquire(node_t * pair) noexcept
+    {
+        size_t references = pair->references.load(std::memory_order_acquire);
+        do {
+            if (references == 0) {
+                return false;
+            }
+        } while (!pair->references.compare_exchange_weak(references, references + 1, std::memory_order_acq_rel));
+        return true;
+    }
+
+    void retire(entry_t * entry, node_t * pair)
+    {
+        if (entry != nullptr) {
+            reclaimer.retire(entry);
+        }
+        if (pair != nullptr) {
+            reclaimer.retire(pair);
+        }
+    }
+
+    /* Frees an entry that was never published */
+    void discard(entry_t * entry)
+    {
+        node_t * pair = entry->pair;
+        delete entry;
+        if (release(pair)) {
+            retire(nullptr, pair);
+        }
+    }
+
+    /* Turns a pending pair into a live or a dead one, linking its right entry if needed */
+    void resolve(node_t * pair)
+    {
+        while (pair->state.load(std::memory_order_acquire) == node_t::pending) {
+            if (!acquire(pair)) {
+                return;
+            }
+            entry_t * entry = new entry_t(pair, random_height());
+            entry_t * existing = link<right_descriptor_t>(right_list, entry, right_compare);
+            if (existing == nullptr) {
+                int expected = node_t::pending;
+                if (pair->state.compare_exchange_strong(expected, node_t::live, std::memory_order_acq_rel)) {
+                    elements_count.fetch_add(1, std::memory_order_relaxed);
+                }
+                else if (expected != node_t::live) {
+                    /* Linked too late for a pair that is already dead or erased */
+                    unlink<right_descriptor_t>(right_list, entry, right_compare);
+                }
+                return;
+            }
+            discard(entry);
+            if (existing->pair == pair) {
+                make_live(pair);
+                return;
+            }
+            node_t * other = existing->pair;
+            make_live(other);
+            if (other->state.load(std::memory_order_acquire) == node_t::live) {
+                int expected = node_t::pending;
+                pair->state.compare_exchange_strong(expected, node_t::dead, std::memory_order_acq_rel);
+                if (expected == node_t::live) {
+                    return;
+                }
+            }
+            else {
+                unlink<right_descriptor_t>(right_list, existing, right_compare);
+            }
+        }
+    }
+
+    /* A pending pair, whose right entry is found in the right list, has already won */
+    void make_live(node_t * pair)
+    {
+        int expected = node_t::pending;
+        if (pair->state.compare_exchange_strong(expected, node_t::live, std::memory_order_acq_rel)) {
+            elements_count.fetch_add(1, std::memory_order_relaxed);
+        }
+    }
+
+    template <typename L, typename R>
+    bool insert_by_values(L && left, R && right)
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        node_t * pair = new node_t(std::forward<L>(left), std::forward<R>(right));
+        entry_t * entry = new entry_t(pair, random_height());
+        for (;;) {
+            entry_t * existing = link<left_descriptor_t>(left_list, entry, left_compare);
+            if (existing == nullptr) {
+                break;
+            }
+            node_t * other = existing->pair;
+            resolve(other);
+            if (other->state.load(std::memory_order_acquire) == node_t::live) {
+                /* Neither the entry nor the pair were ever published */
+                delete entry;
+                delete pair;
+                return false;
+            }
+            unlink<left_descriptor_t>(left_list, existing, left_compare);
+        }
+        resolve(pair);
+        /* The pair may have been erased by someone else right after it became live */
+        if (pair->state.load(std::memory_order_acquire) != node_t::dead) {
+            return true;
+        }
+        unlink<left_descriptor_t>(left_list, entry, left_compare);
+        return false;
+    }
+
+    /* Removes the entry of pair with the given value from the list, if it is still there */
+    template <typename Descriptor, typename T, typename Comparator>
+    void unlink_value(list_t & list, node_t const * pair, T const & x, Comparator const & compare)
+    {
+        std::atomic<uintptr_t> * preds[max_height];
+        entry_t * succs[max_height];
+        while (find<Descriptor>(list, x, compare, preds, succs) && succs[0]->pair == pair) {
+            unlink<Descriptor>(list, succs[0], compare);
+        }
+    }
+
+    template <typename FirstDescriptor, typename SecondDescriptor, typename T, typename FirstComparator, typename SecondComparator>
+    bool erase_element(list_t & first_list, list_t & second_list, T const & key, FirstComparator const & first_compare, SecondComparator const & second_compare)
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        entry_t * entry = bound<FirstDescriptor, false>(first_list, key, first_compare);
+        if (entry == nullptr || first_compare(key, FirstDescriptor::value(entry))) {
+            return false;
+        }
+        /* Only one entry with a value equal to key can be in the list, a pending, dead or erased pair means there is no such element */
+        node_t * pair = entry->pair;
+        int expected = node_t::live;
+        if (!pair->state.compare_exchange_strong(expected, node_t::erased, std::memory_order_acq_rel)) {
+            return false;
+        }
+        elements_count.fetch_sub(1, std::memory_order_relaxed);
+        unlink_value<SecondDescriptor>(second_list, pair, SecondDescriptor::value(entry), second_compare);
+        unlink<FirstDescriptor>(first_list, entry, first_compare);
+        return true;
+    }
+
+    /* Returns the live entry with value equal to desired, must be called with the reclaimer pinned */
+    template <typename Descriptor, typename T>
+    entry_t * find_live(T const & desired) const noexcept
+    {
+        entry_t * entry = bound<Descriptor, false>(list_of<Descriptor>(), desired, compare_of<Descriptor>());
+        if (entry != nullptr && !compare_of<Descriptor>()(desired, Descriptor::value(entry)) && entry->pair->state.load(std::memory_order_acquire) == node_t::live) {
+            return entry;
+        }
+        return nullptr;
+    }
+
+    template <typename Descriptor, typename Iterator, typename T>
+    Iterator find_element(T const & desired) const
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        entry_t * entry = find_live<Descriptor>(desired);
+        return Iterator(this, std::move(guard), entry);
+    }
+
+    template <typename FirstDescriptor, typename SecondDescriptor, typename SecondType, typename T>
+    SecondType at_element(T const & key) const
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        entry_t * entry = find_live<FirstDescriptor>(key);
+        if (entry == nullptr) {
+            throw std::out_of_range("No matching element.");
+        }
+        return SecondDescriptor::value(entry);
+    }
+
+    template <typename Descriptor, bool strict, typename Iterator, typename T>
+    Iterator bound_element(T const & x) const
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        entry_t * entry = next_live(bound<Descriptor, strict>(list_of<Descriptor>(), x, compare_of<Descriptor>()));
+        return Iterator(this, std::move(guard), entry);
+    }
+
+    template <typename Descriptor, typename Iterator>
+    Iterator begin_element() const
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        entry_t * entry = next_live(pointer(list_of<Descriptor>().head[0].load(std::memory_order_acquire)));
+        return Iterator(this, std::move(guard), entry);
+    }
+
+    template <typename Descriptor>
+    list_t const & list_of() const noexcept
+    {
+        if constexpr (std::is_same_v<Descriptor, left_descriptor_t>) {
+            return left_list;
+        }
+        else {
+            return right_list;
+        }
+    }
+
+    template <typename Descriptor>
+    auto const & compare_of() const noexcept
+    {
+        if constexpr (std::is_same_v<Descriptor, left_descriptor_t>) {
+            return left_compare;
+        }
+        else {
+            return right_compare;
+        }
+    }
+
+    void destroy(list_t & list)
+    {
+        entry_t * entry = pointer(list.head[0].load(std::memory_order_relaxed));
+        while (entry != nullptr) {
+            entry_t * next = pointer(entry->next[0].load(std::memory_order_relaxed));
+            node_t * pair = entry->pair;
+            delete entry;
+            if (release(pair)) {
+                delete pair;
+            }
+            entry = next;
+        }
+    }
+
+    list_t left_list;
+    list_t right_list;
+    std::atomic<size_t> elements_count;
+    epoch_reclaimer reclaimer;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+
+public:
+    explicit lockfree_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator()) noexcept
+        : elements_count(0)
+        , left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+    {
+    }
+
+    lockfree_bimap(lockfree_bimap const &) = delete;
+    lockfree_bimap & operator=(lockfree_bimap const &) = delete;
+
+    /* Must not run concurrently with any other operation */
+    ~lockfree_bimap()
+    {
+        destroy(left_list);
+        destroy(right_list);
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    left_iterator begin_left() const
+    {
+        return begin_element<left_descriptor_t, left_iterator>();
+    }
+
+    left_iterator end_left() const
+    {
+        return left_iterator(this, epoch_reclaimer::guard(), nullptr);
+    }
+
+    right_iterator begin_right() const
+    {
+        return begin_element<right_descriptor_t, right_iterator>();
+    }
+
+    right_iterator end_right() const
+    {
+        return right_iterator(this, epoch_reclaimer::guard(), nullptr);
+    }
+
+    bool empty() const noexcept
+    {
+        return (size() == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count.load(std::memory_order_relaxed);
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return find_element<left_descriptor_t, left_iterator>(desired);
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return find_element<right_descriptor_t, right_iterator>(desired);
+    }
+
+    Right at_left(Left const & key) const
+    {
+        return at_element<left_descriptor_t, right_descriptor_t, Right>(key);
+    }
+
+    Left at_right(Right const & key) const
+    {
+        return at_element<right_descriptor_t, left_descriptor_t, Left>(key);
+    }
+
+    /* Returns false if either value is already present */
+    bool insert(Left const & left, Right const & right)
+    {
+        return insert_by_values(left, right);
+    }
+
+    bool insert(Left && left, Right && right)
+    {
+        return insert_by_values(std::move(left), std::move(right));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return erase_element<left_descriptor_t, right_descriptor_t>(left_list, right_list, key, left_compare, right_compare);
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return erase_element<right_descriptor_t, left_descriptor_t>(right_list, left_list, key, right_compare, left_compare);
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        return bound_element<left_descriptor_t, false, left_iterator>(value);
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        return bound_element<left_descriptor_t, true, left_iterator>(value);
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        return bound_element<right_descriptor_t, false, right_iterator>(value);
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        return bound_element<right_descriptor_t, true, right_iterator>(value);
+    }
+};
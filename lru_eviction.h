@@ -0,0 +1,193 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <cstddef>    // size_t
+#include <cstdint>    // uint64_t
+#include <functional> // std::function, std::less
+#include <limits>     // std::numeric_limits
+#include <utility>    // std::move
+
+/*
+ * Eviction policy for bimap, which bounds it by max_size pairs and evicts the least recently used pair.
+ * Every node holds two pointers of an intrusive list, which orders the nodes from the most recently linked
+ * or touched one to the least recently, so linking, touching and unlinking take O(1) time and splaying is untouched.
+ * Inserting beyond max_size evicts the tail of the list from both trees, which requires O(log(size)) time
+ * on average like any erase, and calls the evicted callback, if any, with both values of the pair first.
+ * Counts hits and misses of find_*, at_* and at_*_or_default, and evictions.
+ * Lists link nodes by raw pointers, so the storage policy must keep every node at one address.
+ * A copy of a policy keeps max_size and the callback, but links no nodes and counts from zero.
+ */
+
+template <typename Left, typename Right>
+class lru_eviction
+{
+public:
+    using callback_t = std::function<void(Left const &, Right const &)>;
+
+    struct hook
+    {
+        hook() noexcept
+            : newer(nullptr)
+            , older(nullptr)
+        {
+        }
+
+        hook * newer;
+        hook * older;
+    };
+
+    struct statistics_t
+    {
+        /* Lookups which found their value */
+        uint64_t hits;
+        uint64_t misses;
+        /* Pairs erased for inserting beyond max_size */
+        uint64_t evictions;
+    };
+
+private:
+    mutable hook * newest;
+    mutable hook * oldest;
+    size_t capacity;
+    callback_t callback;
+    mutable statistics_t counters;
+
+    void attach(hook * node) const noexcept
+    {
+        node->newer = nullptr;
+        node->older = newest;
+        if (newest != nullptr) {
+            newest->newer = node;
+        }
+        else {
+            oldest = node;
+        }
+        newest = node;
+    }
+
+    void detach(hook * node) const noexcept
+    {
+        if (node->newer != nullptr) {
+            node->newer->older = node->older;
+        }
+        else {
+            newest = node->older;
+        }
+        if (node->older != nullptr) {
+            node->older->newer = node->newer;
+        }
+        else {
+            oldest = node->newer;
+        }
+    }
+
+public:
+    /* max_size is at least one, so the pair inserted last is never evicted */
+    explicit lru_eviction(size_t max_size = std::numeric_limits<size_t>::max(), callback_t evicted_callback = nullptr)
+        : newest(nullptr)
+        , oldest(nullptr)
+        , capacity(max_size > 0 ? max_size : 1)
+        , callback(std::move(evicted_callback))
+        , counters()
+    {
+    }
+
+    lru_eviction(lru_eviction const & other)
+        : newest(nullptr)
+        , oldest(nullptr)
+        , capacity(other.capacity)
+        , callback(other.callback)
+        , counters()
+    {
+    }
+
+    lru_eviction(lru_eviction && other) noexcept
+        : newest(other.newest)
+        , oldest(other.oldest)
+        , capacity(other.capacity)
+        , callback(std::move(other.callback))
+        , counters(other.counters)
+    {
+        other.newest = nullptr;
+        other.oldest = nullptr;
+    }
+
+    lru_eviction & operator=(lru_eviction && other) noexcept
+    {
+        newest = other.newest;
+        oldest = other.oldest;
+        capacity = other.capacity;
+        callback = std::move(other.callback);
+        counters = other.counters;
+        other.newest = nullptr;
+        other.oldest = nullptr;
+        return *this;
+    }
+
+    template <typename Node>
+    void linked(Node * node) noexcept
+    {
+        attach(node);
+    }
+
+    template <typename Node>
+    void touched(Node * node) const noexcept
+    {
+        ++counters.hits;
+        if (node != newest) {
+            detach(node);
+            attach(node);
+        }
+    }
+
+    void missed() const noexcept
+    {
+        ++counters.misses;
+    }
+
+    template <typename Node>
+    void unlinked(Node * node) noexcept
+    {
+        detach(node);
+    }
+
+    template <typename Node>
+    bool stale(Node const *) const noexcept
+    {
+        return false;
+    }
+
+    template <typename Node>
+    Node * victim(size_t size) const noexcept
+    {
+        return (size > capacity ? static_cast<Node *>(oldest) : nullptr);
+    }
+
+    void evicted(Left const & left, Right const & right)
+    {
+        ++counters.evictions;
+        if (callback) {
+            callback(left, right);
+        }
+    }
+
+    size_t max_size() const noexcept
+    {
+        return capacity;
+    }
+
+    statistics_t const & statistics() const noexcept
+    {
+        return counters;
+    }
+
+    void reset_statistics() noexcept
+    {
+        counters = statistics_t();
+    }
+};
+
+/* Bimap bounded by max_size pairs, constructed as lru_bimap<Left, Right>({}, {}, {}, {}, lru_eviction<Left, Right>(max_size)) */
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+using lru_bimap = bimap<Left, Right, LeftComparator, RightComparator, heap_storage, no_observer, lru_eviction<Left, Right>>;
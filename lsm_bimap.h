@@ -0,0 +1,678 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>          // std::lower_bound, std::max
+#include <atomic>             // std::atomic
+#include <condition_variable> // std::condition_variable
+#include <cstddef>            // size_t
+#include <cstdint>            // uint64_t
+#include <functional>         // std::less
+#include <memory>             // std::shared_ptr, std::make_shared
+#include <mutex>              // std::mutex, std::unique_lock
+#include <optional>           // std::optional
+#include <stdexcept>          // std::out_of_range
+#include <thread>             // std::thread
+#include <utility>            // std::move
+#include <vector>             // std::vector
+
+/*
+ * Write-optimized bimap in the style of a log-structured merge tree, kept in memory.
+ * Inserts go to a memtable, a bimap of the pairs inserted since it was started, next to a bimap of tombstones:
+ * the pairs of older layers erased since. A full memtable is frozen and a background thread flushes it into
+ * an immutable run, which holds the records of both sets twice, sorted by left and sorted by right values,
+ * each with a blocked Bloom filter. The same thread merges a run into the older one next to it while the older one
+ * isn't more than size_ratio times larger, so sizes grow geometrically and there are O(log(size / memtable)) runs;
+ * merging into the oldest run drops the tombstones.
+ * A lookup of one side checks the memtable, the frozen ones, then the runs from newest to oldest, skipping runs whose
+ * filter rejects the value, and stops at the first record of the value: its pair, or a tombstone.
+ *
+ * Uniqueness across sides: a pair is always written or erased on both sides at once, inserting checks that neither
+ * value is live and erasing writes a tombstone of the whole pair, which hides both values. So the newest record of
+ * a left value is live if and only if the newest record of its partner is the same pair, and a lookup of either side
+ * alone is exact. Inserting therefore costs two lookups, which the filters make cheap for new values.
+ * In a memtable a pair is always newer than a tombstone of the same value, as a live value can't be inserted
+ * and a pair of the memtable is erased by removing it, so flushing keeps the pair.
+ *
+ * Requires O(log(memtable)) time for inserting or erasing plus the lookups, O(log(size)) time amortized for flushing
+ * and merging per pair, and O(runs * log(size)) time for a lookup, mostly O(log(size)) with the filters.
+ * Requires about 2 * (sizeof(Left) + sizeof(Right) + 1 + 10 / 8) bytes per record of the runs, whose stale records
+ * are dropped by merging, plus the memtables.
+ * Every call must come from one thread at a time; flushing and merging run in the background thread, so comparators
+ * and bimap_hash must be safe to call concurrently. Inserting stalls while max_frozen memtables wait for flushing.
+ * Values must be copyable, with bimap_hash enabled; there are no iterators.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class lsm_bimap
+{
+    static_assert(bimap_hash<Left>::enabled && bimap_hash<Right>::enabled, "lsm_bimap requires bimap_hash for both value types");
+
+public:
+    static constexpr size_t default_memtable_capacity = size_t(1) << 16;
+    /* Frozen memtables which may wait for flushing before inserting stalls */
+    static constexpr size_t max_frozen = 2;
+    /* A run is merged into the older one while that isn't more than size_ratio times larger */
+    static constexpr size_t size_ratio = 2;
+
+    struct statistics_t
+    {
+        /* Lookups of one value, every insert makes two */
+        uint64_t lookups;
+        /* Runs binary searched by lookups */
+        uint64_t run_probes;
+        /* Runs skipped since their filter rejected the value */
+        uint64_t filtered;
+        /* Freezes which waited for the background thread */
+        uint64_t stalls;
+    };
+
+private:
+    using memtable_map_t = bimap<Left, Right, LeftComparator, RightComparator>;
+
+    struct memtable_t
+    {
+        memtable_t(LeftComparator const & left_compare, RightComparator const & right_compare)
+            : pairs(left_compare, right_compare)
+            , erased(left_compare, right_compare)
+        {
+        }
+
+        memtable_map_t pairs;
+        memtable_map_t erased;
+    };
+
+    struct record_t
+    {
+        Left left;
+        Right right;
+        /* Tombstone of the pair */
+        bool erased;
+    };
+
+    /* Every probe of a key falls into one block of 512 bits, so a lookup touches one cache line */
+    class bloom_filter_t
+    {
+        static constexpr size_t bits_per_key = 10;
+        static constexpr size_t probes = 7;
+        static constexpr size_t block_words = 8;
+
+        static uint64_t mix(uint64_t x) noexcept
+        {
+            x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+            x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+            return x ^ (x >> 31);
+        }
+
+        /* Calls function with the word and the mask of every probe: the block from the hash, then 9 bits of another */
+        template <typename Words, typename Function>
+        static void probe(Words & words, uint64_t hash, Function const & function)
+        {
+            size_t block = static_cast<size_t>(hash % (words.size() / block_words)) * block_words;
+            uint64_t bits = mix(hash);
+            for (size_t i = 0; i < probes; ++i, bits >>= 9) {
+                function(words[block + (bits & 511) / 64], uint64_t(1) << (bits & 63));
+            }
+        }
+
+        std::vector<uint64_t> words;
+
+    public:
+        template <typename T>
+        static uint64_t hash(T const & value)
+        {
+            return mix(bimap_hash<T>::hash(value));
+        }
+
+        explicit bloom_filter_t(size_t keys)
+            : words((keys * bits_per_key / 512 + 1) * block_words)
+        {
+        }
+
+        void add(uint64_t hash) noexcept
+        {
+            probe(words, hash, [](uint64_t & word, uint64_t mask) {
+                word |= mask;
+            });
+        }
+
+        bool may_contain(uint64_t hash) const noexcept
+        {
+            bool found = true;
+            probe(words, hash, [&found](uint64_t const & word, uint64_t mask) {
+                found = found && (word & mask) != 0;
+            });
+            return found;
+        }
+    };
+
+    struct run_t
+    {
+        std::vector<record_t> by_left;
+        std::vector<record_t> by_right;
+        bloom_filter_t left_filter;
+        bloom_filter_t right_filter;
+
+        run_t(std::vector<record_t> by_left, std::vector<record_t> by_right)
+            : by_left(std::move(by_left))
+            , by_right(std::move(by_right))
+            , left_filter(this->by_left.size())
+            , right_filter(this->by_right.size())
+        {
+            for (record_t const & record : this->by_left) {
+                left_filter.add(bloom_filter_t::hash(record.left));
+            }
+            for (record_t const & record : this->by_right) {
+                right_filter.add(bloom_filter_t::hash(record.right));
+            }
+        }
+
+        size_t size() const noexcept
+        {
+            return by_left.size();
+        }
+    };
+
+    /* Immutable state shared with the background thread, both lists from newest to oldest */
+    struct version_t
+    {
+        std::vector<std::shared_ptr<memtable_t const>> frozen;
+        std::vector<std::shared_ptr<run_t const>> runs;
+    };
+
+    struct left_descriptor_t
+    {
+        using key_type = Left;
+        using partner_type = Right;
+
+        static Left const & key(record_t const & record) noexcept
+        {
+            return record.left;
+        }
+
+        static Right const & partner(record_t const & record) noexcept
+        {
+            return record.right;
+        }
+
+        static record_t record(Left const & key, Right const & partner, bool erased)
+        {
+            return record_t{key, partner, erased};
+        }
+
+        static std::vector<record_t> const & records(run_t const & run) noexcept
+        {
+            return run.by_left;
+        }
+
+        static bloom_filter_t const & filter(run_t const & run) noexcept
+        {
+            return run.left_filter;
+        }
+
+        static LeftComparator const & compare(lsm_bimap const * map) noexcept
+        {
+            return map->left_compare;
+        }
+
+        static auto begin(memtable_map_t const & map) noexcept
+        {
+            return map.begin_left();
+        }
+
+        static auto end(memtable_map_t const & map) noexcept
+        {
+            return map.end_left();
+        }
+
+        static auto find(memtable_map_t const & map, Left const & key)
+        {
+            return map.find_left(key);
+        }
+
+        /* Doesn't splay, for memtables the background thread reads too */
+        static auto search(memtable_map_t const & map, Left const & key)
+        {
+            return map.search_left(key);
+        }
+
+        static bool erase(memtable_map_t & map, Left const & key)
+        {
+            return map.erase_left(key);
+        }
+
+        static void insert(memtable_map_t & map, Left const & key, Right const & partner)
+        {
+            map.insert(key, partner);
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        using key_type = Right;
+        using partner_type = Left;
+
+        static Right const & key(record_t const & record) noexcept
+        {
+            return record.right;
+        }
+
+        static Left const & partner(record_t const & record) noexcept
+        {
+            return record.left;
+        }
+
+        static record_t record(Right const & key, Left const & partner, bool erased)
+        {
+            return record_t{partner, key, erased};
+        }
+
+        static std::vector<record_t> const & records(run_t const & run) noexcept
+        {
+            return run.by_right;
+        }
+
+        static bloom_filter_t const & filter(run_t const & run) noexcept
+        {
+            return run.right_filter;
+        }
+
+        static RightComparator const & compare(lsm_bimap const * map) noexcept
+        {
+            return map->right_compare;
+        }
+
+        static auto begin(memtable_map_t const & map) noexcept
+        {
+            return map.begin_right();
+        }
+
+        static auto end(memtable_map_t const & map) noexcept
+        {
+            return map.end_right();
+        }
+
+        static auto find(memtable_map_t const & map, Right const & key)
+        {
+            return map.find_right(key);
+        }
+
+        static auto search(memtable_map_t const & map, Right const & key)
+        {
+            return map.search_right(key);
+        }
+
+        static bool erase(memtable_map_t & map, Right const & key)
+        {
+            return map.erase_right(key);
+        }
+
+        static void insert(memtable_map_t & map, Right const & key, Left const & partner)
+        {
+            map.insert(partner, key);
+        }
+    };
+
+    /* Records of one side of a memtable in its order, a pair hides a tombstone of the same value */
+    template <typename Descriptor>
+    std::vector<record_t> flush_side(memtable_t const & memtable) const
+    {
+        auto const & compare = Descriptor::compare(this);
+        std::vector<record_t> records;
+        records.reserve(memtable.pairs.size() + memtable.erased.size());
+        auto live = Descriptor::begin(memtable.pairs);
+        auto erased = Descriptor::begin(memtable.erased);
+        while (live != Descriptor::end(memtable.pairs) || erased != Descriptor::end(memtable.erased)) {
+            if (erased == Descriptor::end(memtable.erased) || (live != Descriptor::end(memtable.pairs) && !compare(*erased, *live))) {
+                if (erased != Descriptor::end(memtable.erased) && !compare(*live, *erased)) {
+                    ++erased;
+                }
+                records.push_back(Descriptor::record(*live, *live.flip(), false));
+                ++live;
+            }
+            else {
+                records.push_back(Descriptor::record(*erased, *erased.flip(), true));
+                ++erased;
+            }
+        }
+        return records;
+    }
+
+    /* Records of one side of two adjacent runs, the newer record of a value wins; the oldest run needs no tombstones */
+    template <typename Descriptor>
+    std::vector<record_t> merge_side(run_t const & newer, run_t const & older, bool oldest) const
+    {
+        auto const & compare = Descriptor::compare(this);
+        std::vector<record_t> const & first = Descriptor::records(newer);
+        std::vector<record_t> const & second = Descriptor::records(older);
+        std::vector<record_t> records;
+        records.reserve(first.size() + second.size());
+        auto keep = [&records, oldest](record_t const & record) {
+            if (!(oldest && record.erased)) {
+                records.push_back(record);
+            }
+        };
+        auto a = first.begin();
+        auto b = second.begin();
+        while (a != first.end() || b != second.end()) {
+            if (b == second.end() || (a != first.end() && !compare(Descriptor::key(*b), Descriptor::key(*a)))) {
+                if (b != second.end() && !compare(Descriptor::key(*a), Descriptor::key(*b))) {
+                    ++b;
+                }
+                keep(*a++);
+            }
+            else {
+                keep(*b++);
+            }
+        }
+        return records;
+    }
+
+    /* Index of the newest run to merge into the next older one, or runs.size() if none has to be */
+    static size_t compaction_index(version_t const & version) noexcept
+    {
+        for (size_t index = 0; index + 1 < version.runs.size(); ++index) {
+            if (version.runs[index]->size() * size_ratio > version.runs[index + 1]->size()) {
+                return index;
+            }
+        }
+        return version.runs.size();
+    }
+
+    static bool idle(version_t const & version) noexcept
+    {
+        return (version.frozen.empty() && compaction_index(version) == version.runs.size());
+    }
+
+    /* Called with the mutex locked */
+    void publish(std::shared_ptr<version_t const> version)
+    {
+        latest = std::move(version);
+        updated.store(true, std::memory_order_release);
+        changed.notify_all();
+    }
+
+    /* Flushes the oldest frozen memtable, otherwise merges two runs, until stopped */
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [this] {
+                return (stopping || !idle(*latest));
+            });
+            if (stopping) {
+                return;
+            }
+            std::shared_ptr<version_t const> version = latest;
+            lock.unlock();
+            if (!version->frozen.empty()) {
+                memtable_t const & memtable = *version->frozen.back();
+                auto run = std::make_shared<run_t const>(flush_side<left_descriptor_t>(memtable), flush_side<right_descriptor_t>(memtable));
+                lock.lock();
+                /* Only the foreground adds memtables and only at the front, so the oldest one is still last */
+                auto next = std::make_shared<version_t>(*latest);
+                next->frozen.pop_back();
+                next->runs.insert(next->runs.begin(), std::move(run));
+                publish(std::move(next));
+            }
+            else {
+                size_t index = compaction_index(*version);
+                run_t const & newer = *version->runs[index];
+                run_t const & older = *version->runs[index + 1];
+                bool oldest = (index + 2 == version->runs.size());
+                auto run = std::make_shared<run_t const>(merge_side<left_descriptor_t>(newer, older, oldest), merge_side<right_descriptor_t>(newer, older, oldest));
+                lock.lock();
+                /* Only this thread changes runs */
+                auto next = std::make_shared<version_t>(*latest);
+                next->runs.erase(next->runs.begin() + index, next->runs.begin() + index + 2);
+                next->runs.insert(next->runs.begin() + index, std::move(run));
+                publish(std::move(next));
+            }
+        }
+    }
+
+    /* Picks up what the background thread published since the last call */
+    void refresh() const
+    {
+        if (updated.load(std::memory_order_acquire)) {
+            std::unique_lock<std::mutex> lock(mutex);
+            current = latest;
+            updated.store(false, std::memory_order_relaxed);
+        }
+    }
+
+    /* Hands the memtable to the background thread, waits while too many are frozen */
+    void freeze()
+    {
+        auto fresh = std::make_shared<memtable_t>(left_compare, right_compare);
+        std::unique_lock<std::mutex> lock(mutex);
+        auto next = std::make_shared<version_t>(*latest);
+        next->frozen.insert(next->frozen.begin(), std::move(active));
+        active = std::move(fresh);
+        publish(std::move(next));
+        if (latest->frozen.size() > max_frozen) {
+            ++counters.stalls;
+            changed.wait(lock, [this] {
+                return (latest->frozen.size() <= max_frozen);
+            });
+        }
+        current = latest;
+        updated.store(false, std::memory_order_relaxed);
+    }
+
+    void freeze_if_full()
+    {
+        if (active->pairs.size() + active->erased.size() >= memtable_capacity) {
+            freeze();
+        }
+    }
+
+    template <typename Descriptor>
+    record_t const * find_record(run_t const & run, typename Descriptor::key_type const & key, uint64_t hash) const
+    {
+        if (!Descriptor::filter(run).may_contain(hash)) {
+            ++counters.filtered;
+            return nullptr;
+        }
+        ++counters.run_probes;
+        auto const & compare = Descriptor::compare(this);
+        std::vector<record_t> const & records = Descriptor::records(run);
+        auto found = std::lower_bound(records.begin(), records.end(), key, [&compare](record_t const & record, typename Descriptor::key_type const & x) {
+            return compare(Descriptor::key(record), x);
+        });
+        if (found != records.end() && Descriptor::key(*found) == key) {
+            return &*found;
+        }
+        return nullptr;
+    }
+
+    /* Partner of the value if its newest record is a pair, nothing if it is a tombstone or there is none */
+    template <typename Descriptor>
+    std::optional<typename Descriptor::partner_type> lookup(typename Descriptor::key_type const & key) const
+    {
+        refresh();
+        ++counters.lookups;
+        auto live = Descriptor::find(active->pairs, key);
+        if (live != Descriptor::end(active->pairs)) {
+            return *live.flip();
+        }
+        if (Descriptor::find(active->erased, key) != Descriptor::end(active->erased)) {
+            return std::nullopt;
+        }
+        for (auto const & memtable : current->frozen) {
+            auto frozen_live = Descriptor::search(memtable->pairs, key);
+            if (frozen_live != Descriptor::end(memtable->pairs)) {
+                return *frozen_live.flip();
+            }
+            if (Descriptor::search(memtable->erased, key) != Descriptor::end(memtable->erased)) {
+                return std::nullopt;
+            }
+        }
+        uint64_t hash = bloom_filter_t::hash(key);
+        for (auto const & run : current->runs) {
+            record_t const * record = find_record<Descriptor>(*run, key, hash);
+            if (record != nullptr) {
+                if (record->erased) {
+                    return std::nullopt;
+                }
+                return Descriptor::partner(*record);
+            }
+        }
+        return std::nullopt;
+    }
+
+    /* A pair of the memtable is removed, a pair of an older layer gets a tombstone */
+    template <typename Descriptor>
+    bool erase_element(typename Descriptor::key_type const & key)
+    {
+        if (Descriptor::erase(active->pairs, key)) {
+            --elements_count;
+            return true;
+        }
+        auto partner = lookup<Descriptor>(key);
+        if (!partner) {
+            return false;
+        }
+        Descriptor::insert(active->erased, key, *partner);
+        --elements_count;
+        freeze_if_full();
+        return true;
+    }
+
+    template <typename Descriptor, typename T>
+    typename Descriptor::partner_type at_element(T const & key) const
+    {
+        auto partner = lookup<Descriptor>(key);
+        if (!partner) {
+            throw std::out_of_range("No matching element.");
+        }
+        return *partner;
+    }
+
+    LeftComparator left_compare;
+    RightComparator right_compare;
+    size_t memtable_capacity;
+    size_t elements_count;
+    std::shared_ptr<memtable_t> active;
+    mutable statistics_t counters;
+
+    mutable std::mutex mutex;
+    std::condition_variable changed;
+    /* Guarded by the mutex */
+    std::shared_ptr<version_t const> latest;
+    bool stopping;
+    /* The foreground copy of latest and whether it is stale */
+    mutable std::shared_ptr<version_t const> current;
+    mutable std::atomic<bool> updated;
+    std::thread worker;
+
+public:
+    explicit lsm_bimap(size_t memtable_capacity = default_memtable_capacity, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+        , memtable_capacity(std::max<size_t>(memtable_capacity, 1))
+        , elements_count(0)
+        , active(std::make_shared<memtable_t>(this->left_compare, this->right_compare))
+        , counters()
+        , latest(std::make_shared<version_t const>())
+        , stopping(false)
+        , current(latest)
+        , updated(false)
+    {
+        worker = std::thread([this] {
+            work();
+        });
+    }
+
+    lsm_bimap(lsm_bimap const &) = delete;
+    lsm_bimap & operator=(lsm_bimap const &) = delete;
+
+    /* Frozen memtables which weren't flushed yet are dropped with everything else */
+    ~lsm_bimap()
+    {
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stopping = true;
+            changed.notify_all();
+        }
+        worker.join();
+    }
+
+    bool empty() const noexcept
+    {
+        return (elements_count == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count;
+    }
+
+    /* Returns false, changing nothing, if either value is already paired */
+    bool insert(Left const & left, Right const & right)
+    {
+        if (lookup<left_descriptor_t>(left) || lookup<right_descriptor_t>(right)) {
+            return false;
+        }
+        active->pairs.insert(left, right);
+        ++elements_count;
+        freeze_if_full();
+        return true;
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return erase_element<left_descriptor_t>(key);
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return erase_element<right_descriptor_t>(key);
+    }
+
+    std::optional<Right> find_left(Left const & key) const
+    {
+        return lookup<left_descriptor_t>(key);
+    }
+
+    std::optional<Left> find_right(Right const & key) const
+    {
+        return lookup<right_descriptor_t>(key);
+    }
+
+    Right at_left(Left const & key) const
+    {
+        return at_element<left_descriptor_t>(key);
+    }
+
+    Left at_right(Right const & key) const
+    {
+        return at_element<right_descriptor_t>(key);
+    }
+
+    /* Freezes the memtable unless it is empty and waits until it is flushed and no merge is due */
+    void flush()
+    {
+        if (!active->pairs.empty() || !active->erased.empty()) {
+            freeze();
+        }
+        std::unique_lock<std::mutex> lock(mutex);
+        changed.wait(lock, [this] {
+            return idle(*latest);
+        });
+        current = latest;
+        updated.store(false, std::memory_order_relaxed);
+    }
+
+    /* Runs a lookup may search, as of the last call */
+    size_t runs() const
+    {
+        refresh();
+        return current->runs.size();
+    }
+
+    statistics_t const & statistics() const noexcept
+    {
+        return counters;
+    }
+};
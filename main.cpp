@@ -1,7 +1,138 @@
 #include "bimap.h"
+#include "bimap_diff.h"
+#include "btree_bimap.h"
+#include "change_stream.h"
+#include "constexpr_bimap.h"
+#include "epoch_reclaimer.h"
+#include "flat_bimap.h"
+#include "flat_combining_bimap.h"
+#include "learned_bimap.h"
+#include "mapped_bimap.h"
+#include "lockfree_bimap.h"
+#include "lru_eviction.h"
+#include "lsm_bimap.h"
+#include "optimistic_bimap.h"
+#include "paged_bimap.h"
+#include "perfect_hash_bimap.h"
+#include "persistent_bimap.h"
+#include "replicated_bimap.h"
+#include "shared_bimap.h"
+#include "small_bimap.h"
+#include "snapshot.h"
+#include "static_bimap.h"
+#include "ttl_eviction.h"
+#include "wal_bimap.h"
 
 #include "gtest/gtest.h"
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstddef>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <limits>
+#include <list>
+#include <map>
+#include <new>
 #include <random>
+#include <set>
+#include <string_view>
+#include <thread>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Counts every allocation of the test binary, for tests of code which must not
+// allocate. Every form of operator new and delete is replaced, all on top of
+// malloc and free, so that any new matches any delete.
+static std::atomic<size_t> allocations{0};
+
+static void *counted_allocate(size_t size, size_t alignment) noexcept {
+  allocations.fetch_add(1, std::memory_order_relaxed);
+  size = (size > 0 ? size : 1);
+  if (alignment <= alignof(std::max_align_t)) {
+    return std::malloc(size);
+  }
+  return std::aligned_alloc(alignment,
+                            (size + alignment - 1) / alignment * alignment);
+}
+
+static void *counted_allocate_or_throw(size_t size, size_t alignment) {
+  if (void *p = counted_allocate(size, alignment)) {
+    return p;
+  }
+  throw std::bad_alloc();
+}
+
+void *operator new(size_t size) { return counted_allocate_or_throw(size, 0); }
+
+void *operator new[](size_t size) {
+  return counted_allocate_or_throw(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment) {
+  return counted_allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+  return counted_allocate_or_throw(size, static_cast<size_t>(alignment));
+}
+
+void *operator new(size_t size, std::nothrow_t const &) noexcept {
+  return counted_allocate(size, 0);
+}
+
+void *operator new[](size_t size, std::nothrow_t const &) noexcept {
+  return counted_allocate(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment,
+                   std::nothrow_t const &) noexcept {
+  return counted_allocate(size, static_cast<size_t>(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment,
+                     std::nothrow_t const &) noexcept {
+  return counted_allocate(size, static_cast<size_t>(alignment));
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+
+void operator delete[](void *p) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, size_t) noexcept { std::free(p); }
+
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::align_val_t) noexcept { std::free(p); }
+
+void operator delete(void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::nothrow_t const &) noexcept { std::free(p); }
+
+void operator delete[](void *p, std::nothrow_t const &) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t,
+                     std::nothrow_t const &) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, std::align_val_t,
+                       std::nothrow_t const &) noexcept {
+  std::free(p);
+}
 
 struct test_object {
   int a = 0;
@@ -103,6 +234,64 @@ TEST(bimap, copies) {
   EXPECT_NE(b.find_right(-10), b.end_right());
 }
 
+TEST(bimap, copies_balanced) {
+  /* Sorted inserts leave both trees a path, which must neither survive copying nor overflow the stack */
+  bimap<int, int> path;
+  for (int i = 0; i < 200000; i++) {
+    path.insert(i, -i);
+  }
+  bimap<int, int> copy(path);
+  ASSERT_EQ(copy.size(), path.size());
+  for (int i : {0, 77777, 199999}) {
+    size_t left_depth = 0, right_depth = 0;
+    EXPECT_EQ(*copy.search_left(i, &left_depth).flip(), -i);
+    EXPECT_EQ(*copy.search_right(-i, &right_depth).flip(), i);
+    EXPECT_LE(left_depth, 18);
+    EXPECT_LE(right_depth, 18);
+  }
+  EXPECT_EQ(*(--copy.end_right()).flip(), 0);
+}
+
+TEST(bimap, fingerprint) {
+  bimap<int, std::string> a, b;
+  EXPECT_EQ(a.fingerprint(), 0);
+  for (int i = 0; i < 100; i++) {
+    a.insert(i, std::to_string(i));
+    b.insert(99 - i, std::to_string(99 - i));
+  }
+  EXPECT_EQ(a.fingerprint(), b.fingerprint());
+  EXPECT_TRUE(a == b);
+
+  /* Same left values and the same right values, but other partners */
+  b.erase_left(1);
+  b.erase_left(2);
+  b.insert(1, "2");
+  b.insert(2, "1");
+  EXPECT_NE(a.fingerprint(), b.fingerprint());
+  EXPECT_FALSE(a == b);
+  b.erase_right("2");
+  b.erase_right("1");
+  b.insert(2, "2");
+  b.at_left_or_default(1);
+  EXPECT_FALSE(a == b);
+  b.erase_left(1);
+  b.insert(1, "1");
+  EXPECT_TRUE(a == b);
+
+  bimap<int, std::string> copy(a);
+  EXPECT_EQ(copy.fingerprint(), a.fingerprint());
+  bimap<int, std::string> moved(std::move(copy));
+  EXPECT_EQ(moved.fingerprint(), a.fingerprint());
+  EXPECT_EQ(copy.fingerprint(), 0);
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.fingerprint").string();
+  a.save(path);
+  EXPECT_EQ((bimap<int, std::string>::load(path).fingerprint()), a.fingerprint());
+  std::filesystem::remove(path);
+  moved.erase_left(moved.begin_left(), moved.end_left());
+  EXPECT_EQ(moved.fingerprint(), 0);
+}
+
 TEST(bimap, insert) {
   bimap<int, int> b;
   b.insert(4, 10);
@@ -273,6 +462,23 @@ TEST(bimap, upper_bound) {
   EXPECT_EQ(b.upper_bound_left(400), b.end_left());
 }
 
+TEST(bimap, decrement) {
+  bimap<int, std::string> b;
+  EXPECT_EQ(--b.end_left(), b.end_left());
+  b.insert(2, "b");
+  b.insert(1, "c");
+  b.insert(3, "a");
+  auto left = b.end_left();
+  EXPECT_EQ(*--left, 3);
+  EXPECT_EQ(*--left, 2);
+  EXPECT_EQ(*--left, 1);
+  auto right = b.end_right();
+  EXPECT_EQ(*--right, "c");
+  EXPECT_EQ(*--right, "b");
+  EXPECT_EQ(*--right, "a");
+  EXPECT_EQ(right, b.begin_right());
+}
+
 template <typename T>
 std::vector<std::pair<T, T>>
 eliminate_same(std::vector<T> &lefts, std::vector<T> &rights, std::mt19937 &e) {
@@ -416,3 +622,2844 @@ TEST(bimap_randomized, compare_to_two_maps) {
   std::cout << "Performed " << ins << " insertions and " << total - ins - skip
             << " erasures. " << skip << " skipped." << std::endl;
 }
+
+TEST(optimistic_bimap, simple) {
+  optimistic_bimap<int, int> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(4, 10));
+  EXPECT_TRUE(b.insert(10, 4));
+  EXPECT_FALSE(b.insert(4, 42));
+  EXPECT_FALSE(b.insert(42, 10));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(4), 10);
+  EXPECT_EQ(b.at_right(4), 10);
+  EXPECT_EQ(*b.find_right(10), 4);
+  EXPECT_FALSE(b.find_left(5).has_value());
+  EXPECT_THROW(b.at_right(300), std::out_of_range);
+
+  EXPECT_EQ(b.lower_bound_left(5)->first, 10);
+  EXPECT_EQ(b.lower_bound_left(4)->second, 10);
+  EXPECT_EQ(b.upper_bound_left(4)->first, 10);
+  EXPECT_FALSE(b.upper_bound_right(10).has_value());
+  EXPECT_EQ(b.lower_bound_right(-1)->second, 10);
+
+  EXPECT_TRUE(b.erase_left(4));
+  EXPECT_FALSE(b.erase_left(4));
+  EXPECT_FALSE(b.find_right(10).has_value());
+  EXPECT_TRUE(b.erase_right(4));
+  EXPECT_TRUE(b.empty());
+}
+
+TEST(optimistic_bimap, compare_to_two_maps) {
+  optimistic_bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    int l = e() % 1000, r = e() % 1000;
+    if (e() % 3 != 0) {
+      bool inserted = b.insert(l, r);
+      EXPECT_EQ(inserted, left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (left_view.count(l) != 0) {
+      EXPECT_TRUE(b.erase_left(l));
+      right_view.erase(left_view[l]);
+      left_view.erase(l);
+    } else {
+      EXPECT_FALSE(b.erase_left(l));
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+  for (int k = -1; k <= 1000; k++) {
+    auto it = left_view.lower_bound(k);
+    auto found = b.lower_bound_left(k);
+    EXPECT_EQ(found.has_value(), it != left_view.end());
+    if (found) {
+      EXPECT_EQ(found->first, it->first);
+      EXPECT_EQ(found->second, it->second);
+    }
+    auto rit = right_view.upper_bound(k);
+    auto rfound = b.upper_bound_right(k);
+    EXPECT_EQ(rfound.has_value(), rit != right_view.end());
+    if (rfound) {
+      EXPECT_EQ(rfound->first, rit->first);
+    }
+  }
+}
+
+TEST(optimistic_bimap, readers_during_writes) {
+  // Pairs are always (k, -k): readers must never observe anything else.
+  optimistic_bimap<int, int> b;
+  for (int k = 0; k < 1000; k += 2) {
+    b.insert(k, -k);
+  }
+  std::atomic<bool> stop(false);
+  std::atomic<size_t> mismatches(0);
+  std::vector<std::thread> readers;
+  for (int t = 0; t < 4; t++) {
+    readers.emplace_back([&, t] {
+      std::mt19937 e(t);
+      while (!stop) {
+        int k = e() % 1000;
+        auto right = b.find_left(k);
+        if (right && *right != -k) {
+          mismatches++;
+        }
+        auto left = b.find_right(-k);
+        if (left && *left != k) {
+          mismatches++;
+        }
+        auto bound = b.lower_bound_left(k);
+        if (bound && (bound->first < k || bound->second != -bound->first)) {
+          mismatches++;
+        }
+      }
+    });
+  }
+  std::mt19937 e(seed);
+  for (int i = 0; i < 50000; i++) {
+    int k = e() % 1000;
+    if (!b.erase_left(k)) {
+      b.insert(k, -k);
+    }
+  }
+  stop = true;
+  for (auto &t : readers) {
+    t.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+  for (int k = 0; k < 1000; k++) {
+    auto right = b.find_left(k);
+    EXPECT_TRUE(!right || *right == -k);
+  }
+}
+
+TEST(lockfree_bimap, simple) {
+  lockfree_bimap<int, int> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(4, 10));
+  EXPECT_TRUE(b.insert(10, 4));
+  EXPECT_FALSE(b.insert(4, 42));
+  EXPECT_FALSE(b.insert(42, 10));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(4), 10);
+  EXPECT_EQ(b.at_right(4), 10);
+  EXPECT_EQ(*b.find_right(10).flip(), 4);
+  EXPECT_EQ(b.find_left(5), b.end_left());
+  EXPECT_THROW(b.at_right(300), std::out_of_range);
+
+  EXPECT_EQ(*b.lower_bound_left(5), 10);
+  EXPECT_EQ(*b.upper_bound_left(4), 10);
+  EXPECT_EQ(b.upper_bound_right(10), b.end_right());
+  EXPECT_EQ(*b.lower_bound_right(-1).flip(), 10);
+
+  EXPECT_TRUE(b.erase_left(4));
+  EXPECT_FALSE(b.erase_left(4));
+  EXPECT_EQ(b.find_right(10), b.end_right());
+  EXPECT_TRUE(b.insert(4, 10));
+  EXPECT_TRUE(b.erase_right(4));
+  EXPECT_EQ(b.size(), 1);
+}
+
+TEST(lockfree_bimap, compare_to_two_maps) {
+  lockfree_bimap<int, int> b;
+  std::map<int, int> left_view, right_view;
+
+  std::mt19937 e(seed);
+  for (size_t i = 0; i < 20000; i++) {
+    int l = e() % 1000, r = e() % 1000;
+    if (e() % 3 != 0) {
+      bool inserted = b.insert(l, r);
+      EXPECT_EQ(inserted, left_view.count(l) == 0 && right_view.count(r) == 0);
+      if (inserted) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (left_view.count(l) != 0) {
+      EXPECT_TRUE(b.erase_left(l));
+      right_view.erase(left_view[l]);
+      left_view.erase(l);
+    } else {
+      EXPECT_FALSE(b.erase_left(l));
+    }
+  }
+  EXPECT_EQ(b.size(), left_view.size());
+  auto lit = b.begin_left();
+  for (auto const &p : left_view) {
+    ASSERT_NE(lit, b.end_left());
+    EXPECT_EQ(*lit, p.first);
+    EXPECT_EQ(*lit.flip(), p.second);
+    ++lit;
+  }
+  EXPECT_EQ(lit, b.end_left());
+  auto rit = b.begin_right();
+  for (auto const &p : right_view) {
+    ASSERT_NE(rit, b.end_right());
+    EXPECT_EQ(*rit, p.first);
+    ++rit;
+  }
+}
+
+TEST(lockfree_bimap, concurrent_uniqueness) {
+  // Every thread tries to claim every left value with its own right values,
+  // and every right value with its own left values: exactly one claim wins.
+  lockfree_bimap<int, int> b;
+  int const keys = 2000, threads = 4;
+  std::vector<std::vector<int>> won(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      for (int k = 0; k < keys; k++) {
+        if (b.insert(k, (k + t * 7) % keys)) {
+          won[t].push_back(k);
+        }
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  size_t total = 0;
+  std::vector<int> owners(keys, 0);
+  for (auto const &keys_won : won) {
+    total += keys_won.size();
+    for (int k : keys_won) {
+      owners[k]++;
+    }
+  }
+  EXPECT_EQ(total, b.size());
+  for (int k = 0; k < keys; k++) {
+    EXPECT_LE(owners[k], 1);
+  }
+  std::set<int> rights;
+  size_t count = 0;
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++count) {
+    int right = *it.flip();
+    EXPECT_TRUE(rights.insert(right).second);
+    EXPECT_EQ(b.at_right(right), *it);
+  }
+  EXPECT_EQ(count, b.size());
+}
+
+TEST(lockfree_bimap, linearizable_stress) {
+  // Each thread owns a disjoint set of left values and records the outcome of
+  // its own operations; right values are shared, so inserts race on them. At
+  // the end, the per-key history must explain the final contents exactly.
+  lockfree_bimap<int, int> b;
+  int const threads = 4, per_thread = 200, rights = 300;
+  std::vector<std::map<int, int>> expected(threads);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      std::mt19937 e(seed + t);
+      auto &mine = expected[t];
+      for (int i = 0; i < 20000; i++) {
+        int left = t * per_thread + static_cast<int>(e() % per_thread);
+        if (e() % 2 == 0) {
+          int right = e() % rights;
+          bool inserted = b.insert(left, right);
+          if (mine.count(left) != 0) {
+            EXPECT_FALSE(inserted);
+          } else if (inserted) {
+            mine[left] = right;
+          }
+        } else {
+          EXPECT_EQ(b.erase_left(left), mine.erase(left) == 1);
+        }
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  std::map<int, int> all;
+  for (auto const &mine : expected) {
+    all.insert(mine.begin(), mine.end());
+  }
+  EXPECT_EQ(b.size(), all.size());
+  std::set<int> seen_rights;
+  for (auto const &p : all) {
+    EXPECT_EQ(b.at_left(p.first), p.second);
+    EXPECT_EQ(b.at_right(p.second), p.first);
+    EXPECT_TRUE(seen_rights.insert(p.second).second);
+  }
+}
+
+struct counted_object {
+  explicit counted_object(std::atomic<int> &alive) : alive(alive) { alive++; }
+  ~counted_object() { alive--; }
+  std::atomic<int> &alive;
+};
+
+TEST(epoch_reclaimer, frees_after_guards_leave) {
+  std::atomic<int> alive(0);
+  epoch_reclaimer reclaimer;
+  {
+    auto guard = reclaimer.pin();
+    reclaimer.retire(new counted_object(alive));
+    for (int i = 0; i < 10; i++) {
+      reclaimer.collect();
+    }
+    // The retiring thread itself is still pinned.
+    EXPECT_EQ(alive, 1);
+    EXPECT_EQ(reclaimer.pending(), 1);
+  }
+  for (int i = 0; i < 10; i++) {
+    reclaimer.collect();
+  }
+  EXPECT_EQ(alive, 0);
+  EXPECT_EQ(reclaimer.pending(), 0);
+}
+
+TEST(epoch_reclaimer, pinned_reader_blocks_reclamation) {
+  std::atomic<int> alive(0);
+  epoch_reclaimer reclaimer;
+  std::atomic<bool> pinned(false), release(false);
+  std::thread reader([&] {
+    auto guard = reclaimer.pin();
+    auto nested = guard;
+    pinned = true;
+    while (!release) {
+      std::this_thread::yield();
+    }
+  });
+  while (!pinned) {
+    std::this_thread::yield();
+  }
+  for (int i = 0; i < 1000; i++) {
+    reclaimer.retire(new counted_object(alive));
+  }
+  for (int i = 0; i < 10; i++) {
+    reclaimer.collect();
+  }
+  EXPECT_EQ(alive, 1000);
+  release = true;
+  reader.join();
+  for (int i = 0; i < 10; i++) {
+    reclaimer.collect();
+  }
+  EXPECT_EQ(alive, 0);
+}
+
+TEST(epoch_reclaimer, destructor_frees_everything) {
+  std::atomic<int> alive(0);
+  {
+    epoch_reclaimer reclaimer;
+    std::thread other([&] {
+      auto guard = reclaimer.pin();
+      for (int i = 0; i < 10; i++) {
+        reclaimer.retire(new counted_object(alive));
+      }
+    });
+    other.join();
+    auto guard = reclaimer.pin();
+    reclaimer.retire(new counted_object(alive));
+  }
+  EXPECT_EQ(alive, 0);
+}
+
+TEST(flat_combining_bimap, simple) {
+  flat_combining_bimap<int, int> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(4, 10));
+  EXPECT_TRUE(b.insert(10, 4));
+  EXPECT_FALSE(b.insert(4, 42));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(4), 10);
+  EXPECT_EQ(*b.find_right(4), 10);
+  EXPECT_FALSE(b.find_left(5).has_value());
+  EXPECT_THROW(b.at_right(300), std::out_of_range);
+  EXPECT_TRUE(b.erase_right(10));
+  EXPECT_FALSE(b.erase_left(4));
+  EXPECT_EQ(b.size(), 1);
+}
+
+TEST(flat_combining_bimap, concurrent_operations) {
+  // Each thread owns a disjoint range of keys, so the outcome of every
+  // operation is known in advance even though batches mix threads.
+  flat_combining_bimap<int, int> b;
+  int const threads = 8, per_thread = 500;
+  std::atomic<size_t> mismatches(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      int base = t * per_thread;
+      for (int k = base; k < base + per_thread; k++) {
+        mismatches += !b.insert(k, -k);
+      }
+      for (int k = base; k < base + per_thread; k++) {
+        mismatches += (b.find_left(k) != -k);
+        mismatches += (b.find_right(-k) != k);
+      }
+      for (int k = base; k < base + per_thread; k += 2) {
+        mismatches += !b.erase_left(k);
+      }
+      for (int k = base; k < base + per_thread; k++) {
+        mismatches += (b.find_left(k).has_value() != (k % 2 != 0));
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+  EXPECT_EQ(b.size(), threads * per_thread / 2);
+}
+
+// Throws when it meets -1, to check that exceptions reach the right thread.
+struct picky_less {
+  bool operator()(int a, int b) const {
+    if (a == -1 || b == -1) {
+      throw std::invalid_argument("Can't compare -1.");
+    }
+    return a < b;
+  }
+};
+
+TEST(flat_combining_bimap, exceptions_reach_their_thread) {
+  // Whichever thread combines, an operation which throws must fail in the
+  // thread which published it, exactly once, and nowhere else.
+  flat_combining_bimap<int, int, std::less<>, picky_less> b;
+  int const threads = 8, per_thread = 500;
+  std::atomic<size_t> mismatches(0), thrown(0), misplaced(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      int base = t * per_thread;
+      for (int k = base; k < base + per_thread; k++) {
+        try {
+          mismatches += !b.insert(k, k);
+        } catch (...) {
+          misplaced++;
+        }
+        if (k % 10 == 0) {
+          try {
+            b.insert(k + 1000000, -1);
+            mismatches++;
+          } catch (std::invalid_argument const &) {
+            thrown++;
+          }
+          try {
+            b.erase_right(-1);
+            mismatches++;
+          } catch (std::invalid_argument const &) {
+            thrown++;
+          }
+        }
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+  EXPECT_EQ(misplaced, 0);
+  EXPECT_EQ(thrown, threads * per_thread / 10 * 2);
+  EXPECT_EQ(b.size(), threads * per_thread);
+  EXPECT_FALSE(b.find_left(1000000).has_value());
+}
+
+TEST(replicated_bimap, simple) {
+  // A log of four entries wraps around many times, so updates have to bring
+  // the replicas that no thread reads from up to date themselves.
+  replicated_bimap<int, int> b(3, 4);
+  EXPECT_EQ(b.replicas_size(), 3);
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(4, 10));
+  EXPECT_TRUE(b.insert(10, 4));
+  EXPECT_FALSE(b.insert(4, 42));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(4), 10);
+  EXPECT_EQ(*b.find_right(4), 10);
+  EXPECT_FALSE(b.find_left(5).has_value());
+  EXPECT_THROW(b.at_right(300), std::out_of_range);
+  EXPECT_TRUE(b.erase_right(10));
+  EXPECT_FALSE(b.erase_left(4));
+  for (int i = 0; i < 100; i++) {
+    EXPECT_TRUE(b.insert(i + 100, i + 100));
+  }
+  EXPECT_EQ(b.size(), 101);
+  EXPECT_THROW((replicated_bimap<int, int>(2, 6)), std::invalid_argument);
+}
+
+TEST(replicated_bimap, concurrent_operations) {
+  replicated_bimap<int, int> b(4, 64);
+  int const threads = 8, per_thread = 500;
+  std::atomic<size_t> mismatches(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&, t] {
+      int base = t * per_thread;
+      for (int k = base; k < base + per_thread; k++) {
+        mismatches += !b.insert(k, -k);
+      }
+      for (int k = base; k < base + per_thread; k++) {
+        mismatches += (b.find_left(k) != -k);
+        mismatches += (b.find_right(-k) != k);
+      }
+      for (int k = base; k < base + per_thread; k += 2) {
+        mismatches += !b.erase_left(k);
+      }
+      for (int k = base; k < base + per_thread; k++) {
+        mismatches += (b.find_left(k).has_value() != (k % 2 != 0));
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(mismatches, 0);
+  EXPECT_EQ(b.size(), threads * per_thread / 2);
+}
+
+TEST(replicated_bimap, contended_inserts) {
+  // Every thread tries to insert the same pairs, exactly one must win each.
+  replicated_bimap<int, int> b(2, 32);
+  int const threads = 4, n = 1000;
+  std::atomic<int> won(0);
+  std::vector<std::thread> workers;
+  for (int t = 0; t < threads; t++) {
+    workers.emplace_back([&] {
+      for (int k = 0; k < n; k++) {
+        won += b.insert(k, k + 1);
+      }
+    });
+  }
+  for (auto &w : workers) {
+    w.join();
+  }
+  EXPECT_EQ(won, n);
+  EXPECT_EQ(b.size(), n);
+}
+
+TEST(flat_bimap, simple) {
+  bimap<int, int> b;
+  b.insert(4, 10);
+  b.insert(10, 4);
+  b.insert(7, 1);
+  flat_bimap<int, int> f = b.freeze();
+  EXPECT_EQ(f.size(), 3);
+  EXPECT_EQ(f.at_left(4), 10);
+  EXPECT_EQ(f.at_right(1), 7);
+  EXPECT_THROW(f.at_left(5), std::out_of_range);
+  EXPECT_EQ(*f.find_right(4).flip(), 10);
+  EXPECT_EQ(f.find_left(5), f.end_left());
+  EXPECT_EQ(*f.lower_bound_left(5), 7);
+  EXPECT_EQ(*f.upper_bound_right(4), 10);
+  EXPECT_EQ(f.upper_bound_left(10), f.end_left());
+  EXPECT_EQ(*--f.end_left(), 10);
+  EXPECT_EQ(*--f.end_right(), 10);
+  EXPECT_EQ(--f.begin_left(), f.end_left());
+
+  bimap<int, int> thawed = f.thaw();
+  EXPECT_EQ(thawed, b);
+  EXPECT_TRUE(thawed.insert(5, 5) != thawed.end_left());
+  EXPECT_EQ(f.size(), 3);
+
+  bimap<int, int> sorted;
+  for (int i = 0; i < 200000; i++) {
+    sorted.insert(i, -i);
+  }
+  bimap<int, int> balanced = sorted.freeze().thaw();
+  ASSERT_EQ(balanced.size(), sorted.size());
+  for (int i : {0, 77777, 199999}) {
+    size_t left_depth = 0, right_depth = 0;
+    EXPECT_EQ(*balanced.search_left(i, &left_depth).flip(), -i);
+    EXPECT_EQ(*balanced.search_right(-i, &right_depth).flip(), i);
+    EXPECT_LE(left_depth, 18);
+    EXPECT_LE(right_depth, 18);
+  }
+
+  flat_bimap<int, int> empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.begin_left(), empty.end_left());
+  EXPECT_EQ((bimap<int, int>().freeze()), empty);
+}
+
+TEST(flat_bimap, compare_to_bimap) {
+  // Sizes around powers of two cover complete and partial last levels of
+  // the implicit tree.
+  std::mt19937 e(seed);
+  for (size_t n : {1, 2, 3, 7, 8, 9, 100, 1023, 1024, 1025, 5000}) {
+    bimap<int, int> b;
+    while (b.size() < n) {
+      b.insert(e() % (4 * n), e() % (4 * n));
+    }
+    flat_bimap<int, int> f = b.freeze();
+    ASSERT_EQ(f.size(), n);
+
+    auto fit = f.begin_left();
+    for (auto it = b.begin_left(); it != b.end_left(); ++it, ++fit) {
+      ASSERT_NE(fit, f.end_left());
+      EXPECT_EQ(*fit, *it);
+      EXPECT_EQ(*fit.flip(), *it.flip());
+      EXPECT_EQ(*fit.flip().flip(), *it);
+    }
+    EXPECT_EQ(fit, f.end_left());
+    auto rit = f.end_right();
+    for (auto it = b.begin_right(); it != b.end_right(); ++it) {
+      EXPECT_EQ(*it, f.at_left(*it.flip()));
+    }
+    for (size_t i = 0; i < n; i++) {
+      --rit;
+    }
+    EXPECT_EQ(rit, f.begin_right());
+
+    for (int x = -1; x <= static_cast<int>(4 * n); x++) {
+      auto lower = b.lower_bound_left(x);
+      auto flat_lower = f.lower_bound_left(x);
+      ASSERT_EQ(lower == b.end_left(), flat_lower == f.end_left());
+      if (lower != b.end_left()) {
+        EXPECT_EQ(*flat_lower, *lower);
+      }
+      auto upper = b.upper_bound_right(x);
+      auto flat_upper = f.upper_bound_right(x);
+      ASSERT_EQ(upper == b.end_right(), flat_upper == f.end_right());
+      if (upper != b.end_right()) {
+        EXPECT_EQ(*flat_upper, *upper);
+      }
+      EXPECT_EQ(b.find_left(x) == b.end_left(), f.find_left(x) == f.end_left());
+    }
+  }
+}
+
+TEST(learned_bimap, simple) {
+  bimap<int, double> b;
+  b.insert(4, 1.5);
+  b.insert(10, -2);
+  b.insert(-7, 0.25);
+  learned_bimap<int, double> l(b);
+  EXPECT_EQ(l.size(), 3);
+  EXPECT_EQ(l.at_left(4), 1.5);
+  EXPECT_EQ(l.at_right(-2), 10);
+  EXPECT_THROW(l.at_left(5), std::out_of_range);
+  EXPECT_EQ(*l.find_right(0.25).flip(), -7);
+  EXPECT_EQ(l.find_left(5), l.end_left());
+  EXPECT_EQ(*l.lower_bound_left(5), 10);
+  EXPECT_EQ(*l.upper_bound_right(0.25), 1.5);
+  EXPECT_EQ(l.upper_bound_left(10), l.end_left());
+  EXPECT_EQ(*--l.end_right(), 1.5);
+  EXPECT_EQ(*l.begin_left(), -7);
+
+  learned_bimap<int, double> empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.begin_left(), empty.end_left());
+  EXPECT_EQ(empty.lower_bound_right(1), empty.end_right());
+  EXPECT_EQ((learned_bimap<int, double>(bimap<int, double>())), empty);
+}
+
+TEST(learned_bimap, compare_to_bimap) {
+  // Clustered keys with large gaps and extreme values need many segments and
+  // several model levels; epsilon 1 makes every prediction tight.
+  std::mt19937_64 e(seed);
+  for (size_t epsilon : {1, 4, 32}) {
+    for (size_t n : {1, 2, 100, 5000, 100000}) {
+      bimap<int64_t, uint64_t> b;
+      b.insert(std::numeric_limits<int64_t>::min(), 0);
+      b.insert(std::numeric_limits<int64_t>::max(), ~uint64_t(0));
+      while (b.size() < n + 2) {
+        int64_t cluster = static_cast<int64_t>(e() % 16) << 40;
+        b.insert(cluster + static_cast<int64_t>(e() % (8 * n)), e() % (64 * n));
+      }
+      learned_bimap<int64_t, uint64_t> l(b, epsilon);
+      ASSERT_EQ(l.size(), b.size());
+
+      auto lit = l.begin_left();
+      for (auto it = b.begin_left(); it != b.end_left(); ++it, ++lit) {
+        ASSERT_EQ(*lit, *it);
+        ASSERT_EQ(*lit.flip(), *it.flip());
+        ASSERT_EQ(*lit.flip().flip(), *it);
+        ASSERT_EQ(l.at_left(*it), *it.flip());
+        ASSERT_EQ(l.at_right(*it.flip()), *it);
+      }
+      EXPECT_EQ(lit, l.end_left());
+
+      for (size_t i = 0; i < 2000; i++) {
+        int64_t x = (static_cast<int64_t>(e() % 17) << 40) +
+                    static_cast<int64_t>(e() % (8 * n)) - 1;
+        uint64_t y = e() % (64 * n + 1);
+        auto lower = b.lower_bound_left(x);
+        auto learned_lower = l.lower_bound_left(x);
+        ASSERT_EQ(lower == b.end_left(), learned_lower == l.end_left());
+        if (lower != b.end_left()) {
+          EXPECT_EQ(*learned_lower, *lower);
+        }
+        auto upper = b.upper_bound_right(y);
+        auto learned_upper = l.upper_bound_right(y);
+        ASSERT_EQ(upper == b.end_right(), learned_upper == l.end_right());
+        if (upper != b.end_right()) {
+          EXPECT_EQ(*learned_upper, *upper);
+        }
+        EXPECT_EQ(b.find_left(x) == b.end_left(),
+                  l.find_left(x) == l.end_left());
+      }
+    }
+  }
+}
+
+TEST(perfect_hash_bimap, simple) {
+  bimap<std::string, int> b;
+  b.insert("four", 4);
+  b.insert("ten", 10);
+  b.insert("minus seven", -7);
+  perfect_hash_bimap<std::string, int> p(b);
+  EXPECT_EQ(p.size(), 3);
+  EXPECT_EQ(p.at_left("four"), 4);
+  EXPECT_EQ(p.at_right(10), "ten");
+  EXPECT_THROW(p.at_left("five"), std::out_of_range);
+  EXPECT_THROW(p.at_right(5), std::out_of_range);
+  EXPECT_EQ(*p.find_right(-7).flip(), "minus seven");
+  EXPECT_EQ(*p.find_left("ten").flip().flip(), "ten");
+  EXPECT_EQ(p.find_left("five"), p.end_left());
+  std::set<int> rights;
+  for (auto it = p.begin_right(); it != p.end_right(); ++it) {
+    EXPECT_EQ(b.at_right(*it), *it.flip());
+    rights.insert(*it);
+  }
+  EXPECT_EQ(rights, (std::set<int>{-7, 4, 10}));
+  EXPECT_EQ(p, (perfect_hash_bimap<std::string, int>(b, 1)));
+  b.erase_left("ten");
+  EXPECT_NE(p, (perfect_hash_bimap<std::string, int>(b)));
+
+  perfect_hash_bimap<std::string, int> empty;
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.begin_left(), empty.end_left());
+  EXPECT_EQ(empty.find_right(1), empty.end_right());
+  EXPECT_EQ((perfect_hash_bimap<std::string, int>(bimap<std::string, int>())),
+            empty);
+}
+
+struct same_hash_value {
+  int value;
+
+  bool operator<(same_hash_value const &other) const {
+    return value < other.value;
+  }
+
+  bool operator==(same_hash_value const &other) const {
+    return value == other.value;
+  }
+};
+
+template <> struct bimap_hash<same_hash_value> {
+  static constexpr bool enabled = true;
+
+  static uint64_t hash(same_hash_value const &) { return 7; }
+};
+
+TEST(perfect_hash_bimap, equal_hashes) {
+  bimap<same_hash_value, int> b;
+  b.insert(same_hash_value{1}, 1);
+  EXPECT_EQ((perfect_hash_bimap<same_hash_value, int>(b).at_right(1).value), 1);
+  b.insert(same_hash_value{2}, 2);
+  EXPECT_THROW((perfect_hash_bimap<same_hash_value, int>(b, 4)),
+               std::invalid_argument);
+}
+
+TEST(perfect_hash_bimap, compare_to_bimap) {
+  // Several partitions of varying sizes, built on one and on several threads.
+  std::mt19937_64 e(seed);
+  for (size_t n : {1, 2, 100, 5000, 100000}) {
+    bimap<int64_t, uint64_t> b;
+    while (b.size() < n) {
+      b.insert(static_cast<int64_t>(e() % (8 * n)), e());
+    }
+    perfect_hash_bimap<int64_t, uint64_t> p(b, 1);
+    ASSERT_EQ(p.size(), b.size());
+    EXPECT_EQ(p, (perfect_hash_bimap<int64_t, uint64_t>(b, 4)));
+    EXPECT_LT(p.index_bytes(), n * 2 + 200);
+
+    for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+      ASSERT_EQ(p.at_left(*it), *it.flip());
+      ASSERT_EQ(p.at_right(*it.flip()), *it);
+      ASSERT_EQ(*p.find_left(*it).flip().flip(), *it);
+    }
+    size_t visited = 0;
+    for (auto it = p.begin_right(); it != p.end_right(); ++it, ++visited) {
+      ASSERT_EQ(b.at_right(*it), *it.flip());
+    }
+    EXPECT_EQ(visited, n);
+
+    for (size_t i = 0; i < 2000; i++) {
+      int64_t x = static_cast<int64_t>(e() % (16 * n)) - 1;
+      uint64_t y = e() % 4 == 0 ? e() % 64 : e();
+      EXPECT_EQ(b.find_left(x) == b.end_left(), p.find_left(x) == p.end_left());
+      EXPECT_EQ(b.find_right(y) == b.end_right(),
+                p.find_right(y) == p.end_right());
+    }
+  }
+}
+
+TEST(snapshot, round_trip) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.snapshot").string();
+  std::mt19937 e(seed);
+  bimap<int, uint64_t> b;
+  while (b.size() < 10000) {
+    b.insert(static_cast<int>(e()), e() % 1000000);
+  }
+  b.save(path);
+  bimap<int, uint64_t> loaded = bimap<int, uint64_t>::load(path);
+  ASSERT_EQ(loaded.size(), b.size());
+  auto lit = loaded.begin_left();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++lit) {
+    ASSERT_EQ(*lit, *it);
+    ASSERT_EQ(*lit.flip(), *it.flip());
+  }
+  auto rit = loaded.begin_right();
+  for (auto it = b.begin_right(); it != b.end_right(); ++it, ++rit) {
+    ASSERT_EQ(*rit, *it);
+    ASSERT_EQ(*rit.flip(), *it.flip());
+  }
+
+  // The linked trees must behave like ones built by inserts.
+  for (auto it = b.begin_left(); it != b.end_left(); ++it) {
+    EXPECT_EQ(loaded.at_right(*it.flip()), *it);
+  }
+  EXPECT_TRUE(loaded.erase_left(*b.begin_left()));
+  auto inserted = loaded.insert(1, 1000001);
+  EXPECT_EQ(inserted, loaded.find_left(1));
+  EXPECT_EQ(loaded.size(), b.size());
+
+  bimap<int, uint64_t>().save(path);
+  EXPECT_TRUE((bimap<int, uint64_t>::load(path).empty()));
+  std::filesystem::remove(path);
+}
+
+TEST(snapshot, string_codec) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.snapshot").string();
+  bimap<std::string, int> b;
+  b.insert("", 3);
+  b.insert("eleven", 11);
+  b.insert(std::string(5000, 'x'), -1);
+  b.save(path);
+  auto loaded = bimap<std::string, int>::load(path);
+  EXPECT_EQ(loaded.size(), 3);
+  EXPECT_EQ(loaded.at_right(3), "");
+  EXPECT_EQ(loaded.at_left("eleven"), 11);
+  EXPECT_EQ(loaded.at_right(-1), std::string(5000, 'x'));
+  EXPECT_THROW((bimap<int, int>::load(path)), std::runtime_error);
+  std::filesystem::remove(path);
+}
+
+TEST(snapshot, rejects_damaged_files) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.snapshot").string();
+  bimap<uint32_t, uint32_t> b;
+  for (uint32_t i = 0; i < 1000; i++) {
+    b.insert(i, 1000 - i);
+  }
+  b.save(path);
+  auto size = std::filesystem::file_size(path);
+  {
+    std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+    file.seekp(size / 2);
+    file.put('\x7f');
+  }
+  EXPECT_THROW((bimap<uint32_t, uint32_t>::load(path)), std::runtime_error);
+  b.save(path);
+  std::filesystem::resize_file(path, size - 8);
+  EXPECT_THROW((bimap<uint32_t, uint32_t>::load(path)), std::runtime_error);
+  std::filesystem::remove(path);
+  EXPECT_THROW((bimap<uint32_t, uint32_t>::load(path)), std::runtime_error);
+}
+
+TEST(mapped_bimap, compare_to_bimap) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.snapshot").string();
+  std::mt19937 e(seed);
+  bimap<int, uint64_t> b;
+  while (b.size() < 20000) {
+    b.insert(static_cast<int>(e() % 100000), e() % 100000);
+  }
+  b.save(path);
+  using warm_up = mapped_bimap<int, uint64_t>::warm_up;
+  for (warm_up mode : {warm_up::none, warm_up::advise, warm_up::populate}) {
+    mapped_bimap<int, uint64_t> m(path, mode);
+    ASSERT_EQ(m.size(), b.size());
+    EXPECT_TRUE(m.verify());
+    auto mit = m.begin_left();
+    for (auto it = b.begin_left(); it != b.end_left(); ++it, ++mit) {
+      ASSERT_EQ(*mit, *it);
+      ASSERT_EQ(*mit.flip(), *it.flip());
+      ASSERT_EQ(*mit.flip().flip(), *it);
+      ASSERT_EQ(m.at_right(*it.flip()), *it);
+    }
+    EXPECT_EQ(mit, m.end_left());
+    EXPECT_EQ(*--m.end_right(), *--b.end_right());
+    for (int x = -1; x <= 100000; x += 13) {
+      auto lower = b.lower_bound_left(x);
+      auto mapped_lower = m.lower_bound_left(x);
+      ASSERT_EQ(lower == b.end_left(), mapped_lower == m.end_left());
+      if (lower != b.end_left()) {
+        EXPECT_EQ(*mapped_lower, *lower);
+      }
+      auto upper = b.upper_bound_right(x);
+      auto mapped_upper = m.upper_bound_right(x);
+      ASSERT_EQ(upper == b.end_right(), mapped_upper == m.end_right());
+      if (upper != b.end_right()) {
+        EXPECT_EQ(*mapped_upper, *upper);
+      }
+      EXPECT_EQ(b.find_left(x) == b.end_left(), m.find_left(x) == m.end_left());
+    }
+    EXPECT_THROW(m.at_left(100001), std::out_of_range);
+  }
+
+  mapped_bimap<int, uint64_t> moved(std::move(*std::make_unique<mapped_bimap<int, uint64_t>>(path)));
+  EXPECT_EQ(moved.at_left(*b.begin_left()), *b.begin_left().flip());
+  EXPECT_THROW((mapped_bimap<int, uint32_t>(path)), std::runtime_error);
+  std::filesystem::resize_file(path, std::filesystem::file_size(path) - 8);
+  EXPECT_THROW((mapped_bimap<int, uint64_t>(path)), std::runtime_error);
+
+  bimap<int, uint64_t>().save(path);
+  mapped_bimap<int, uint64_t> empty(path);
+  EXPECT_TRUE(empty.empty());
+  EXPECT_EQ(empty.find_right(1), empty.end_right());
+  std::filesystem::remove(path);
+}
+
+TEST(persistent_bimap, reopen) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.persistent").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  std::mt19937 e(seed);
+  bimap<int, uint64_t> b;
+  {
+    persistent_bimap<int, uint64_t> p(path);
+    EXPECT_TRUE(p.empty());
+    EXPECT_THROW((persistent_bimap<int, uint64_t>(path)), std::runtime_error);
+    while (b.size() < 50000) {
+      int left = static_cast<int>(e() % 100000);
+      uint64_t right = e() % 100000;
+      EXPECT_EQ(b.insert(left, right) == b.end_left(),
+                p.insert(left, right) == p.end_left());
+    }
+    EXPECT_GT(p.file_size(), size_t(1) << 20);
+  }
+  EXPECT_THROW((persistent_bimap<int, uint32_t>(path)), std::runtime_error);
+  persistent_bimap<int, uint64_t> p(path);
+  ASSERT_EQ(p.size(), b.size());
+  auto pit = p.begin_left();
+  for (auto it = b.begin_left(); it != b.end_left(); ++it, ++pit) {
+    ASSERT_EQ(*pit, *it);
+    ASSERT_EQ(*pit.flip(), *it.flip());
+  }
+  EXPECT_EQ(pit, p.end_left());
+  for (int x = -1; x <= 100000; x += 7) {
+    EXPECT_EQ(b.find_left(x) == b.end_left(), p.find_left(x) == p.end_left());
+    EXPECT_EQ(b.erase_right(x), p.erase_right(x));
+    auto lower = b.lower_bound_left(x);
+    auto persistent_lower = p.lower_bound_left(x);
+    ASSERT_EQ(lower == b.end_left(), persistent_lower == p.end_left());
+    if (lower != b.end_left()) {
+      EXPECT_EQ(*persistent_lower.flip(), *lower.flip());
+    }
+  }
+  EXPECT_EQ(p.at_right(*b.begin_right()), *b.begin_right().flip());
+  EXPECT_THROW(p.at_left(100001), std::out_of_range);
+  std::filesystem::remove(path);
+}
+
+TEST(persistent_bimap, reuses_erased_nodes) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.persistent").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  persistent_bimap<uint64_t, uint64_t> p(path, persistent_bimap<uint64_t, uint64_t>::durability::synchronous);
+  for (uint64_t i = 0; i < 1000; i++) {
+    p.insert(i, i);
+  }
+  size_t file_size = p.file_size();
+  for (uint64_t round = 1; round < 5; round++) {
+    for (uint64_t i = 0; i < 1000; i++) {
+      EXPECT_TRUE(p.erase_left(i));
+      p.insert(i, i + round * 1000);
+    }
+  }
+  EXPECT_EQ(p.file_size(), file_size);
+  EXPECT_EQ(p.at_left(999), 4999);
+  EXPECT_EQ(p.at_left_or_default(1000), 0);
+  EXPECT_EQ(p.size(), 1001);
+  std::filesystem::remove(path);
+}
+
+TEST(persistent_bimap, keeps_unsynced_changes_out_of_the_file) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.persistent").string();
+  std::string copy = path + ".copy";
+  std::filesystem::remove(path);
+  std::filesystem::remove(copy);
+  std::filesystem::remove(copy + ".journal");
+  {
+    persistent_bimap<int, int> p(path);
+    p.insert(1, 2);
+    p.sync();
+    p.insert(3, 4);
+    EXPECT_EQ(p.at_right(4), 3);
+    // A crash now leaves the file as it was synced.
+    std::filesystem::copy_file(path, copy);
+  }
+  {
+    persistent_bimap<int, int> p(copy);
+    EXPECT_EQ(p.size(), 1);
+    EXPECT_EQ(p.at_left(1), 2);
+    EXPECT_EQ(p.find_left(3), p.end_left());
+  }
+  EXPECT_EQ((persistent_bimap<int, int>(path)).at_right(4), 3);
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  std::filesystem::remove(copy);
+  std::filesystem::remove(copy + ".journal");
+}
+
+TEST(persistent_bimap, recovers_after_crash) {
+  // A child inserts until it is killed at a random moment, possibly during a
+  // sync; reopening must give back every pair of some sync, nothing torn.
+  using map = persistent_bimap<uint64_t, uint64_t>;
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.persistent").string();
+  std::mt19937 e(seed);
+  for (auto mode : {map::durability::synchronous, map::durability::on_sync}) {
+    size_t const batch = (mode == map::durability::synchronous ? 1 : 100);
+    std::filesystem::remove(path);
+    std::filesystem::remove(path + ".journal");
+    uint64_t synced = 0;
+    for (int round = 0; round < 5; round++) {
+      pid_t pid = fork();
+      if (pid == 0) {
+        try {
+          map p(path, mode);
+          for (uint64_t i = p.size();; i++) {
+            p.insert(i, 3 * i + 1);
+            if ((i + 1) % batch == 0) {
+              p.sync();
+            }
+          }
+        }
+        catch (...) {
+        }
+        _exit(1);
+      }
+      ASSERT_GT(pid, 0);
+      std::this_thread::sleep_for(std::chrono::milliseconds(20 + e() % 80));
+      kill(pid, SIGKILL);
+      int status;
+      waitpid(pid, &status, 0);
+      map p(path, mode);
+      ASSERT_GE(p.size(), synced);
+      ASSERT_EQ(p.size() % batch, 0);
+      uint64_t expected = 0;
+      for (auto it = p.begin_left(); it != p.end_left(); ++it, ++expected) {
+        ASSERT_EQ(*it, expected);
+        ASSERT_EQ(*it.flip(), 3 * expected + 1);
+      }
+      ASSERT_EQ(expected, p.size());
+      if (expected > 0) {
+        EXPECT_EQ(p.at_right(3 * expected - 2), expected - 1);
+      }
+      synced = p.size();
+    }
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+TEST(persistent_bimap, rebalances_after_deep_lookups) {
+  // Sorted inserts leave both trees a path; a deep lookup marks the map and
+  // the next change or sync rebalances it, so later lookups stay shallow.
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.persistent").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  {
+    persistent_bimap<int, int> p(path);
+    for (int i = 0; i < 200000; i++) {
+      p.insert(i, -i);
+    }
+    size_t depth = 0;
+    EXPECT_NE(p.find_left(0, &depth), p.end_left());
+    EXPECT_GT(depth, 1000);
+    p.insert(-1, 1);
+    for (int i : {-1, 0, 77777, 199999}) {
+      EXPECT_EQ(*p.find_left(i, &depth).flip(), -i);
+      EXPECT_LE(depth, 24);
+      EXPECT_EQ(*p.find_right(-i, &depth).flip(), i);
+      EXPECT_LE(depth, 24);
+    }
+    for (int i = 200000; i < 300000; i++) {
+      p.insert(i, -i);
+    }
+    EXPECT_NE(p.find_right(-200000, &depth), p.end_right());
+    EXPECT_GT(depth, 1000);
+    p.sync();
+  }
+  persistent_bimap<int, int> p(path);
+  for (int i : {-1, 0, 200000, 299999}) {
+    size_t depth = 0;
+    EXPECT_EQ(*p.find_left(i, &depth).flip(), -i);
+    EXPECT_LE(depth, 24);
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+TEST(persistent_bimap, lookups_write_nothing) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.persistent").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  persistent_bimap<int, int> p(path);
+  for (int i = 0; i < 1000; i++) {
+    p.insert(i, -i);
+  }
+  p.rebalance();
+  p.sync();
+  auto before = std::filesystem::last_write_time(path);
+  std::this_thread::sleep_for(std::chrono::milliseconds(20));
+  for (int i = -1; i <= 1000; i++) {
+    EXPECT_EQ(p.find_left(i) == p.end_left(), i < 0 || i == 1000);
+    if (i >= 0 && i < 1000) {
+      EXPECT_EQ(p.at_right(-i), i);
+      EXPECT_EQ(*p.lower_bound_right(-i), -i);
+    }
+  }
+  p.sync();
+  EXPECT_EQ(std::filesystem::last_write_time(path), before);
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+TEST(bimap, search_without_splaying) {
+  std::mt19937 e(seed);
+  bimap<int, int> b;
+  std::map<int, int> m;
+  while (b.size() < 2000) {
+    int left = static_cast<int>(e() % 10000), right = static_cast<int>(e() % 10000);
+    if (b.insert(left, right) != b.end_left()) {
+      m[left] = right;
+    }
+  }
+  for (int x = -1; x <= 10001; x++) {
+    auto it = m.lower_bound(x);
+    auto lower = b.search_lower_bound_left(x);
+    ASSERT_EQ(it == m.end(), lower == b.end_left());
+    if (it != m.end()) {
+      EXPECT_EQ(*lower, it->first);
+      EXPECT_EQ(*lower.flip(), it->second);
+    }
+    it = m.upper_bound(x);
+    auto upper = b.search_upper_bound_left(x);
+    ASSERT_EQ(it == m.end(), upper == b.end_left());
+    if (it != m.end()) {
+      EXPECT_EQ(*upper, it->first);
+    }
+    EXPECT_EQ(b.search_left(x), b.find_left(x));
+    EXPECT_EQ(b.search_right(x), b.find_right(x));
+    EXPECT_EQ(b.search_lower_bound_right(x), b.lower_bound_right(x));
+    EXPECT_EQ(b.search_upper_bound_right(x), b.upper_bound_right(x));
+  }
+}
+
+TEST(shared_bimap, simple) {
+  using map = shared_bimap<uint64_t, uint64_t>;
+  std::string name = "/bimap-test-" + std::to_string(getpid());
+  EXPECT_THROW(map(name, map::access::open), std::runtime_error);
+  map writer(name, map::access::create);
+  EXPECT_THROW(map(name, map::access::create), std::runtime_error);
+  EXPECT_TRUE(writer.insert(1, 2));
+  EXPECT_FALSE(writer.insert(1, 3));
+  map reader(name, map::access::open);
+  EXPECT_EQ(reader.find_left(1), 2);
+  EXPECT_EQ(reader.find_right(2), 1);
+  EXPECT_EQ(reader.find_left(2), std::nullopt);
+  EXPECT_EQ(reader.version(), 1);
+  EXPECT_THROW(reader.insert(5, 6), std::logic_error);
+  for (uint64_t i = 10; i < 100000; i++) {
+    writer.insert(i, i * 3);
+  }
+  EXPECT_EQ(reader.size(), 99991);
+  EXPECT_EQ(reader.lower_bound_left(5), std::make_pair(uint64_t(10), uint64_t(30)));
+  EXPECT_TRUE(writer.erase_right(30));
+  EXPECT_EQ(reader.lower_bound_right(30), std::make_pair(uint64_t(33), uint64_t(11)));
+  EXPECT_EQ(writer.version(), reader.version());
+}
+
+TEST(shared_bimap, forked_readers) {
+  using map = shared_bimap<uint64_t, uint64_t>;
+  std::string name = "/bimap-test-" + std::to_string(getpid());
+  size_t const n = 100000;
+  map writer(name, map::access::create);
+  for (uint64_t i = 0; i < n / 2; i++) {
+    writer.insert(i, 3 * i + 1);
+  }
+  /* Every reader checks pairs and order while the writer inserts and erases */
+  auto spawn_reader = [&](unsigned seed, bool complete) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      int status = 0;
+      try {
+        map reader(name, map::access::open);
+        std::mt19937 e(seed);
+        for (size_t i = 0; i < 20000; i++) {
+          uint64_t key = e() % n;
+          auto right = reader.find_left(key);
+          if (right && *right != 3 * key + 1) {
+            status = 1;
+          }
+          /* The writer may erase the pair between the two lookups */
+          auto left = right ? reader.find_right(*right) : std::nullopt;
+          if (left && *left != key) {
+            status = 1;
+          }
+          auto lower = reader.lower_bound_left(key);
+          if (lower && (lower->first < key || lower->second != 3 * lower->first + 1)) {
+            status = 2;
+          }
+        }
+        if (complete) {
+          uint64_t expected = 0;
+          size_t count = 0;
+          reader.for_each([&](uint64_t left, uint64_t right) {
+            if (left != expected || right != 3 * left + 1) {
+              status = 3;
+            }
+            expected += 2;
+            count++;
+          });
+          if (count != n / 2 || reader.size() != n / 2) {
+            status = 4;
+          }
+        }
+      }
+      catch (...) {
+        status = 5;
+      }
+      _exit(status);
+    }
+    return pid;
+  };
+  std::vector<pid_t> readers;
+  for (unsigned i = 0; i < 3; i++) {
+    readers.push_back(spawn_reader(seed + i, false));
+    ASSERT_GT(readers.back(), 0);
+  }
+  for (uint64_t i = n / 2; i < n; i++) {
+    writer.insert(i, 3 * i + 1);
+  }
+  for (uint64_t i = 1; i < n; i += 2) {
+    EXPECT_TRUE(writer.erase_left(i));
+  }
+  writer.rebalance();
+  readers.push_back(spawn_reader(seed, true));
+  for (pid_t pid : readers) {
+    int status = -1;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+    EXPECT_TRUE(WIFEXITED(status));
+    EXPECT_EQ(WEXITSTATUS(status), 0);
+  }
+  EXPECT_EQ(writer.version(), n + n / 2);
+}
+
+namespace {
+std::string wal_test_path() {
+  std::filesystem::path directory =
+      std::filesystem::temp_directory_path() / "bimap-test-wal";
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directory(directory);
+  return (directory / "map").string();
+}
+
+template <typename Wal, typename Map>
+void expect_same_pairs(Wal const &wal, Map const &expected) {
+  ASSERT_EQ(wal.size(), expected.size());
+  for (auto it = expected.begin_left(); it != expected.end_left(); ++it) {
+    ASSERT_EQ(wal.find_left(*it), *it.flip());
+    ASSERT_EQ(wal.find_right(*it.flip()), *it);
+  }
+}
+} // namespace
+
+TEST(wal_bimap, recovers_after_crash) {
+  using wal = wal_bimap<int, std::string>;
+  std::string path = wal_test_path();
+  bimap<int, std::string> expected;
+  std::mt19937 e(seed);
+  auto change = [&](wal &w) {
+    int left = static_cast<int>(e() % 1000);
+    std::string right = std::to_string(e() % 1000);
+    switch (e() % 3) {
+    case 0:
+      EXPECT_EQ(w.insert(left, right),
+                expected.insert(left, right) != expected.end_left());
+      break;
+    case 1:
+      EXPECT_EQ(w.erase_left(left), expected.erase_left(left));
+      break;
+    default:
+      EXPECT_EQ(w.erase_right(right), expected.erase_right(right));
+    }
+  };
+  {
+    wal w(path, wal::sync_mode::per_operation);
+    for (size_t i = 0; i < 3000; i++) {
+      change(w);
+    }
+  }
+  {
+    wal w(path, wal::sync_mode::group_commit);
+    expect_same_pairs(w, expected);
+    for (size_t i = 0; i < 3000; i++) {
+      change(w);
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      /* Every returned change must survive exiting without closing */
+      w.insert(5000, "crash");
+      _exit(0);
+    }
+    int status = -1;
+    ASSERT_EQ(waitpid(pid, &status, 0), pid);
+  }
+  {
+    std::string last;
+    for (auto const &entry : std::filesystem::directory_iterator(
+             std::filesystem::path(path).parent_path())) {
+      last = std::max(last, entry.path().string());
+    }
+    std::ofstream torn(last, std::ios::binary | std::ios::app);
+    torn << "torn record";
+  }
+  wal w(path, wal::sync_mode::none);
+  expected.insert(5000, "crash");
+  expect_same_pairs(w, expected);
+}
+
+TEST(wal_bimap, compaction) {
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  std::string path = wal_test_path();
+  bimap<uint64_t, uint64_t> expected;
+  std::mt19937_64 e(seed);
+  {
+    wal w(path, wal::sync_mode::none, 1 << 16);
+    for (size_t i = 0; i < 20000; i++) {
+      uint64_t left = e() % 10000, right = e() % 10000;
+      if (i % 4 == 3) {
+        EXPECT_EQ(w.erase_left(left), expected.erase_left(left));
+      }
+      else {
+        EXPECT_EQ(w.insert(left, right), expected.insert(left, right) != expected.end_left());
+      }
+    }
+    EXPECT_LT(w.current_log_bytes(), 1 << 17);
+    w.compact();
+    w.wait_for_checkpoint();
+    size_t snapshots = 0;
+    for (auto const &entry : std::filesystem::directory_iterator(
+             std::filesystem::path(path).parent_path())) {
+      snapshots += entry.path().string().find(".snapshot.") != std::string::npos;
+    }
+    /* The latest snapshot and the previous one, kept as a fallback */
+    EXPECT_EQ(snapshots, 2);
+    w.insert(20000, 20000);
+  }
+  expected.insert(20000, 20000);
+  expect_same_pairs(wal(path), expected);
+}
+
+TEST(wal_bimap, falls_back_to_previous_snapshot) {
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  std::string path = wal_test_path();
+  bimap<uint64_t, uint64_t> expected;
+  {
+    wal w(path, wal::sync_mode::none);
+    for (uint64_t round = 0; round < 3; round++) {
+      for (uint64_t i = 0; i < 1000; i++) {
+        w.insert(round * 1000 + i, i);
+        expected.insert(round * 1000 + i, i);
+      }
+      if (round < 2) {
+        w.compact();
+        w.wait_for_checkpoint();
+      }
+    }
+  }
+  std::vector<std::string> snapshots;
+  for (auto const &entry : std::filesystem::directory_iterator(
+           std::filesystem::path(path).parent_path())) {
+    if (entry.path().string().find(".snapshot.") != std::string::npos) {
+      snapshots.push_back(entry.path().string());
+    }
+  }
+  ASSERT_EQ(snapshots.size(), 2);
+  std::sort(snapshots.begin(), snapshots.end());
+  {
+    std::fstream file(snapshots.back(), std::ios::in | std::ios::out | std::ios::binary);
+    auto middle = std::filesystem::file_size(snapshots.back()) / 2;
+    file.seekg(middle);
+    char byte = static_cast<char>(file.get());
+    file.seekp(middle);
+    file.put(static_cast<char>(~byte));
+  }
+  expect_same_pairs(wal(path), expected);
+  EXPECT_TRUE(std::filesystem::exists(snapshots.back() + ".corrupt"));
+  /* Without the previous snapshot's logs there is nothing to fall back to */
+  std::filesystem::rename(snapshots.back() + ".corrupt", snapshots.back());
+  std::filesystem::remove(snapshots.front());
+  EXPECT_THROW(wal{path}, std::runtime_error);
+}
+
+TEST(wal_bimap, survives_write_errors) {
+  // A child may only write small files, so its logs fail in the middle of a
+  // record again and again; every failure must start a new generation from a
+  // snapshot, without losing or duplicating any change.
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  auto run = [](auto &target) {
+    for (uint64_t i = 0; i < 20000; i++) {
+      if (i % 3 == 2) {
+        target.erase_left(i % 1000);
+      } else {
+        target.insert(i % 1000, i);
+      }
+    }
+  };
+  bimap<uint64_t, uint64_t> expected;
+  run(expected);
+  for (auto mode : {wal::sync_mode::none, wal::sync_mode::per_operation,
+                    wal::sync_mode::group_commit}) {
+    std::string path = wal_test_path();
+    pid_t pid = fork();
+    if (pid == 0) {
+      int code = 1;
+      try {
+        std::signal(SIGXFSZ, SIG_IGN);
+        rlimit limit = {1 << 16, 1 << 16};
+        setrlimit(RLIMIT_FSIZE, &limit);
+        wal w(path, mode);
+        run(w);
+        w.sync();
+        code = (w.size() == expected.size() ? 0 : 2);
+      } catch (...) {
+      }
+      _exit(code);
+    }
+    ASSERT_GT(pid, 0);
+    int status;
+    waitpid(pid, &status, 0);
+    ASSERT_TRUE(WIFEXITED(status));
+    ASSERT_EQ(WEXITSTATUS(status), 0);
+    EXPECT_TRUE(std::filesystem::exists(path + ".snapshot.2"));
+    expect_same_pairs(wal(path), expected);
+  }
+}
+
+TEST(wal_bimap, checkpoint_during_changes) {
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  std::string path = wal_test_path();
+  std::string target = path + ".checkpoint";
+  bimap<uint64_t, uint64_t> expected;
+  std::mt19937_64 e(seed);
+  wal w(path, wal::sync_mode::none);
+  for (size_t i = 0; i < 100000; i++) {
+    uint64_t left = e() % 200000, right = e() % 200000;
+    if (w.insert(left, right)) {
+      expected.insert(left, right);
+    }
+  }
+  w.checkpoint_async(target);
+  /* Changes race with the copy, including erasing and reinserting the same left values */
+  for (size_t i = 0; i < 100000; i++) {
+    uint64_t left = e() % 200000, right = e() % 200000;
+    if (i % 2 == 0) {
+      w.erase_left(left);
+    }
+    else {
+      w.insert(left, right);
+    }
+  }
+  w.wait_for_checkpoint();
+  auto saved = bimap<uint64_t, uint64_t>::load(target);
+  ASSERT_EQ(saved.size(), expected.size());
+  for (auto it = expected.begin_left(), other = saved.begin_left();
+       it != expected.end_left(); ++it, ++other) {
+    ASSERT_EQ(*other, *it);
+    ASSERT_EQ(*other.flip(), *it.flip());
+  }
+  for (auto it = expected.begin_right(), other = saved.begin_right();
+       it != expected.end_right(); ++it, ++other) {
+    ASSERT_EQ(*other, *it);
+    ASSERT_EQ(*other.flip(), *it.flip());
+  }
+}
+
+TEST(wal_bimap, group_commit_from_many_threads) {
+  using wal = wal_bimap<uint64_t, uint64_t>;
+  std::string path = wal_test_path();
+  {
+    wal w(path);
+    std::vector<std::thread> threads;
+    for (uint64_t t = 0; t < 4; t++) {
+      threads.emplace_back([&w, t] {
+        for (uint64_t i = 0; i < 200; i++) {
+          w.insert(t * 1000 + i, t * 1000 + i);
+        }
+      });
+    }
+    for (auto &thread : threads) {
+      thread.join();
+    }
+  }
+  wal w(path);
+  EXPECT_EQ(w.size(), 800);
+  EXPECT_EQ(w.find_right(3199), 3199);
+  std::filesystem::remove_all(std::filesystem::path(path).parent_path());
+}
+
+TEST(change_stream, replicates_changes) {
+  using master_t = bimap<int, int, std::less<>, std::less<>, heap_storage,
+                         change_recorder<int, int>>;
+  change_batch<int, int> batch;
+  master_t master{std::less<>(), std::less<>(), heap_storage(),
+                  change_recorder<int, int>(&batch)};
+  bimap<int, int> replica;
+  change_applier<int, int> applier;
+  std::mt19937 e(seed);
+  for (size_t round = 0; round < 20; round++) {
+    for (size_t i = 0; i < 500; i++) {
+      int left = static_cast<int>(e() % 300);
+      int right = static_cast<int>(e() % 300);
+      switch (e() % 5) {
+      case 0:
+      case 1:
+        master.insert(left, right);
+        break;
+      case 2:
+        master.erase_left(left);
+        break;
+      case 3:
+        master.erase_right(right);
+        break;
+      default:
+        master.at_left_or_default(left);
+        master.erase_left(master.lower_bound_left(left),
+                          master.upper_bound_left(left + 3));
+      }
+    }
+    std::vector<char> frame = batch.encode();
+    EXPECT_TRUE(batch.empty());
+    ASSERT_TRUE(applier.apply(replica, frame));
+    ASSERT_EQ(replica.size(), master.size());
+    auto other = replica.begin_left();
+    for (auto it = master.begin_left(); it != master.end_left(); ++it, ++other) {
+      ASSERT_EQ(*other, *it);
+      ASSERT_EQ(*other.flip(), *it.flip());
+    }
+  }
+}
+
+TEST(change_stream, rejects_corrupted_frames) {
+  using master_t = bimap<int, std::string, std::less<>, std::less<>,
+                         heap_storage, change_recorder<int, std::string>>;
+  change_batch<int, std::string> batch;
+  master_t master;
+  master.insert(1, "one");
+  EXPECT_TRUE(batch.empty());
+  master.observer().attach(&batch);
+  master.insert(2, "two");
+  master.erase_right("one");
+  EXPECT_EQ(batch.size(), 2);
+  std::vector<char> frame = batch.encode();
+
+  bimap<int, std::string> replica;
+  replica.insert(1, "one");
+  change_applier<int, std::string> applier;
+  std::vector<char> corrupted = frame;
+  corrupted.back() ^= 1;
+  EXPECT_THROW(applier.apply(replica, corrupted), std::runtime_error);
+  corrupted.pop_back();
+  EXPECT_THROW(applier.apply(replica, corrupted), std::runtime_error);
+  EXPECT_EQ(replica.at_left(1), "one");
+  EXPECT_EQ(replica.size(), 1);
+
+  /* A replica missing the erased pair still gets the inserted one */
+  bimap<int, std::string> diverged;
+  EXPECT_FALSE(applier.apply(diverged, frame));
+  EXPECT_EQ(diverged.at_right("two"), 2);
+  EXPECT_TRUE(applier.apply(replica, frame));
+  EXPECT_EQ(replica.size(), 1);
+  EXPECT_EQ(replica.at_left(2), "two");
+}
+
+// A value whose encoding fails when it is negative, to check lost changes.
+struct fragile_value {
+  int value;
+  fragile_value(int value) : value(value) {}
+  fragile_value(fragile_value const &other) : value(other.value) {}
+  friend bool operator<(fragile_value const &a, fragile_value const &b) {
+    return a.value < b.value;
+  }
+  friend bool operator==(fragile_value const &a, fragile_value const &b) {
+    return a.value == b.value;
+  }
+};
+
+template <> struct snapshot_codec<fragile_value> {
+  static constexpr uint32_t fixed_size = sizeof(int);
+
+  template <typename Output>
+  static void write(Output &out, fragile_value const &value) {
+    if (value.value < 0) {
+      throw std::runtime_error("Can't encode a negative value.");
+    }
+    out.write(&value.value, sizeof(int));
+  }
+
+  template <typename Input> static fragile_value read(Input &in) {
+    int value;
+    in.read(&value, sizeof(int));
+    return value;
+  }
+};
+
+TEST(change_stream, reports_lost_changes) {
+  using master_t = bimap<int, fragile_value, std::less<>, std::less<>,
+                         heap_storage, change_recorder<int, fragile_value>>;
+  change_batch<int, fragile_value> batch;
+  master_t master{std::less<>(), std::less<>(), heap_storage(),
+                  change_recorder<int, fragile_value>(&batch)};
+  master.insert(1, 1);
+  master.insert(2, -2);
+  EXPECT_FALSE(batch.complete());
+  EXPECT_EQ(master.size(), 2);
+  EXPECT_THROW(batch.encode(), std::runtime_error);
+  EXPECT_TRUE(batch.empty());
+  EXPECT_TRUE(batch.complete());
+
+  master.erase_left(1);
+  bimap<int, fragile_value> replica;
+  replica.insert(1, 1);
+  change_applier<int, fragile_value> applier;
+  EXPECT_TRUE(applier.apply(replica, batch.encode()));
+  EXPECT_TRUE(replica.empty());
+}
+
+TEST(bimap_diff, diff_and_apply_patch) {
+  bimap<int, int> a, b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 2000; i++) {
+    a.insert(2 * i, 2 * i + 1);
+  }
+  b = a;
+  for (int i = 0; i < 50; i++) {
+    int left = 2 * static_cast<int>(e() % 2000);
+    switch (i % 3) {
+    case 0:
+      b.erase_left(left);
+      break;
+    case 1:
+      b.insert(left + 1, -left);
+      break;
+    default:
+      if (b.erase_left(left)) {
+        b.insert(left, -left - 1);
+      }
+    }
+  }
+  /* Partners swapped between two pairs */
+  b.erase_left(4000 - 2);
+  b.erase_left(4000 - 4);
+  b.insert(4000 - 2, 4000 - 3);
+  b.insert(4000 - 4, 4000 - 1);
+
+  auto patch = diff(a, b);
+  EXPECT_EQ(patch.removed.size() + b.size(), patch.added.size() + a.size());
+  EXPECT_GE(patch.changed.size(), 2);
+  for (auto const &change : patch.changed) {
+    EXPECT_EQ(a.at_left(change.left), change.from);
+    EXPECT_EQ(b.at_left(change.left), change.to);
+  }
+  EXPECT_TRUE(diff(b, b).empty());
+
+  bimap<int, int> patched = a;
+  EXPECT_TRUE(apply_patch(patched, patch));
+  EXPECT_TRUE(diff(patched, b).empty());
+  EXPECT_TRUE(diff(b, patched).empty());
+  EXPECT_FALSE(apply_patch(patched, patch));
+}
+
+TEST(bimap_diff, apply_large_patch_in_bulk) {
+  bimap<int, int> a, b;
+  std::mt19937 e(seed);
+  for (int i = 0; i < 20000; i++) {
+    a.insert(i, i);
+  }
+  b = a;
+  for (int i = 0; i < 20000; i += 2) {
+    b.erase_left(i);
+    if (i % 4 == 0) {
+      b.insert(i, -i - 1);
+    }
+  }
+  for (int i = 0; i < 5000; i++) {
+    b.insert(20000 + static_cast<int>(e() % 20000), 20000 + i);
+  }
+
+  auto patch = diff(a, b);
+  EXPECT_GE(patch.size(), a.size() / 8);
+  bimap<int, int> patched = a;
+  auto kept = patched.find_left(1);
+  EXPECT_TRUE(apply_patch(patched, patch));
+  EXPECT_EQ(patched, b);
+  EXPECT_TRUE(diff(patched, b).empty());
+  EXPECT_EQ(*kept, 1);
+  EXPECT_EQ(*kept.flip(), 1);
+  size_t depth = 0;
+  EXPECT_NE(patched.search_left(19999, &depth), patched.end_left());
+  EXPECT_LE(depth, 16);
+  depth = 0;
+  EXPECT_NE(patched.search_right(19999, &depth), patched.end_right());
+  EXPECT_LE(depth, 16);
+
+  /* Pairs held no longer and inserts colliding by left or right value are skipped */
+  EXPECT_FALSE(apply_patch(patched, patch));
+  EXPECT_EQ(patched, b);
+  bimap<int, int> collided = a;
+  EXPECT_FALSE(collided.replace_sorted({{0, 1}, {3, 3}}, {{3, -4}, {20000, 5}, {20001, 1}, {20002, 20002}, {20003, 20002}}));
+  EXPECT_EQ(collided.size(), a.size() + 1);
+  EXPECT_EQ(collided.at_left(3), -4);
+  EXPECT_EQ(collided.at_left(20002), 20002);
+  EXPECT_EQ(collided.at_left(0), 0);
+  EXPECT_EQ(collided.find_left(20000), collided.end_left());
+  EXPECT_EQ(collided.find_left(20001), collided.end_left());
+  EXPECT_EQ(collided.find_left(20003), collided.end_left());
+}
+
+TEST(btree_bimap, simple) {
+  btree_bimap<uint32_t, uint64_t> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(--b.end_left(), b.end_left());
+  EXPECT_EQ(--b.end_right(), b.end_right());
+  EXPECT_EQ(*b.insert(4, 10), 4);
+  EXPECT_NE(b.insert(10, 4), b.end_left());
+  EXPECT_EQ(b.insert(4, 42), b.end_left());
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left(4), 10);
+  EXPECT_EQ(b.at_right(4), 10);
+  EXPECT_THROW(b.at_left(5), std::out_of_range);
+  EXPECT_EQ(*b.find_left(10).flip(), 4);
+  EXPECT_EQ(*b.find_right(10).flip().flip(), 10);
+  EXPECT_EQ(*b.lower_bound_left(5), 10);
+  EXPECT_EQ(b.upper_bound_left(10), b.end_left());
+  EXPECT_EQ(*--b.end_right(), 10);
+  EXPECT_EQ(b.at_left_or_default(7), 0);
+  EXPECT_EQ(b.at_right_or_default(0), 7);
+  EXPECT_TRUE(b.erase_left(7));
+  EXPECT_FALSE(b.erase_right(100));
+
+  btree_bimap<uint32_t, uint64_t> copy = b;
+  EXPECT_EQ(copy, b);
+  EXPECT_EQ(*copy.erase_left(copy.begin_left()), 10);
+  EXPECT_NE(copy, b);
+  EXPECT_EQ(copy.erase_right(copy.begin_right(), copy.end_right()),
+            copy.end_right());
+  EXPECT_TRUE(copy.empty());
+  EXPECT_EQ(--copy.end_left(), copy.end_left());
+  EXPECT_EQ(b.size(), 2);
+}
+
+TEST(btree_bimap, infinite_keys) {
+  double const inf = std::numeric_limits<double>::infinity();
+  btree_bimap<double, float> b;
+  EXPECT_NE(b.insert(1.0, 1.0f), b.end_left());
+  EXPECT_NE(b.insert(inf, std::numeric_limits<float>::infinity()),
+            b.end_left());
+  EXPECT_NE(b.insert(-inf, -std::numeric_limits<float>::infinity()),
+            b.end_left());
+  EXPECT_NE(b.insert(2.0, 3.0f), b.end_left());
+  EXPECT_EQ(b.insert(inf, 7.0f), b.end_left());
+  EXPECT_EQ(b.size(), 4);
+  EXPECT_EQ(*b.begin_left(), -inf);
+  EXPECT_EQ(*--b.end_left(), inf);
+  EXPECT_EQ(*b.find_left(inf).flip(), std::numeric_limits<float>::infinity());
+  EXPECT_EQ(*b.find_right(std::numeric_limits<float>::infinity()).flip(), inf);
+  EXPECT_EQ(*b.find_left(-inf).flip(),
+            -std::numeric_limits<float>::infinity());
+  EXPECT_EQ(*b.lower_bound_left(3.0), inf);
+  EXPECT_EQ(b.upper_bound_left(inf), b.end_left());
+  EXPECT_TRUE(b.erase_left(inf));
+  EXPECT_TRUE(b.erase_right(-std::numeric_limits<float>::infinity()));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(*--b.end_left(), 2.0);
+  EXPECT_EQ(b.find_left(inf), b.end_left());
+}
+
+TEST(btree_bimap, string_keys) {
+  btree_bimap<std::string, int> b;
+  for (int i = 0; i < 1000; i++) {
+    b.insert(std::to_string(i), i);
+  }
+  EXPECT_EQ(b.size(), 1000);
+  EXPECT_EQ(*b.begin_left(), "0");
+  EXPECT_EQ(*--b.end_left(), "999");
+  EXPECT_EQ(*b.lower_bound_left("5"), "5");
+  EXPECT_EQ(*b.upper_bound_left("5"), "50");
+  for (int i = 0; i < 1000; i += 3) {
+    EXPECT_TRUE(b.erase_right(i));
+  }
+  EXPECT_EQ(b.size(), 666);
+  EXPECT_EQ(b.at_right(500), "500");
+  EXPECT_EQ(b.find_left("501"), b.end_left());
+}
+
+TEST(btree_bimap, compare_to_two_maps) {
+  // Small key ranges make inserts and erases collide often, which exercises
+  // leaf splits, borrowing from siblings and merges on both sides.
+  std::mt19937 e(seed);
+  btree_bimap<int, unsigned> b;
+  std::map<int, unsigned> left_view;
+  std::map<unsigned, int> right_view;
+  for (size_t i = 0; i < 200000; i++) {
+    int l = static_cast<int>(e() % 20000) - 10000;
+    unsigned r = e() % 20000;
+    if (e() % 8 < 5) {
+      bool inserted = (b.insert(l, r) != b.end_left());
+      bool expected = !left_view.count(l) && !right_view.count(r);
+      ASSERT_EQ(inserted, expected);
+      if (expected) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (e() % 2 == 0) {
+      auto it = left_view.find(l);
+      ASSERT_EQ(b.erase_left(l), it != left_view.end());
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+    } else {
+      auto it = right_view.find(r);
+      ASSERT_EQ(b.erase_right(r), it != right_view.end());
+      if (it != right_view.end()) {
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    }
+    if (i % 20000 == 0) {
+      ASSERT_EQ(b.size(), left_view.size());
+      auto it = b.begin_left();
+      for (auto const &p : left_view) {
+        ASSERT_EQ(*it, p.first);
+        ASSERT_EQ(*it.flip(), p.second);
+        ++it;
+      }
+      EXPECT_EQ(it, b.end_left());
+      auto rit = b.end_right();
+      for (auto p = right_view.rbegin(); p != right_view.rend(); ++p) {
+        --rit;
+        ASSERT_EQ(*rit, p->first);
+      }
+      for (int k = -10001; k <= 10001; k += 7) {
+        auto lower = left_view.lower_bound(k);
+        auto upper = right_view.upper_bound(static_cast<unsigned>(k));
+        auto b_lower = b.lower_bound_left(k);
+        auto b_upper = b.upper_bound_right(static_cast<unsigned>(k));
+        ASSERT_EQ(lower == left_view.end(), b_lower == b.end_left());
+        ASSERT_EQ(upper == right_view.end(), b_upper == b.end_right());
+        if (lower != left_view.end()) {
+          EXPECT_EQ(*b_lower, lower->first);
+        }
+        if (upper != right_view.end()) {
+          EXPECT_EQ(*b_upper, upper->first);
+        }
+      }
+    }
+  }
+  while (!left_view.empty()) {
+    ASSERT_TRUE(b.erase_left(left_view.begin()->first));
+    left_view.erase(left_view.begin());
+  }
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_right(), b.end_right());
+}
+
+TEST(paged_bimap, simple) {
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.paged").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  {
+    paged_bimap<uint32_t, uint64_t> b(path);
+    EXPECT_TRUE(b.empty());
+    EXPECT_EQ(b.begin_left(), b.end_left());
+    EXPECT_EQ(--b.end_left(), b.end_left());
+    EXPECT_EQ(--b.end_right(), b.end_right());
+    EXPECT_THROW((paged_bimap<uint32_t, uint64_t>(path)), std::runtime_error);
+    EXPECT_EQ(*b.insert(4, 10), 4);
+    EXPECT_NE(b.insert(10, 4), b.end_left());
+    EXPECT_EQ(b.insert(4, 42), b.end_left());
+    EXPECT_EQ(b.size(), 2);
+    EXPECT_EQ(b.at_left(4), 10);
+    EXPECT_EQ(b.at_right(4), 10);
+    EXPECT_THROW(b.at_left(5), std::out_of_range);
+    EXPECT_EQ(*b.find_left(10).flip(), 4);
+    EXPECT_EQ(*b.find_right(10).flip().flip(), 10);
+    EXPECT_EQ(*b.lower_bound_left(5), 10);
+    EXPECT_EQ(b.upper_bound_left(10), b.end_left());
+    EXPECT_EQ(*--b.end_right(), 10);
+    EXPECT_EQ(b.at_left_or_default(7), 0);
+    EXPECT_EQ(b.at_right_or_default(0), 7);
+    EXPECT_TRUE(b.erase_left(7));
+    EXPECT_FALSE(b.erase_right(100));
+    EXPECT_EQ(*b.erase_left(b.begin_left()), 10);
+    EXPECT_EQ(b.size(), 1);
+  }
+  EXPECT_THROW((paged_bimap<uint32_t, uint32_t>(path)), std::runtime_error);
+  paged_bimap<uint32_t, uint64_t> b(path);
+  EXPECT_EQ(b.size(), 1);
+  EXPECT_EQ(b.at_right(4), 10);
+  EXPECT_EQ(b.erase_right(b.begin_right(), b.end_right()), b.end_right());
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(--b.end_left(), b.end_left());
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+TEST(paged_bimap, recovers_after_crash) {
+  // A child with the smallest pool, so that most changed pages are evicted to
+  // the journal, inserts until it is killed at a random moment, possibly
+  // during a sync; reopening must give back every pair of some sync.
+  using paged = paged_bimap<uint64_t, uint64_t, std::less<>, std::less<>, 256>;
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.paged").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  std::mt19937 e(seed);
+  size_t const batch = 500;
+  uint64_t synced = 0;
+  for (int round = 0; round < 8; round++) {
+    pid_t pid = fork();
+    if (pid == 0) {
+      try {
+        paged p(path, 0);
+        for (uint64_t i = p.size();; i++) {
+          p.insert(i * 7919 % 1000003, 3 * i + 1);
+          if ((i + 1) % batch == 0) {
+            p.sync();
+          }
+        }
+      } catch (...) {
+      }
+      _exit(1);
+    }
+    ASSERT_GT(pid, 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20 + e() % 80));
+    kill(pid, SIGKILL);
+    int status;
+    waitpid(pid, &status, 0);
+    paged p(path, 0);
+    ASSERT_GE(p.size(), synced);
+    ASSERT_EQ(p.size() % batch, 0);
+    for (uint64_t i = 0; i < p.size(); i++) {
+      ASSERT_EQ(p.at_left(i * 7919 % 1000003), 3 * i + 1);
+      ASSERT_EQ(p.at_right(3 * i + 1), i * 7919 % 1000003);
+    }
+    size_t count = 0;
+    for (auto it = p.begin_right(); it != p.end_right(); ++it) {
+      ++count;
+    }
+    ASSERT_EQ(count, p.size());
+    synced = p.size();
+  }
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+TEST(paged_bimap, compare_to_two_maps) {
+  // Small pages and the smallest pool make the trees deep and evict on
+  // almost every operation, while splits, borrowing and merges run on both
+  // sides; the map is reopened halfway from what sync() wrote.
+  using paged = paged_bimap<int, unsigned, std::less<>, std::less<>, 256>;
+  std::string path =
+      (std::filesystem::temp_directory_path() / "bimap-test.paged").string();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+  std::mt19937 e(seed);
+  auto b = std::make_unique<paged>(path, 0);
+  EXPECT_EQ(b->pool_pages(), paged::minimum_pool_pages);
+  std::map<int, unsigned> left_view;
+  std::map<unsigned, int> right_view;
+  for (size_t i = 0; i < 200000; i++) {
+    if (i == 100000) {
+      b->sync();
+      EXPECT_GT(b->statistics().reads, 1000);
+      b.reset();
+      b = std::make_unique<paged>(path, 0);
+      ASSERT_EQ(b->size(), left_view.size());
+    }
+    int l = static_cast<int>(e() % 20000) - 10000;
+    unsigned r = e() % 20000;
+    if (e() % 8 < 5) {
+      bool inserted = (b->insert(l, r) != b->end_left());
+      bool expected = !left_view.count(l) && !right_view.count(r);
+      ASSERT_EQ(inserted, expected);
+      if (expected) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (e() % 2 == 0) {
+      auto it = left_view.find(l);
+      ASSERT_EQ(b->erase_left(l), it != left_view.end());
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+    } else {
+      auto it = right_view.find(r);
+      ASSERT_EQ(b->erase_right(r), it != right_view.end());
+      if (it != right_view.end()) {
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    }
+    if (i % 20000 == 0) {
+      ASSERT_EQ(b->size(), left_view.size());
+      auto it = b->begin_left();
+      for (auto const &p : left_view) {
+        ASSERT_EQ(*it, p.first);
+        ASSERT_EQ(*it.flip(), p.second);
+        ++it;
+      }
+      EXPECT_EQ(it, b->end_left());
+      auto rit = b->end_right();
+      for (auto p = right_view.rbegin(); p != right_view.rend(); ++p) {
+        --rit;
+        ASSERT_EQ(*rit, p->first);
+      }
+      for (int k = -10001; k <= 10001; k += 7) {
+        auto lower = left_view.lower_bound(k);
+        auto upper = right_view.upper_bound(static_cast<unsigned>(k));
+        auto b_lower = b->lower_bound_left(k);
+        auto b_upper = b->upper_bound_right(static_cast<unsigned>(k));
+        ASSERT_EQ(lower == left_view.end(), b_lower == b->end_left());
+        ASSERT_EQ(upper == right_view.end(), b_upper == b->end_right());
+        if (lower != left_view.end()) {
+          EXPECT_EQ(*b_lower, lower->first);
+        }
+        if (upper != right_view.end()) {
+          EXPECT_EQ(*b_upper, upper->first);
+        }
+      }
+    }
+  }
+  size_t file_size = b->file_size();
+  // Every iterator pins its leaf, the pool runs out of unpinned frames.
+  std::vector<paged::left_iterator> pinned;
+  auto pin_leaves = [&] {
+    size_t index = 0;
+    for (auto it = b->begin_left(); it != b->end_left(); ++it, ++index) {
+      if (index % 10 == 0) {
+        pinned.push_back(it);
+      }
+    }
+  };
+  EXPECT_THROW(pin_leaves(), std::length_error);
+  pinned.clear();
+  while (!left_view.empty()) {
+    ASSERT_TRUE(b->erase_left(left_view.begin()->first));
+    left_view.erase(left_view.begin());
+  }
+  EXPECT_TRUE(b->empty());
+  EXPECT_EQ(b->begin_right(), b->end_right());
+  for (unsigned i = 0; i < 5000; i++) {
+    b->insert(static_cast<int>(i), i);
+  }
+  EXPECT_EQ(b->file_size(), file_size);
+  b.reset();
+  std::filesystem::remove(path);
+  std::filesystem::remove(path + ".journal");
+}
+
+TEST(lsm_bimap, simple) {
+  lsm_bimap<int, std::string> b(4);
+  EXPECT_TRUE(b.empty());
+  EXPECT_TRUE(b.insert(1, "one"));
+  EXPECT_TRUE(b.insert(2, "two"));
+  EXPECT_FALSE(b.insert(1, "three"));
+  EXPECT_FALSE(b.insert(3, "two"));
+  b.flush();
+  EXPECT_EQ(b.runs(), 1);
+  EXPECT_EQ(b.at_left(2), "two");
+  EXPECT_EQ(b.at_right("one"), 1);
+  EXPECT_THROW(b.at_left(3), std::out_of_range);
+  // The erased pair stays in the run, its tombstone hides both values.
+  EXPECT_TRUE(b.erase_right("one"));
+  EXPECT_FALSE(b.erase_left(1));
+  EXPECT_FALSE(b.find_left(1));
+  EXPECT_FALSE(b.find_right("one"));
+  EXPECT_TRUE(b.insert(3, "one"));
+  EXPECT_TRUE(b.insert(1, "four"));
+  EXPECT_EQ(b.size(), 3);
+  b.flush();
+  EXPECT_EQ(*b.find_right("one"), 3);
+  EXPECT_EQ(*b.find_left(1), "four");
+  EXPECT_TRUE(b.erase_left(3));
+  EXPECT_TRUE(b.erase_left(1));
+  EXPECT_TRUE(b.erase_left(2));
+  b.flush();
+  EXPECT_TRUE(b.empty());
+  EXPECT_FALSE(b.find_right("two"));
+}
+
+TEST(lsm_bimap, compare_to_two_maps) {
+  // A tiny memtable makes the background thread flush and merge all the
+  // time, while lookups see memtables, frozen ones and runs.
+  std::mt19937 e(seed);
+  lsm_bimap<int, unsigned> b(64);
+  std::map<int, unsigned> left_view;
+  std::map<unsigned, int> right_view;
+  for (size_t i = 0; i < 100000; i++) {
+    int l = static_cast<int>(e() % 4000) - 2000;
+    unsigned r = e() % 4000;
+    if (e() % 8 < 5) {
+      bool expected = !left_view.count(l) && !right_view.count(r);
+      ASSERT_EQ(b.insert(l, r), expected);
+      if (expected) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (e() % 2 == 0) {
+      auto it = left_view.find(l);
+      ASSERT_EQ(b.erase_left(l), it != left_view.end());
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+    } else {
+      auto it = right_view.find(r);
+      ASSERT_EQ(b.erase_right(r), it != right_view.end());
+      if (it != right_view.end()) {
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    }
+    if (i % 10000 == 0) {
+      if (i % 20000 == 0) {
+        b.flush();
+      }
+      ASSERT_EQ(b.size(), left_view.size());
+      for (int k = -2000; k < 2000; k++) {
+        auto left = left_view.find(k);
+        auto right = right_view.find(static_cast<unsigned>(k + 2000));
+        auto found_left = b.find_left(k);
+        auto found_right = b.find_right(static_cast<unsigned>(k + 2000));
+        ASSERT_EQ(left != left_view.end(), found_left.has_value());
+        ASSERT_EQ(right != right_view.end(), found_right.has_value());
+        if (found_left) {
+          ASSERT_EQ(*found_left, left->second);
+        }
+        if (found_right) {
+          ASSERT_EQ(*found_right, right->second);
+        }
+      }
+    }
+  }
+  b.flush();
+  EXPECT_LE(b.runs(), 8);
+  EXPECT_GT(b.statistics().filtered, 0);
+}
+
+TEST(lru_eviction, simple) {
+  std::vector<std::pair<int, std::string>> evicted;
+  lru_bimap<int, std::string> b(
+      std::less<>(), std::less<>(), heap_storage(), no_observer(),
+      lru_eviction<int, std::string>(
+          3, [&](int const &l, std::string const &r) {
+            evicted.emplace_back(l, r);
+          }));
+  b.insert(1, "one");
+  b.insert(2, "two");
+  b.insert(3, "three");
+  EXPECT_EQ(b.at_left(1), "one");
+  EXPECT_EQ(b.find_right("two").flip(), b.find_left(2));
+  EXPECT_EQ(b.find_left(4), b.end_left());
+  EXPECT_THROW(b.at_right("four"), std::out_of_range);
+  // Searching doesn't count as a use, so 3 is the least recently used pair.
+  EXPECT_NE(b.search_left(3), b.end_left());
+  EXPECT_EQ(*b.insert(4, "four"), 4);
+  ASSERT_EQ(evicted.size(), 1);
+  EXPECT_EQ(evicted[0], std::make_pair(3, std::string("three")));
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.find_left(3), b.end_left());
+  EXPECT_EQ(b.at_left_or_default(5), "");
+  EXPECT_EQ(evicted.back(), std::make_pair(1, std::string("one")));
+  EXPECT_TRUE(b.erase_left(2));
+  b.insert(6, "six");
+  EXPECT_EQ(evicted.size(), 2);
+  EXPECT_EQ(b.eviction().statistics().hits, 3);
+  EXPECT_EQ(b.eviction().statistics().misses, 4);
+  EXPECT_EQ(b.eviction().statistics().evictions, 2);
+  // Copies link their nodes in left order and count from zero.
+  lru_bimap<int, std::string> c(b);
+  EXPECT_EQ(c.eviction().max_size(), 3);
+  EXPECT_EQ(c.eviction().statistics().hits, 0);
+  c.insert(7, "seven");
+  EXPECT_EQ(evicted.back(), std::make_pair(4, std::string("four")));
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(c.size(), 3);
+  lru_bimap<int, std::string> d(std::move(c));
+  d.insert(8, "eight");
+  EXPECT_EQ(evicted.back(), std::make_pair(5, std::string("")));
+}
+
+TEST(lru_eviction, compare_to_model) {
+  // The model keeps the left values from the most recently used to the
+  // least recently used one, next to the two views.
+  size_t const capacity = 300;
+  std::mt19937 e(seed);
+  std::vector<std::pair<int, int>> evicted;
+  lru_bimap<int, int> b(std::less<>(), std::less<>(), heap_storage(),
+                        no_observer(),
+                        lru_eviction<int, int>(
+                            capacity, [&](int const &l, int const &r) {
+                              evicted.emplace_back(l, r);
+                            }));
+  std::list<int> order;
+  std::map<int, int> left_view;
+  std::map<int, int> right_view;
+  auto touch = [&](int l) {
+    order.remove(l);
+    order.push_front(l);
+  };
+  auto erase = [&](int l) {
+    order.remove(l);
+    right_view.erase(left_view[l]);
+    left_view.erase(l);
+  };
+  auto insert = [&](int l, int r) {
+    left_view[l] = r;
+    right_view[r] = l;
+    order.push_front(l);
+    if (order.size() > capacity) {
+      int victim = order.back();
+      ASSERT_EQ(evicted.back(), std::make_pair(victim, left_view[victim]));
+      erase(victim);
+    }
+  };
+  for (size_t i = 0; i < 100000; i++) {
+    int l = static_cast<int>(e() % 1000);
+    int r = static_cast<int>(e() % 1000);
+    switch (e() % 6) {
+    case 0:
+    case 1: {
+      bool expected = !left_view.count(l) && !right_view.count(r);
+      ASSERT_EQ(b.insert(l, r) != b.end_left(), expected);
+      if (expected) {
+        insert(l, r);
+      }
+      break;
+    }
+    case 2: {
+      auto it = b.find_left(l);
+      ASSERT_EQ(it != b.end_left(), left_view.count(l) != 0);
+      if (it != b.end_left()) {
+        ASSERT_EQ(*it.flip(), left_view[l]);
+        touch(l);
+      }
+      break;
+    }
+    case 3:
+      if (right_view.count(r)) {
+        ASSERT_EQ(b.at_right(r), right_view[r]);
+        touch(right_view[r]);
+      } else {
+        ASSERT_THROW(b.at_right(r), std::out_of_range);
+      }
+      break;
+    case 4:
+      ASSERT_EQ(b.erase_left(l), left_view.count(l) != 0);
+      if (left_view.count(l)) {
+        erase(l);
+      }
+      break;
+    default:
+      if (left_view.count(l)) {
+        ASSERT_EQ(b.at_left_or_default(l), left_view[l]);
+        touch(l);
+      } else {
+        ASSERT_EQ(b.at_left_or_default(l), 0);
+        if (right_view.count(0)) {
+          erase(right_view[0]);
+        }
+        insert(l, 0);
+      }
+    }
+    ASSERT_EQ(b.size(), left_view.size());
+  }
+  auto it = b.begin_left();
+  for (auto const &pair : left_view) {
+    ASSERT_EQ(*it, pair.first);
+    ASSERT_EQ(*it.flip(), pair.second);
+    ++it;
+  }
+  auto const &statistics = b.eviction().statistics();
+  EXPECT_EQ(statistics.evictions, evicted.size());
+  EXPECT_GT(statistics.evictions, 1000);
+  EXPECT_GT(statistics.hits, 1000);
+  EXPECT_GT(statistics.misses, 1000);
+}
+
+// Clock for ttl_eviction which only moves when a test sets it.
+struct test_clock {
+  using duration = std::chrono::milliseconds;
+  using rep = duration::rep;
+  using period = duration::period;
+  using time_point = std::chrono::time_point<test_clock>;
+  static constexpr bool is_steady = true;
+
+  static inline time_point current{};
+
+  static time_point now() { return current; }
+};
+
+TEST(ttl_eviction, simple) {
+  using namespace std::chrono_literals;
+  using map_t =
+      ttl_bimap<int, std::string, std::less<>, std::less<>, test_clock>;
+  using eviction_t = ttl_eviction<int, std::string, test_clock>;
+  test_clock::current = test_clock::time_point();
+  std::vector<int> expired;
+  map_t b{std::less<>(), std::less<>(), heap_storage(), no_observer(),
+          eviction_t(100ms, 1ms, [&](int const &l, std::string const &) {
+            expired.push_back(l);
+          })};
+  b.insert(1, "one");
+  test_clock::current += 50ms;
+  b.insert(2, "two");
+  b.eviction().set_time_to_live(10ms);
+  b.insert(3, "three");
+  test_clock::current += 10ms;
+  // Expired pairs are absent for lookups before expire() erases them.
+  EXPECT_EQ(b.find_left(3), b.end_left());
+  EXPECT_THROW(b.at_right("three"), std::out_of_range);
+  EXPECT_EQ(b.size(), 3);
+  EXPECT_EQ(b.expire(test_clock::now()), 1);
+  EXPECT_EQ(expired, std::vector<int>({3}));
+  EXPECT_EQ(b.size(), 2);
+  test_clock::current += 39ms;
+  EXPECT_EQ(b.at_left(1), "one");
+  EXPECT_EQ(b.expire(test_clock::now()), 0);
+  test_clock::current += 1ms;
+  EXPECT_EQ(b.find_right("one"), b.end_right());
+  // Inserting a value of an expired pair evicts it.
+  EXPECT_NE(b.insert(4, "one"), b.end_left());
+  EXPECT_EQ(expired, std::vector<int>({3, 1}));
+  EXPECT_EQ(b.size(), 2);
+  EXPECT_EQ(b.at_left_or_default(2), "two");
+  test_clock::current += 1s;
+  EXPECT_EQ(b.expire(test_clock::now()), 2);
+  EXPECT_TRUE(b.empty());
+  // Deadlines far beyond the span of the wheel move down step by step.
+  b.eviction().set_time_to_live(std::chrono::hours(24 * 30));
+  b.insert(5, "five");
+  map_t c(std::move(b));
+  EXPECT_EQ(c.expire(test_clock::now() + std::chrono::hours(24 * 30) - 1ms),
+            0);
+  EXPECT_EQ(c.find_left(5).flip(), c.find_right("five"));
+  EXPECT_EQ(c.expire(test_clock::now() + std::chrono::hours(24 * 30)), 1);
+  EXPECT_TRUE(c.empty());
+  EXPECT_EQ(c.eviction().statistics().expired, 5);
+  EXPECT_GE(c.eviction().statistics().cascaded, 3);
+  EXPECT_EQ(c.eviction().statistics().stale_hits, 4);
+}
+
+TEST(ttl_eviction, compare_to_model) {
+  // With a resolution of 4ms, expire(now) erases the pairs due by the last
+  // multiple of 4ms not after now, lookups hide every pair due by now. Times
+  // to live of a tick at least keep pairs off the tick expire() reached.
+  using namespace std::chrono_literals;
+  using map_t = ttl_bimap<int, int, std::less<>, std::less<>, test_clock>;
+  using eviction_t = ttl_eviction<int, int, test_clock>;
+  test_clock::current = test_clock::time_point(12345ms);
+  std::mt19937 e(seed);
+  std::set<std::pair<int, int>> expired;
+  map_t b{std::less<>(), std::less<>(), heap_storage(), no_observer(),
+          eviction_t(1s, 4ms, [&](int const &l, int const &r) {
+            EXPECT_TRUE(expired.emplace(l, r).second);
+          })};
+  std::map<int, std::pair<int, test_clock::time_point>> left_view;
+  std::map<int, int> right_view;
+  auto erase = [&](int l) {
+    right_view.erase(left_view[l].first);
+    left_view.erase(l);
+  };
+  auto live = [&](int l) {
+    auto it = left_view.find(l);
+    return it != left_view.end() && it->second.second > test_clock::now();
+  };
+  for (size_t i = 0; i < 100000; i++) {
+    int l = static_cast<int>(e() % 1000);
+    int r = static_cast<int>(e() % 1000);
+    switch (e() % 8) {
+    case 0:
+    case 1:
+    case 2: {
+      if (e() % 100 == 0) {
+        // Beyond the span of the wheel, 2^24 ticks of 4ms.
+        b.eviction().set_time_to_live(
+            std::chrono::milliseconds(4 + e() % (1 << 27)));
+      } else {
+        b.eviction().set_time_to_live(std::chrono::milliseconds(4 + e() % 5000));
+      }
+      // The left value is checked first, so an expired pair holding it is
+      // evicted even if the right value is taken.
+      std::set<std::pair<int, int>> evicted;
+      bool free = true;
+      if (left_view.count(l)) {
+        if (live(l)) {
+          free = false;
+        } else {
+          evicted.emplace(l, left_view[l].first);
+          erase(l);
+        }
+      }
+      if (free && right_view.count(r)) {
+        if (live(right_view[r])) {
+          free = false;
+        } else {
+          evicted.emplace(right_view[r], r);
+          erase(right_view[r]);
+        }
+      }
+      expired.clear();
+      ASSERT_EQ(b.insert(l, r) != b.end_left(), free);
+      ASSERT_EQ(expired, evicted);
+      if (free) {
+        left_view[l] = {r, test_clock::now() + b.eviction().get_time_to_live()};
+        right_view[r] = l;
+      }
+      break;
+    }
+    case 3:
+      ASSERT_EQ(b.find_left(l) != b.end_left(), live(l));
+      break;
+    case 4:
+      ASSERT_EQ(b.find_right(r) != b.end_right(),
+                right_view.count(r) && live(right_view[r]));
+      break;
+    case 5:
+      ASSERT_EQ(b.erase_left(l), left_view.count(l) != 0);
+      if (left_view.count(l)) {
+        erase(l);
+      }
+      break;
+    case 6:
+      test_clock::current += std::chrono::milliseconds(
+          e() % 1000 == 0 ? e() % (1 << 28) : e() % 20);
+      break;
+    default: {
+      auto now = test_clock::now();
+      auto due = test_clock::time_point(now.time_since_epoch() / 4ms * 4ms);
+      std::set<std::pair<int, int>> evicted;
+      for (auto const &pair : left_view) {
+        if (pair.second.second <= due) {
+          evicted.emplace(pair.first, pair.second.first);
+        }
+      }
+      expired.clear();
+      ASSERT_EQ(b.expire(now), evicted.size());
+      ASSERT_EQ(expired, evicted);
+      for (auto const &pair : evicted) {
+        erase(pair.first);
+      }
+    }
+    }
+    ASSERT_EQ(b.size(), left_view.size());
+  }
+  EXPECT_GT(b.eviction().statistics().expired, 1000);
+  EXPECT_GT(b.eviction().statistics().stale_hits, 100);
+}
+
+TEST(small_bimap, simple) {
+  small_bimap<int, std::string, 4> b;
+  EXPECT_TRUE(b.empty());
+  auto end = b.end_left();
+  EXPECT_EQ(b.begin_left(), end);
+  EXPECT_EQ(*b.insert(2, "two"), 2);
+  EXPECT_EQ(++b.begin_left(), end);
+  EXPECT_EQ(*b.insert(1, "one").flip(), "one");
+  b.insert(4, "four");
+  EXPECT_EQ(b.insert(3, "one"), b.end_left());
+  EXPECT_EQ(b.insert(2, "three"), b.end_left());
+  b.insert(3, "three");
+  EXPECT_TRUE(b.is_inline());
+  EXPECT_EQ(b.at_left(3), "three");
+  EXPECT_EQ(b.at_right("four"), 4);
+  EXPECT_THROW(b.at_left(5), std::out_of_range);
+  EXPECT_EQ(*b.lower_bound_right("p"), "three");
+  EXPECT_EQ(*b.upper_bound_left(3), 4);
+  EXPECT_EQ(*--b.end_right(), "two");
+  small_bimap<int, std::string, 4> inline_copy(b);
+  b.insert(5, "five");
+  EXPECT_FALSE(b.is_inline());
+  EXPECT_EQ(b.size(), 5);
+  EXPECT_EQ(b.find_right("two").flip(), b.find_left(2));
+  EXPECT_NE(b, inline_copy);
+  EXPECT_TRUE(b.erase_right("five"));
+  EXPECT_EQ(b, inline_copy);
+  b.shrink_to_fit();
+  EXPECT_TRUE(b.is_inline());
+  EXPECT_EQ(b, inline_copy);
+  EXPECT_EQ(*b.erase_left(b.find_left(2)), 3);
+  EXPECT_EQ(b.at_left_or_default(6), "");
+  EXPECT_EQ(b.at_right_or_default("seven"), 0);
+  EXPECT_FALSE(b.is_inline());
+  // The default partner of 8 is taken by 6, which is erased first.
+  EXPECT_EQ(b.at_left_or_default(8), "");
+  EXPECT_EQ(b.find_left(6), b.end_left());
+  small_bimap<int, std::string, 4> moved(std::move(b));
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(moved.size(), 5);
+  b = inline_copy;
+  EXPECT_EQ(b, inline_copy);
+  moved.clear();
+  EXPECT_TRUE(moved.empty());
+}
+
+TEST(small_bimap, compare_to_two_maps) {
+  // Values from a range of 40 keep the map around N = 16, so that it grows
+  // into a tree and shrinks back inline again and again.
+  std::mt19937 e(seed);
+  small_bimap<int, std::string, 16> b;
+  std::map<int, std::string> left_view;
+  std::map<std::string, int> right_view;
+  size_t grown = 0;
+  for (size_t i = 0; i < 100000; i++) {
+    int l = static_cast<int>(e() % 40);
+    std::string r = std::to_string(e() % 40);
+    switch (e() % 6) {
+    case 0:
+    case 1: {
+      bool expected = !left_view.count(l) && !right_view.count(r);
+      bool was_inline = b.is_inline();
+      auto it = b.insert(l, r);
+      ASSERT_EQ(it != b.end_left(), expected);
+      if (expected) {
+        ASSERT_EQ(*it, l);
+        ASSERT_EQ(*it.flip(), r);
+        left_view[l] = r;
+        right_view[r] = l;
+        grown += (was_inline && !b.is_inline());
+      }
+      break;
+    }
+    case 2: {
+      auto it = left_view.find(l);
+      ASSERT_EQ(b.erase_left(l), it != left_view.end());
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+      break;
+    }
+    case 3: {
+      auto found = b.find_right(r);
+      ASSERT_EQ(found != b.end_right(), right_view.count(r) != 0);
+      if (found != b.end_right()) {
+        ASSERT_EQ(*found.flip(), right_view[r]);
+        left_view.erase(right_view[r]);
+        right_view.erase(r);
+        b.erase_right(found);
+      }
+      break;
+    }
+    case 4:
+      b.shrink_to_fit();
+      ASSERT_EQ(b.is_inline(), left_view.size() <= 16);
+      break;
+    default: {
+      auto it = b.lower_bound_left(l);
+      auto expected = left_view.lower_bound(l);
+      ASSERT_EQ(it == b.end_left(), expected == left_view.end());
+      if (it != b.end_left()) {
+        ASSERT_EQ(*it, expected->first);
+      }
+    }
+    }
+    ASSERT_EQ(b.size(), left_view.size());
+    if (i % 100 == 0) {
+      auto left = b.begin_left();
+      for (auto const &pair : left_view) {
+        ASSERT_EQ(*left, pair.first);
+        ASSERT_EQ(*left.flip(), pair.second);
+        ++left;
+      }
+      ASSERT_EQ(left, b.end_left());
+      auto right = b.begin_right();
+      for (auto const &pair : right_view) {
+        ASSERT_EQ(*right, pair.first);
+        ASSERT_EQ(*right.flip(), pair.second);
+        ++right;
+      }
+      ASSERT_EQ(right, b.end_right());
+    }
+  }
+  EXPECT_GT(grown, 100);
+}
+
+TEST(static_bimap, simple) {
+  static_bimap<int, std::string, 4> b;
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_left(), b.end_left());
+  EXPECT_EQ(*b.insert(2, "two"), 2);
+  EXPECT_EQ(*b.insert(1, "one").flip(), "one");
+  EXPECT_EQ(b.insert(3, "one"), b.end_left());
+  EXPECT_FALSE(b.full());
+  b.insert(4, "four");
+  EXPECT_NE(b.insert(3, "three"), b.end_left());
+  EXPECT_TRUE(b.full());
+  // A full map fails to insert without throwing.
+  EXPECT_EQ(b.insert(5, "five"), b.end_left());
+  EXPECT_EQ(b.size(), 4);
+  EXPECT_EQ(b.at_left(3), "three");
+  EXPECT_EQ(b.at_right("four"), 4);
+  EXPECT_THROW(b.at_left(5), std::out_of_range);
+  EXPECT_EQ(*b.lower_bound_right("p"), "three");
+  EXPECT_EQ(*b.upper_bound_left(3), 4);
+  EXPECT_EQ(*--b.end_right(), "two");
+  EXPECT_EQ(b.find_right("two").flip(), b.find_left(2));
+  static_bimap<int, std::string, 4> copy(b);
+  EXPECT_EQ(copy, b);
+  // References stay valid while other pairs are erased and inserted.
+  std::string const &three = b.at_left(3);
+  EXPECT_EQ(*b.erase_left(b.find_left(2)), 3);
+  EXPECT_TRUE(b.erase_right("one"));
+  EXPECT_FALSE(b.erase_right("one"));
+  EXPECT_NE(b.insert(5, "five"), b.end_left());
+  EXPECT_EQ(three, "three");
+  EXPECT_NE(copy, b);
+  b = copy;
+  EXPECT_EQ(b, copy);
+  static_bimap<int, std::string, 4> moved(std::move(b));
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(moved, copy);
+  EXPECT_EQ(moved.erase_left(moved.begin_left(), moved.end_left()),
+            moved.end_left());
+  EXPECT_TRUE(moved.empty());
+  EXPECT_EQ(moved.begin_right(), moved.end_right());
+}
+
+TEST(static_bimap, no_allocations) {
+  // Fills, drains and copies maps of both policies and checks the counting
+  // operator new was never called in between; results are checked after.
+  static_bimap<uint32_t, std::pair<int, int>, 1000> avl;
+  static_bimap<uint32_t, std::pair<int, int>, 1000, std::less<>, std::less<>,
+               splay_tree>
+      splay;
+  static_bimap<uint32_t, std::pair<int, int>, 1000> avl_copy;
+  std::mt19937 e(seed);
+  size_t inserted = 0;
+  size_t failed = 0;
+  size_t found = 0;
+  size_t before = allocations.load();
+  for (size_t round = 0; round < 5; round++) {
+    for (uint32_t i = 0; i < 1200; i++) {
+      uint32_t key = e() % 4000;
+      std::pair<int, int> value(static_cast<int>(key % 7), static_cast<int>(i));
+      bool added = avl.insert(key, value) != avl.end_left();
+      splay.insert(key, value);
+      inserted += added;
+      failed += !added && avl.full();
+    }
+    for (uint32_t key = 0; key < 4000; key++) {
+      found += avl.find_left(key) != avl.end_left();
+      found += splay.find_left(key) != splay.end_left();
+    }
+    avl_copy = avl;
+    for (auto it = avl.begin_left(); it != avl.end_left();) {
+      if (e() % 2 == 0) {
+        it = avl.erase_left(it);
+      } else {
+        ++it;
+      }
+    }
+    splay.erase_right(splay.begin_right(), splay.end_right());
+  }
+  size_t after = allocations.load();
+  EXPECT_EQ(after, before);
+  EXPECT_GT(inserted, 1000);
+  EXPECT_GT(failed, 0);
+  EXPECT_GT(found, 2000);
+  EXPECT_TRUE(splay.empty());
+  EXPECT_EQ(avl_copy.size(), avl_copy.capacity());
+}
+
+template <typename Map>
+void static_bimap_compare_to_two_maps(Map &b) {
+  // Few keys make inserts and erases collide often, and a capacity below the
+  // key count makes the map full often.
+  std::mt19937 e(seed);
+  std::map<int, unsigned> left_view;
+  std::map<unsigned, int> right_view;
+  for (size_t i = 0; i < 200000; i++) {
+    int l = static_cast<int>(e() % 3000) - 1500;
+    unsigned r = e() % 3000;
+    if (e() % 8 < 5) {
+      bool inserted = (b.insert(l, r) != b.end_left());
+      bool expected = !left_view.count(l) && !right_view.count(r) &&
+                      left_view.size() < b.capacity();
+      ASSERT_EQ(inserted, expected);
+      if (expected) {
+        left_view[l] = r;
+        right_view[r] = l;
+      }
+    } else if (e() % 2 == 0) {
+      auto it = left_view.find(l);
+      ASSERT_EQ(b.erase_left(l), it != left_view.end());
+      if (it != left_view.end()) {
+        right_view.erase(it->second);
+        left_view.erase(it);
+      }
+    } else {
+      auto it = right_view.find(r);
+      auto found = b.find_right(r);
+      ASSERT_EQ(found != b.end_right(), it != right_view.end());
+      if (it != right_view.end()) {
+        ASSERT_EQ(*found.flip(), it->second);
+        b.erase_right(found);
+        left_view.erase(it->second);
+        right_view.erase(it);
+      }
+    }
+    ASSERT_EQ(b.full(), left_view.size() == b.capacity());
+    if (i % 20000 == 0) {
+      ASSERT_EQ(b.size(), left_view.size());
+      auto it = b.begin_left();
+      for (auto const &p : left_view) {
+        ASSERT_EQ(*it, p.first);
+        ASSERT_EQ(*it.flip(), p.second);
+        ++it;
+      }
+      EXPECT_EQ(it, b.end_left());
+      auto rit = b.end_right();
+      for (auto p = right_view.rbegin(); p != right_view.rend(); ++p) {
+        --rit;
+        ASSERT_EQ(*rit, p->first);
+      }
+      for (int k = -1501; k <= 1501; k += 7) {
+        auto lower = left_view.lower_bound(k);
+        auto upper = right_view.upper_bound(static_cast<unsigned>(k));
+        auto b_lower = b.lower_bound_left(k);
+        auto b_upper = b.upper_bound_right(static_cast<unsigned>(k));
+        ASSERT_EQ(lower == left_view.end(), b_lower == b.end_left());
+        ASSERT_EQ(upper == right_view.end(), b_upper == b.end_right());
+        if (lower != left_view.end()) {
+          EXPECT_EQ(*b_lower, lower->first);
+        }
+        if (upper != right_view.end()) {
+          EXPECT_EQ(*b_upper, upper->first);
+        }
+      }
+    }
+  }
+  while (!left_view.empty()) {
+    ASSERT_TRUE(b.erase_left(left_view.begin()->first));
+    left_view.erase(left_view.begin());
+  }
+  EXPECT_TRUE(b.empty());
+  EXPECT_EQ(b.begin_right(), b.end_right());
+}
+
+TEST(static_bimap, compare_to_two_maps) {
+  static_bimap<int, unsigned, 1000> avl;
+  static_bimap_compare_to_two_maps(avl);
+  static_bimap<int, unsigned, 1000, std::less<>, std::less<>, splay_tree> splay;
+  static_bimap_compare_to_two_maps(splay);
+}
+
+enum class test_color { red, green, blue, black };
+
+static constexpr auto test_color_names =
+    make_constexpr_bimap<test_color, std::string_view>(
+        {{test_color::green, "green"},
+         {test_color::red, "red"},
+         {test_color::blue, "blue"},
+         {test_color::black, "black"}});
+
+TEST(constexpr_bimap, simple) {
+  // Lookups are constant expressions; a missing value or a duplicate in the
+  // list would fail to compile.
+  static_assert(test_color_names.size() == 4);
+  static_assert(test_color_names.at_left(test_color::blue) == "blue");
+  static_assert(test_color_names.at_right("red") == test_color::red);
+  static_assert(*test_color_names.find_right("green").flip() ==
+                test_color::green);
+  static_assert(test_color_names.find_left(test_color(7)) ==
+                test_color_names.end_left());
+  static_assert(*test_color_names.begin_right() == "black");
+  static_assert(*--test_color_names.end_left() == test_color::black);
+  static_assert(*test_color_names.upper_bound_right("blue") == "green");
+  std::vector<std::string_view> names;
+  for (auto it = test_color_names.begin_left();
+       it != test_color_names.end_left(); ++it) {
+    names.push_back(*it.flip());
+  }
+  EXPECT_EQ(names, (std::vector<std::string_view>{"red", "green", "blue",
+                                                  "black"}));
+  std::string white = "white";
+  EXPECT_THROW(test_color_names.at_right(white), std::out_of_range);
+  // Outside constant expressions duplicates throw.
+  EXPECT_THROW((make_constexpr_bimap<int, int>({{1, 2}, {3, 4}, {1, 5}})),
+               std::invalid_argument);
+  EXPECT_THROW((make_constexpr_bimap<int, int>({{1, 2}, {3, 2}})),
+               std::invalid_argument);
+  auto reversed = make_constexpr_bimap<int, int, std::greater<>>(
+      {{1, 2}, {3, 4}, {2, 6}});
+  EXPECT_EQ(*reversed.begin_left(), 3);
+  EXPECT_EQ(reversed.at_right(6), 2);
+}
+
+TEST(constexpr_bimap, compare_to_two_maps) {
+  std::mt19937 e(seed);
+  std::map<int, unsigned> left_view;
+  std::map<unsigned, int> right_view;
+  static std::pair<int, unsigned> pairs[1000];
+  for (auto &p : pairs) {
+    do {
+      p = {static_cast<int>(e() % 5000) - 2500, e() % 5000};
+    } while (left_view.count(p.first) || right_view.count(p.second));
+    left_view[p.first] = p.second;
+    right_view[p.second] = p.first;
+  }
+  constexpr_bimap<int, unsigned, 1000> b(pairs);
+  auto it = b.begin_left();
+  for (auto const &p : left_view) {
+    ASSERT_EQ(*it, p.first);
+    ASSERT_EQ(*it.flip(), p.second);
+    ++it;
+  }
+  EXPECT_EQ(it, b.end_left());
+  auto rit = b.begin_right();
+  for (auto const &p : right_view) {
+    ASSERT_EQ(*rit, p.first);
+    ASSERT_EQ(*rit.flip(), p.second);
+    ++rit;
+  }
+  for (int k = -2501; k <= 2501; k++) {
+    auto found = left_view.find(k);
+    ASSERT_EQ(b.find_left(k) == b.end_left(), found == left_view.end());
+    if (found != left_view.end()) {
+      ASSERT_EQ(b.at_left(k), found->second);
+    }
+    auto lower = right_view.lower_bound(static_cast<unsigned>(k));
+    auto b_lower = b.lower_bound_right(static_cast<unsigned>(k));
+    ASSERT_EQ(lower == right_view.end(), b_lower == b.end_right());
+    if (lower != right_view.end()) {
+      ASSERT_EQ(*b_lower, lower->first);
+    }
+  }
+}
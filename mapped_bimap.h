@@ -0,0 +1,377 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <algorithm>   // std::lower_bound, std::upper_bound
+#include <cstddef>     // size_t
+#include <cstdint>     // uint32_t, uint64_t
+#include <cstring>     // std::memcmp
+#include <functional>  // std::less
+#include <limits>      // std::numeric_limits
+#include <stdexcept>   // std::out_of_range, std::runtime_error
+#include <string>      // std::string
+#include <type_traits> // std::is_trivially_copyable
+#include <utility>     // std::move, std::swap
+
+#include <fcntl.h>    // open
+#include <sys/mman.h> // mmap, munmap, madvise
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close
+
+/*
+ * Read-only bimap served directly from a memory-mapped snapshot written by bimap::save(), POSIX only.
+ * Nothing is deserialized: lookups binary search the sorted sections of the file and follow the stored partner ranks,
+ * so opening takes O(1) time, pages are read on first touch and the page cache is shared by every process
+ * mapping the same file. Opening checks the header and the section bounds only, verify() checks the checksum.
+ * Optionally the whole file is read ahead on opening, by madvise(MADV_WILLNEED) or by MAP_POPULATE.
+ * Requires O(log(size)) time for finding one element, O(1) for iterating, and O(1) bytes memory besides the mapping.
+ * Values must be trivially copyable, with an alignment of at most 8 bytes, and ordered by the comparators the map
+ * was saved with. The file must not be modified while it is mapped.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class mapped_bimap
+{
+    static_assert(std::is_trivially_copyable<Left>::value && std::is_trivially_copyable<Right>::value, "mapped_bimap requires trivially copyable values");
+    static_assert(alignof(Left) <= 8 && alignof(Right) <= 8, "mapped_bimap requires values aligned to at most 8 bytes");
+
+    struct left_descriptor_t
+    {
+        static Left const * values(mapped_bimap const * map) noexcept
+        {
+            return map->left_values;
+        }
+
+        static size_t partner(mapped_bimap const * map, size_t rank) noexcept
+        {
+            return map->rank_at(map->left_partners, rank);
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static Right const * values(mapped_bimap const * map) noexcept
+        {
+            return map->right_values;
+        }
+
+        static size_t partner(mapped_bimap const * map, size_t rank) noexcept
+        {
+            return map->rank_at(map->right_partners, rank);
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class mapped_bimap<Left, Right, LeftComparator, RightComparator>;
+
+        template <typename, typename, typename, typename>
+        friend class basic_iterator;
+
+        basic_iterator(mapped_bimap const * map, size_t rank) noexcept
+            : map(map)
+            , rank(rank)
+        {
+        }
+
+        mapped_bimap const * map;
+        size_t rank;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->rank == other.rank);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            ++rank;
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++rank;
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            --rank;
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --rank;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::values(map)[rank];
+        }
+
+        auto flip() const noexcept
+        {
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, MainDescriptor::partner(map, rank));
+        }
+    };
+
+    size_t rank_at(void const * ranks, size_t rank) const noexcept
+    {
+        if (rank_size == sizeof(uint32_t)) {
+            return static_cast<uint32_t const *>(ranks)[rank];
+        }
+        return static_cast<uint64_t const *>(ranks)[rank];
+    }
+
+    template <typename Iterator, typename T, typename Comparator>
+    Iterator find_element(T const * values, T const & desired, Comparator const & compare) const
+    {
+        T const * found = std::lower_bound(values, values + elements_count, desired, compare);
+        if (found != values + elements_count && *found == desired) {
+            return Iterator(this, found - values);
+        }
+        return Iterator(this, elements_count);
+    }
+
+    template <typename FirstType, typename SecondType, typename FirstComparator>
+    SecondType const & at_element(FirstType const * values, SecondType const * partners_values, void const * partners, FirstType const & key, FirstComparator const & compare) const
+    {
+        FirstType const * found = std::lower_bound(values, values + elements_count, key, compare);
+        if (found == values + elements_count || !(*found == key)) {
+            throw std::out_of_range("No matching element.");
+        }
+        return partners_values[rank_at(partners, found - values)];
+    }
+
+    /* Checks that every section fits between its offset and the next one */
+    static bool valid_layout(snapshot_header const & header, uint64_t file_size) noexcept
+    {
+        uint64_t count = header.count;
+        auto fits = [&](uint64_t offset, uint64_t element_size, uint64_t limit) {
+            return (offset % 8 == 0 && offset >= sizeof(snapshot_header) && offset <= limit && count <= (limit - offset) / element_size);
+        };
+        return (header.file_size == file_size
+                && fits(header.left_offset, sizeof(Left), header.right_offset)
+                && fits(header.right_offset, sizeof(Right), header.left_partners_offset)
+                && fits(header.left_partners_offset, header.rank_size, header.right_partners_offset)
+                && fits(header.right_partners_offset, header.rank_size, file_size));
+    }
+
+    void unmap() noexcept
+    {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+        }
+        mapping = nullptr;
+        mapping_size = 0;
+    }
+
+    void * mapping;
+    size_t mapping_size;
+    size_t elements_count;
+    uint32_t rank_size;
+    Left const * left_values;
+    Right const * right_values;
+    void const * left_partners;
+    void const * right_partners;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+
+public:
+    enum class warm_up
+    {
+        /* Pages are read on first touch */
+        none,
+        /* The kernel reads the whole file ahead in the background */
+        advise,
+        /* Opening blocks until the whole file is mapped */
+        populate,
+    };
+
+    explicit mapped_bimap(std::string const & path, warm_up mode = warm_up::none, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : mapping(nullptr)
+        , mapping_size(0)
+        , left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+    {
+        int descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) {
+            throw std::runtime_error("Can't open snapshot " + path + ".");
+        }
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || static_cast<uint64_t>(status.st_size) < sizeof(snapshot_header)) {
+            close(descriptor);
+            throw std::runtime_error("Not a snapshot.");
+        }
+        int flags = MAP_SHARED;
+#ifdef MAP_POPULATE
+        if (mode == warm_up::populate) {
+            flags |= MAP_POPULATE;
+        }
+#endif
+        mapping_size = static_cast<size_t>(status.st_size);
+        mapping = mmap(nullptr, mapping_size, PROT_READ, flags, descriptor, 0);
+        close(descriptor);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::runtime_error("Can't map snapshot " + path + ".");
+        }
+        if (mode == warm_up::advise) {
+            madvise(mapping, mapping_size, MADV_WILLNEED);
+        }
+
+        snapshot_header const & header = *static_cast<snapshot_header const *>(mapping);
+        if (std::memcmp(header.magic, snapshot_header::signature, sizeof(header.magic)) != 0
+            || header.version != snapshot_header::current_version || header.byte_order != snapshot_header::native_byte_order
+            || header.left_size != sizeof(Left) || header.right_size != sizeof(Right)
+            || header.rank_size != (header.count < std::numeric_limits<uint32_t>::max() ? sizeof(uint32_t) : sizeof(uint64_t))
+            || !valid_layout(header, mapping_size)) {
+            unmap();
+            throw std::runtime_error("Snapshot doesn't match the value types or is corrupted.");
+        }
+        char const * bytes = static_cast<char const *>(mapping);
+        elements_count = header.count;
+        rank_size = header.rank_size;
+        left_values = reinterpret_cast<Left const *>(bytes + header.left_offset);
+        right_values = reinterpret_cast<Right const *>(bytes + header.right_offset);
+        left_partners = bytes + header.left_partners_offset;
+        right_partners = bytes + header.right_partners_offset;
+    }
+
+    mapped_bimap(mapped_bimap const &) = delete;
+    mapped_bimap & operator=(mapped_bimap const &) = delete;
+
+    mapped_bimap(mapped_bimap && other) noexcept
+        : mapping(other.mapping)
+        , mapping_size(other.mapping_size)
+        , elements_count(other.elements_count)
+        , rank_size(other.rank_size)
+        , left_values(other.left_values)
+        , right_values(other.right_values)
+        , left_partners(other.left_partners)
+        , right_partners(other.right_partners)
+        , left_compare(std::move(other.left_compare))
+        , right_compare(std::move(other.right_compare))
+    {
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+        other.elements_count = 0;
+    }
+
+    mapped_bimap & operator=(mapped_bimap && other) noexcept
+    {
+        std::swap(mapping, other.mapping);
+        std::swap(mapping_size, other.mapping_size);
+        std::swap(elements_count, other.elements_count);
+        std::swap(rank_size, other.rank_size);
+        std::swap(left_values, other.left_values);
+        std::swap(right_values, other.right_values);
+        std::swap(left_partners, other.left_partners);
+        std::swap(right_partners, other.right_partners);
+        std::swap(left_compare, other.left_compare);
+        std::swap(right_compare, other.right_compare);
+        return *this;
+    }
+
+    ~mapped_bimap()
+    {
+        unmap();
+    }
+
+    /* Reads the whole file, returns false if the checksum doesn't match */
+    bool verify() const noexcept
+    {
+        snapshot_header header = *static_cast<snapshot_header const *>(mapping);
+        uint64_t expected = header.checksum;
+        header.checksum = 0;
+        snapshot_checksum checksum;
+        checksum.update(static_cast<char const *>(mapping) + sizeof(header), mapping_size - sizeof(header));
+        checksum.update(&header, sizeof(header));
+        return (checksum.value() == expected);
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, 0);
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, elements_count);
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, 0);
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, elements_count);
+    }
+
+    bool empty() const noexcept
+    {
+        return (elements_count == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count;
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return find_element<left_iterator>(left_values, desired, left_compare);
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return find_element<right_iterator>(right_values, desired, right_compare);
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        return left_iterator(this, std::lower_bound(left_values, left_values + elements_count, value, left_compare) - left_values);
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        return left_iterator(this, std::upper_bound(left_values, left_values + elements_count, value, left_compare) - left_values);
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        return right_iterator(this, std::lower_bound(right_values, right_values + elements_count, value, right_compare) - right_values);
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        return right_iterator(this, std::upper_bound(right_values, right_values + elements_count, value, right_compare) - right_values);
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        return at_element(left_values, right_values, left_partners, key, left_compare);
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        return at_element(right_values, left_values, right_partners, key, right_compare);
+    }
+};
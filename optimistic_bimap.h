@@ -0,0 +1,491 @@
+#pragma once
+
+#include "epoch_reclaimer.h"
+
+#include <atomic>     // std::atomic, std::atomic_thread_fence
+#include <cstddef>    // size_t
+#include <cstdint>    // uint32_t, uint64_t
+#include <functional> // std::less
+#include <mutex>      // std::mutex, std::lock_guard
+#include <optional>   // std::optional
+#include <stdexcept>  // std::out_of_range
+#include <thread>     // std::this_thread
+#include <utility>    // std::forward, std::move, std::pair
+
+/*
+ * Has treap based structure: both trees are balanced by random priorities and are never splayed,
+ * so lookups don't modify the trees.
+ * Readers never take a lock: they traverse the trees optimistically, then validate a per-map version
+ * counter (seqlock) and retry if a writer has changed the trees in the meantime.
+ * Writers are serialized by a mutex and mutate the trees in place.
+ * Erased nodes are retired to an epoch_reclaimer instead of deleted, so they are freed only once no reader
+ * that could have seen them is still running.
+ * Requires O(log(size)) expected time for inserting, erasing or finding one element.
+ * Lookups return copies of the stored values, since references may be invalidated by a concurrent writer.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class optimistic_bimap
+{
+    /* Stores data of left and right trees in the same node */
+    struct node_t
+    {
+        struct tree_node_t
+        {
+            std::atomic<node_t *> left;
+            std::atomic<node_t *> right;
+
+            tree_node_t() noexcept
+                : left(nullptr)
+                , right(nullptr)
+            {
+            }
+        };
+
+        template <typename L, typename R>
+        explicit node_t(L left_value, R right_value, uint32_t priority)
+            : left_value(std::forward<L>(left_value))
+            , right_value(std::forward<R>(right_value))
+            , priority(priority)
+        {
+        }
+
+        Left const left_value;
+        Right const right_value;
+        uint32_t const priority;
+        tree_node_t left_tree_data;
+        tree_node_t right_tree_data;
+    };
+
+    struct left_descriptor_t
+    {
+        static std::atomic<node_t *> & left(node_t * node) noexcept
+        {
+            return node->left_tree_data.left;
+        }
+
+        static std::atomic<node_t *> const & left(node_t const * node) noexcept
+        {
+            return node->left_tree_data.left;
+        }
+
+        static std::atomic<node_t *> & right(node_t * node) noexcept
+        {
+            return node->left_tree_data.right;
+        }
+
+        static std::atomic<node_t *> const & right(node_t const * node) noexcept
+        {
+            return node->left_tree_data.right;
+        }
+
+        static Left const & value(node_t const * node) noexcept
+        {
+            return node->left_value;
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static std::atomic<node_t *> & left(node_t * node) noexcept
+        {
+            return node->right_tree_data.left;
+        }
+
+        static std::atomic<node_t *> const & left(node_t const * node) noexcept
+        {
+            return node->right_tree_data.left;
+        }
+
+        static std::atomic<node_t *> & right(node_t * node) noexcept
+        {
+            return node->right_tree_data.right;
+        }
+
+        static std::atomic<node_t *> const & right(node_t const * node) noexcept
+        {
+            return node->right_tree_data.right;
+        }
+
+        static Right const & value(node_t const * node) noexcept
+        {
+            return node->right_value;
+        }
+    };
+
+    /* Bounds a single optimistic traversal: concurrent restructuring may lead a reader astray */
+    static constexpr size_t max_traversal_steps = size_t(1) << 16;
+
+    /*
+     * Runs traversal as an optimistic read section until it completes without interference from writers.
+     * Traversal returns false if it gave up, which only happens when the trees were modified concurrently.
+     */
+    template <typename Result, typename Traversal>
+    Result read(Traversal const & traversal) const
+    {
+        epoch_reclaimer::guard guard = reclaimer.pin();
+        for (size_t attempt = 0;; ++attempt) {
+            uint64_t before = version.load(std::memory_order_acquire);
+            if ((before & 1) == 0) {
+                Result result;
+                bool completed = traversal(result);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (completed && version.load(std::memory_order_relaxed) == before) {
+                    return result;
+                }
+            }
+            if (attempt % 64 == 63) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    /* Finds the node with value equal to x, leaves nullptr in found if there is none */
+    template <typename Descriptor, typename T, typename Comparator>
+    static bool find(std::atomic<node_t *> const & root, T const & x, Comparator const & compare, node_t const *& found) noexcept
+    {
+        node_t const * t = root.load(std::memory_order_acquire);
+        for (size_t steps = 0; t != nullptr; ++steps) {
+            if (steps == max_traversal_steps) {
+                return false;
+            }
+            if (compare(x, Descriptor::value(t))) {
+                t = Descriptor::left(t).load(std::memory_order_acquire);
+            }
+            else if (compare(Descriptor::value(t), x)) {
+                t = Descriptor::right(t).load(std::memory_order_acquire);
+            }
+            else {
+                break;
+            }
+        }
+        found = t;
+        return true;
+    }
+
+    /* Finds the first node with value not less than x (or greater than x, if strict) */
+    template <typename Descriptor, bool strict, typename T, typename Comparator>
+    static bool bound(std::atomic<node_t *> const & root, T const & x, Comparator const & compare, node_t const *& found) noexcept
+    {
+        node_t const * t = root.load(std::memory_order_acquire);
+        node_t const * candidate = nullptr;
+        for (size_t steps = 0; t != nullptr; ++steps) {
+            if (steps == max_traversal_steps) {
+                return false;
+            }
+            if (strict ? compare(x, Descriptor::value(t)) : !compare(Descriptor::value(t), x)) {
+                candidate = t;
+                t = Descriptor::left(t).load(std::memory_order_acquire);
+            }
+            else {
+                t = Descriptor::right(t).load(std::memory_order_acquire);
+            }
+        }
+        found = candidate;
+        return true;
+    }
+
+    template <typename FirstDescriptor, typename SecondDescriptor, typename SecondType, typename T, typename Comparator>
+    std::optional<SecondType> find_element(std::atomic<node_t *> const & root, T const & key, Comparator const & compare) const
+    {
+        return read<std::optional<SecondType>>([&](std::optional<SecondType> & result) {
+            node_t const * found = nullptr;
+            if (!find<FirstDescriptor>(root, key, compare, found)) {
+                return false;
+            }
+            if (found != nullptr) {
+                result.emplace(SecondDescriptor::value(found));
+            }
+            return true;
+        });
+    }
+
+    template <typename FirstDescriptor, typename SecondDescriptor, bool strict, typename FirstType, typename SecondType, typename T, typename Comparator>
+    std::optional<std::pair<FirstType, SecondType>> bound_element(std::atomic<node_t *> const & root, T const & key, Comparator const & compare) const
+    {
+        return read<std::optional<std::pair<FirstType, SecondType>>>([&](std::optional<std::pair<FirstType, SecondType>> & result) {
+            node_t const * found = nullptr;
+            if (!bound<FirstDescriptor, strict>(root, key, compare, found)) {
+                return false;
+            }
+            if (found != nullptr) {
+                result.emplace(FirstDescriptor::value(found), SecondDescriptor::value(found));
+            }
+            return true;
+        });
+    }
+
+    /*
+     * Writer side. Called with writer_mutex held and inside an odd version, so that concurrent readers
+     * notice any intermediate state. Links are published with release stores, so that readers
+     * never see a node before its values are constructed.
+     */
+
+    /* Returns the link that points to the node with value equal to x, or the empty link where it belongs */
+    template <typename Descriptor, typename T, typename Comparator>
+    static std::atomic<node_t *> & find_link(std::atomic<node_t *> & root, T const & x, Comparator const & compare) noexcept
+    {
+        std::atomic<node_t *> * link = &root;
+        for (node_t * t = link->load(std::memory_order_relaxed); t != nullptr; t = link->load(std::memory_order_relaxed)) {
+            if (compare(x, Descriptor::value(t))) {
+                link = &Descriptor::left(t);
+            }
+            else if (compare(Descriptor::value(t), x)) {
+                link = &Descriptor::right(t);
+            }
+            else {
+                break;
+            }
+        }
+        return *link;
+    }
+
+    /* Splits t into values less than and greater than x, x itself must not be present */
+    template <typename Descriptor, typename T, typename Comparator>
+    static void split(node_t * t, T const & x, Comparator const & compare, std::atomic<node_t *> & less, std::atomic<node_t *> & greater) noexcept
+    {
+        if (t == nullptr) {
+            less.store(nullptr, std::memory_order_release);
+            greater.store(nullptr, std::memory_order_release);
+        }
+        else if (compare(Descriptor::value(t), x)) {
+            split<Descriptor>(Descriptor::right(t).load(std::memory_order_relaxed), x, compare, Descriptor::right(t), greater);
+            less.store(t, std::memory_order_release);
+        }
+        else {
+            split<Descriptor>(Descriptor::left(t).load(std::memory_order_relaxed), x, compare, less, Descriptor::left(t));
+            greater.store(t, std::memory_order_release);
+        }
+    }
+
+    template <typename Descriptor>
+    static node_t * merge(node_t * a, node_t * b) noexcept
+    {
+        if (a == nullptr) {
+            return b;
+        }
+        if (b == nullptr) {
+            return a;
+        }
+        if (a->priority > b->priority) {
+            Descriptor::right(a).store(merge<Descriptor>(Descriptor::right(a).load(std::memory_order_relaxed), b), std::memory_order_release);
+            return a;
+        }
+        else {
+            Descriptor::left(b).store(merge<Descriptor>(a, Descriptor::left(b).load(std::memory_order_relaxed)), std::memory_order_release);
+            return b;
+        }
+    }
+
+    template <typename Descriptor, typename Comparator>
+    static void insert(std::atomic<node_t *> & root, node_t * new_node, Comparator const & compare) noexcept
+    {
+        std::atomic<node_t *> * link = &root;
+        for (node_t * t = link->load(std::memory_order_relaxed); t != nullptr && t->priority >= new_node->priority; t = link->load(std::memory_order_relaxed)) {
+            if (compare(Descriptor::value(new_node), Descriptor::value(t))) {
+                link = &Descriptor::left(t);
+            }
+            else {
+                link = &Descriptor::right(t);
+            }
+        }
+        split<Descriptor>(link->load(std::memory_order_relaxed), Descriptor::value(new_node), compare, Descriptor::left(new_node), Descriptor::right(new_node));
+        link->store(new_node, std::memory_order_release);
+    }
+
+    template <typename Descriptor>
+    static void erase(std::atomic<node_t *> & link) noexcept
+    {
+        node_t * t = link.load(std::memory_order_relaxed);
+        link.store(merge<Descriptor>(Descriptor::left(t).load(std::memory_order_relaxed), Descriptor::right(t).load(std::memory_order_relaxed)), std::memory_order_release);
+    }
+
+    class write_section
+    {
+    public:
+        explicit write_section(optimistic_bimap & map) noexcept
+            : map(map)
+        {
+            map.version.store(map.version.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+        }
+
+        write_section(write_section const &) = delete;
+        write_section & operator=(write_section const &) = delete;
+
+        ~write_section()
+        {
+            map.version.store(map.version.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+        }
+
+    private:
+        optimistic_bimap & map;
+    };
+
+    uint32_t next_priority() noexcept
+    {
+        /* xorshift32 */
+        random_state ^= random_state << 13;
+        random_state ^= random_state >> 17;
+        random_state ^= random_state << 5;
+        return random_state;
+    }
+
+    template <typename L, typename R>
+    bool insert_by_values(L && left, R && right)
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        if (find_link<left_descriptor_t>(left_root, left, left_compare).load(std::memory_order_relaxed) != nullptr || find_link<right_descriptor_t>(right_root, right, right_compare).load(std::memory_order_relaxed) != nullptr) {
+            return false;
+        }
+        node_t * new_node = new node_t(std::forward<L>(left), std::forward<R>(right), next_priority());
+        {
+            write_section section(*this);
+            insert<left_descriptor_t>(left_root, new_node, left_compare);
+            insert<right_descriptor_t>(right_root, new_node, right_compare);
+        }
+        elements_count.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    template <typename FirstDescriptor, typename SecondDescriptor, typename T, typename FirstComparator, typename SecondComparator>
+    bool erase_element(std::atomic<node_t *> & first_root, std::atomic<node_t *> & second_root, T const & key, FirstComparator const & first_compare, SecondComparator const & second_compare)
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex);
+        std::atomic<node_t *> & first_link = find_link<FirstDescriptor>(first_root, key, first_compare);
+        node_t * excess = first_link.load(std::memory_order_relaxed);
+        if (excess == nullptr) {
+            return false;
+        }
+        std::atomic<node_t *> & second_link = find_link<SecondDescriptor>(second_root, SecondDescriptor::value(excess), second_compare);
+        {
+            write_section section(*this);
+            erase<FirstDescriptor>(first_link);
+            erase<SecondDescriptor>(second_link);
+        }
+        elements_count.fetch_sub(1, std::memory_order_relaxed);
+        reclaimer.retire(excess);
+        return true;
+    }
+
+    template <typename Descriptor>
+    static void destroy(node_t * node) noexcept
+    {
+        if (node == nullptr) {
+            return;
+        }
+        destroy<Descriptor>(Descriptor::left(node).load(std::memory_order_relaxed));
+        destroy<Descriptor>(Descriptor::right(node).load(std::memory_order_relaxed));
+        delete node;
+    }
+
+    std::atomic<node_t *> left_root;
+    std::atomic<node_t *> right_root;
+    std::atomic<uint64_t> version;
+    std::atomic<size_t> elements_count;
+    std::mutex writer_mutex;
+    epoch_reclaimer reclaimer;
+    uint32_t random_state;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+
+public:
+    explicit optimistic_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator()) noexcept
+        : left_root(nullptr)
+        , right_root(nullptr)
+        , version(0)
+        , elements_count(0)
+        , random_state(2463534242u)
+        , left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+    {
+    }
+
+    optimistic_bimap(optimistic_bimap const &) = delete;
+    optimistic_bimap & operator=(optimistic_bimap const &) = delete;
+
+    /* Must not run concurrently with any other operation */
+    ~optimistic_bimap()
+    {
+        destroy<left_descriptor_t>(left_root.load(std::memory_order_relaxed));
+    }
+
+    bool empty() const noexcept
+    {
+        return (size() == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return elements_count.load(std::memory_order_relaxed);
+    }
+
+    std::optional<Right> find_left(Left const & desired) const
+    {
+        return find_element<left_descriptor_t, right_descriptor_t, Right>(left_root, desired, left_compare);
+    }
+
+    std::optional<Left> find_right(Right const & desired) const
+    {
+        return find_element<right_descriptor_t, left_descriptor_t, Left>(right_root, desired, right_compare);
+    }
+
+    Right at_left(Left const & key) const
+    {
+        std::optional<Right> found = find_left(key);
+        if (!found) {
+            throw std::out_of_range("No matching element.");
+        }
+        return std::move(*found);
+    }
+
+    Left at_right(Right const & key) const
+    {
+        std::optional<Left> found = find_right(key);
+        if (!found) {
+            throw std::out_of_range("No matching element.");
+        }
+        return std::move(*found);
+    }
+
+    std::optional<std::pair<Left, Right>> lower_bound_left(Left const & value) const
+    {
+        return bound_element<left_descriptor_t, right_descriptor_t, false, Left, Right>(left_root, value, left_compare);
+    }
+
+    std::optional<std::pair<Left, Right>> upper_bound_left(Left const & value) const
+    {
+        return bound_element<left_descriptor_t, right_descriptor_t, true, Left, Right>(left_root, value, left_compare);
+    }
+
+    std::optional<std::pair<Right, Left>> lower_bound_right(Right const & value) const
+    {
+        return bound_element<right_descriptor_t, left_descriptor_t, false, Right, Left>(right_root, value, right_compare);
+    }
+
+    std::optional<std::pair<Right, Left>> upper_bound_right(Right const & value) const
+    {
+        return bound_element<right_descriptor_t, left_descriptor_t, true, Right, Left>(right_root, value, right_compare);
+    }
+
+    /* Returns false if either value is already present */
+    bool insert(Left const & left, Right const & right)
+    {
+        return insert_by_values(left, right);
+    }
+
+    bool insert(Left && left, Right && right)
+    {
+        return insert_by_values(std::move(left), std::move(right));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return erase_element<left_descriptor_t, right_descriptor_t>(left_root, right_root, key, left_compare, right_compare);
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return erase_element<right_descriptor_t, left_descriptor_t>(right_root, left_root, key, right_compare, left_compare);
+    }
+};
@@ -0,0 +1,1493 @@
+#pragma once
+
+#include "snapshot.h"
+
+#include <algorithm>     // std::copy, std::copy_backward, std::lower_bound, std::upper_bound, std::max, std::sort
+#include <cstddef>       // size_t
+#include <cstdint>       // uint32_t, uint64_t
+#include <cstring>       // std::memcmp, std::memcpy, std::memset
+#include <functional>    // std::less
+#include <limits>        // std::numeric_limits
+#include <memory>        // std::unique_ptr
+#include <optional>      // std::optional
+#include <stdexcept>     // std::length_error, std::out_of_range, std::runtime_error
+#include <string>        // std::string
+#include <type_traits>   // std::is_trivially_copyable
+#include <unordered_map> // std::unordered_map
+#include <utility>       // std::move, std::swap
+#include <vector>        // std::vector
+
+#include <fcntl.h>    // open
+#include <sys/file.h> // flock
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close, fdatasync, ftruncate, pread, pwrite
+
+/*
+ * Out-of-core bimap for data sets larger than memory, POSIX only. The file is divided into pages of PageSize bytes:
+ * a header page, the pages of a heap holding every pair once, and the pages of one B+-tree per side, whose leaves
+ * map values to the positions of their pairs in the heap. Only a buffer pool of a fixed number of frames is kept
+ * in memory: when a page is missing and every frame is taken, the CLOCK hand evicts the first unpinned page which
+ * wasn't used since the hand last passed it, writing it back if it was changed.
+ * Iterators pin the leaf they point into, so a dereferenced value stays valid while the iterator lives;
+ * at_left() and at_right() read the partner from the heap and return a copy.
+ * Requires O(log(size)) page accesses for inserting, erasing or finding one element, O(1) amortized for iterating,
+ * and O(log(size)) for flip(); requires pool_pages * PageSize bytes memory plus a table of the resident pages.
+ * Requires about (sizeof(Left) + sizeof(Right) + (sizeof(Left) + sizeof(Right) + 16) / fill) * size bytes of the file,
+ * where the fill factor of leaves is between 1/2 and 1; erased pairs and pages are reused, the file never shrinks.
+ * Values must be trivially copyable and default constructible with an alignment of at most 8 bytes, and the file
+ * must be reopened with the same types and comparators; the file is locked while it is open.
+ * Like btree_bimap, inserting or erasing invalidates every iterator. Every pinned page takes a frame,
+ * so holding more iterators than the pool has spare frames throws std::length_error.
+ *
+ * Changes become durable by sync() through a redo journal next to the file, path.journal. Pages of the last synced
+ * state are never overwritten between syncs: evicting such a changed page writes it to the journal instead, and
+ * it is read back from there. sync() writes the remaining changed pages, then the directory of the journal and
+ * the header; syncing the journal commits the changes, which are then copied into the file, which is synced before
+ * the journal is emptied. Opening applies a committed journal and discards any other one, so after a crash the map
+ * holds the state of the last finished sync. The journal takes a page per page changed since the last sync.
+ * An I/O error in the middle of a change or a sync leaves the map unusable.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>, size_t PageSize = 4096>
+class paged_bimap
+{
+    static_assert(std::is_trivially_copyable<Left>::value && std::is_trivially_copyable<Right>::value, "paged_bimap requires trivially copyable values");
+    static_assert(alignof(Left) <= 8 && alignof(Right) <= 8, "paged_bimap requires values aligned to at most 8 bytes");
+    static_assert(PageSize % 64 == 0, "paged_bimap requires pages of a multiple of 64 bytes");
+
+public:
+    static constexpr size_t page_size = PageSize;
+    static constexpr size_t default_pool_pages = 4096;
+    /* Frames kept however small the requested pool, enough for the pages one change pins */
+    static constexpr size_t minimum_pool_pages = 16;
+
+    struct statistics_t
+    {
+        /* Pages found in the pool */
+        uint64_t hits;
+        /* Pages read from the file */
+        uint64_t reads;
+        /* Pages written back, on eviction or by sync() */
+        uint64_t writes;
+    };
+
+private:
+    using page_id_t = uint32_t;
+
+    /* Page 0 holds the header, so no link points to it */
+    static constexpr page_id_t no_page = 0;
+    /* Slots of the heap page 0 don't exist either */
+    static constexpr uint64_t no_slot = 0;
+
+    struct pair_t
+    {
+        Left left;
+        Right right;
+    };
+
+    struct tree_header_t
+    {
+        page_id_t root;
+        /* First and last leaf */
+        page_id_t head;
+        page_id_t tail;
+        uint32_t reserved;
+    };
+
+    struct header_t
+    {
+        static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'P', 'G', 'D'};
+        static constexpr uint32_t current_version = 2;
+        static constexpr uint32_t native_byte_order = 0x01020304;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t left_size;
+        uint32_t right_size;
+        uint32_t page_size;
+        uint32_t reserved;
+        uint64_t count;
+        /* Head of the list of erased heap slots */
+        uint64_t free_slot;
+        /* Pages of the file including the header one, and the head of the list of released pages */
+        page_id_t pages_count;
+        page_id_t free_page;
+        /* Heap page being filled and the slots of it used so far */
+        page_id_t heap_page;
+        uint32_t heap_used;
+        tree_header_t left_tree;
+        tree_header_t right_tree;
+    };
+
+    static_assert(sizeof(header_t) <= PageSize, "paged_bimap requires the header to fit a page");
+
+    /* Journal directory entry of the page image in the slot of the same index */
+    struct journal_entry_t
+    {
+        page_id_t page;
+        uint32_t reserved;
+        uint64_t checksum;
+    };
+
+    /* Ends a committed journal, after the page images and their directory */
+    struct journal_trailer_t
+    {
+        static constexpr uint64_t signature = 0x4C4E524A44475042;
+
+        uint64_t magic;
+        uint64_t count;
+        /* Of the directory and the header */
+        uint64_t checksum;
+        header_t header;
+    };
+
+    class buffer_pool_t;
+
+    /* Pins one frame of the buffer pool while it lives, an empty one refers to no page */
+    class page_ref
+    {
+        buffer_pool_t * pool;
+        size_t frame;
+
+    public:
+        page_ref() noexcept
+            : pool(nullptr)
+            , frame(0)
+        {
+        }
+
+        page_ref(buffer_pool_t * pool, size_t frame) noexcept
+            : pool(pool)
+            , frame(frame)
+        {
+            ++pool->frames[frame].pins;
+        }
+
+        page_ref(page_ref const & other) noexcept
+            : pool(other.pool)
+            , frame(other.frame)
+        {
+            if (pool != nullptr) {
+                ++pool->frames[frame].pins;
+            }
+        }
+
+        page_ref(page_ref && other) noexcept
+            : pool(other.pool)
+            , frame(other.frame)
+        {
+            other.pool = nullptr;
+        }
+
+        page_ref & operator=(page_ref other) noexcept
+        {
+            std::swap(pool, other.pool);
+            std::swap(frame, other.frame);
+            return *this;
+        }
+
+        ~page_ref()
+        {
+            if (pool != nullptr) {
+                --pool->frames[frame].pins;
+            }
+        }
+
+        explicit operator bool() const noexcept
+        {
+            return (pool != nullptr);
+        }
+
+        page_id_t id() const noexcept
+        {
+            return (pool != nullptr ? pool->frames[frame].page : no_page);
+        }
+
+        char * data() const noexcept
+        {
+            return pool->pages[frame].bytes;
+        }
+
+        /* Must be called before the page is changed */
+        void changed() const noexcept
+        {
+            pool->frames[frame].dirty = true;
+        }
+    };
+
+    /* Caches pages of the file in a fixed number of frames and hands out the pages of the file */
+    class buffer_pool_t
+    {
+        friend class page_ref;
+
+        struct alignas(64) page_t
+        {
+            char bytes[PageSize];
+        };
+
+        struct frame_t
+        {
+            page_id_t page = no_page;
+            uint32_t pins = 0;
+            bool dirty = false;
+            /* Used since the hand last passed */
+            bool referenced = false;
+        };
+
+        [[noreturn]] void fail(std::string const & message)
+        {
+            close(descriptor);
+            descriptor = -1;
+            if (journal_descriptor >= 0) {
+                close(journal_descriptor);
+                journal_descriptor = -1;
+            }
+            throw std::runtime_error(message);
+        }
+
+        static void write_at(int file, void const * data, size_t size, uint64_t offset)
+        {
+            if (pwrite(file, data, size, static_cast<off_t>(offset)) != static_cast<ssize_t>(size)) {
+                throw std::runtime_error("Can't write paged bimap.");
+            }
+        }
+
+        static void read_at(int file, void * data, size_t size, uint64_t offset)
+        {
+            if (pread(file, data, size, static_cast<off_t>(offset)) != static_cast<ssize_t>(size)) {
+                throw std::runtime_error("Can't read paged bimap.");
+            }
+        }
+
+        static void sync_data(int file)
+        {
+            if (fdatasync(file) != 0) {
+                throw std::runtime_error("Can't sync paged bimap.");
+            }
+        }
+
+        static uint64_t checksum(void const * data, size_t size) noexcept
+        {
+            snapshot_checksum result;
+            result.update(data, size);
+            return result.value();
+        }
+
+        /* A page of the last synced state goes to its journal slot, any other one to its place in the file */
+        void write(size_t index)
+        {
+            frame_t & frame = frames[index];
+            char const * bytes = pages[index].bytes;
+            if (frame.page < committed_pages) {
+                directory.reserve(directory.size() + 1);
+                auto slot = journaled.emplace(frame.page, directory.size());
+                if (slot.second) {
+                    directory.push_back(journal_entry_t{frame.page, 0, 0});
+                }
+                directory[slot.first->second].checksum = checksum(bytes, PageSize);
+                write_at(journal_descriptor, bytes, PageSize, slot.first->second * PageSize);
+            }
+            else {
+                write_at(descriptor, bytes, PageSize, uint64_t(frame.page) * PageSize);
+            }
+            frame.dirty = false;
+            ++statistics.writes;
+        }
+
+        /* Copies the page images of a committed journal into the file with its header, syncs it and empties the journal */
+        void apply_journal(std::vector<journal_entry_t> const & entries, header_t const & committed)
+        {
+            std::unique_ptr<page_t> buffer(new page_t);
+            for (size_t slot = 0; slot < entries.size(); ++slot) {
+                read_at(journal_descriptor, buffer->bytes, PageSize, slot * PageSize);
+                write_at(descriptor, buffer->bytes, PageSize, uint64_t(entries[slot].page) * PageSize);
+            }
+            write_at(descriptor, &committed, sizeof(committed), 0);
+            sync_data(descriptor);
+            if (ftruncate(journal_descriptor, 0) != 0) {
+                throw std::runtime_error("Can't truncate the journal of paged bimap.");
+            }
+        }
+
+        /* Applies a journal which sync() committed before a crash, discards one it didn't */
+        void recover()
+        {
+            struct stat status;
+            if (fstat(journal_descriptor, &status) != 0) {
+                throw std::runtime_error("Can't read the journal of paged bimap.");
+            }
+            uint64_t size = static_cast<uint64_t>(status.st_size);
+            journal_trailer_t trailer;
+            std::vector<journal_entry_t> entries;
+            bool committed = false;
+            if (size >= sizeof(trailer)) {
+                read_at(journal_descriptor, &trailer, sizeof(trailer), size - sizeof(trailer));
+                committed = (trailer.magic == journal_trailer_t::signature && trailer.count <= size / PageSize
+                    && trailer.count * (PageSize + sizeof(journal_entry_t)) + sizeof(trailer) == size);
+            }
+            if (committed) {
+                entries.resize(static_cast<size_t>(trailer.count));
+                read_at(journal_descriptor, entries.data(), entries.size() * sizeof(journal_entry_t), trailer.count * PageSize);
+                snapshot_checksum expected;
+                expected.update(entries.data(), entries.size() * sizeof(journal_entry_t));
+                expected.update(&trailer.header, sizeof(trailer.header));
+                committed = (expected.value() == trailer.checksum);
+                std::unique_ptr<page_t> buffer(new page_t);
+                for (size_t slot = 0; committed && slot < entries.size(); ++slot) {
+                    read_at(journal_descriptor, buffer->bytes, PageSize, slot * PageSize);
+                    committed = (entries[slot].page != no_page && checksum(buffer->bytes, PageSize) == entries[slot].checksum);
+                }
+            }
+            if (committed) {
+                apply_journal(entries, trailer.header);
+            }
+            else if (size > 0 && ftruncate(journal_descriptor, 0) != 0) {
+                throw std::runtime_error("Can't truncate the journal of paged bimap.");
+            }
+        }
+
+        /* Two sweeps of the hand clear every reference bit, so finding nothing means every frame is pinned */
+        size_t victim()
+        {
+            for (size_t step = 0; step < 2 * frames.size(); ++step) {
+                size_t index = hand;
+                hand = (hand + 1 == frames.size() ? 0 : hand + 1);
+                frame_t & frame = frames[index];
+                if (frame.pins != 0) {
+                    continue;
+                }
+                if (frame.referenced) {
+                    frame.referenced = false;
+                    continue;
+                }
+                return index;
+            }
+            throw std::length_error("Every page of the buffer pool is pinned.");
+        }
+
+        /* Frame holding the page, read from the file if Read, otherwise zeroed */
+        template <bool Read>
+        size_t load(page_id_t page)
+        {
+            auto found = resident.find(page);
+            if (found != resident.end()) {
+                ++statistics.hits;
+                frames[found->second].referenced = true;
+                return found->second;
+            }
+            size_t index = victim();
+            frame_t & frame = frames[index];
+            if (frame.page != no_page) {
+                if (frame.dirty) {
+                    write(index);
+                }
+                resident.erase(frame.page);
+                frame.page = no_page;
+            }
+            if constexpr (Read) {
+                auto slot = journaled.find(page);
+                if (slot != journaled.end()) {
+                    read_at(journal_descriptor, pages[index].bytes, PageSize, slot->second * PageSize);
+                }
+                else {
+                    read_at(descriptor, pages[index].bytes, PageSize, uint64_t(page) * PageSize);
+                }
+                ++statistics.reads;
+            }
+            else {
+                std::memset(pages[index].bytes, 0, PageSize);
+            }
+            frame.page = page;
+            frame.referenced = true;
+            resident.emplace(page, index);
+            return index;
+        }
+
+        int descriptor;
+        int journal_descriptor;
+        std::unique_ptr<page_t[]> pages;
+        std::vector<frame_t> frames;
+        std::unordered_map<page_id_t, size_t> resident;
+        size_t hand;
+        /* Pages of the last synced state, which are journaled instead of written in place */
+        page_id_t committed_pages;
+        /* Journal slots of the pages written since the last sync, and the directory of the slots */
+        std::unordered_map<page_id_t, size_t> journaled;
+        std::vector<journal_entry_t> directory;
+        bool changed;
+
+    public:
+        header_t header;
+        statistics_t statistics;
+
+        /* Opens the file or creates an empty map in it, recovering the last synced state through the journal */
+        buffer_pool_t(std::string const & path, size_t capacity)
+            : descriptor(-1)
+            , journal_descriptor(-1)
+            , pages(new page_t[capacity])
+            , frames(capacity)
+            , hand(0)
+            , committed_pages(0)
+            , changed(false)
+            , header()
+            , statistics()
+        {
+            resident.reserve(capacity);
+            descriptor = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+            if (descriptor < 0) {
+                throw std::runtime_error("Can't open paged bimap " + path + ".");
+            }
+            if (flock(descriptor, LOCK_EX | LOCK_NB) != 0) {
+                fail("Paged bimap " + path + " is already open.");
+            }
+            journal_descriptor = open((path + ".journal").c_str(), O_RDWR | O_CREAT, 0644);
+            if (journal_descriptor < 0) {
+                fail("Can't open the journal of paged bimap " + path + ".");
+            }
+            struct stat status;
+            try {
+                recover();
+            }
+            catch (std::runtime_error const & error) {
+                fail(error.what());
+            }
+            if (fstat(descriptor, &status) != 0) {
+                fail("Can't open paged bimap " + path + ".");
+            }
+            if (status.st_size == 0) {
+                std::memcpy(header.magic, header_t::signature, sizeof(header.magic));
+                header.version = header_t::current_version;
+                header.byte_order = header_t::native_byte_order;
+                header.left_size = sizeof(Left);
+                header.right_size = sizeof(Right);
+                header.page_size = PageSize;
+                header.pages_count = 1;
+                committed_pages = 1;
+                try {
+                    if (ftruncate(descriptor, PageSize) != 0) {
+                        throw std::runtime_error("Can't grow paged bimap.");
+                    }
+                    write_at(descriptor, &header, sizeof(header), 0);
+                    sync_data(descriptor);
+                }
+                catch (std::runtime_error const & error) {
+                    fail(error.what());
+                }
+                return;
+            }
+            if (pread(descriptor, &header, sizeof(header), 0) != static_cast<ssize_t>(sizeof(header))
+                || std::memcmp(header.magic, header_t::signature, sizeof(header.magic)) != 0
+                || header.version != header_t::current_version || header.byte_order != header_t::native_byte_order
+                || header.left_size != sizeof(Left) || header.right_size != sizeof(Right) || header.page_size != PageSize
+                || header.pages_count == 0 || static_cast<uint64_t>(status.st_size) < uint64_t(header.pages_count) * PageSize) {
+                fail("Paged bimap doesn't match the value types or is corrupted.");
+            }
+            committed_pages = header.pages_count;
+        }
+
+        buffer_pool_t(buffer_pool_t const &) = delete;
+        buffer_pool_t & operator=(buffer_pool_t const &) = delete;
+
+        /* Syncs, after a failed sync reopening yields the state of the last finished one */
+        ~buffer_pool_t()
+        {
+            try {
+                sync();
+            }
+            catch (std::runtime_error const &) {
+            }
+            close(descriptor);
+            close(journal_descriptor);
+        }
+
+        size_t capacity() const noexcept
+        {
+            return frames.size();
+        }
+
+        page_ref fetch(page_id_t page)
+        {
+            return page_ref(this, load<true>(page));
+        }
+
+        /* Returns a zeroed page, marked changed, reusing a released one if there is any */
+        page_ref allocate()
+        {
+            page_id_t page = header.free_page;
+            if (page != no_page) {
+                page_ref ref = fetch(page);
+                std::memcpy(&header.free_page, ref.data(), sizeof(page_id_t));
+                std::memset(ref.data(), 0, PageSize);
+                ref.changed();
+                return ref;
+            }
+            if (header.pages_count == std::numeric_limits<page_id_t>::max()) {
+                throw std::length_error("Paged bimap is full.");
+            }
+            page_ref ref(this, load<false>(header.pages_count));
+            ++header.pages_count;
+            ref.changed();
+            return ref;
+        }
+
+        /* Links the page into the list of released ones */
+        void release(page_id_t page)
+        {
+            page_ref ref = fetch(page);
+            ref.changed();
+            std::memcpy(ref.data(), &header.free_page, sizeof(page_id_t));
+            header.free_page = page;
+        }
+
+        /* Must be called before a change, so that sync() commits it */
+        void mark_changed() noexcept
+        {
+            changed = true;
+        }
+
+        /*
+         * Writes changed pages in file order, pages of the last synced state to the journal; writing the directory
+         * and the header after them and syncing the journal commits the changes, which are then copied into the file
+         */
+        void sync()
+        {
+            if (!changed) {
+                return;
+            }
+            std::vector<size_t> dirty;
+            for (size_t index = 0; index < frames.size(); ++index) {
+                if (frames[index].dirty) {
+                    dirty.push_back(index);
+                }
+            }
+            std::sort(dirty.begin(), dirty.end(), [this](size_t a, size_t b) {
+                return frames[a].page < frames[b].page;
+            });
+            for (size_t index : dirty) {
+                write(index);
+            }
+            /* Pages beyond the last synced state, written in place, must be durable before the commit */
+            sync_data(descriptor);
+            journal_trailer_t trailer = {journal_trailer_t::signature, directory.size(), 0, header};
+            snapshot_checksum sum;
+            sum.update(directory.data(), directory.size() * sizeof(journal_entry_t));
+            sum.update(&trailer.header, sizeof(trailer.header));
+            trailer.checksum = sum.value();
+            write_at(journal_descriptor, directory.data(), directory.size() * sizeof(journal_entry_t), directory.size() * PageSize);
+            write_at(journal_descriptor, &trailer, sizeof(trailer), directory.size() * (PageSize + sizeof(journal_entry_t)));
+            sync_data(journal_descriptor);
+
+            apply_journal(directory, header);
+            journaled.clear();
+            directory.clear();
+            committed_pages = header.pages_count;
+            changed = false;
+        }
+    };
+
+    /* Keeps pairs in fixed-size slots of heap pages, a slot id is the page times the slots per page plus the slot */
+    class heap_t
+    {
+        static constexpr size_t slot_size = std::max(sizeof(pair_t), sizeof(uint64_t));
+        static constexpr uint64_t slots_per_page = PageSize / slot_size;
+
+        static_assert(slots_per_page > 0, "paged_bimap requires a pair to fit a page");
+
+        static char * slot(page_ref const & ref, uint64_t id) noexcept
+        {
+            return ref.data() + (id % slots_per_page) * slot_size;
+        }
+
+        buffer_pool_t * pool;
+
+    public:
+        explicit heap_t(buffer_pool_t * pool) noexcept
+            : pool(pool)
+        {
+        }
+
+        uint64_t create(pair_t const & pair)
+        {
+            header_t & header = pool->header;
+            uint64_t id = header.free_slot;
+            page_ref ref;
+            if (id != no_slot) {
+                ref = pool->fetch(static_cast<page_id_t>(id / slots_per_page));
+                std::memcpy(&header.free_slot, slot(ref, id), sizeof(uint64_t));
+            }
+            else {
+                if (header.heap_page == no_page || header.heap_used == slots_per_page) {
+                    ref = pool->allocate();
+                    header.heap_page = ref.id();
+                    header.heap_used = 0;
+                }
+                else {
+                    ref = pool->fetch(header.heap_page);
+                }
+                id = uint64_t(header.heap_page) * slots_per_page + header.heap_used++;
+            }
+            ref.changed();
+            std::memcpy(slot(ref, id), &pair, sizeof(pair_t));
+            return id;
+        }
+
+        void destroy(uint64_t id)
+        {
+            page_ref ref = pool->fetch(static_cast<page_id_t>(id / slots_per_page));
+            ref.changed();
+            std::memcpy(slot(ref, id), &pool->header.free_slot, sizeof(uint64_t));
+            pool->header.free_slot = id;
+        }
+
+        pair_t operator[](uint64_t id) const
+        {
+            page_ref ref = pool->fetch(static_cast<page_id_t>(id / slots_per_page));
+            pair_t pair;
+            std::memcpy(&pair, slot(ref, id), sizeof(pair_t));
+            return pair;
+        }
+    };
+
+    /* Ordered index of one side in pages, maps keys to heap slot ids */
+    template <typename Key, typename Comparator>
+    class tree_t
+    {
+        struct node_t
+        {
+            uint32_t count;
+            uint32_t leaf;
+            /* Neighbour leaves */
+            page_id_t previous;
+            page_id_t next;
+        };
+
+    public:
+        static constexpr size_t leaf_capacity = (PageSize - sizeof(node_t)) / (sizeof(uint64_t) + sizeof(Key));
+        /* Leaves room for padding between the children and the keys */
+        static constexpr size_t inner_capacity = (PageSize - sizeof(node_t) - sizeof(page_id_t) - alignof(Key)) / (sizeof(page_id_t) + sizeof(Key));
+
+    private:
+        static constexpr size_t leaf_minimum = leaf_capacity / 2;
+        static constexpr size_t inner_minimum = inner_capacity / 2 - 1;
+
+        struct leaf_t : node_t
+        {
+            uint64_t ids[leaf_capacity];
+            Key keys[leaf_capacity];
+        };
+
+        /* Separator i is not greater than any key of child i + 1 and greater than every key of child i */
+        struct inner_t : node_t
+        {
+            page_id_t children[inner_capacity + 1];
+            Key keys[inner_capacity];
+        };
+
+        static_assert(leaf_capacity >= 4 && inner_capacity >= 4, "paged_bimap requires pages holding at least 4 values");
+        static_assert(sizeof(leaf_t) <= PageSize && sizeof(inner_t) <= PageSize, "paged_bimap nodes must fit a page");
+
+        static node_t * as_node(page_ref const & ref) noexcept
+        {
+            return reinterpret_cast<node_t *>(ref.data());
+        }
+
+        static leaf_t * as_leaf(page_ref const & ref) noexcept
+        {
+            return reinterpret_cast<leaf_t *>(ref.data());
+        }
+
+        static inner_t * as_inner(page_ref const & ref) noexcept
+        {
+            return reinterpret_cast<inner_t *>(ref.data());
+        }
+
+        /* Number of keys ordered before x, or not after x if Inclusive */
+        template <bool Inclusive>
+        size_t rank(Key const * keys, size_t count, Key const & x) const
+        {
+            if constexpr (Inclusive) {
+                return (std::upper_bound(keys, keys + count, x, compare) - keys);
+            }
+            else {
+                return (std::lower_bound(keys, keys + count, x, compare) - keys);
+            }
+        }
+
+        static void insert_entry(leaf_t * leaf, size_t index, Key const & key, uint64_t id)
+        {
+            std::copy_backward(leaf->keys + index, leaf->keys + leaf->count, leaf->keys + leaf->count + 1);
+            std::copy_backward(leaf->ids + index, leaf->ids + leaf->count, leaf->ids + leaf->count + 1);
+            leaf->keys[index] = key;
+            leaf->ids[index] = id;
+            ++leaf->count;
+        }
+
+        static void remove_entry(leaf_t * leaf, size_t index)
+        {
+            std::copy(leaf->keys + index + 1, leaf->keys + leaf->count, leaf->keys + index);
+            std::copy(leaf->ids + index + 1, leaf->ids + leaf->count, leaf->ids + index);
+            --leaf->count;
+        }
+
+        /* Inserts separator at index and child right after it */
+        static void insert_child(inner_t * inner, size_t index, Key const & separator, page_id_t child)
+        {
+            std::copy_backward(inner->keys + index, inner->keys + inner->count, inner->keys + inner->count + 1);
+            std::copy_backward(inner->children + index + 1, inner->children + inner->count + 1, inner->children + inner->count + 2);
+            inner->keys[index] = separator;
+            inner->children[index + 1] = child;
+            ++inner->count;
+        }
+
+        /* Removes separator at index and the child right after it */
+        static void remove_child(inner_t * inner, size_t index)
+        {
+            std::copy(inner->keys + index + 1, inner->keys + inner->count, inner->keys + index);
+            std::copy(inner->children + index + 2, inner->children + inner->count + 1, inner->children + index + 1);
+            --inner->count;
+        }
+
+        /* Pages are acquired before the leaf changes, so that running out of frames leaves the tree intact */
+        page_ref split_leaf(page_ref const & ref)
+        {
+            leaf_t * leaf = as_leaf(ref);
+            page_ref following;
+            if (leaf->next != no_page) {
+                following = pool->fetch(leaf->next);
+            }
+            page_ref right_ref = pool->allocate();
+            leaf_t * right = as_leaf(right_ref);
+            right->leaf = 1;
+            size_t middle = leaf->count / 2;
+            std::copy(leaf->keys + middle, leaf->keys + leaf->count, right->keys);
+            std::copy(leaf->ids + middle, leaf->ids + leaf->count, right->ids);
+            right->count = leaf->count - middle;
+            leaf->count = middle;
+            right->previous = ref.id();
+            right->next = leaf->next;
+            if (following) {
+                following.changed();
+                as_leaf(following)->previous = right_ref.id();
+            }
+            else {
+                state->tail = right_ref.id();
+            }
+            leaf->next = right_ref.id();
+            return right_ref;
+        }
+
+        /* Returns the new right sibling of the page if it was split, together with the separator between them */
+        page_id_t insert_into(page_id_t page, Key const & key, uint64_t id, Key & separator)
+        {
+            page_ref ref = pool->fetch(page);
+            if (as_node(ref)->leaf != 0) {
+                leaf_t * leaf = as_leaf(ref);
+                size_t index = rank<false>(leaf->keys, leaf->count, key);
+                ref.changed();
+                if (leaf->count < leaf_capacity) {
+                    insert_entry(leaf, index, key, id);
+                    return no_page;
+                }
+                page_ref right_ref = split_leaf(ref);
+                leaf_t * right = as_leaf(right_ref);
+                if (index <= leaf->count) {
+                    insert_entry(leaf, index, key, id);
+                }
+                else {
+                    insert_entry(right, index - leaf->count, key, id);
+                }
+                separator = right->keys[0];
+                return right_ref.id();
+            }
+            inner_t * inner = as_inner(ref);
+            size_t index = rank<true>(inner->keys, inner->count, key);
+            Key child_separator;
+            page_id_t child_sibling = insert_into(inner->children[index], key, id, child_separator);
+            if (child_sibling == no_page) {
+                return no_page;
+            }
+            ref.changed();
+            if (inner->count < inner_capacity) {
+                insert_child(inner, index, child_separator, child_sibling);
+                return no_page;
+            }
+            /* The middle separator moves up, the new child goes to the half which its left neighbour belongs to */
+            page_ref right_ref = pool->allocate();
+            inner_t * right = as_inner(right_ref);
+            size_t middle = inner_capacity / 2;
+            separator = inner->keys[middle];
+            std::copy(inner->keys + middle + 1, inner->keys + inner->count, right->keys);
+            std::copy(inner->children + middle + 1, inner->children + inner->count + 1, right->children);
+            right->count = inner->count - middle - 1;
+            inner->count = middle;
+            if (index <= middle) {
+                insert_child(inner, index, child_separator, child_sibling);
+            }
+            else {
+                insert_child(right, index - middle - 1, child_separator, child_sibling);
+            }
+            return right_ref.id();
+        }
+
+        /* Merges child index + 1 of the inner page into child index */
+        void merge(page_ref const & ref, size_t index)
+        {
+            inner_t * inner = as_inner(ref);
+            page_ref left_ref = pool->fetch(inner->children[index]);
+            page_ref right_ref = pool->fetch(inner->children[index + 1]);
+            page_id_t excess = right_ref.id();
+            left_ref.changed();
+            if (as_node(left_ref)->leaf != 0) {
+                leaf_t * left_leaf = as_leaf(left_ref);
+                leaf_t * right_leaf = as_leaf(right_ref);
+                page_ref following;
+                if (right_leaf->next != no_page) {
+                    following = pool->fetch(right_leaf->next);
+                }
+                std::copy(right_leaf->keys, right_leaf->keys + right_leaf->count, left_leaf->keys + left_leaf->count);
+                std::copy(right_leaf->ids, right_leaf->ids + right_leaf->count, left_leaf->ids + left_leaf->count);
+                left_leaf->count += right_leaf->count;
+                left_leaf->next = right_leaf->next;
+                if (following) {
+                    following.changed();
+                    as_leaf(following)->previous = left_ref.id();
+                }
+                else {
+                    state->tail = left_ref.id();
+                }
+            }
+            else {
+                inner_t * left_inner = as_inner(left_ref);
+                inner_t * right_inner = as_inner(right_ref);
+                left_inner->keys[left_inner->count] = inner->keys[index];
+                std::copy(right_inner->keys, right_inner->keys + right_inner->count, left_inner->keys + left_inner->count + 1);
+                std::copy(right_inner->children, right_inner->children + right_inner->count + 1, left_inner->children + left_inner->count + 1);
+                left_inner->count += right_inner->count + 1;
+            }
+            remove_child(inner, index);
+            pool->release(excess);
+        }
+
+        /* Refills child index of the inner page from a sibling if it has become underfull */
+        void rebalance(page_ref const & ref, size_t index)
+        {
+            inner_t * inner = as_inner(ref);
+            page_ref child_ref = pool->fetch(inner->children[index]);
+            node_t * child = as_node(child_ref);
+            size_t minimum = (child->leaf != 0 ? leaf_minimum : inner_minimum);
+            if (child->count >= minimum) {
+                return;
+            }
+            page_ref left_ref;
+            page_ref right_ref;
+            if (index > 0) {
+                left_ref = pool->fetch(inner->children[index - 1]);
+            }
+            if (index < inner->count) {
+                right_ref = pool->fetch(inner->children[index + 1]);
+            }
+            ref.changed();
+            if (left_ref && as_node(left_ref)->count > minimum) {
+                left_ref.changed();
+                child_ref.changed();
+                if (child->leaf != 0) {
+                    leaf_t * left_leaf = as_leaf(left_ref);
+                    insert_entry(as_leaf(child_ref), 0, left_leaf->keys[left_leaf->count - 1], left_leaf->ids[left_leaf->count - 1]);
+                    --left_leaf->count;
+                    inner->keys[index - 1] = as_leaf(child_ref)->keys[0];
+                }
+                else {
+                    inner_t * left_inner = as_inner(left_ref);
+                    inner_t * child_inner = as_inner(child_ref);
+                    std::copy_backward(child_inner->keys, child_inner->keys + child_inner->count, child_inner->keys + child_inner->count + 1);
+                    std::copy_backward(child_inner->children, child_inner->children + child_inner->count + 1, child_inner->children + child_inner->count + 2);
+                    child_inner->keys[0] = inner->keys[index - 1];
+                    child_inner->children[0] = left_inner->children[left_inner->count];
+                    ++child_inner->count;
+                    inner->keys[index - 1] = left_inner->keys[left_inner->count - 1];
+                    --left_inner->count;
+                }
+            }
+            else if (right_ref && as_node(right_ref)->count > minimum) {
+                right_ref.changed();
+                child_ref.changed();
+                if (child->leaf != 0) {
+                    leaf_t * right_leaf = as_leaf(right_ref);
+                    insert_entry(as_leaf(child_ref), child->count, right_leaf->keys[0], right_leaf->ids[0]);
+                    remove_entry(right_leaf, 0);
+                    inner->keys[index] = right_leaf->keys[0];
+                }
+                else {
+                    inner_t * right_inner = as_inner(right_ref);
+                    inner_t * child_inner = as_inner(child_ref);
+                    child_inner->keys[child_inner->count] = inner->keys[index];
+                    child_inner->children[child_inner->count + 1] = right_inner->children[0];
+                    ++child_inner->count;
+                    inner->keys[index] = right_inner->keys[0];
+                    std::copy(right_inner->keys + 1, right_inner->keys + right_inner->count, right_inner->keys);
+                    std::copy(right_inner->children + 1, right_inner->children + right_inner->count + 1, right_inner->children);
+                    --right_inner->count;
+                }
+            }
+            else if (left_ref) {
+                merge(ref, index - 1);
+            }
+            else {
+                merge(ref, index);
+            }
+        }
+
+        bool erase_from(page_id_t page, Key const & key, uint64_t & id)
+        {
+            page_ref ref = pool->fetch(page);
+            if (as_node(ref)->leaf != 0) {
+                leaf_t * leaf = as_leaf(ref);
+                size_t index = rank<false>(leaf->keys, leaf->count, key);
+                if (index == leaf->count || !(leaf->keys[index] == key)) {
+                    return false;
+                }
+                id = leaf->ids[index];
+                ref.changed();
+                remove_entry(leaf, index);
+                return true;
+            }
+            inner_t * inner = as_inner(ref);
+            size_t index = rank<true>(inner->keys, inner->count, key);
+            if (!erase_from(inner->children[index], key, id)) {
+                return false;
+            }
+            rebalance(ref, index);
+            return true;
+        }
+
+        /* Descends pinning one page at a time */
+        page_ref find_leaf(Key const & key) const
+        {
+            page_ref ref = pool->fetch(state->root);
+            while (as_node(ref)->leaf == 0) {
+                inner_t const * inner = as_inner(ref);
+                ref = pool->fetch(inner->children[rank<true>(inner->keys, inner->count, key)]);
+            }
+            return ref;
+        }
+
+        buffer_pool_t * pool;
+        tree_header_t * state;
+        Comparator compare;
+
+    public:
+        /* Entry of a leaf, which stays pinned while the position lives; the end pins nothing */
+        struct position_t
+        {
+            page_ref ref;
+            size_t index;
+
+            bool operator==(position_t const & other) const noexcept
+            {
+                return (ref.id() == other.ref.id() && index == other.index);
+            }
+
+            uint64_t id() const noexcept
+            {
+                return as_leaf(ref)->ids[index];
+            }
+
+            Key const & key() const noexcept
+            {
+                return as_leaf(ref)->keys[index];
+            }
+        };
+
+        tree_t(buffer_pool_t * pool, tree_header_t * state, Comparator compare)
+            : pool(pool)
+            , state(state)
+            , compare(std::move(compare))
+        {
+        }
+
+        void swap(tree_t & other) noexcept
+        {
+            std::swap(pool, other.pool);
+            std::swap(state, other.state);
+            std::swap(compare, other.compare);
+        }
+
+        position_t begin() const
+        {
+            return (state->head != no_page ? position_t{pool->fetch(state->head), 0} : end());
+        }
+
+        position_t end() const noexcept
+        {
+            return position_t{page_ref(), 0};
+        }
+
+        void next(position_t & position) const
+        {
+            leaf_t const * leaf = as_leaf(position.ref);
+            if (++position.index == leaf->count) {
+                page_id_t following = leaf->next;
+                position.ref = (following != no_page ? pool->fetch(following) : page_ref());
+                position.index = 0;
+            }
+        }
+
+        void previous(position_t & position) const
+        {
+            if (!position.ref) {
+                if (state->tail != no_page) {
+                    position.ref = pool->fetch(state->tail);
+                    position.index = as_leaf(position.ref)->count - 1;
+                }
+            }
+            else if (position.index == 0) {
+                page_id_t preceding = as_leaf(position.ref)->previous;
+                position.ref = (preceding != no_page ? pool->fetch(preceding) : page_ref());
+                position.index = (preceding != no_page ? as_leaf(position.ref)->count - 1 : 0);
+            }
+            else {
+                --position.index;
+            }
+        }
+
+        /* First key not ordered before x, or after x if Inclusive */
+        template <bool Inclusive>
+        position_t bound(Key const & key) const
+        {
+            if (state->root == no_page) {
+                return end();
+            }
+            page_ref ref = find_leaf(key);
+            leaf_t const * leaf = as_leaf(ref);
+            size_t index = rank<Inclusive>(leaf->keys, leaf->count, key);
+            if (index < leaf->count) {
+                return position_t{std::move(ref), index};
+            }
+            page_id_t following = leaf->next;
+            return (following != no_page ? position_t{pool->fetch(following), 0} : end());
+        }
+
+        position_t find(Key const & key) const
+        {
+            position_t position = bound<false>(key);
+            if (position.ref && position.key() == key) {
+                return position;
+            }
+            return end();
+        }
+
+        /* Key must be absent */
+        void insert(Key const & key, uint64_t id)
+        {
+            if (state->root == no_page) {
+                page_ref ref = pool->allocate();
+                as_node(ref)->leaf = 1;
+                state->root = state->head = state->tail = ref.id();
+            }
+            Key separator;
+            page_id_t sibling = insert_into(state->root, key, id, separator);
+            if (sibling != no_page) {
+                page_ref ref = pool->allocate();
+                inner_t * new_root = as_inner(ref);
+                new_root->keys[0] = separator;
+                new_root->children[0] = state->root;
+                new_root->children[1] = sibling;
+                new_root->count = 1;
+                state->root = ref.id();
+            }
+        }
+
+        /* Returns false if the key is absent, otherwise the id of the erased entry */
+        bool erase(Key const & key, uint64_t & id)
+        {
+            if (state->root == no_page || !erase_from(state->root, key, id)) {
+                return false;
+            }
+            page_ref ref = pool->fetch(state->root);
+            node_t const * root = as_node(ref);
+            if (root->count == 0) {
+                page_id_t excess = state->root;
+                state->root = (root->leaf != 0 ? no_page : as_inner(ref)->children[0]);
+                if (state->root == no_page) {
+                    state->head = state->tail = no_page;
+                }
+                pool->release(excess);
+            }
+            return true;
+        }
+    };
+
+    using left_tree_t = tree_t<Left, LeftComparator>;
+    using right_tree_t = tree_t<Right, RightComparator>;
+
+    struct left_descriptor_t
+    {
+        using tree_type = left_tree_t;
+
+        static left_tree_t const & tree(paged_bimap const * map) noexcept
+        {
+            return map->left_tree;
+        }
+
+        static Left const & value(pair_t const & pair) noexcept
+        {
+            return pair.left;
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        using tree_type = right_tree_t;
+
+        static right_tree_t const & tree(paged_bimap const * map) noexcept
+        {
+            return map->right_tree;
+        }
+
+        static Right const & value(pair_t const & pair) noexcept
+        {
+            return pair.right;
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class paged_bimap<Left, Right, LeftComparator, RightComparator, PageSize>;
+
+        template <typename, typename, typename, typename>
+        friend class basic_iterator;
+
+        using position_t = typename MainDescriptor::tree_type::position_t;
+
+        basic_iterator(paged_bimap const * map, position_t position) noexcept
+            : map(map)
+            , position(std::move(position))
+        {
+        }
+
+        paged_bimap const * map;
+        position_t position;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++()
+        {
+            MainDescriptor::tree(map).next(position);
+            return *this;
+        }
+
+        basic_iterator operator++(int)
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        basic_iterator & operator--()
+        {
+            MainDescriptor::tree(map).previous(position);
+            return *this;
+        }
+
+        basic_iterator operator--(int)
+        {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        /* Valid while the iterator lives, which keeps the leaf pinned */
+        MainType const & operator*() const noexcept
+        {
+            return position.key();
+        }
+
+        /* Reads the partner from the heap and looks it up in the other tree */
+        auto flip() const
+        {
+            FlipType partner = FlipDescriptor::value(map->heap[position.id()]);
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, FlipDescriptor::tree(map).find(partner));
+        }
+    };
+
+    template <typename FirstTree, typename SecondTree, typename SecondDescriptor, typename T>
+    bool erase_element(FirstTree & first_tree, SecondTree & second_tree, T const & key)
+    {
+        if (first_tree.find(key) == first_tree.end()) {
+            return false;
+        }
+        pool->mark_changed();
+        uint64_t id;
+        first_tree.erase(key, id);
+        second_tree.erase(SecondDescriptor::value(heap[id]), id);
+        heap.destroy(id);
+        --pool->header.count;
+        return true;
+    }
+
+    template <typename FlipDescriptor, typename SecondType, typename Tree, typename T>
+    SecondType at_element(Tree const & tree, T const & key) const
+    {
+        auto position = tree.find(key);
+        if (position == tree.end()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return FlipDescriptor::value(heap[position.id()]);
+    }
+
+    void swap(paged_bimap & other) noexcept
+    {
+        std::swap(pool, other.pool);
+        std::swap(heap, other.heap);
+        left_tree.swap(other.left_tree);
+        right_tree.swap(other.right_tree);
+    }
+
+    std::unique_ptr<buffer_pool_t> pool;
+    heap_t heap;
+    left_tree_t left_tree;
+    right_tree_t right_tree;
+
+public:
+    /* Opens the file or creates an empty map in it, caching at least minimum_pool_pages pages */
+    explicit paged_bimap(std::string const & path, size_t pool_pages = default_pool_pages, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : pool(new buffer_pool_t(path, std::max(pool_pages, minimum_pool_pages)))
+        , heap(pool.get())
+        , left_tree(pool.get(), &pool->header.left_tree, std::move(left_compare))
+        , right_tree(pool.get(), &pool->header.right_tree, std::move(right_compare))
+    {
+    }
+
+    paged_bimap(paged_bimap const &) = delete;
+    paged_bimap & operator=(paged_bimap const &) = delete;
+
+    paged_bimap(paged_bimap && other) noexcept
+        : pool(std::move(other.pool))
+        , heap(other.heap)
+        , left_tree(std::move(other.left_tree))
+        , right_tree(std::move(other.right_tree))
+    {
+    }
+
+    paged_bimap & operator=(paged_bimap && other) noexcept
+    {
+        swap(other);
+        return *this;
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    /* Makes every change durable, see the journal above */
+    void sync()
+    {
+        pool->sync();
+    }
+
+    /* Bytes of the file */
+    size_t file_size() const noexcept
+    {
+        return size_t(pool->header.pages_count) * PageSize;
+    }
+
+    size_t pool_pages() const noexcept
+    {
+        return pool->capacity();
+    }
+
+    statistics_t const & statistics() const noexcept
+    {
+        return pool->statistics;
+    }
+
+    left_iterator begin_left() const
+    {
+        return left_iterator(this, left_tree.begin());
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, left_tree.end());
+    }
+
+    right_iterator begin_right() const
+    {
+        return right_iterator(this, right_tree.begin());
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, right_tree.end());
+    }
+
+    bool empty() const noexcept
+    {
+        return (pool->header.count == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return pool->header.count;
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return left_iterator(this, left_tree.find(desired));
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return right_iterator(this, right_tree.find(desired));
+    }
+
+    left_iterator insert(Left const & left, Right const & right)
+    {
+        if (!(left_tree.find(left) == left_tree.end()) || !(right_tree.find(right) == right_tree.end())) {
+            return end_left();
+        }
+        pool->mark_changed();
+        uint64_t id = heap.create(pair_t{left, right});
+        left_tree.insert(left, id);
+        right_tree.insert(right, id);
+        ++pool->header.count;
+        return left_iterator(this, left_tree.find(left));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return erase_element<left_tree_t, right_tree_t, right_descriptor_t>(left_tree, right_tree, key);
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return erase_element<right_tree_t, left_tree_t, left_descriptor_t>(right_tree, left_tree, key);
+    }
+
+    /* Returns the element following the erased one, found again since erasing invalidates iterators */
+    left_iterator erase_left(left_iterator const & it)
+    {
+        left_iterator last = it;
+        return erase_left(it, ++last);
+    }
+
+    right_iterator erase_right(right_iterator const & it)
+    {
+        right_iterator last = it;
+        return erase_right(it, ++last);
+    }
+
+    left_iterator erase_left(left_iterator first, left_iterator const & last)
+    {
+        std::vector<Left> keys;
+        for (; first != last; ++first) {
+            keys.push_back(*first);
+        }
+        std::optional<Left> following;
+        if (last != end_left()) {
+            following.emplace(*last);
+        }
+        for (Left const & key : keys) {
+            erase_left(key);
+        }
+        return (following ? find_left(*following) : end_left());
+    }
+
+    right_iterator erase_right(right_iterator first, right_iterator const & last)
+    {
+        std::vector<Right> keys;
+        for (; first != last; ++first) {
+            keys.push_back(*first);
+        }
+        std::optional<Right> following;
+        if (last != end_right()) {
+            following.emplace(*last);
+        }
+        for (Right const & key : keys) {
+            erase_right(key);
+        }
+        return (following ? find_right(*following) : end_right());
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        return left_iterator(this, left_tree.template bound<false>(value));
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        return left_iterator(this, left_tree.template bound<true>(value));
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        return right_iterator(this, right_tree.template bound<false>(value));
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        return right_iterator(this, right_tree.template bound<true>(value));
+    }
+
+    /* Partners are copied out of the heap, the page holding them may be evicted right after */
+    Right at_left(Left const & key) const
+    {
+        return at_element<right_descriptor_t, Right>(left_tree, key);
+    }
+
+    Left at_right(Right const & key) const
+    {
+        return at_element<left_descriptor_t, Left>(right_tree, key);
+    }
+
+    Right at_left_or_default(Left const & key)
+    {
+        auto position = left_tree.find(key);
+        if (position == left_tree.end()) {
+            erase_right(Right());
+            insert(key, Right());
+            return Right();
+        }
+        return heap[position.id()].right;
+    }
+
+    Left at_right_or_default(Right const & key)
+    {
+        auto position = right_tree.find(key);
+        if (position == right_tree.end()) {
+            erase_left(Left());
+            insert(Left(), key);
+            return Left();
+        }
+        return heap[position.id()].left;
+    }
+
+    bool operator==(paged_bimap const & other) const
+    {
+        if (size() != other.size()) {
+            return false;
+        }
+        for (left_iterator first = begin_left(), second = other.begin_left(); first != end_left(); ++first, ++second) {
+            if (!(*first == *second) || !(heap[first.position.id()].right == other.heap[second.position.id()].right)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(paged_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
@@ -0,0 +1,579 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm> // std::max, std::min, std::sort
+#include <atomic>    // std::atomic
+#include <cmath>     // std::ceil, std::log2
+#include <cstddef>   // size_t
+#include <cstdint>   // uint32_t, uint64_t
+#include <exception> // std::exception_ptr, std::current_exception, std::rethrow_exception
+#include <mutex>     // std::mutex, std::lock_guard
+#include <stdexcept> // std::out_of_range, std::length_error, std::invalid_argument
+#include <thread>    // std::thread
+#include <utility>   // std::move
+#include <vector>    // std::vector
+
+/*
+ * Immutable unordered bimap for large static key sets, an alternative to flat_bimap when only exact lookups matter.
+ * Every side has a minimal perfect hash function mapping its values one to one onto the slots of its array:
+ * the 64-bit hash of a value selects a partition of about 4096 values and a bucket in it, and the pilot stored
+ * for the bucket, chosen at construction so that no two values of the partition collide, selects the slot
+ * (the PTHash scheme). Partitions are independent, so they are built in parallel.
+ * A lookup computes one hash, reads the partition and one pilot, and compares the value in the slot,
+ * taking O(1) time; for 1% of the values it reads one more position through a remapping array.
+ * Iterators visit pairs in slot order, which is arbitrary; there are no lower and upper bounds.
+ * Requires ((sizeof(Left) + sizeof(Right) + 2 * sizeof(uint32_t)) * size + index_bytes()) bytes memory,
+ * index_bytes() is about 3.6 bits per value of each side for large maps.
+ * Values are hashed by bimap_hash, which must be enabled for both types, and compared by operator==;
+ * they must be default constructible. Holds at most 2^32 - 2 pairs.
+ */
+
+template <typename Left, typename Right>
+class perfect_hash_bimap
+{
+    static_assert(bimap_hash<Left>::enabled && bimap_hash<Right>::enabled, "perfect_hash_bimap requires bimap_hash for both value types");
+
+    using position_t = uint32_t;
+
+    static uint64_t mix(uint64_t x) noexcept
+    {
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EB;
+        return x ^ (x >> 31);
+    }
+
+    /* Calls function(index) for every index below count, on at most threads threads; rethrows the first exception */
+    template <typename Function>
+    static void parallel_for(size_t count, size_t threads, Function const & function)
+    {
+        std::atomic<size_t> next(0);
+        std::exception_ptr failure;
+        std::mutex failure_mutex;
+        auto work = [&] {
+            try {
+                for (size_t index; (index = next.fetch_add(1)) < count;) {
+                    function(index);
+                }
+            }
+            catch (...) {
+                next = count;
+                std::lock_guard<std::mutex> lock(failure_mutex);
+                if (!failure) {
+                    failure = std::current_exception();
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (size_t i = 1; i < std::min(threads, count); ++i) {
+            workers.emplace_back(work);
+        }
+        work();
+        for (std::thread & worker : workers) {
+            worker.join();
+        }
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+    }
+
+    /* Minimal perfect hash function of one side, from mixed hashes of its values onto [0, size) */
+    class perfect_hash_t
+    {
+        static constexpr size_t partition_keys = 4096;
+        /* Buckets per key are bucket_factor / log2(keys), fewer buckets take less memory but longer to build */
+        static constexpr double bucket_factor = 4.0;
+        /* Slots of a partition are keys / load_factor, positions past the keys are remapped to free slots */
+        static constexpr double load_factor = 0.99;
+
+        struct partition_t
+        {
+            uint64_t first_pilot_bit;
+            position_t first_slot;
+            position_t first_free;
+            position_t keys;
+            position_t table_size;
+            position_t buckets;
+            uint32_t pilot_bits;
+        };
+
+        /* Pilots, positions and remapping of one partition before they are packed */
+        struct partition_result_t
+        {
+            std::vector<uint32_t> pilots;
+            std::vector<position_t> free;
+            uint32_t pilot_bits = 0;
+        };
+
+        /* The first 60% of hashes fall into the first 30% of buckets, big buckets placed first ease the search */
+        static size_t bucket(uint64_t hash, size_t buckets) noexcept
+        {
+            constexpr uint64_t dense_hashes = 0x9999999A;
+            uint64_t low = static_cast<uint32_t>(hash);
+            size_t dense = buckets * 3 / 10 + 1;
+            if (low < dense_hashes) {
+                return static_cast<size_t>(low * dense / dense_hashes);
+            }
+            return dense + static_cast<size_t>((low - dense_hashes) * (buckets - dense) / ((uint64_t(1) << 32) - dense_hashes));
+        }
+
+        static size_t position(uint64_t hash, uint64_t pilot, size_t table_size) noexcept
+        {
+            return static_cast<size_t>(((mix(hash ^ (pilot * 0x9E3779B97F4A7C15)) >> 32) * table_size) >> 32);
+        }
+
+        static size_t partition(uint64_t hash, size_t partitions) noexcept
+        {
+            return static_cast<size_t>(((hash >> 32) * partitions) >> 32);
+        }
+
+        static size_t bucket_count(size_t keys) noexcept
+        {
+            double per_key = bucket_factor / std::max(1.0, std::log2(double(keys)));
+            return std::max<size_t>(2, static_cast<size_t>(std::ceil(per_key * keys)));
+        }
+
+        static size_t table_size(size_t keys) noexcept
+        {
+            return std::max(keys, static_cast<size_t>(std::ceil(keys / load_factor)));
+        }
+
+        /* Searches pilots bucket by bucket, biggest first, and sets slots[i] to the local slot of hashes[i] */
+        static partition_result_t build_partition(uint64_t const * hashes, size_t keys, position_t * slots)
+        {
+            size_t buckets = bucket_count(keys);
+            size_t table = table_size(keys);
+            std::vector<position_t> bucket_starts(buckets + 1);
+            for (size_t i = 0; i < keys; ++i) {
+                ++bucket_starts[bucket(hashes[i], buckets) + 1];
+            }
+            size_t largest = 0;
+            for (size_t b = 0; b < buckets; ++b) {
+                largest = std::max<size_t>(largest, bucket_starts[b + 1]);
+                bucket_starts[b + 1] += bucket_starts[b];
+            }
+            std::vector<uint64_t> bucketed(keys);
+            std::vector<position_t> cursors(bucket_starts.begin(), bucket_starts.end() - 1);
+            for (size_t i = 0; i < keys; ++i) {
+                bucketed[cursors[bucket(hashes[i], buckets)]++] = hashes[i];
+            }
+            /* Equal hashes would collide with every pilot */
+            for (size_t b = 0; b < buckets; ++b) {
+                std::sort(bucketed.begin() + bucket_starts[b], bucketed.begin() + bucket_starts[b + 1]);
+                for (size_t i = bucket_starts[b] + 1; i < bucket_starts[b + 1]; ++i) {
+                    if (bucketed[i - 1] == bucketed[i]) {
+                        throw std::invalid_argument("Two values have the same hash.");
+                    }
+                }
+            }
+            /* Counting sort of the buckets by descending size */
+            std::vector<position_t> size_starts(largest + 2);
+            for (size_t b = 0; b < buckets; ++b) {
+                ++size_starts[largest - (bucket_starts[b + 1] - bucket_starts[b]) + 1];
+            }
+            for (size_t s = 0; s <= largest; ++s) {
+                size_starts[s + 1] += size_starts[s];
+            }
+            std::vector<position_t> order(buckets);
+            for (size_t b = 0; b < buckets; ++b) {
+                order[size_starts[largest - (bucket_starts[b + 1] - bucket_starts[b])]++] = static_cast<position_t>(b);
+            }
+
+            partition_result_t result;
+            result.pilots.assign(buckets, 0);
+            std::vector<bool> taken(table);
+            std::vector<size_t> positions(largest);
+            uint32_t highest_pilot = 0;
+            for (position_t b : order) {
+                size_t first = bucket_starts[b];
+                size_t size = bucket_starts[b + 1] - first;
+                if (size == 0) {
+                    break;
+                }
+                for (uint32_t pilot = 0;; ++pilot) {
+                    size_t placed = 0;
+                    for (; placed < size; ++placed) {
+                        size_t p = position(bucketed[first + placed], pilot, table);
+                        if (taken[p]) {
+                            break;
+                        }
+                        taken[p] = true;
+                        positions[placed] = p;
+                    }
+                    if (placed == size) {
+                        result.pilots[b] = pilot;
+                        highest_pilot = std::max(highest_pilot, pilot);
+                        break;
+                    }
+                    for (size_t i = 0; i < placed; ++i) {
+                        taken[positions[i]] = false;
+                    }
+                }
+            }
+            while (result.pilot_bits < 32 && (highest_pilot >> result.pilot_bits) != 0) {
+                ++result.pilot_bits;
+            }
+
+            /* Taken positions past the keys, in order, take the free slots below them, in order */
+            result.free.assign(table - keys, 0);
+            size_t free_slot = 0;
+            for (size_t p = keys; p < table; ++p) {
+                if (taken[p]) {
+                    while (taken[free_slot]) {
+                        ++free_slot;
+                    }
+                    result.free[p - keys] = static_cast<position_t>(free_slot++);
+                }
+            }
+            for (size_t i = 0; i < keys; ++i) {
+                size_t p = position(hashes[i], result.pilots[bucket(hashes[i], buckets)], table);
+                slots[i] = static_cast<position_t>(p < keys ? p : result.free[p - keys]);
+            }
+            return result;
+        }
+
+        uint32_t pilot(partition_t const & part, size_t bucket) const noexcept
+        {
+            uint64_t bit = part.first_pilot_bit + uint64_t(bucket) * part.pilot_bits;
+            size_t word = static_cast<size_t>(bit / 64);
+            unsigned offset = bit % 64;
+            /* The last word is padding, so the following word can always be read */
+            uint64_t bits = (pilot_words[word] >> offset) | (pilot_words[word + 1] << (63 - offset) << 1);
+            return static_cast<uint32_t>(bits & ((uint64_t(1) << part.pilot_bits) - 1));
+        }
+
+        std::vector<partition_t> partitions;
+        std::vector<uint64_t> pilot_words;
+        std::vector<position_t> free_slots;
+
+    public:
+        /* Sets slots[i] to the slot of hashes[i] */
+        void build(std::vector<uint64_t> const & hashes, size_t threads, std::vector<position_t> & slots)
+        {
+            size_t keys = hashes.size();
+            size_t partitions_count = (keys + partition_keys - 1) / partition_keys;
+            partitions.assign(partitions_count, partition_t{});
+            pilot_words.assign(1, 0);
+            free_slots.clear();
+            slots.resize(keys);
+            if (keys == 0) {
+                return;
+            }
+            /* Counting sort of the hashes by partition */
+            std::vector<size_t> starts(partitions_count + 1);
+            for (uint64_t hash : hashes) {
+                ++starts[partition(hash, partitions_count) + 1];
+            }
+            for (size_t i = 0; i < partitions_count; ++i) {
+                starts[i + 1] += starts[i];
+            }
+            std::vector<uint64_t> ordered(keys);
+            std::vector<position_t> indices(keys);
+            std::vector<size_t> cursors(starts.begin(), starts.end() - 1);
+            for (size_t i = 0; i < keys; ++i) {
+                size_t at = cursors[partition(hashes[i], partitions_count)]++;
+                ordered[at] = hashes[i];
+                indices[at] = static_cast<position_t>(i);
+            }
+
+            std::vector<partition_result_t> results(partitions_count);
+            parallel_for(partitions_count, threads, [&](size_t i) {
+                size_t count = starts[i + 1] - starts[i];
+                std::vector<position_t> local(count);
+                results[i] = build_partition(ordered.data() + starts[i], count, local.data());
+                for (size_t k = 0; k < count; ++k) {
+                    slots[indices[starts[i] + k]] = static_cast<position_t>(starts[i] + local[k]);
+                }
+            });
+
+            uint64_t pilot_bit = 0;
+            size_t free_count = 0;
+            for (size_t i = 0; i < partitions_count; ++i) {
+                partition_t & part = partitions[i];
+                part.first_pilot_bit = pilot_bit;
+                part.first_slot = static_cast<position_t>(starts[i]);
+                part.first_free = static_cast<position_t>(free_count);
+                part.keys = static_cast<position_t>(starts[i + 1] - starts[i]);
+                part.table_size = static_cast<position_t>(table_size(part.keys));
+                part.buckets = static_cast<position_t>(results[i].pilots.size());
+                part.pilot_bits = results[i].pilot_bits;
+                pilot_bit += uint64_t(part.buckets) * part.pilot_bits;
+                free_count += results[i].free.size();
+            }
+            pilot_words.assign(static_cast<size_t>(pilot_bit / 64) + 2, 0);
+            free_slots.reserve(free_count);
+            for (size_t i = 0; i < partitions_count; ++i) {
+                partition_t const & part = partitions[i];
+                for (size_t b = 0; b < part.buckets; ++b) {
+                    uint64_t bit = part.first_pilot_bit + uint64_t(b) * part.pilot_bits;
+                    uint64_t value = results[i].pilots[b];
+                    pilot_words[bit / 64] |= value << (bit % 64);
+                    if (bit % 64 + part.pilot_bits > 64) {
+                        pilot_words[bit / 64 + 1] |= value >> (64 - bit % 64);
+                    }
+                }
+                free_slots.insert(free_slots.end(), results[i].free.begin(), results[i].free.end());
+                results[i] = partition_result_t();
+            }
+        }
+
+        /* Slot of a hash of one of the values, or of any slot for other hashes; requires a nonempty side */
+        size_t slot(uint64_t hash) const noexcept
+        {
+            partition_t const & part = partitions[partition(hash, partitions.size())];
+            size_t p = position(hash, pilot(part, bucket(hash, part.buckets)), part.table_size);
+            return part.first_slot + (p < part.keys ? p : free_slots[part.first_free + p - part.keys]);
+        }
+
+        size_t index_bytes() const noexcept
+        {
+            return partitions.size() * sizeof(partition_t) + pilot_words.size() * sizeof(uint64_t) + free_slots.size() * sizeof(position_t);
+        }
+    };
+
+    struct left_descriptor_t
+    {
+        static Left const & value(perfect_hash_bimap const * map, position_t position) noexcept
+        {
+            return map->left_values[position];
+        }
+
+        static position_t partner(perfect_hash_bimap const * map, position_t position) noexcept
+        {
+            return map->left_partners[position];
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static Right const & value(perfect_hash_bimap const * map, position_t position) noexcept
+        {
+            return map->right_values[position];
+        }
+
+        static position_t partner(perfect_hash_bimap const * map, position_t position) noexcept
+        {
+            return map->right_partners[position];
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class perfect_hash_bimap<Left, Right>;
+
+        template <typename, typename, typename, typename>
+        friend class basic_iterator;
+
+        basic_iterator(perfect_hash_bimap const * map, position_t position) noexcept
+            : map(map)
+            , position(position)
+        {
+        }
+
+        perfect_hash_bimap const * map;
+        position_t position;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            ++position;
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++position;
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            --position;
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --position;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::value(map, position);
+        }
+
+        auto flip() const noexcept
+        {
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, MainDescriptor::partner(map, position));
+        }
+    };
+
+    /* Slot holding desired, or size() */
+    template <typename T>
+    static position_t find_position(perfect_hash_t const & hash, std::vector<T> const & values, T const & desired)
+    {
+        if (values.empty()) {
+            return 0;
+        }
+        size_t slot = hash.slot(mix(bimap_hash<T>::hash(desired)));
+        return static_cast<position_t>(values[slot] == desired ? slot : values.size());
+    }
+
+    /* Hashes of all values, computed in parallel */
+    template <typename T>
+    static std::vector<uint64_t> hashes(std::vector<T> const & values, size_t threads)
+    {
+        constexpr size_t chunk = 1 << 16;
+        std::vector<uint64_t> result(values.size());
+        parallel_for((values.size() + chunk - 1) / chunk, threads, [&](size_t i) {
+            for (size_t k = i * chunk; k < std::min(values.size(), (i + 1) * chunk); ++k) {
+                result[k] = mix(bimap_hash<T>::hash(values[k]));
+            }
+        });
+        return result;
+    }
+
+    std::vector<Left> left_values;
+    std::vector<Right> right_values;
+    std::vector<position_t> left_partners;
+    std::vector<position_t> right_partners;
+    perfect_hash_t left_hash;
+    perfect_hash_t right_hash;
+
+public:
+    static size_t default_threads() noexcept
+    {
+        return std::max<size_t>(1, std::thread::hardware_concurrency());
+    }
+
+    perfect_hash_bimap() = default;
+
+    /*
+     * Copies every pair of the map, requires O(size) expected time, spread over threads;
+     * throws std::invalid_argument if two values of one side have the same bimap_hash
+     */
+    template <typename LeftComparator, typename RightComparator, typename Storage, typename Observer, typename Eviction>
+    explicit perfect_hash_bimap(bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction> const & map, size_t threads = default_threads())
+    {
+        size_t count = map.size();
+        if (count >= size_t(position_t(-1))) {
+            throw std::length_error("Too many pairs to freeze.");
+        }
+        std::vector<Left> lefts;
+        std::vector<Right> rights;
+        lefts.reserve(count);
+        rights.reserve(count);
+        for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+            lefts.push_back(*it);
+            rights.push_back(*it.flip());
+        }
+        std::vector<position_t> left_slots;
+        std::vector<position_t> right_slots;
+        left_hash.build(hashes(lefts, threads), threads, left_slots);
+        right_hash.build(hashes(rights, threads), threads, right_slots);
+
+        left_values.resize(count);
+        right_values.resize(count);
+        left_partners.resize(count);
+        right_partners.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            left_values[left_slots[i]] = std::move(lefts[i]);
+            right_values[right_slots[i]] = std::move(rights[i]);
+            left_partners[left_slots[i]] = right_slots[i];
+            right_partners[right_slots[i]] = left_slots[i];
+        }
+    }
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, 0);
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, static_cast<position_t>(left_values.size()));
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, 0);
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, static_cast<position_t>(right_values.size()));
+    }
+
+    bool empty() const noexcept
+    {
+        return left_values.empty();
+    }
+
+    size_t size() const noexcept
+    {
+        return left_values.size();
+    }
+
+    /* Bytes taken by the hash functions of both sides */
+    size_t index_bytes() const noexcept
+    {
+        return left_hash.index_bytes() + right_hash.index_bytes();
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return left_iterator(this, find_position(left_hash, left_values, desired));
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return right_iterator(this, find_position(right_hash, right_values, desired));
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        position_t position = find_position(left_hash, left_values, key);
+        if (position == left_values.size()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return right_values[left_partners[position]];
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        position_t position = find_position(right_hash, right_values, key);
+        if (position == right_values.size()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return left_values[right_partners[position]];
+    }
+
+    /* Slots depend only on the values, so equal maps hold equal arrays */
+    bool operator==(perfect_hash_bimap const & other) const
+    {
+        return (left_values == other.left_values && right_values == other.right_values && left_partners == other.left_partners);
+    }
+
+    bool operator!=(perfect_hash_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
@@ -0,0 +1,950 @@
+#pragma once
+
+#include "bimap.h"
+#include "snapshot.h"
+
+#include <algorithm>   // std::max, std::min, std::sort
+#include <cstddef>     // size_t, std::nullptr_t
+#include <cstdint>     // uint32_t, uint64_t, uintptr_t
+#include <cstring>     // std::memcmp, std::memcpy
+#include <exception>   // std::exception
+#include <filesystem>  // std::filesystem
+#include <functional>  // std::less
+#include <limits>      // std::numeric_limits
+#include <new>         // std::bad_alloc, placement new
+#include <stdexcept>   // std::length_error, std::out_of_range, std::runtime_error
+#include <string>      // std::string
+#include <type_traits> // std::is_trivially_copyable
+#include <utility>     // std::forward, std::move, std::pair, std::swap
+#include <vector>      // std::vector
+
+#include <cerrno>     // errno, EEXIST, EINTR
+#include <fcntl.h>    // open
+#include <sys/file.h> // flock
+#include <sys/mman.h> // madvise, mmap, munmap
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close, fdatasync, ftruncate, pread, pwrite, sysconf
+
+/*
+ * Byte ranges written inside a mapped region, collected while the journal is active on the writing thread.
+ * Offset pointers and arenas report their stores to it, persistent_bimap reports the rest of its writes.
+ * It keeps one bit per 64-byte line, so recording a store is O(1) and repeated writes to a line cost nothing;
+ * if recording runs out of memory the journal falls back to the whole region.
+ */
+class persistent_journal
+{
+    static constexpr uint64_t line_size = 64;
+
+    char const * begin;
+    char const * end;
+    std::vector<uint64_t> lines;
+    std::vector<size_t> touched;
+    std::vector<std::pair<uint64_t, uint64_t>> ranges;
+    bool overflowed;
+
+public:
+    /* Journal of the operation running on this thread, if any */
+    static inline thread_local persistent_journal * active = nullptr;
+
+    explicit persistent_journal(void const * begin = nullptr, size_t size = 0) noexcept
+        : begin(static_cast<char const *>(begin))
+        , end(static_cast<char const *>(begin) + size)
+        , overflowed(false)
+    {
+    }
+
+    /* Notes a store of bytes at address, ignored outside the region */
+    static void note(void const * address, size_t bytes) noexcept
+    {
+        persistent_journal * journal = active;
+        char const * first = static_cast<char const *>(address);
+        if (journal != nullptr && first >= journal->begin && first < journal->end) {
+            journal->record(static_cast<uint64_t>(first - journal->begin), bytes);
+        }
+    }
+
+    /* Marks the lines of line_size bytes covering the range, one bit each */
+    void record(uint64_t offset, uint64_t bytes) noexcept
+    {
+        try {
+            for (uint64_t line = offset / line_size; line <= (offset + bytes - 1) / line_size; ++line) {
+                size_t word = static_cast<size_t>(line / 64);
+                if (word >= lines.size()) {
+                    lines.resize(word + 1);
+                }
+                if (lines[word] == 0) {
+                    touched.push_back(word);
+                }
+                lines[word] |= uint64_t(1) << (line % 64);
+            }
+        }
+        catch (...) {
+            overflowed = true;
+        }
+    }
+
+    /* Ranges of whole lines written since the last clear() clipped to size, the whole region after an overflow */
+    std::vector<std::pair<uint64_t, uint64_t>> const & written(uint64_t size)
+    {
+        ranges.clear();
+        if (overflowed) {
+            ranges.emplace_back(0, size);
+            return ranges;
+        }
+        std::sort(touched.begin(), touched.end());
+        for (size_t word : touched) {
+            for (uint64_t bits = lines[word]; bits != 0; bits &= bits - 1) {
+                uint64_t first = (word * 64 + __builtin_ctzll(bits)) * line_size;
+                if (first >= size) {
+                    continue;
+                }
+                uint64_t last = std::min(first + line_size, size);
+                if (!ranges.empty() && ranges.back().first + ranges.back().second == first) {
+                    ranges.back().second = last - ranges.back().first;
+                }
+                else {
+                    ranges.emplace_back(first, last - first);
+                }
+            }
+        }
+        return ranges;
+    }
+
+    bool empty() const noexcept
+    {
+        return touched.empty() && !overflowed;
+    }
+
+    void clear() noexcept
+    {
+        for (size_t word : touched) {
+            lines[word] = 0;
+        }
+        touched.clear();
+        ranges.clear();
+        overflowed = false;
+    }
+};
+
+/*
+ * Self-relative pointer: stores the distance from its own address to the target, so a structure linked by
+ * offset pointers stays valid wherever it is mapped. Zero distance means nullptr, so it can't point to itself.
+ * Copying recomputes the distance for the new address. Every store is reported to the active persistent_journal.
+ */
+template <typename T>
+class offset_ptr
+{
+    uintptr_t offset;
+
+    void set(T const * pointer) noexcept
+    {
+        offset = (pointer != nullptr ? reinterpret_cast<uintptr_t>(pointer) - reinterpret_cast<uintptr_t>(this) : 0);
+        persistent_journal::note(&offset, sizeof(offset));
+    }
+
+public:
+    offset_ptr() noexcept
+    {
+        set(nullptr);
+    }
+
+    offset_ptr(std::nullptr_t) noexcept
+    {
+        set(nullptr);
+    }
+
+    offset_ptr(T * pointer) noexcept
+    {
+        set(pointer);
+    }
+
+    offset_ptr(offset_ptr const & other) noexcept
+    {
+        set(other.get());
+    }
+
+    offset_ptr & operator=(offset_ptr const & other) noexcept
+    {
+        set(other.get());
+        return *this;
+    }
+
+    offset_ptr & operator=(T * pointer) noexcept
+    {
+        set(pointer);
+        return *this;
+    }
+
+    T * get() const noexcept
+    {
+        return (offset != 0 ? reinterpret_cast<T *>(reinterpret_cast<uintptr_t>(this) + offset) : nullptr);
+    }
+
+    operator T *() const noexcept
+    {
+        return get();
+    }
+
+    T * operator->() const noexcept
+    {
+        return get();
+    }
+
+    T & operator*() const noexcept
+    {
+        return *get();
+    }
+};
+
+/*
+ * Node arena inside a mapped region: bump allocation of equal slots from the bytes following the arena,
+ * freed slots are reused through a free list. The owner of the region grows capacity, allocation never does.
+ */
+class persistent_arena
+{
+    struct free_slot_t
+    {
+        offset_ptr<free_slot_t> next;
+    };
+
+    char * bytes() noexcept
+    {
+        return reinterpret_cast<char *>(this);
+    }
+
+public:
+    /* Slots are aligned to this, so is the first slot */
+    static constexpr size_t slot_alignment = 16;
+
+    /* Offsets from the arena itself */
+    uint64_t used;
+    uint64_t capacity;
+    /* Zero until the first allocation fixes it */
+    uint64_t slot_size;
+    offset_ptr<free_slot_t> free_list;
+
+    explicit persistent_arena(uint64_t used, uint64_t capacity) noexcept
+        : used(used)
+        , capacity(capacity)
+        , slot_size(0)
+    {
+    }
+
+    /* Whether the next allocation fits without growing */
+    bool has_room() const noexcept
+    {
+        return (free_list != nullptr || capacity - used >= std::max<uint64_t>(slot_size, 1));
+    }
+
+    void * allocate(size_t size, size_t alignment)
+    {
+        if (slot_size == 0) {
+            slot_size = (std::max(size, sizeof(free_slot_t)) + slot_alignment - 1) / slot_alignment * slot_alignment;
+        }
+        if (size > slot_size || alignment > slot_alignment) {
+            throw std::bad_alloc();
+        }
+        void * slot;
+        if (free_list != nullptr) {
+            free_slot_t * reused = free_list;
+            free_list = reused->next;
+            slot = reused;
+        }
+        else {
+            if (capacity - used < slot_size) {
+                throw std::bad_alloc();
+            }
+            slot = bytes() + used;
+            used += slot_size;
+        }
+        /* The node is constructed into the slot without offset pointers storing all of it */
+        persistent_journal::note(slot, slot_size);
+        return slot;
+    }
+
+    void deallocate(void * pointer) noexcept
+    {
+        free_slot_t * slot = new (pointer) free_slot_t();
+        slot->next = free_list;
+        free_list = slot;
+    }
+};
+
+/* Storage policy for bimap keeping nodes in a persistent_arena, linked by offset pointers */
+class persistent_storage
+{
+    offset_ptr<persistent_arena> arena;
+
+public:
+    template <typename Node>
+    using link = offset_ptr<Node>;
+
+    explicit persistent_storage(persistent_arena * arena = nullptr) noexcept
+        : arena(arena)
+    {
+    }
+
+    template <typename Node, typename... Args>
+    Node * create(Args &&... args)
+    {
+        void * slot = arena->allocate(sizeof(Node), alignof(Node));
+        try {
+            return new (slot) Node(std::forward<Args>(args)...);
+        }
+        catch (...) {
+            arena->deallocate(slot);
+            throw;
+        }
+    }
+
+    template <typename Node>
+    void destroy(Node * node) noexcept
+    {
+        node->~Node();
+        arena->deallocate(node);
+    }
+};
+
+/*
+ * Mutable bimap living in a memory-mapped file, POSIX only. Nodes, links and the map object itself are stored
+ * in the file, linked by offset pointers, so reopening the file gives back the live map in O(1) time without
+ * rebuilding anything; pages are read on first touch. The file grows in chunks inside one reserved address range.
+ * Inserting and erasing have the same complexity as bimap, plus O(1) amortized time for growing the file.
+ * Lookups don't splay, so they write nothing: they take O(depth) time like bimap::search_*. Since splaying may leave
+ * deep paths, e.g. after sorted inserts, a lookup which descends deeper than O(log(size)) marks the map unbalanced,
+ * and the next change or sync() rebalances both trees, once at least size / 8 changes were made since the last
+ * rebalancing, which keeps it O(1) amortized time per change.
+ * Requires (6 * sizeof(offset_ptr) + sizeof(Left) + sizeof(Right), rounded up to 16) * size bytes of the file
+ * plus one page for the header; erased nodes are reused but the file never shrinks.
+ * Values and comparators must be trivially copyable with an alignment of at most 16 bytes, and the file must
+ * be reopened with the same types; the file is locked while it is open.
+ *
+ * The file is mapped privately, so changes stay in memory until sync(), which commits them through a redo journal:
+ * it writes every byte range changed since the last sync to path + ".journal" and syncs it, then writes the ranges
+ * into the file, syncs it and empties the journal. Opening replays a complete journal and ignores a torn one,
+ * so after a crash the map is in the state of the last sync() or of the one interrupted, never torn.
+ * With durability::synchronous every change is synced before returning. Changed pages take private memory,
+ * and the journal takes their changed bytes, until the next sync().
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class persistent_bimap
+{
+    static_assert(std::is_trivially_copyable<Left>::value && std::is_trivially_copyable<Right>::value, "persistent_bimap requires trivially copyable values");
+    static_assert(std::is_trivially_copyable<LeftComparator>::value && std::is_trivially_copyable<RightComparator>::value, "persistent_bimap requires trivially copyable comparators");
+    static_assert(alignof(Left) <= persistent_arena::slot_alignment && alignof(Right) <= persistent_arena::slot_alignment, "persistent_bimap requires values aligned to at most 16 bytes");
+
+public:
+    using map_t = bimap<Left, Right, LeftComparator, RightComparator, persistent_storage>;
+    using left_iterator = typename map_t::left_iterator;
+    using right_iterator = typename map_t::right_iterator;
+
+    enum class durability
+    {
+        /* Changes are durable after sync() or closing */
+        on_sync,
+        /* Every operation is synced before returning */
+        synchronous,
+    };
+
+    /* Address space reserved for the mapping, the file can't grow beyond it */
+    static constexpr size_t default_max_bytes = size_t(1) << 36;
+
+private:
+    struct header_t
+    {
+        static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'P', 'E', 'R'};
+        static constexpr uint32_t current_version = 3;
+        static constexpr uint32_t native_byte_order = 0x01020304;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t left_size;
+        uint32_t right_size;
+        uint64_t map_size;
+        uint64_t file_size;
+        uint64_t reserved;
+    };
+
+    /* Placed right after the header page */
+    struct root_t
+    {
+        persistent_arena arena;
+        map_t map;
+    };
+
+    /* Ends the journal, which holds records of an offset, a size and the bytes padded to 8 */
+    struct journal_trailer_t
+    {
+        static constexpr uint64_t signature = 0x4C4E524A50414D42;
+
+        uint64_t magic;
+        /* Of the records */
+        uint64_t bytes;
+        uint64_t checksum;
+    };
+
+    /* Reports the stores of one operation to the journal */
+    class journal_scope
+    {
+        persistent_journal * previous;
+
+    public:
+        explicit journal_scope(persistent_journal & journal) noexcept
+            : previous(persistent_journal::active)
+        {
+            persistent_journal::active = &journal;
+        }
+
+        journal_scope(journal_scope const &) = delete;
+        journal_scope & operator=(journal_scope const &) = delete;
+
+        ~journal_scope()
+        {
+            persistent_journal::active = previous;
+        }
+    };
+
+    static constexpr size_t header_bytes = 4096;
+    static constexpr size_t growth_bytes = size_t(1) << 20;
+    static constexpr size_t first_slot = (sizeof(root_t) + persistent_arena::slot_alignment - 1) / persistent_arena::slot_alignment * persistent_arena::slot_alignment;
+
+    header_t * header() const noexcept
+    {
+        return static_cast<header_t *>(mapping);
+    }
+
+    root_t * root() const noexcept
+    {
+        return reinterpret_cast<root_t *>(static_cast<char *>(mapping) + header_bytes);
+    }
+
+    void release() noexcept
+    {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+        }
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+        if (journal_descriptor >= 0) {
+            close(journal_descriptor);
+        }
+        mapping = nullptr;
+        mapping_size = 0;
+        descriptor = -1;
+        journal_descriptor = -1;
+    }
+
+    static void write_all(int descriptor, void const * data, size_t size, uint64_t offset)
+    {
+        char const * bytes = static_cast<char const *>(data);
+        while (size > 0) {
+            ssize_t written = pwrite(descriptor, bytes, size, static_cast<off_t>(offset));
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Can't write persistent bimap.");
+            }
+            bytes += written;
+            size -= static_cast<size_t>(written);
+            offset += static_cast<uint64_t>(written);
+        }
+    }
+
+    static void read_all(int descriptor, void * data, size_t size, uint64_t offset)
+    {
+        char * bytes = static_cast<char *>(data);
+        while (size > 0) {
+            ssize_t read = pread(descriptor, bytes, size, static_cast<off_t>(offset));
+            if (read <= 0) {
+                if (read < 0 && errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Can't read persistent bimap.");
+            }
+            bytes += read;
+            size -= static_cast<size_t>(read);
+            offset += static_cast<uint64_t>(read);
+        }
+    }
+
+    static void sync_data(int descriptor)
+    {
+        if (fdatasync(descriptor) != 0) {
+            throw std::runtime_error("Can't sync persistent bimap.");
+        }
+    }
+
+    static void truncate(int descriptor, uint64_t size)
+    {
+        if (ftruncate(descriptor, static_cast<off_t>(size)) != 0) {
+            throw std::runtime_error("Can't resize persistent bimap.");
+        }
+    }
+
+    /* Opens the journal, syncing the directory if it's new */
+    void open_journal(std::string const & path)
+    {
+        std::string journal_path = path + ".journal";
+        journal_descriptor = open(journal_path.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (journal_descriptor >= 0) {
+            std::string directory = std::filesystem::path(path).parent_path().string();
+            if (!snapshot_writer::sync(directory.empty() ? std::string(".") : directory, true)) {
+                throw std::runtime_error("Can't sync the directory of persistent bimap " + path + ".");
+            }
+        }
+        else if (errno == EEXIST) {
+            journal_descriptor = open(journal_path.c_str(), O_RDWR);
+        }
+        if (journal_descriptor < 0) {
+            throw std::runtime_error("Can't open journal " + journal_path + ".");
+        }
+    }
+
+    /* Writes a complete journal into the file and empties it, ignores a torn one */
+    void replay_journal()
+    {
+        struct stat status;
+        if (fstat(journal_descriptor, &status) != 0) {
+            throw std::runtime_error("Can't read persistent bimap journal.");
+        }
+        uint64_t size = static_cast<uint64_t>(status.st_size);
+        if (size < sizeof(journal_trailer_t)) {
+            return;
+        }
+        journal_trailer_t trailer;
+        read_all(journal_descriptor, &trailer, sizeof(trailer), size - sizeof(trailer));
+        if (trailer.magic != journal_trailer_t::signature || trailer.bytes != size - sizeof(trailer)) {
+            return;
+        }
+        std::vector<char> records(static_cast<size_t>(trailer.bytes));
+        read_all(journal_descriptor, records.data(), records.size(), 0);
+        snapshot_checksum checksum;
+        checksum.update(records.data(), records.size());
+        if (checksum.value() != trailer.checksum) {
+            return;
+        }
+        for (size_t at = 0; at + 2 * sizeof(uint64_t) <= records.size();) {
+            uint64_t range[2];
+            std::memcpy(range, records.data() + at, sizeof(range));
+            at += sizeof(range);
+            if (range[1] > records.size() - at) {
+                throw std::runtime_error("Corrupted persistent bimap journal.");
+            }
+            write_all(descriptor, records.data() + at, static_cast<size_t>(range[1]), range[0]);
+            at += static_cast<size_t>((range[1] + 7) / 8 * 8);
+        }
+        sync_data(descriptor);
+        truncate(journal_descriptor, 0);
+    }
+
+    void resize(uint64_t file_size)
+    {
+        truncate(descriptor, file_size);
+        header()->file_size = file_size;
+        root()->arena.capacity = file_size - header_bytes;
+    }
+
+    /* Grows the file before an insertion could run out of slots */
+    void reserve_node()
+    {
+        persistent_arena const & arena = root()->arena;
+        if (!arena.has_room()) {
+            uint64_t file_size = header()->file_size;
+            if (file_size >= mapping_size) {
+                throw std::length_error("Persistent bimap is full.");
+            }
+            resize(std::min<uint64_t>(file_size + std::max<uint64_t>(file_size / 2, growth_bytes), mapping_size));
+        }
+    }
+
+    /* Marks the map unbalanced when a lookup descended deeper than O(log(size)) */
+    void check_depth(size_t depth) const noexcept
+    {
+        size_t limit = 16;
+        for (size_t size = root()->map.size(); size > 0; size /= 2) {
+            limit += 4;
+        }
+        if (depth > limit) {
+            unbalanced = true;
+        }
+    }
+
+    /* Must run inside a change */
+    void rebalance_locked()
+    {
+        root()->map.rebalance();
+        unbalanced = false;
+        changes_since_rebalance = 0;
+    }
+
+    bool rebalance_due() const noexcept
+    {
+        return (unbalanced && changes_since_rebalance >= root()->map.size() / 8);
+    }
+
+    /* The header and the root are changed by plain stores, so every change journals them */
+    template <typename Operation>
+    decltype(auto) change(Operation const & operation)
+    {
+        journal_scope scope(journal);
+        journal.record(0, sizeof(header_t));
+        journal.record(header_bytes, sizeof(root_t));
+        if (rebalance_due()) {
+            rebalance_locked();
+        }
+        decltype(auto) result = operation(root()->map);
+        ++changes_since_rebalance;
+        if (mode == durability::synchronous) {
+            sync();
+        }
+        return result;
+    }
+
+    int descriptor;
+    int journal_descriptor;
+    void * mapping;
+    size_t mapping_size;
+    durability mode;
+    persistent_journal journal;
+    /* Set by lookups, which must not write to the map */
+    mutable bool unbalanced;
+    uint64_t changes_since_rebalance;
+
+public:
+    /* Opens the file, replaying its journal, or creates an empty map in it */
+    explicit persistent_bimap(std::string const & path, durability mode = durability::on_sync, size_t max_bytes = default_max_bytes)
+        : descriptor(-1)
+        , journal_descriptor(-1)
+        , mapping(nullptr)
+        , mapping_size(0)
+        , mode(mode)
+        , unbalanced(false)
+        , changes_since_rebalance(std::numeric_limits<uint64_t>::max())
+    {
+        descriptor = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+        if (descriptor < 0) {
+            throw std::runtime_error("Can't open persistent bimap " + path + ".");
+        }
+        if (flock(descriptor, LOCK_EX | LOCK_NB) != 0) {
+            release();
+            throw std::runtime_error("Persistent bimap " + path + " is already open.");
+        }
+        struct stat status;
+        try {
+            open_journal(path);
+            replay_journal();
+            if (fstat(descriptor, &status) != 0) {
+                throw std::runtime_error("Can't open persistent bimap " + path + ".");
+            }
+        }
+        catch (...) {
+            release();
+            throw;
+        }
+        uint64_t file_size = static_cast<uint64_t>(status.st_size);
+        mapping_size = std::max<size_t>(max_bytes, file_size);
+        /* Private pages are charged only when written, not for the whole reserved range */
+        mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_NORESERVE, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            release();
+            throw std::runtime_error("Can't map persistent bimap " + path + ".");
+        }
+        journal = persistent_journal(mapping, mapping_size);
+
+        /* A crash before the first sync leaves a file without a header */
+        static constexpr char no_signature[8] = {};
+        if (file_size < sizeof(header_t) || std::memcmp(header()->magic, no_signature, sizeof(no_signature)) == 0) {
+            try {
+                journal_scope scope(journal);
+                uint64_t initial_size = header_bytes + first_slot + growth_bytes;
+                truncate(descriptor, initial_size);
+                header_t * created = new (mapping) header_t();
+                std::memcpy(created->magic, header_t::signature, sizeof(created->magic));
+                created->version = header_t::current_version;
+                created->byte_order = header_t::native_byte_order;
+                created->left_size = sizeof(Left);
+                created->right_size = sizeof(Right);
+                created->map_size = sizeof(map_t);
+                created->file_size = initial_size;
+                root_t * created_root = root();
+                new (&created_root->arena) persistent_arena(first_slot, initial_size - header_bytes);
+                new (&created_root->map) map_t(LeftComparator(), RightComparator(), persistent_storage(&created_root->arena));
+                journal.record(0, sizeof(header_t));
+                journal.record(header_bytes, sizeof(root_t));
+                sync();
+            }
+            catch (...) {
+                release();
+                throw;
+            }
+            return;
+        }
+
+        header_t const & existing = *header();
+        if (file_size < header_bytes + first_slot
+            || std::memcmp(existing.magic, header_t::signature, sizeof(existing.magic)) != 0
+            || existing.version != header_t::current_version || existing.byte_order != header_t::native_byte_order
+            || existing.left_size != sizeof(Left) || existing.right_size != sizeof(Right)
+            || existing.map_size != sizeof(map_t) || existing.file_size > file_size) {
+            release();
+            throw std::runtime_error("Persistent bimap doesn't match the value types or is corrupted.");
+        }
+        /* Growth which no sync committed */
+        if (existing.file_size < file_size) {
+            try {
+                truncate(descriptor, existing.file_size);
+            }
+            catch (...) {
+                release();
+                throw;
+            }
+        }
+    }
+
+    persistent_bimap(persistent_bimap const &) = delete;
+    persistent_bimap & operator=(persistent_bimap const &) = delete;
+
+    persistent_bimap(persistent_bimap && other) noexcept
+        : descriptor(other.descriptor)
+        , journal_descriptor(other.journal_descriptor)
+        , mapping(other.mapping)
+        , mapping_size(other.mapping_size)
+        , mode(other.mode)
+        , journal(std::move(other.journal))
+        , unbalanced(other.unbalanced)
+        , changes_since_rebalance(other.changes_since_rebalance)
+    {
+        other.descriptor = -1;
+        other.journal_descriptor = -1;
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+    }
+
+    persistent_bimap & operator=(persistent_bimap && other) noexcept
+    {
+        std::swap(descriptor, other.descriptor);
+        std::swap(journal_descriptor, other.journal_descriptor);
+        std::swap(mapping, other.mapping);
+        std::swap(mapping_size, other.mapping_size);
+        std::swap(mode, other.mode);
+        std::swap(journal, other.journal);
+        std::swap(unbalanced, other.unbalanced);
+        std::swap(changes_since_rebalance, other.changes_since_rebalance);
+        return *this;
+    }
+
+    /* Syncs, a failed sync loses the changes since the last one */
+    ~persistent_bimap()
+    {
+        if (mapping != nullptr) {
+            try {
+                sync();
+            }
+            catch (std::exception const &) {
+            }
+        }
+        release();
+    }
+
+    /*
+     * Commits the changes since the last sync: writes them to the journal and syncs it, then writes them
+     * to the file, syncs it and empties the journal; the private copies of the changed pages are dropped afterwards
+     */
+    void sync()
+    {
+        if (rebalance_due()) {
+            change([&](map_t &) {
+                rebalance_locked();
+                return true;
+            });
+            if (mode == durability::synchronous) {
+                return;
+            }
+        }
+        if (journal.empty()) {
+            return;
+        }
+        auto const & ranges = journal.written(header()->file_size);
+        std::vector<char> records;
+        for (auto const & range : ranges) {
+            uint64_t head[2] = {range.first, range.second};
+            char const * bytes = static_cast<char const *>(mapping) + range.first;
+            records.insert(records.end(), reinterpret_cast<char const *>(head), reinterpret_cast<char const *>(head) + sizeof(head));
+            records.insert(records.end(), bytes, bytes + range.second);
+            records.resize((records.size() + 7) / 8 * 8, '\0');
+        }
+        snapshot_checksum checksum;
+        checksum.update(records.data(), records.size());
+        journal_trailer_t trailer = {journal_trailer_t::signature, records.size(), checksum.value()};
+        truncate(journal_descriptor, 0);
+        write_all(journal_descriptor, records.data(), records.size(), 0);
+        write_all(journal_descriptor, &trailer, sizeof(trailer), records.size());
+        sync_data(journal_descriptor);
+
+        for (auto const & range : ranges) {
+            write_all(descriptor, static_cast<char const *>(mapping) + range.first, static_cast<size_t>(range.second), range.first);
+        }
+        sync_data(descriptor);
+        truncate(journal_descriptor, 0);
+
+        uint64_t page = static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+        for (auto const & range : ranges) {
+            uint64_t first = range.first / page * page;
+            uint64_t last = (range.first + range.second + page - 1) / page * page;
+            madvise(static_cast<char *>(mapping) + first, static_cast<size_t>(last - first), MADV_DONTNEED);
+        }
+        journal.clear();
+    }
+
+    /* Bytes of the file */
+    size_t file_size() const noexcept
+    {
+        return header()->file_size;
+    }
+
+    /* Iterators stay valid until the map is changed or closed */
+    left_iterator begin_left() const noexcept
+    {
+        return root()->map.begin_left();
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return root()->map.end_left();
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return root()->map.begin_right();
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return root()->map.end_right();
+    }
+
+    bool empty() const noexcept
+    {
+        return root()->map.empty();
+    }
+
+    size_t size() const noexcept
+    {
+        return root()->map.size();
+    }
+
+    /* If depth isn't null, it receives the number of nodes visited, as for bimap::search_left() */
+    left_iterator find_left(Left const & desired, size_t * depth = nullptr) const
+    {
+        size_t visited = 0;
+        left_iterator found = root()->map.search_left(desired, &visited);
+        check_depth(visited);
+        if (depth != nullptr) {
+            *depth = visited;
+        }
+        return found;
+    }
+
+    right_iterator find_right(Right const & desired, size_t * depth = nullptr) const
+    {
+        size_t visited = 0;
+        right_iterator found = root()->map.search_right(desired, &visited);
+        check_depth(visited);
+        if (depth != nullptr) {
+            *depth = visited;
+        }
+        return found;
+    }
+
+    left_iterator insert(Left const & left, Right const & right)
+    {
+        reserve_node();
+        return change([&](map_t & map) { return map.insert(left, right); });
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return change([&](map_t & map) { return map.erase_left(key); });
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return change([&](map_t & map) { return map.erase_right(key); });
+    }
+
+    /* Relinks both trees balanced in O(size) time, so that lookups take O(log(size)) time */
+    void rebalance()
+    {
+        change([&](map_t &) {
+            rebalance_locked();
+            return true;
+        });
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        size_t depth = 0;
+        left_iterator found = root()->map.search_lower_bound_left(value, &depth);
+        check_depth(depth);
+        return found;
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        size_t depth = 0;
+        left_iterator found = root()->map.search_upper_bound_left(value, &depth);
+        check_depth(depth);
+        return found;
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        size_t depth = 0;
+        right_iterator found = root()->map.search_lower_bound_right(value, &depth);
+        check_depth(depth);
+        return found;
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        size_t depth = 0;
+        right_iterator found = root()->map.search_upper_bound_right(value, &depth);
+        check_depth(depth);
+        return found;
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        left_iterator found = find_left(key);
+        if (found == end_left()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return *found.flip();
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        right_iterator found = find_right(key);
+        if (found == end_right()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return *found.flip();
+    }
+
+    Right const & at_left_or_default(Left const & key)
+    {
+        reserve_node();
+        return change([&](map_t & map) -> Right const & { return map.at_left_or_default(key); });
+    }
+
+    Left const & at_right_or_default(Right const & key)
+    {
+        reserve_node();
+        return change([&](map_t & map) -> Left const & { return map.at_right_or_default(key); });
+    }
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>  // std::max
+#include <atomic>     // std::atomic
+#include <cstddef>    // size_t
+#include <cstdint>    // uint64_t
+#include <functional> // std::less, std::hash
+#include <memory>     // std::unique_ptr
+#include <mutex>      // std::mutex, std::lock_guard
+#include <optional>   // std::optional
+#include <stdexcept>  // std::out_of_range, std::invalid_argument
+#include <thread>     // std::this_thread, std::thread
+#include <utility>    // std::move
+
+#ifdef __linux__
+#include <sched.h> // sched_getcpu
+#endif
+
+/*
+ * Node replication: every group of cores owns its own bimap replica, replicas are kept consistent by a shared
+ * append-only operation log.
+ * An update reserves the next log entry, fills it in, then brings the replica of its thread up to date,
+ * taking its own result from there, so updates are linearizable in log order.
+ * A lookup brings the replica of its thread up to the log tail it observed, then reads that replica,
+ * so concurrent lookups on different groups share nothing but the cache line of the log tail.
+ * The log is a ring buffer: an update, whose slot still holds an entry unapplied by some replica, applies
+ * the log to that replica itself, so an idle group never stalls the others.
+ * Requires O(replicas) more memory than one bimap, every update is applied once per replica.
+ * Lookups return copies of the stored values.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class replicated_bimap
+{
+    enum class operation_t
+    {
+        insert,
+        erase_left,
+        erase_right,
+    };
+
+    enum outcome_t : int
+    {
+        unknown,
+        succeeded,
+        failed,
+    };
+
+    struct replica_t;
+
+    struct entry_t
+    {
+        /* Equals position + 1 once the entry at that position is filled in */
+        std::atomic<uint64_t> sequence{0};
+        /* Equals position + 1 once the writer of the entry at that position has taken its outcome */
+        std::atomic<uint64_t> collected{0};
+        /* Set when the replica of the writer applies the entry */
+        std::atomic<int> outcome{unknown};
+        replica_t * origin;
+        operation_t operation;
+        std::optional<Left> left;
+        std::optional<Right> right;
+    };
+
+    struct alignas(64) replica_t
+    {
+        explicit replica_t(LeftComparator const & left_compare, RightComparator const & right_compare)
+            : map(left_compare, right_compare)
+            , applied(0)
+        {
+        }
+
+        std::mutex mutex;
+        bimap<Left, Right, LeftComparator, RightComparator> map;
+        /* Number of log entries applied to this replica */
+        std::atomic<uint64_t> applied;
+    };
+
+    static bool apply(bimap<Left, Right, LeftComparator, RightComparator> & map, entry_t const & entry)
+    {
+        switch (entry.operation) {
+        case operation_t::insert:
+            return (map.insert(*entry.left, *entry.right) != map.end_left());
+        case operation_t::erase_left:
+            return map.erase_left(*entry.left);
+        case operation_t::erase_right:
+            return map.erase_right(*entry.right);
+        }
+        return false;
+    }
+
+    static void wait(size_t attempt) noexcept
+    {
+        if (attempt % 64 == 63) {
+            std::this_thread::yield();
+        }
+    }
+
+    /* Called with replica.mutex held */
+    void catch_up(replica_t & replica, uint64_t target)
+    {
+        for (uint64_t position = replica.applied.load(std::memory_order_relaxed); position < target; ++position) {
+            entry_t & entry = log[position & log_mask];
+            for (size_t attempt = 0; entry.sequence.load(std::memory_order_acquire) != position + 1; ++attempt) {
+                wait(attempt);
+            }
+            bool applied = apply(replica.map, entry);
+            if (entry.origin == &replica) {
+                entry.outcome.store(applied ? succeeded : failed, std::memory_order_release);
+            }
+            replica.applied.store(position + 1, std::memory_order_release);
+        }
+    }
+
+    /*
+     * Waits until the previous entry stored where position goes is applied by every replica and collected by its writer.
+     * Lagging replicas are brought up to date by the waiting thread.
+     */
+    void wait_for_space(uint64_t position)
+    {
+        if (position < log_capacity) {
+            return;
+        }
+        uint64_t required = position - log_capacity + 1;
+        for (size_t index = 0; index < replicas_count; ++index) {
+            /* The holder of a replica lock may be waiting for the entry of this thread, so never block on it */
+            replica_t & replica = *replicas[index];
+            for (size_t attempt = 0; replica.applied.load(std::memory_order_acquire) < required; ++attempt) {
+                if (replica.mutex.try_lock()) {
+                    std::lock_guard<std::mutex> lock(replica.mutex, std::adopt_lock);
+                    catch_up(replica, required);
+                }
+                else {
+                    wait(attempt);
+                }
+            }
+        }
+        entry_t const & entry = log[position & log_mask];
+        for (size_t attempt = 0; entry.collected.load(std::memory_order_acquire) != required; ++attempt) {
+            wait(attempt);
+        }
+    }
+
+    /* Threads running on neighbouring cores share a replica */
+    replica_t & replica_of_this_thread() const noexcept
+    {
+#ifdef __linux__
+        int cpu = sched_getcpu();
+        if (cpu >= 0) {
+            return *replicas[(static_cast<size_t>(cpu) * replicas_count / cores_count) % replicas_count];
+        }
+#endif
+        return *replicas[std::hash<std::thread::id>()(std::this_thread::get_id()) % replicas_count];
+    }
+
+    /* Appends the operation to the log and waits until the replica of this thread has applied it */
+    template <typename Prepare>
+    bool update(Prepare const & prepare)
+    {
+        uint64_t position = tail.fetch_add(1, std::memory_order_relaxed);
+        wait_for_space(position);
+        replica_t & replica = replica_of_this_thread();
+        entry_t & entry = log[position & log_mask];
+        entry.origin = &replica;
+        prepare(entry);
+        entry.sequence.store(position + 1, std::memory_order_release);
+
+        int outcome;
+        for (size_t attempt = 0; (outcome = entry.outcome.load(std::memory_order_acquire)) == unknown; ++attempt) {
+            if (replica.mutex.try_lock()) {
+                std::lock_guard<std::mutex> lock(replica.mutex, std::adopt_lock);
+                catch_up(replica, position + 1);
+            }
+            else {
+                wait(attempt);
+            }
+        }
+        entry.outcome.store(unknown, std::memory_order_relaxed);
+        entry.collected.store(position + 1, std::memory_order_release);
+        return (outcome == succeeded);
+    }
+
+    /* Brings the replica of this thread up to the current log tail and reads it */
+    template <typename Read>
+    auto read(Read const & reader)
+    {
+        replica_t & replica = replica_of_this_thread();
+        std::lock_guard<std::mutex> lock(replica.mutex);
+        catch_up(replica, tail.load(std::memory_order_acquire));
+        return reader(replica.map);
+    }
+
+    size_t replicas_count;
+    size_t cores_count;
+    size_t log_capacity;
+    uint64_t log_mask;
+    std::unique_ptr<entry_t[]> log;
+    std::unique_ptr<std::unique_ptr<replica_t>[]> replicas;
+    alignas(64) std::atomic<uint64_t> tail;
+
+public:
+    /* One replica per four cores, which usually share a cache */
+    static size_t default_replicas() noexcept
+    {
+        return std::max<size_t>(1, std::thread::hardware_concurrency() / 4);
+    }
+
+    /* Log capacity must be a power of two */
+    explicit replicated_bimap(size_t replicas_count = default_replicas(), size_t log_capacity = size_t(1) << 16, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : replicas_count(replicas_count)
+        , cores_count(std::max<size_t>(1, std::thread::hardware_concurrency()))
+        , log_capacity(log_capacity)
+        , log_mask(log_capacity - 1)
+        , tail(0)
+    {
+        if (replicas_count == 0 || log_capacity == 0 || (log_capacity & log_mask) != 0) {
+            throw std::invalid_argument("Invalid replication parameters.");
+        }
+        log.reset(new entry_t[log_capacity]);
+        replicas.reset(new std::unique_ptr<replica_t>[replicas_count]);
+        for (size_t index = 0; index < replicas_count; ++index) {
+            replicas[index].reset(new replica_t(left_compare, right_compare));
+        }
+    }
+
+    replicated_bimap(replicated_bimap const &) = delete;
+    replicated_bimap & operator=(replicated_bimap const &) = delete;
+
+    size_t replicas_size() const noexcept
+    {
+        return replicas_count;
+    }
+
+    bool empty()
+    {
+        return (size() == 0);
+    }
+
+    size_t size()
+    {
+        return read([](auto const & map) {
+            return map.size();
+        });
+    }
+
+    /* Returns false if either value is already present */
+    bool insert(Left const & left, Right const & right)
+    {
+        return update([&](entry_t & entry) {
+            entry.operation = operation_t::insert;
+            entry.left.emplace(left);
+            entry.right.emplace(right);
+        });
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return update([&](entry_t & entry) {
+            entry.operation = operation_t::erase_left;
+            entry.left.emplace(key);
+            entry.right.reset();
+        });
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return update([&](entry_t & entry) {
+            entry.operation = operation_t::erase_right;
+            entry.left.reset();
+            entry.right.emplace(key);
+        });
+    }
+
+    std::optional<Right> find_left(Left const & key)
+    {
+        return read([&](auto & map) {
+            auto it = map.find_left(key);
+            return (it != map.end_left() ? std::optional<Right>(*it.flip()) : std::nullopt);
+        });
+    }
+
+    std::optional<Left> find_right(Right const & key)
+    {
+        return read([&](auto & map) {
+            auto it = map.find_right(key);
+            return (it != map.end_right() ? std::optional<Left>(*it.flip()) : std::nullopt);
+        });
+    }
+
+    Right at_left(Left const & key)
+    {
+        std::optional<Right> found = find_left(key);
+        if (!found) {
+            throw std::out_of_range("No matching element.");
+        }
+        return std::move(*found);
+    }
+
+    Left at_right(Right const & key)
+    {
+        std::optional<Left> found = find_right(key);
+        if (!found) {
+            throw std::out_of_range("No matching element.");
+        }
+        return std::move(*found);
+    }
+};
@@ -0,0 +1,463 @@
+#pragma once
+
+#include "persistent_bimap.h"
+
+#include <algorithm>   // std::max, std::min
+#include <atomic>      // std::atomic
+#include <cstddef>     // size_t
+#include <cstdint>     // uint32_t, uint64_t
+#include <cstring>     // std::memcmp, std::memcpy
+#include <functional>  // std::less
+#include <new>         // placement new
+#include <optional>    // std::optional
+#include <stdexcept>   // std::length_error, std::logic_error, std::runtime_error
+#include <string>      // std::string
+#include <type_traits> // std::is_trivially_copyable
+#include <utility>     // std::move, std::pair, std::swap
+
+#include <fcntl.h>    // O_CREAT, O_EXCL, O_RDWR
+#include <pthread.h>  // pthread_rwlock_t
+#include <sys/mman.h> // mmap, mprotect, munmap, shm_open, shm_unlink
+#include <sys/stat.h> // fstat
+#include <unistd.h>   // close, ftruncate
+
+/*
+ * Bimap shared by one writer process and many reader processes through POSIX shared memory, without a copy per process.
+ * The segment holds the map object and its nodes, allocated from a persistent_arena and linked by offset pointers,
+ * so every process may map it at a different address. The writer creates the segment and unlinks its name when closed,
+ * readers open it by name; every process reserves the same address range, and the writer grows the segment inside it.
+ * Readers map the nodes read-only and look up without splaying, so they never write to shared nodes.
+ * Since the writer's splaying may leave deep paths, e.g. after sorted inserts, a reader which descends deeper
+ * than O(log(size)) asks the writer to rebalance both trees. The writer does so on a later change, once at least
+ * size / 8 changes were made since the last rebalancing, which keeps it O(1) amortized time per change;
+ * the writer should call rebalance() after a burst of changes.
+ * A process-shared reader/writer lock in the segment header serializes the writer against readers,
+ * and a version counter, incremented by every change, lets readers detect changes.
+ * If the writer dies while holding the lock, readers block forever.
+ * Requires O(log(size)) time on average for inserting or erasing one element, lookups require O(depth) time
+ * since they don't splay. Lookups return copies of the stored values, since the writer may change them after unlocking.
+ * Values and comparators must be trivially copyable with an alignment of at most 16 bytes,
+ * and every process must use the same types and the same build.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class shared_bimap
+{
+    static_assert(std::is_trivially_copyable<Left>::value && std::is_trivially_copyable<Right>::value, "shared_bimap requires trivially copyable values");
+    static_assert(std::is_trivially_copyable<LeftComparator>::value && std::is_trivially_copyable<RightComparator>::value, "shared_bimap requires trivially copyable comparators");
+    static_assert(alignof(Left) <= persistent_arena::slot_alignment && alignof(Right) <= persistent_arena::slot_alignment, "shared_bimap requires values aligned to at most 16 bytes");
+
+    using map_t = bimap<Left, Right, LeftComparator, RightComparator, persistent_storage>;
+
+    struct header_t
+    {
+        static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'S', 'H', 'M'};
+        static constexpr uint32_t current_version = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t left_size;
+        uint32_t right_size;
+        uint32_t map_size;
+        uint64_t max_bytes;
+        uint64_t segment_size;
+        pthread_rwlock_t lock;
+        std::atomic<uint64_t> changes;
+        /* Set by readers which descended too deep */
+        std::atomic<uint32_t> unbalanced;
+        uint64_t rebalanced_changes;
+        /* Set last by the writer, once the segment is initialized */
+        std::atomic<uint32_t> ready;
+    };
+
+    struct root_t
+    {
+        persistent_arena arena;
+        map_t map;
+    };
+
+    /* Writable by readers for locking, covers the largest common page size */
+    static constexpr size_t header_bytes = size_t(1) << 16;
+    static constexpr size_t growth_bytes = size_t(1) << 20;
+    static constexpr size_t first_slot = (sizeof(root_t) + persistent_arena::slot_alignment - 1) / persistent_arena::slot_alignment * persistent_arena::slot_alignment;
+
+    class read_lock_t
+    {
+        pthread_rwlock_t * lock;
+
+    public:
+        explicit read_lock_t(header_t * header) noexcept
+            : lock(&header->lock)
+        {
+            pthread_rwlock_rdlock(lock);
+        }
+
+        read_lock_t(read_lock_t const &) = delete;
+
+        ~read_lock_t()
+        {
+            pthread_rwlock_unlock(lock);
+        }
+    };
+
+    class write_lock_t
+    {
+        pthread_rwlock_t * lock;
+
+    public:
+        explicit write_lock_t(header_t * header) noexcept
+            : lock(&header->lock)
+        {
+            pthread_rwlock_wrlock(lock);
+        }
+
+        write_lock_t(write_lock_t const &) = delete;
+
+        ~write_lock_t()
+        {
+            pthread_rwlock_unlock(lock);
+        }
+    };
+
+    header_t * header() const noexcept
+    {
+        return static_cast<header_t *>(mapping);
+    }
+
+    root_t * root() const noexcept
+    {
+        return reinterpret_cast<root_t *>(static_cast<char *>(mapping) + header_bytes);
+    }
+
+    void release() noexcept
+    {
+        if (mapping != nullptr) {
+            munmap(mapping, mapping_size);
+        }
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+        if (writer && !name.empty()) {
+            shm_unlink(name.c_str());
+        }
+        mapping = nullptr;
+        mapping_size = 0;
+        descriptor = -1;
+    }
+
+    /* Grows the segment before an insertion could run out of slots, under the write lock */
+    void reserve_node()
+    {
+        if (!root()->arena.has_room()) {
+            uint64_t segment_size = header()->segment_size;
+            if (segment_size >= mapping_size) {
+                throw std::length_error("Shared bimap is full.");
+            }
+            segment_size = std::min<uint64_t>(segment_size + std::max<uint64_t>(segment_size / 2, growth_bytes), mapping_size);
+            if (ftruncate(descriptor, static_cast<off_t>(segment_size)) != 0) {
+                throw std::runtime_error("Can't grow shared bimap.");
+            }
+            header()->segment_size = segment_size;
+            root()->arena.capacity = segment_size - header_bytes;
+        }
+    }
+
+    template <typename Read>
+    auto read(Read const & reader) const
+    {
+        read_lock_t lock(header());
+        return reader(static_cast<map_t const &>(root()->map));
+    }
+
+    void check_depth(map_t const & map, size_t depth) const noexcept
+    {
+        size_t limit = 16;
+        for (size_t size = map.size(); size > 0; size /= 2) {
+            limit += 4;
+        }
+        if (depth > limit && header()->unbalanced.load(std::memory_order_relaxed) == 0) {
+            header()->unbalanced.store(1, std::memory_order_relaxed);
+        }
+    }
+
+    void rebalance_locked()
+    {
+        root()->map.rebalance();
+        header()->rebalanced_changes = header()->changes;
+        header()->unbalanced.store(0, std::memory_order_relaxed);
+    }
+
+    template <typename Update>
+    bool update(Update const & updater)
+    {
+        if (!writer) {
+            throw std::logic_error("Shared bimap is opened for reading only.");
+        }
+        write_lock_t lock(header());
+        header_t * shared = header();
+        if (shared->unbalanced.load(std::memory_order_relaxed) != 0 && shared->changes - shared->rebalanced_changes >= root()->map.size() / 8) {
+            rebalance_locked();
+        }
+        bool changed = updater(root()->map);
+        if (changed) {
+            header()->changes.fetch_add(1, std::memory_order_release);
+        }
+        return changed;
+    }
+
+    void create(size_t max_bytes)
+    {
+        mapping_size = std::max(max_bytes, header_bytes + first_slot + growth_bytes);
+        uint64_t initial_size = header_bytes + first_slot + growth_bytes;
+        if (ftruncate(descriptor, static_cast<off_t>(initial_size)) != 0) {
+            throw std::runtime_error("Can't size shared bimap " + name + ".");
+        }
+        mapping = mmap(nullptr, mapping_size, PROT_READ | PROT_WRITE, MAP_SHARED, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::runtime_error("Can't map shared bimap " + name + ".");
+        }
+        header_t * created = new (mapping) header_t();
+        std::memcpy(created->magic, header_t::signature, sizeof(created->magic));
+        created->version = header_t::current_version;
+        created->left_size = sizeof(Left);
+        created->right_size = sizeof(Right);
+        created->map_size = sizeof(map_t);
+        created->max_bytes = mapping_size;
+        created->segment_size = initial_size;
+        pthread_rwlockattr_t attributes;
+        pthread_rwlockattr_init(&attributes);
+        pthread_rwlockattr_setpshared(&attributes, PTHREAD_PROCESS_SHARED);
+#ifdef __GLIBC__
+        /* Readers mustn't starve the only writer */
+        pthread_rwlockattr_setkind_np(&attributes, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+        int error = pthread_rwlock_init(&created->lock, &attributes);
+        pthread_rwlockattr_destroy(&attributes);
+        if (error != 0) {
+            throw std::runtime_error("Can't initialize the lock of shared bimap " + name + ".");
+        }
+        root_t * created_root = root();
+        new (&created_root->arena) persistent_arena(first_slot, initial_size - header_bytes);
+        new (&created_root->map) map_t(LeftComparator(), RightComparator(), persistent_storage(&created_root->arena));
+        created->ready.store(1, std::memory_order_release);
+    }
+
+    void attach()
+    {
+        struct stat status;
+        if (fstat(descriptor, &status) != 0 || static_cast<uint64_t>(status.st_size) < header_bytes + first_slot) {
+            throw std::runtime_error("Shared bimap " + name + " isn't ready.");
+        }
+        header_t const * existing = static_cast<header_t const *>(mmap(nullptr, header_bytes, PROT_READ, MAP_SHARED, descriptor, 0));
+        if (existing == MAP_FAILED) {
+            throw std::runtime_error("Can't map shared bimap " + name + ".");
+        }
+        bool valid = (existing->ready.load(std::memory_order_acquire) != 0
+                      && std::memcmp(existing->magic, header_t::signature, sizeof(existing->magic)) == 0
+                      && existing->version == header_t::current_version
+                      && existing->left_size == sizeof(Left) && existing->right_size == sizeof(Right)
+                      && existing->map_size == sizeof(map_t));
+        size_t max_bytes = existing->max_bytes;
+        munmap(const_cast<header_t *>(existing), header_bytes);
+        if (!valid) {
+            throw std::runtime_error("Shared bimap " + name + " isn't ready or doesn't match the value types.");
+        }
+        /* Nodes are read-only, only the lock in the header is written */
+        mapping_size = max_bytes;
+        mapping = mmap(nullptr, mapping_size, PROT_READ, MAP_SHARED, descriptor, 0);
+        if (mapping == MAP_FAILED) {
+            mapping = nullptr;
+            throw std::runtime_error("Can't map shared bimap " + name + ".");
+        }
+        if (mprotect(mapping, header_bytes, PROT_READ | PROT_WRITE) != 0) {
+            throw std::runtime_error("Can't map shared bimap " + name + ".");
+        }
+    }
+
+    std::string name;
+    bool writer;
+    int descriptor;
+    void * mapping;
+    size_t mapping_size;
+
+public:
+    enum class access
+    {
+        /* Creates the segment, fails if the name exists */
+        create,
+        /* Opens an existing segment for reading */
+        open,
+    };
+
+    /* Address space reserved by every process, the segment can't grow beyond it */
+    static constexpr size_t default_max_bytes = size_t(1) << 34;
+
+    /* The name follows shm_open rules, like "/name" */
+    explicit shared_bimap(std::string name, access mode, size_t max_bytes = default_max_bytes)
+        : name(std::move(name))
+        , writer(mode == access::create)
+        , descriptor(-1)
+        , mapping(nullptr)
+        , mapping_size(0)
+    {
+        descriptor = (writer ? shm_open(this->name.c_str(), O_RDWR | O_CREAT | O_EXCL, 0600) : shm_open(this->name.c_str(), O_RDWR, 0));
+        if (descriptor < 0) {
+            /* Don't unlink a segment which belongs to another writer */
+            writer = false;
+            throw std::runtime_error("Can't open shared bimap " + this->name + ".");
+        }
+        try {
+            if (writer) {
+                create(max_bytes);
+            }
+            else {
+                attach();
+            }
+        }
+        catch (...) {
+            release();
+            throw;
+        }
+    }
+
+    shared_bimap(shared_bimap const &) = delete;
+    shared_bimap & operator=(shared_bimap const &) = delete;
+
+    shared_bimap(shared_bimap && other) noexcept
+        : name(std::move(other.name))
+        , writer(other.writer)
+        , descriptor(other.descriptor)
+        , mapping(other.mapping)
+        , mapping_size(other.mapping_size)
+    {
+        other.name.clear();
+        other.descriptor = -1;
+        other.mapping = nullptr;
+        other.mapping_size = 0;
+    }
+
+    shared_bimap & operator=(shared_bimap && other) noexcept
+    {
+        std::swap(name, other.name);
+        std::swap(writer, other.writer);
+        std::swap(descriptor, other.descriptor);
+        std::swap(mapping, other.mapping);
+        std::swap(mapping_size, other.mapping_size);
+        return *this;
+    }
+
+    /* The writer unlinks the name, processes which still map the segment keep using it */
+    ~shared_bimap()
+    {
+        release();
+    }
+
+    /* Number of changes so far, readers may compare it to detect changes */
+    uint64_t version() const noexcept
+    {
+        return header()->changes.load(std::memory_order_acquire);
+    }
+
+    bool empty() const
+    {
+        return read([](map_t const & map) { return map.empty(); });
+    }
+
+    size_t size() const
+    {
+        return read([](map_t const & map) { return map.size(); });
+    }
+
+    std::optional<Right> find_left(Left const & desired) const
+    {
+        return read([&](map_t const & map) -> std::optional<Right> {
+            size_t depth = 0;
+            auto it = map.search_left(desired, &depth);
+            check_depth(map, depth);
+            if (it == map.end_left()) {
+                return std::nullopt;
+            }
+            return *it.flip();
+        });
+    }
+
+    std::optional<Left> find_right(Right const & desired) const
+    {
+        return read([&](map_t const & map) -> std::optional<Left> {
+            size_t depth = 0;
+            auto it = map.search_right(desired, &depth);
+            check_depth(map, depth);
+            if (it == map.end_right()) {
+                return std::nullopt;
+            }
+            return *it.flip();
+        });
+    }
+
+    std::optional<std::pair<Left, Right>> lower_bound_left(Left const & value) const
+    {
+        return read([&](map_t const & map) -> std::optional<std::pair<Left, Right>> {
+            size_t depth = 0;
+            auto it = map.search_lower_bound_left(value, &depth);
+            check_depth(map, depth);
+            if (it == map.end_left()) {
+                return std::nullopt;
+            }
+            return std::make_pair(*it, *it.flip());
+        });
+    }
+
+    std::optional<std::pair<Right, Left>> lower_bound_right(Right const & value) const
+    {
+        return read([&](map_t const & map) -> std::optional<std::pair<Right, Left>> {
+            size_t depth = 0;
+            auto it = map.search_lower_bound_right(value, &depth);
+            check_depth(map, depth);
+            if (it == map.end_right()) {
+                return std::nullopt;
+            }
+            return std::make_pair(*it, *it.flip());
+        });
+    }
+
+    /* Calls function with every pair in left order, under one read lock */
+    template <typename Function>
+    void for_each(Function const & function) const
+    {
+        read([&](map_t const & map) {
+            for (auto it = map.begin_left(); it != map.end_left(); ++it) {
+                function(*it, *it.flip());
+            }
+            return true;
+        });
+    }
+
+    /* Writer only */
+    bool insert(Left const & left, Right const & right)
+    {
+        return update([&](map_t & map) {
+            reserve_node();
+            return (map.insert(left, right) != map.end_left());
+        });
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return update([&](map_t & map) { return map.erase_left(key); });
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return update([&](map_t & map) { return map.erase_right(key); });
+    }
+
+    /* Rebalances both trees in O(size) time */
+    void rebalance()
+    {
+        update([this](map_t &) {
+            rebalance_locked();
+            return false;
+        });
+    }
+};
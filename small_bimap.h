@@ -0,0 +1,634 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>   // std::lower_bound, std::move, std::move_backward, std::upper_bound
+#include <cstddef>     // size_t
+#include <cstdint>     // uint8_t, uint16_t
+#include <functional>  // std::less
+#include <limits>      // std::numeric_limits
+#include <memory>      // std::unique_ptr
+#include <new>         // placement new
+#include <optional>    // std::optional
+#include <stdexcept>   // std::out_of_range
+#include <type_traits> // std::conditional_t, std::is_nothrow_move_assignable, std::is_nothrow_move_constructible
+#include <utility>     // std::forward, std::move
+
+/*
+ * Bimap for many small maps: up to N pairs live inside the object, beyond N the pairs move into a bimap on the heap.
+ * Inline pairs are two arrays of values, sorted by the left and by the right comparator, and two arrays of 8-bit
+ * (16-bit for N over 255) indices linking every value to its partner, so a map of at most N pairs allocates nothing.
+ * Inline operations require O(log(N)) comparisons for finding and O(N) moves for inserting and erasing,
+ * inserting the (N + 1)th pair copies every pair into a new tree, then operations are those of bimap.
+ * A map which shrinks again stays a tree until shrink_to_fit() or clear().
+ * Requires (N * (sizeof(Left) + sizeof(Right) + 2 * sizeof(index)) + sizeof(index) + sizeof(pointer)
+ *          + sizeof(LeftComparator) + sizeof(RightComparator)) bytes memory, plus the bimap and its nodes beyond N pairs.
+ * Inserting or erasing invalidates every iterator of an inline map but its end iterators; iterators of a tree behave like bimap's.
+ * Both types must be copyable and nothrow movable. Holds at most 65535 pairs inline.
+ */
+
+template <typename Left, typename Right, size_t N = 16, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class small_bimap
+{
+    static_assert(N > 0 && N < 65536, "small_bimap holds 1 to 65535 pairs inline");
+    static_assert(std::is_nothrow_move_constructible<Left>::value && std::is_nothrow_move_assignable<Left>::value, "Left must be nothrow movable");
+    static_assert(std::is_nothrow_move_constructible<Right>::value && std::is_nothrow_move_assignable<Right>::value, "Right must be nothrow movable");
+
+    /* Count of inline pairs and indices into the inline arrays */
+    using index_t = std::conditional_t<(N < 256), uint8_t, uint16_t>;
+    using tree_t = bimap<Left, Right, LeftComparator, RightComparator>;
+
+    /* Position of inline end iterators, which stay equal while the count changes, like those of bimap */
+    static constexpr index_t end_position = std::numeric_limits<index_t>::max();
+
+    struct left_descriptor_t
+    {
+        using tree_iterator = typename tree_t::left_iterator;
+
+        static Left const & value(small_bimap const * map, index_t position) noexcept
+        {
+            return map->left_values()[position];
+        }
+
+        static index_t partner(small_bimap const * map, index_t position) noexcept
+        {
+            return map->left_partners[position];
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        using tree_iterator = typename tree_t::right_iterator;
+
+        static Right const & value(small_bimap const * map, index_t position) noexcept
+        {
+            return map->right_values()[position];
+        }
+
+        static index_t partner(small_bimap const * map, index_t position) noexcept
+        {
+            return map->right_partners[position];
+        }
+    };
+
+    /* Refers to an inline position while the map is inline, to a node of the tree otherwise */
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class small_bimap<Left, Right, N, LeftComparator, RightComparator>;
+
+        template <typename, typename, typename, typename>
+        friend class basic_iterator;
+
+        using tree_iterator = typename MainDescriptor::tree_iterator;
+
+        basic_iterator(small_bimap const * map, index_t position) noexcept
+            : map(map)
+            , position(position < map->count ? position : end_position)
+        {
+        }
+
+        basic_iterator(small_bimap const * map, tree_iterator it) noexcept
+            : map(map)
+            , position(0)
+            , it(it)
+        {
+        }
+
+        small_bimap const * map;
+        index_t position;
+        std::optional<tree_iterator> it;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->position == other.position && this->it == other.it);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            if (it) {
+                ++*it;
+            }
+            else if (++position == map->count) {
+                position = end_position;
+            }
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            if (it) {
+                --*it;
+            }
+            else {
+                position = (position == end_position ? map->count : position) - 1;
+            }
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return (it ? **it : MainDescriptor::value(map, position));
+        }
+
+        auto flip() const noexcept
+        {
+            using flip_iterator = basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>;
+            return (it ? flip_iterator(map, it->flip()) : flip_iterator(map, MainDescriptor::partner(map, position)));
+        }
+    };
+
+    /* Holds the pairs beyond N, nullptr while they are inline */
+    std::unique_ptr<tree_t> tree;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+    index_t count;
+    index_t left_partners[N];
+    index_t right_partners[N];
+    alignas(Left) unsigned char left_bytes[N * sizeof(Left)];
+    alignas(Right) unsigned char right_bytes[N * sizeof(Right)];
+
+    Left * left_values() noexcept
+    {
+        return reinterpret_cast<Left *>(left_bytes);
+    }
+
+    Left const * left_values() const noexcept
+    {
+        return reinterpret_cast<Left const *>(left_bytes);
+    }
+
+    Right * right_values() noexcept
+    {
+        return reinterpret_cast<Right *>(right_bytes);
+    }
+
+    Right const * right_values() const noexcept
+    {
+        return reinterpret_cast<Right const *>(right_bytes);
+    }
+
+    template <typename T, typename Comparator>
+    index_t lower_index(T const * values, T const & x, Comparator const & compare) const
+    {
+        return static_cast<index_t>(std::lower_bound(values, values + count, x, compare) - values);
+    }
+
+    template <typename T, typename Comparator>
+    index_t upper_index(T const * values, T const & x, Comparator const & compare) const
+    {
+        return static_cast<index_t>(std::upper_bound(values, values + count, x, compare) - values);
+    }
+
+    /* Position of x in values, or count */
+    template <typename T, typename Comparator>
+    index_t find_index(T const * values, T const & x, Comparator const & compare) const
+    {
+        index_t position = lower_index(values, x, compare);
+        return (position < count && !compare(x, values[position]) ? position : count);
+    }
+
+    /* Moves value into position of an array of count values, shifting the following ones */
+    template <typename T>
+    void insert_value(T * values, index_t position, T && value) noexcept
+    {
+        if (position == count) {
+            new (values + count) T(std::move(value));
+            return;
+        }
+        new (values + count) T(std::move(values[count - 1]));
+        std::move_backward(values + position, values + count - 1, values + count);
+        values[position] = std::move(value);
+    }
+
+    template <typename T>
+    void erase_value(T * values, index_t position) noexcept
+    {
+        std::move(values + position + 1, values + count, values + position);
+        values[count - 1].~T();
+    }
+
+    /* Links a pair at left position p and right position q, the values must be free */
+    void insert_inline(index_t p, index_t q, Left && left, Right && right) noexcept
+    {
+        for (index_t i = 0; i < count; ++i) {
+            left_partners[i] += (left_partners[i] >= q ? 1 : 0);
+            right_partners[i] += (right_partners[i] >= p ? 1 : 0);
+        }
+        std::move_backward(left_partners + p, left_partners + count, left_partners + count + 1);
+        std::move_backward(right_partners + q, right_partners + count, right_partners + count + 1);
+        left_partners[p] = q;
+        right_partners[q] = p;
+        insert_value(left_values(), p, std::move(left));
+        insert_value(right_values(), q, std::move(right));
+        ++count;
+    }
+
+    void erase_inline(index_t p) noexcept
+    {
+        index_t q = left_partners[p];
+        erase_value(left_values(), p);
+        erase_value(right_values(), q);
+        std::move(left_partners + p + 1, left_partners + count, left_partners + p);
+        std::move(right_partners + q + 1, right_partners + count, right_partners + q);
+        --count;
+        for (index_t i = 0; i < count; ++i) {
+            left_partners[i] -= (left_partners[i] > q ? 1 : 0);
+            right_partners[i] -= (right_partners[i] > p ? 1 : 0);
+        }
+    }
+
+    void destroy_inline() noexcept
+    {
+        for (index_t i = 0; i < count; ++i) {
+            left_values()[i].~Left();
+            right_values()[i].~Right();
+        }
+        count = 0;
+    }
+
+    /*
+     * Copies the inline pairs into a new tree, so that nothing changes if allocating fails;
+     * inserting in left order leaves the left tree a path, so both trees are relinked balanced
+     */
+    void grow()
+    {
+        std::unique_ptr<tree_t> new_tree(new tree_t(left_compare, right_compare));
+        for (index_t i = 0; i < count; ++i) {
+            new_tree->insert(left_values()[i], right_values()[left_partners[i]]);
+        }
+        new_tree->rebalance();
+        destroy_inline();
+        tree = std::move(new_tree);
+    }
+
+    /* Moves the pairs of an inline map, which this map doesn't hold, or takes its tree */
+    void take(small_bimap & other) noexcept
+    {
+        tree = std::move(other.tree);
+        for (index_t i = 0; i < other.count; ++i) {
+            new (left_values() + i) Left(std::move(other.left_values()[i]));
+            new (right_values() + i) Right(std::move(other.right_values()[i]));
+            left_partners[i] = other.left_partners[i];
+            right_partners[i] = other.right_partners[i];
+        }
+        count = other.count;
+        other.destroy_inline();
+    }
+
+    template <typename L, typename R>
+    auto insert_by_values(L && left, R && right)
+    {
+        if (tree == nullptr) {
+            index_t p = lower_index(left_values(), static_cast<Left const &>(left), left_compare);
+            index_t q = lower_index(right_values(), static_cast<Right const &>(right), right_compare);
+            if ((p < count && !left_compare(left, left_values()[p])) || (q < count && !right_compare(right, right_values()[q]))) {
+                return end_left();
+            }
+            if (count < N) {
+                Left new_left(std::forward<L>(left));
+                Right new_right(std::forward<R>(right));
+                insert_inline(p, q, std::move(new_left), std::move(new_right));
+                return left_iterator(this, p);
+            }
+            grow();
+        }
+        return left_iterator(this, tree->insert(std::forward<L>(left), std::forward<R>(right)));
+    }
+
+public:
+    static constexpr size_t inline_capacity = N;
+
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+    explicit small_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator()) noexcept
+        : left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+        , count(0)
+    {
+    }
+
+    small_bimap(small_bimap const & other)
+        : left_compare(other.left_compare)
+        , right_compare(other.right_compare)
+        , count(0)
+    {
+        if (other.tree != nullptr) {
+            tree.reset(new tree_t(*other.tree));
+            return;
+        }
+        try {
+            for (; count < other.count; ++count) {
+                new (left_values() + count) Left(other.left_values()[count]);
+                try {
+                    new (right_values() + count) Right(other.right_values()[count]);
+                }
+                catch (...) {
+                    left_values()[count].~Left();
+                    throw;
+                }
+                left_partners[count] = other.left_partners[count];
+                right_partners[count] = other.right_partners[count];
+            }
+        }
+        catch (...) {
+            destroy_inline();
+            throw;
+        }
+    }
+
+    small_bimap(small_bimap && other) noexcept
+        : left_compare(std::move(other.left_compare))
+        , right_compare(std::move(other.right_compare))
+        , count(0)
+    {
+        take(other);
+    }
+
+    small_bimap & operator=(small_bimap const & other)
+    {
+        small_bimap copy(other);
+        *this = std::move(copy);
+        return *this;
+    }
+
+    small_bimap & operator=(small_bimap && other) noexcept
+    {
+        if (this != &other) {
+            clear();
+            left_compare = std::move(other.left_compare);
+            right_compare = std::move(other.right_compare);
+            take(other);
+        }
+        return *this;
+    }
+
+    ~small_bimap()
+    {
+        destroy_inline();
+    }
+
+    left_iterator begin_left() const noexcept
+    {
+        return (tree != nullptr ? left_iterator(this, tree->begin_left()) : left_iterator(this, 0));
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return (tree != nullptr ? left_iterator(this, tree->end_left()) : left_iterator(this, count));
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return (tree != nullptr ? right_iterator(this, tree->begin_right()) : right_iterator(this, 0));
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return (tree != nullptr ? right_iterator(this, tree->end_right()) : right_iterator(this, count));
+    }
+
+    /* True while the pairs live inside the object */
+    bool is_inline() const noexcept
+    {
+        return (tree == nullptr);
+    }
+
+    bool empty() const noexcept
+    {
+        return (size() == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return (tree != nullptr ? tree->size() : count);
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        if (tree != nullptr) {
+            return left_iterator(this, tree->find_left(desired));
+        }
+        return left_iterator(this, find_index(left_values(), desired, left_compare));
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        if (tree != nullptr) {
+            return right_iterator(this, tree->find_right(desired));
+        }
+        return right_iterator(this, find_index(right_values(), desired, right_compare));
+    }
+
+    left_iterator insert(Left const & left, Right const & right)
+    {
+        return insert_by_values(left, right);
+    }
+
+    left_iterator insert(Left const & left, Right && right)
+    {
+        return insert_by_values(left, std::move(right));
+    }
+
+    left_iterator insert(Left && left, Right const & right)
+    {
+        return insert_by_values(std::move(left), right);
+    }
+
+    left_iterator insert(Left && left, Right && right)
+    {
+        return insert_by_values(std::move(left), std::move(right));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        if (tree != nullptr) {
+            return tree->erase_left(key);
+        }
+        index_t p = find_index(left_values(), key, left_compare);
+        if (p == count) {
+            return false;
+        }
+        erase_inline(p);
+        return true;
+    }
+
+    bool erase_right(Right const & key)
+    {
+        if (tree != nullptr) {
+            return tree->erase_right(key);
+        }
+        index_t q = find_index(right_values(), key, right_compare);
+        if (q == count) {
+            return false;
+        }
+        erase_inline(right_partners[q]);
+        return true;
+    }
+
+    left_iterator erase_left(left_iterator const & it)
+    {
+        if (tree != nullptr) {
+            return left_iterator(this, tree->erase_left(*it.it));
+        }
+        erase_inline(it.position);
+        return left_iterator(this, it.position);
+    }
+
+    right_iterator erase_right(right_iterator const & it)
+    {
+        if (tree != nullptr) {
+            return right_iterator(this, tree->erase_right(*it.it));
+        }
+        erase_inline(right_partners[it.position]);
+        return right_iterator(this, it.position);
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        if (tree != nullptr) {
+            return left_iterator(this, tree->lower_bound_left(value));
+        }
+        return left_iterator(this, lower_index(left_values(), value, left_compare));
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        if (tree != nullptr) {
+            return left_iterator(this, tree->upper_bound_left(value));
+        }
+        return left_iterator(this, upper_index(left_values(), value, left_compare));
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        if (tree != nullptr) {
+            return right_iterator(this, tree->lower_bound_right(value));
+        }
+        return right_iterator(this, lower_index(right_values(), value, right_compare));
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        if (tree != nullptr) {
+            return right_iterator(this, tree->upper_bound_right(value));
+        }
+        return right_iterator(this, upper_index(right_values(), value, right_compare));
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        left_iterator it = find_left(key);
+        if (it == end_left()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return *it.flip();
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        right_iterator it = find_right(key);
+        if (it == end_right()) {
+            throw std::out_of_range("No matching element.");
+        }
+        return *it.flip();
+    }
+
+    Right const & at_left_or_default(Left const & key)
+    {
+        left_iterator it = find_left(key);
+        if (it != end_left()) {
+            return *it.flip();
+        }
+        erase_right(Right());
+        return *insert(key, Right()).flip();
+    }
+
+    Left const & at_right_or_default(Right const & key)
+    {
+        right_iterator it = find_right(key);
+        if (it != end_right()) {
+            return *it.flip();
+        }
+        erase_left(Left());
+        return *insert(Left(), key);
+    }
+
+    void clear() noexcept
+    {
+        destroy_inline();
+        tree.reset();
+    }
+
+    /* Moves the pairs of a tree holding at most N pairs back inside the object, requires O(N * log(N)) time */
+    void shrink_to_fit()
+    {
+        if (tree == nullptr || tree->size() > N) {
+            return;
+        }
+        /* Both arrays are filled in order, so a failed copy destroys a prefix of each */
+        index_t rights = 0;
+        try {
+            for (auto it = tree->begin_left(); it != tree->end_left(); ++it, ++count) {
+                new (left_values() + count) Left(*it);
+            }
+            for (auto it = tree->begin_right(); it != tree->end_right(); ++it, ++rights) {
+                new (right_values() + rights) Right(*it);
+                index_t p = find_index(left_values(), *it.flip(), left_compare);
+                left_partners[p] = rights;
+                right_partners[rights] = p;
+            }
+        }
+        catch (...) {
+            for (index_t i = 0; i < rights; ++i) {
+                right_values()[i].~Right();
+            }
+            for (index_t i = 0; i < count; ++i) {
+                left_values()[i].~Left();
+            }
+            count = 0;
+            throw;
+        }
+        tree.reset();
+    }
+
+    bool operator==(small_bimap const & other) const
+    {
+        if (size() != other.size()) {
+            return false;
+        }
+        for (left_iterator first = begin_left(), second = other.begin_left(); first != end_left(); ++first, ++second) {
+            if (!(*first == *second) || !(*first.flip() == *second.flip())) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(small_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
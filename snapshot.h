@@ -0,0 +1,583 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <algorithm>   // std::sort, std::min
+#include <cstddef>     // size_t
+#include <cstdint>     // uint32_t, uint64_t
+#include <cstdio>      // std::rename, std::remove
+#include <cstring>     // std::memcpy, std::memcmp
+#include <filesystem>  // std::filesystem
+#include <fstream>     // std::ofstream, std::ifstream
+#include <functional>  // std::less
+#include <limits>      // std::numeric_limits
+#include <stdexcept>   // std::runtime_error
+#include <string>      // std::string
+#include <type_traits> // std::enable_if_t, std::is_trivially_copyable
+#include <utility>     // std::move
+#include <vector>      // std::vector
+
+#include <fcntl.h>  // open
+#include <unistd.h> // close, fsync
+
+/*
+ * Binary snapshot of a bimap, written by bimap::save() and read by bimap::load().
+ * A file is a header followed by four sections, each starting at a multiple of 8 bytes:
+ * left values in left order, right values in right order, the right rank of the partner of every left rank
+ * and the left rank of the partner of every right rank. Ranks take 4 bytes, or 8 bytes for 2^32 pairs and more.
+ * Values are encoded by snapshot_codec, which copies the bytes of trivially copyable types in native byte order
+ * and stores std::string as its length and characters; specialize snapshot_codec for any other type.
+ * The header records the format version, the byte order, the value sizes and a checksum of the whole file,
+ * so loading rejects files from other versions, machines or types and detects corruption.
+ * Saving requires O(size * log(size)) time and 20 bytes per pair of temporary memory,
+ * it writes a temporary file next to the target, syncs it, renames it and syncs the directory,
+ * so a crash leaves either the old or the new snapshot, never a partial one.
+ * Loading requires O(size) time: both sorted orders are linked into balanced trees directly, without comparisons.
+ */
+
+struct snapshot_header
+{
+    static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'S', 'N', 'P'};
+    static constexpr uint32_t current_version = 1;
+    static constexpr uint32_t native_byte_order = 0x01020304;
+
+    char magic[8];
+    uint32_t version;
+    uint32_t byte_order;
+    uint64_t count;
+    /* Bytes per value, 0 for variable length encodings */
+    uint32_t left_size;
+    uint32_t right_size;
+    uint32_t rank_size;
+    uint32_t reserved;
+    uint64_t left_offset;
+    uint64_t right_offset;
+    uint64_t left_partners_offset;
+    uint64_t right_partners_offset;
+    uint64_t file_size;
+    /* Of the sections and of this header with the checksum set to zero */
+    uint64_t checksum;
+};
+
+/* Word-at-a-time hash, fast enough to be bound by the disk */
+class snapshot_checksum
+{
+    uint64_t state = 0x9E3779B97F4A7C15;
+
+    void mix(uint64_t word) noexcept
+    {
+        state ^= word * 0x87C37B91114253D5;
+        state = ((state << 31) | (state >> 33)) * 0x4CF5AD432745937F;
+    }
+
+public:
+    /* Only the last update of a sequence may have a size, which is not a multiple of 8 */
+    void update(void const * data, size_t size) noexcept
+    {
+        unsigned char const * bytes = static_cast<unsigned char const *>(data);
+        uint64_t word;
+        for (; size >= sizeof(word); size -= sizeof(word), bytes += sizeof(word)) {
+            std::memcpy(&word, bytes, sizeof(word));
+            mix(word);
+        }
+        if (size > 0) {
+            word = 0;
+            std::memcpy(&word, bytes, size);
+            mix(word);
+        }
+    }
+
+    uint64_t value() const noexcept
+    {
+        return state ^ (state >> 29);
+    }
+};
+
+/* Buffered output of the sections, which keeps their checksum */
+class snapshot_writer
+{
+    static constexpr size_t buffer_size = size_t(1) << 20;
+
+    std::string path;
+    std::string temporary_path;
+    std::ofstream file;
+    std::vector<char> buffer;
+    size_t buffered;
+    uint64_t written;
+    snapshot_checksum checksum;
+
+    void flush()
+    {
+        checksum.update(buffer.data(), buffered);
+        file.write(buffer.data(), buffered);
+        if (!file) {
+            throw std::runtime_error("Can't write snapshot.");
+        }
+        buffered = 0;
+    }
+
+public:
+    /* Flushes a file or a directory entry to the disk */
+    static bool sync(std::string const & name, bool directory)
+    {
+        int descriptor = open(name.c_str(), directory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+        if (descriptor < 0) {
+            return false;
+        }
+        bool synced = (fsync(descriptor) == 0);
+        close(descriptor);
+        return synced;
+    }
+
+    explicit snapshot_writer(std::string path)
+        : path(std::move(path))
+        , temporary_path(this->path + ".tmp")
+        , file(temporary_path, std::ios::binary | std::ios::trunc)
+        , buffer(buffer_size)
+        , buffered(0)
+        , written(sizeof(snapshot_header))
+    {
+        if (!file) {
+            throw std::runtime_error("Can't create snapshot " + temporary_path + ".");
+        }
+        snapshot_header placeholder = {};
+        file.write(reinterpret_cast<char const *>(&placeholder), sizeof(placeholder));
+    }
+
+    snapshot_writer(snapshot_writer const &) = delete;
+    snapshot_writer & operator=(snapshot_writer const &) = delete;
+
+    ~snapshot_writer()
+    {
+        if (file.is_open()) {
+            file.close();
+            std::remove(temporary_path.c_str());
+        }
+    }
+
+    void write(void const * data, size_t size)
+    {
+        char const * bytes = static_cast<char const *>(data);
+        written += size;
+        while (size > 0) {
+            size_t chunk = std::min(size, buffer_size - buffered);
+            std::memcpy(buffer.data() + buffered, bytes, chunk);
+            buffered += chunk;
+            bytes += chunk;
+            size -= chunk;
+            if (buffered == buffer_size) {
+                flush();
+            }
+        }
+    }
+
+    /* Pads with zeros to a multiple of 8 bytes and returns the offset */
+    uint64_t align()
+    {
+        static constexpr char zeros[8] = {};
+        write(zeros, (8 - written % 8) % 8);
+        return written;
+    }
+
+    /* Completes the header, writes it and replaces the target file */
+    void finish(snapshot_header header)
+    {
+        header.file_size = align();
+        flush();
+        header.checksum = 0;
+        checksum.update(&header, sizeof(header));
+        header.checksum = checksum.value();
+        file.seekp(0);
+        file.write(reinterpret_cast<char const *>(&header), sizeof(header));
+        file.close();
+        if (file.fail() || !sync(temporary_path, false) || std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+            std::remove(temporary_path.c_str());
+            throw std::runtime_error("Can't write snapshot " + path + ".");
+        }
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        if (!sync(directory.empty() ? std::string(".") : directory.string(), true)) {
+            throw std::runtime_error("Can't sync the directory of snapshot " + path + ".");
+        }
+    }
+};
+
+/* Buffered input of the sections, which checks their checksum and bounds */
+class snapshot_reader
+{
+    static constexpr size_t buffer_size = size_t(1) << 20;
+
+    std::ifstream file;
+    snapshot_header file_header;
+    std::vector<char> buffer;
+    size_t buffered;
+    size_t consumed;
+    uint64_t offset;
+    snapshot_checksum checksum;
+
+    void fill()
+    {
+        file.read(buffer.data(), buffer_size);
+        buffered = static_cast<size_t>(file.gcount());
+        consumed = 0;
+        if (buffered == 0) {
+            throw std::runtime_error("Truncated snapshot.");
+        }
+        checksum.update(buffer.data(), buffered);
+    }
+
+public:
+    explicit snapshot_reader(std::string const & path)
+        : file(path, std::ios::binary)
+        , buffer(buffer_size)
+        , buffered(0)
+        , consumed(0)
+        , offset(sizeof(snapshot_header))
+    {
+        if (!file) {
+            throw std::runtime_error("Can't open snapshot " + path + ".");
+        }
+        file.read(reinterpret_cast<char *>(&file_header), sizeof(file_header));
+        if (file.gcount() != sizeof(file_header) || std::memcmp(file_header.magic, snapshot_header::signature, sizeof(file_header.magic)) != 0) {
+            throw std::runtime_error("Not a snapshot.");
+        }
+        if (file_header.version != snapshot_header::current_version || file_header.byte_order != snapshot_header::native_byte_order) {
+            throw std::runtime_error("Unsupported snapshot version or byte order.");
+        }
+    }
+
+    snapshot_header const & header() const noexcept
+    {
+        return file_header;
+    }
+
+    void read(void * data, size_t size)
+    {
+        char * bytes = static_cast<char *>(data);
+        offset += size;
+        if (offset > file_header.file_size) {
+            throw std::runtime_error("Truncated snapshot.");
+        }
+        while (size > 0) {
+            if (consumed == buffered) {
+                fill();
+            }
+            size_t chunk = std::min(size, buffered - consumed);
+            std::memcpy(bytes, buffer.data() + consumed, chunk);
+            consumed += chunk;
+            bytes += chunk;
+            size -= chunk;
+        }
+    }
+
+    /* Skips the padding before a section */
+    void seek(uint64_t target)
+    {
+        if (target < offset || target > file_header.file_size) {
+            throw std::runtime_error("Corrupted snapshot.");
+        }
+        char skipped[8];
+        while (offset < target) {
+            read(skipped, std::min<uint64_t>(sizeof(skipped), target - offset));
+        }
+    }
+
+    /* Bytes of the whole file, bounds any length read from it */
+    uint64_t size() const noexcept
+    {
+        return file_header.file_size;
+    }
+
+    /* Reads the rest of the file and verifies the checksum */
+    void finish()
+    {
+        seek(file_header.file_size);
+        char excess;
+        if (consumed != buffered || file.read(&excess, 1)) {
+            throw std::runtime_error("Corrupted snapshot.");
+        }
+        snapshot_header copy = file_header;
+        copy.checksum = 0;
+        checksum.update(&copy, sizeof(copy));
+        if (checksum.value() != file_header.checksum) {
+            throw std::runtime_error("Snapshot checksum mismatch.");
+        }
+    }
+};
+
+/* Encodes values to any output with write(data, size), decodes from any input with read(data, size) and size() */
+template <typename T, typename Enable = void>
+struct snapshot_codec;
+
+template <typename T>
+struct snapshot_codec<T, std::enable_if_t<std::is_trivially_copyable<T>::value>>
+{
+    static constexpr uint32_t fixed_size = sizeof(T);
+
+    template <typename Output>
+    static void write(Output & out, T const & value)
+    {
+        out.write(&value, sizeof(T));
+    }
+
+    template <typename Input>
+    static T read(Input & in)
+    {
+        T value;
+        in.read(&value, sizeof(T));
+        return value;
+    }
+};
+
+template <>
+struct snapshot_codec<std::string>
+{
+    static constexpr uint32_t fixed_size = 0;
+
+    template <typename Output>
+    static void write(Output & out, std::string const & value)
+    {
+        uint64_t length = value.size();
+        out.write(&length, sizeof(length));
+        out.write(value.data(), value.size());
+    }
+
+    template <typename Input>
+    static std::string read(Input & in)
+    {
+        uint64_t length;
+        in.read(&length, sizeof(length));
+        if (length > in.size()) {
+            throw std::runtime_error("Corrupted snapshot.");
+        }
+        std::string value(length, '\0');
+        in.read(&value[0], length);
+        return value;
+    }
+};
+
+/*
+ * Writes a snapshot of pairs added one by one in strictly increasing left order, e.g. from a background thread.
+ * Left values are streamed to the file as they are added, right values are kept until finish() sorts them
+ * and writes the remaining sections, which requires (sizeof(Right) + 16) bytes per pair of temporary memory.
+ */
+template <typename Left, typename Right, typename RightComparator = std::less<>>
+class snapshot_builder
+{
+    snapshot_writer out;
+    snapshot_header header;
+    std::vector<Right> rights;
+    RightComparator right_compare;
+
+public:
+    explicit snapshot_builder(std::string path, RightComparator right_compare = RightComparator())
+        : out(std::move(path))
+        , header()
+        , right_compare(std::move(right_compare))
+    {
+        header.left_offset = out.align();
+    }
+
+    void add(Left const & left, Right const & right)
+    {
+        snapshot_codec<Left>::write(out, left);
+        rights.push_back(right);
+    }
+
+    /* Writes the right values with both partner sections and replaces the target file */
+    void finish()
+    {
+        size_t count = rights.size();
+        auto write_sections = [&](auto rank_tag) {
+            using rank_t = decltype(rank_tag);
+            std::vector<rank_t> right_partners(count);
+            for (size_t rank = 0; rank < count; ++rank) {
+                right_partners[rank] = static_cast<rank_t>(rank);
+            }
+            std::sort(right_partners.begin(), right_partners.end(), [&](rank_t a, rank_t b) {
+                return right_compare(rights[a], rights[b]);
+            });
+            header.right_offset = out.align();
+            for (rank_t rank : right_partners) {
+                snapshot_codec<Right>::write(out, rights[rank]);
+            }
+            rights = {};
+            std::vector<rank_t> left_partners(count);
+            for (size_t rank = 0; rank < count; ++rank) {
+                left_partners[right_partners[rank]] = static_cast<rank_t>(rank);
+            }
+            header.left_partners_offset = out.align();
+            out.write(left_partners.data(), count * sizeof(rank_t));
+            header.right_partners_offset = out.align();
+            out.write(right_partners.data(), count * sizeof(rank_t));
+            header.rank_size = sizeof(rank_t);
+        };
+        if (count < std::numeric_limits<uint32_t>::max()) {
+            write_sections(uint32_t());
+        }
+        else {
+            write_sections(uint64_t());
+        }
+        std::memcpy(header.magic, snapshot_header::signature, sizeof(header.magic));
+        header.version = snapshot_header::current_version;
+        header.byte_order = snapshot_header::native_byte_order;
+        header.count = count;
+        header.left_size = snapshot_codec<Left>::fixed_size;
+        header.right_size = snapshot_codec<Right>::fixed_size;
+        out.finish(header);
+    }
+};
+
+template <typename Left, typename Right, typename LeftComparator, typename RightComparator, typename Storage, typename Observer, typename Eviction>
+void bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction>::save(std::string const & path) const
+{
+    size_t count = elements_count;
+    std::vector<node_t const *> by_left;
+    by_left.reserve(count);
+    for (left_iterator it = begin_left(); it != end_left(); ++it) {
+        by_left.push_back(it.node);
+    }
+
+    auto write_sections = [&](auto rank_tag) {
+        using rank_t = decltype(rank_tag);
+        /* Left ranks ordered by node address, to find the left rank of every node visited in right order */
+        std::vector<rank_t> by_address(count);
+        for (size_t rank = 0; rank < count; ++rank) {
+            by_address[rank] = static_cast<rank_t>(rank);
+        }
+        std::sort(by_address.begin(), by_address.end(), [&](rank_t a, rank_t b) {
+            return std::less<node_t const *>()(by_left[a], by_left[b]);
+        });
+        std::vector<rank_t> left_partners(count);
+        std::vector<rank_t> right_partners(count);
+        size_t right_rank = 0;
+        for (right_iterator it = begin_right(); it != end_right(); ++it, ++right_rank) {
+            auto found = std::lower_bound(by_address.begin(), by_address.end(), it.node, [&](rank_t rank, node_t const * node) {
+                return std::less<node_t const *>()(by_left[rank], node);
+            });
+            right_partners[right_rank] = *found;
+            left_partners[*found] = static_cast<rank_t>(right_rank);
+        }
+        by_address = {};
+
+        snapshot_header header = {};
+        std::memcpy(header.magic, snapshot_header::signature, sizeof(header.magic));
+        header.version = snapshot_header::current_version;
+        header.byte_order = snapshot_header::native_byte_order;
+        header.count = count;
+        header.left_size = snapshot_codec<Left>::fixed_size;
+        header.right_size = snapshot_codec<Right>::fixed_size;
+        header.rank_size = sizeof(rank_t);
+
+        snapshot_writer out(path);
+        header.left_offset = out.align();
+        for (node_t const * node : by_left) {
+            snapshot_codec<Left>::write(out, node->left_value);
+        }
+        header.right_offset = out.align();
+        for (rank_t rank : right_partners) {
+            snapshot_codec<Right>::write(out, by_left[rank]->right_value);
+        }
+        header.left_partners_offset = out.align();
+        out.write(left_partners.data(), count * sizeof(rank_t));
+        header.right_partners_offset = out.align();
+        out.write(right_partners.data(), count * sizeof(rank_t));
+        out.finish(header);
+    };
+
+    if (count < std::numeric_limits<uint32_t>::max()) {
+        write_sections(uint32_t());
+    }
+    else {
+        write_sections(uint64_t());
+    }
+}
+
+template <typename Left, typename Right, typename LeftComparator, typename RightComparator, typename Storage, typename Observer, typename Eviction>
+bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction> bimap<Left, Right, LeftComparator, RightComparator, Storage, Observer, Eviction>::load(std::string const & path, LeftComparator left_compare, RightComparator right_compare, Storage storage)
+{
+    snapshot_reader in(path);
+    snapshot_header const & header = in.header();
+    if (header.left_size != snapshot_codec<Left>::fixed_size || header.right_size != snapshot_codec<Right>::fixed_size) {
+        throw std::runtime_error("Snapshot value types don't match.");
+    }
+    if (header.rank_size != (header.count < std::numeric_limits<uint32_t>::max() ? sizeof(uint32_t) : sizeof(uint64_t))) {
+        throw std::runtime_error("Corrupted snapshot.");
+    }
+    if (header.count > header.file_size / (2 * header.rank_size)) {
+        throw std::runtime_error("Corrupted snapshot.");
+    }
+    size_t count = header.count;
+    std::vector<Left> lefts;
+    std::vector<Right> rights;
+    std::vector<uint64_t> left_partners(count);
+
+    in.seek(header.left_offset);
+    lefts.reserve(count);
+    for (size_t rank = 0; rank < count; ++rank) {
+        lefts.push_back(snapshot_codec<Left>::read(in));
+        if (rank > 0 && !left_compare(lefts[rank - 1], lefts[rank])) {
+            throw std::runtime_error("Snapshot isn't ordered by the left comparator.");
+        }
+    }
+    in.seek(header.right_offset);
+    rights.reserve(count);
+    for (size_t rank = 0; rank < count; ++rank) {
+        rights.push_back(snapshot_codec<Right>::read(in));
+        if (rank > 0 && !right_compare(rights[rank - 1], rights[rank])) {
+            throw std::runtime_error("Snapshot isn't ordered by the right comparator.");
+        }
+    }
+    auto read_rank = [&]() -> uint64_t {
+        uint64_t rank;
+        if (header.rank_size == sizeof(uint32_t)) {
+            uint32_t small_rank;
+            in.read(&small_rank, sizeof(small_rank));
+            rank = small_rank;
+        }
+        else {
+            in.read(&rank, sizeof(rank));
+        }
+        if (rank >= count) {
+            throw std::runtime_error("Corrupted snapshot.");
+        }
+        return rank;
+    };
+    in.seek(header.left_partners_offset);
+    for (size_t rank = 0; rank < count; ++rank) {
+        left_partners[rank] = read_rank();
+    }
+    /* Both sections must be inverse permutations */
+    in.seek(header.right_partners_offset);
+    for (size_t rank = 0; rank < count; ++rank) {
+        if (left_partners[read_rank()] != rank) {
+            throw std::runtime_error("Corrupted snapshot.");
+        }
+    }
+    in.finish();
+
+    bimap result(std::move(left_compare), std::move(right_compare), std::move(storage));
+    std::vector<node_t *> by_left(count, nullptr);
+    std::vector<node_t *> by_right(count, nullptr);
+    try {
+        for (size_t rank = 0; rank < count; ++rank) {
+            by_left[rank] = result.create_node(std::move(lefts[rank]), std::move(rights[left_partners[rank]]));
+            by_right[left_partners[rank]] = by_left[rank];
+        }
+    }
+    catch (...) {
+        for (node_t * node : by_left) {
+            if (node != nullptr) {
+                result.destroy_node(node);
+            }
+        }
+        throw;
+    }
+    result.left_root = link_balanced<left_descriptor_t>(by_left.data(), count, nullptr);
+    result.right_root = link_balanced<right_descriptor_t>(by_right.data(), count, nullptr);
+    result.elements_count = count;
+    for (node_t * node : by_left) {
+        result.pairs_fingerprint += pair_fingerprint(node->left_value, node->right_value);
+        result.Eviction::linked(node);
+    }
+    return result;
+}
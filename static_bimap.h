@@ -0,0 +1,874 @@
+#pragma once
+
+#include <cstddef>     // size_t
+#include <cstdint>     // int8_t, uint16_t, uint32_t
+#include <functional>  // std::less
+#include <limits>      // std::numeric_limits
+#include <new>         // placement new
+#include <stdexcept>   // std::out_of_range
+#include <type_traits> // std::conditional_t, std::is_nothrow_move_constructible, std::is_rvalue_reference, std::is_same, std::is_trivially_destructible
+#include <utility>     // std::forward, std::move
+
+/* Tree policy of static_bimap: AVL trees, so every bound is a worst case */
+struct avl_tree
+{
+};
+
+/* Tree policy of static_bimap: splay trees like bimap's, faster for skewed lookups, but amortized */
+struct splay_tree
+{
+};
+
+/*
+ * Bimap of at most N pairs which never allocates: its nodes are an array inside the object, linked by 16-bit
+ * (32-bit for N of 65535 or more) indices into it, and erased nodes are reused through a free list.
+ * Inserting into a full map fails like inserting a pair with a present value does, returning the end iterator,
+ * full() tells these apart; nothing throws for lack of room. There are no at_*_or_default, which would have to.
+ * With avl_tree both trees are at most 1.44 * log2(N + 2) high, so in the worst case
+ *     find_*, lower_bound_*, upper_bound_*, at_* take O(log(N)) comparisons,
+ *     insert takes O(log(N)) comparisons, at most two rotations per tree and one copy or move of each value,
+ *     erase_* take O(log(N)) comparisons and rotations,
+ *     ++ and -- of an iterator take O(log(N)) steps, O(1) amortized over a traversal,
+ *     construction takes O(1) time, so do destruction and clear() for trivially destructible values, O(N) otherwise,
+ *     copying and moving take O(N) time.
+ * With splay_tree every lookup moves what it finds to the root, so these bounds hold only amortized, for
+ * O(log(size)), and one operation may take O(size) time; lookups change the trees, so a const map isn't thread safe.
+ * Requires (N * (sizeof(Left) + sizeof(Right) + 2 * (3 * sizeof(index) + 1), padded to the alignment of the values)
+ *          + 5 * sizeof(index) + sizeof(LeftComparator) + sizeof(RightComparator)) bytes memory.
+ * Erasing invalidates only the iterators to the erased pair, references to values stay valid until then.
+ * Exceptions of constructing the values leave the map unchanged. Holds at most 2^32 - 2 pairs.
+ */
+
+template <typename Left, typename Right, size_t N, typename LeftComparator = std::less<>, typename RightComparator = std::less<>, typename Tree = avl_tree>
+class static_bimap
+{
+    static_assert(N > 0 && N < 0xffffffffu, "static_bimap holds 1 to 2^32 - 2 pairs");
+    static_assert(std::is_same<Tree, avl_tree>::value || std::is_same<Tree, splay_tree>::value, "Tree must be avl_tree or splay_tree");
+
+    /* Index of a node, nil links to none */
+    using index_t = std::conditional_t<(N < 0xffff), uint16_t, uint32_t>;
+
+    static constexpr index_t nil = std::numeric_limits<index_t>::max();
+    static constexpr bool splaying = std::is_same<Tree, splay_tree>::value;
+    static constexpr bool trivially_destructible = std::is_trivially_destructible<Left>::value && std::is_trivially_destructible<Right>::value;
+
+    struct tree_node_t
+    {
+        index_t child[2];
+        index_t parent;
+        /* Height of the right subtree minus the height of the left one, kept by avl_tree only */
+        int8_t balance;
+    };
+
+    /*
+     * Values are constructed when a node is taken and destroyed when it is erased.
+     * A free node is its own parent in the left tree, whose left child links the next free node.
+     */
+    struct node_t
+    {
+        tree_node_t trees[2];
+        alignas(Left) unsigned char left_bytes[sizeof(Left)];
+        alignas(Right) unsigned char right_bytes[sizeof(Right)];
+    };
+
+    struct left_descriptor_t
+    {
+        static constexpr size_t side = 0;
+
+        static Left const & value(static_bimap const * map, index_t node) noexcept
+        {
+            return map->left_value(node);
+        }
+
+        static LeftComparator const & compare(static_bimap const * map) noexcept
+        {
+            return map->left_compare;
+        }
+    };
+
+    struct right_descriptor_t
+    {
+        static constexpr size_t side = 1;
+
+        static Right const & value(static_bimap const * map, index_t node) noexcept
+        {
+            return map->right_value(node);
+        }
+
+        static RightComparator const & compare(static_bimap const * map) noexcept
+        {
+            return map->right_compare;
+        }
+    };
+
+    template <typename MainDescriptor, typename FlipDescriptor, typename MainType, typename FlipType>
+    class basic_iterator
+    {
+    protected:
+        friend class static_bimap<Left, Right, N, LeftComparator, RightComparator, Tree>;
+
+        basic_iterator(static_bimap const * map, index_t node) noexcept
+            : map(map)
+            , node(node)
+        {
+        }
+
+        static_bimap const * map;
+        index_t node;
+
+    public:
+        bool operator==(basic_iterator const & other) const noexcept
+        {
+            return (this->map == other.map && this->node == other.node);
+        }
+
+        bool operator!=(basic_iterator const & other) const noexcept
+        {
+            return !(*this == other);
+        }
+
+        basic_iterator & operator++() noexcept
+        {
+            node = map->step(MainDescriptor::side, node, 1);
+            return *this;
+        }
+
+        basic_iterator operator++(int) noexcept
+        {
+            auto copy = *this;
+            ++*this;
+            return copy;
+        }
+
+        basic_iterator & operator--() noexcept
+        {
+            if (node == nil) {
+                index_t root = map->roots[MainDescriptor::side];
+                node = (root != nil ? map->extreme(MainDescriptor::side, root, 1) : nil);
+            }
+            else {
+                node = map->step(MainDescriptor::side, node, 0);
+            }
+            return *this;
+        }
+
+        basic_iterator operator--(int) noexcept
+        {
+            auto copy = *this;
+            --*this;
+            return copy;
+        }
+
+        MainType const & operator*() const noexcept
+        {
+            return MainDescriptor::value(map, node);
+        }
+
+        auto flip() const noexcept
+        {
+            return basic_iterator<FlipDescriptor, MainDescriptor, FlipType, MainType>(map, node);
+        }
+    };
+
+public:
+    using left_iterator = basic_iterator<left_descriptor_t, right_descriptor_t, Left, Right>;
+    using right_iterator = basic_iterator<right_descriptor_t, left_descriptor_t, Right, Left>;
+
+private:
+    LeftComparator left_compare;
+    RightComparator right_compare;
+    /* Splay trees move nodes on lookups, so the roots and the links are mutable */
+    mutable index_t roots[2];
+    index_t count;
+    /* Nodes below used have been taken at least once, the ones above are neither free nor initialized */
+    index_t used;
+    index_t free_head;
+    mutable node_t nodes[N];
+
+    tree_node_t & link(size_t side, index_t node) const noexcept
+    {
+        return nodes[node].trees[side];
+    }
+
+    Left & left_value(index_t node) const noexcept
+    {
+        return *reinterpret_cast<Left *>(nodes[node].left_bytes);
+    }
+
+    Right & right_value(index_t node) const noexcept
+    {
+        return *reinterpret_cast<Right *>(nodes[node].right_bytes);
+    }
+
+    bool is_free(index_t node) const noexcept
+    {
+        return (nodes[node].trees[0].parent == node);
+    }
+
+    /* Which child of its parent node is, node must have a parent */
+    size_t direction(size_t side, index_t node) const noexcept
+    {
+        return (link(side, link(side, node).parent).child[1] == node ? 1 : 0);
+    }
+
+    void replace_child(size_t side, index_t parent, index_t old_child, index_t new_child) const noexcept
+    {
+        if (parent == nil) {
+            roots[side] = new_child;
+        }
+        else {
+            tree_node_t & p = link(side, parent);
+            p.child[p.child[0] == old_child ? 0 : 1] = new_child;
+        }
+    }
+
+    /* Moves x one level down towards direction, its child on the other side takes its place */
+    index_t rotate(size_t side, index_t x, size_t direction) const noexcept
+    {
+        tree_node_t & lx = link(side, x);
+        index_t y = lx.child[1 - direction];
+        tree_node_t & ly = link(side, y);
+        lx.child[1 - direction] = ly.child[direction];
+        if (ly.child[direction] != nil) {
+            link(side, ly.child[direction]).parent = x;
+        }
+        ly.parent = lx.parent;
+        replace_child(side, lx.parent, x, y);
+        ly.child[direction] = x;
+        lx.parent = y;
+        return y;
+    }
+
+    void splay(size_t side, index_t x) const noexcept
+    {
+        while (link(side, x).parent != nil) {
+            index_t p = link(side, x).parent;
+            size_t dx = direction(side, x);
+            if (link(side, p).parent == nil) {
+                rotate(side, p, 1 - dx);
+            }
+            else {
+                index_t g = link(side, p).parent;
+                size_t dp = direction(side, p);
+                if (dx == dp) {
+                    rotate(side, g, 1 - dp);
+                    rotate(side, p, 1 - dx);
+                }
+                else {
+                    rotate(side, p, 1 - dx);
+                    rotate(side, g, 1 - dp);
+                }
+            }
+        }
+    }
+
+    /* Restores the balance above x, a new leaf, with at most one single or double rotation */
+    void rebalance_inserted(size_t side, index_t x) const noexcept
+    {
+        for (index_t p = link(side, x).parent; p != nil; x = p, p = link(side, p).parent) {
+            size_t d = direction(side, x);
+            int8_t delta = (d == 1 ? 1 : -1);
+            tree_node_t & lp = link(side, p);
+            if (lp.balance == 0) {
+                lp.balance = delta;
+                continue;
+            }
+            if (lp.balance != delta) {
+                lp.balance = 0;
+                return;
+            }
+            tree_node_t & lx = link(side, x);
+            if (lx.balance == delta) {
+                rotate(side, p, 1 - d);
+                lp.balance = 0;
+                lx.balance = 0;
+            }
+            else {
+                index_t y = lx.child[1 - d];
+                tree_node_t & ly = link(side, y);
+                rotate(side, x, d);
+                rotate(side, p, 1 - d);
+                lp.balance = (ly.balance == delta ? -delta : 0);
+                lx.balance = (ly.balance == -delta ? delta : 0);
+                ly.balance = 0;
+            }
+            return;
+        }
+    }
+
+    /* Restores the balance from p up, whose subtree in direction d got one level lower, with O(log(N)) rotations */
+    void rebalance_erased(size_t side, index_t p, size_t d) const noexcept
+    {
+        while (p != nil) {
+            int8_t delta = (d == 1 ? 1 : -1);
+            tree_node_t & lp = link(side, p);
+            index_t top = p;
+            if (lp.balance == 0) {
+                lp.balance = -delta;
+                return;
+            }
+            if (lp.balance == delta) {
+                lp.balance = 0;
+            }
+            else {
+                index_t s = lp.child[1 - d];
+                tree_node_t & ls = link(side, s);
+                if (ls.balance == 0) {
+                    rotate(side, p, d);
+                    lp.balance = -delta;
+                    ls.balance = delta;
+                    return;
+                }
+                if (ls.balance == -delta) {
+                    rotate(side, p, d);
+                    lp.balance = 0;
+                    ls.balance = 0;
+                    top = s;
+                }
+                else {
+                    index_t y = ls.child[d];
+                    tree_node_t & ly = link(side, y);
+                    rotate(side, s, 1 - d);
+                    rotate(side, p, d);
+                    lp.balance = (ly.balance == -delta ? delta : 0);
+                    ls.balance = (ly.balance == delta ? -delta : 0);
+                    ly.balance = 0;
+                    top = y;
+                }
+            }
+            p = link(side, top).parent;
+            if (p != nil) {
+                d = direction(side, top);
+            }
+        }
+    }
+
+    /* Leftmost (direction 0) or rightmost (direction 1) node of the subtree of node */
+    index_t extreme(size_t side, index_t node, size_t direction) const noexcept
+    {
+        while (link(side, node).child[direction] != nil) {
+            node = link(side, node).child[direction];
+        }
+        return node;
+    }
+
+    /* Next (direction 1) or previous (direction 0) node in the order of side, or nil */
+    index_t step(size_t side, index_t node, size_t direction) const noexcept
+    {
+        if (link(side, node).child[direction] != nil) {
+            return extreme(side, link(side, node).child[direction], 1 - direction);
+        }
+        index_t p = link(side, node).parent;
+        while (p != nil && link(side, p).child[direction] == node) {
+            node = p;
+            p = link(side, p).parent;
+        }
+        return p;
+    }
+
+    /* Node holding a value equivalent to x, or nil; splay trees splay the last node visited */
+    template <typename Descriptor, typename T>
+    index_t find_node(T const & x) const
+    {
+        auto const & compare = Descriptor::compare(this);
+        index_t last = nil;
+        index_t t = roots[Descriptor::side];
+        while (t != nil) {
+            last = t;
+            if (compare(x, Descriptor::value(this, t))) {
+                t = link(Descriptor::side, t).child[0];
+            }
+            else if (compare(Descriptor::value(this, t), x)) {
+                t = link(Descriptor::side, t).child[1];
+            }
+            else {
+                break;
+            }
+        }
+        if (splaying && last != nil) {
+            splay(Descriptor::side, last);
+        }
+        return t;
+    }
+
+    /* First node not less than x, or greater than x if Upper, or nil; splay trees splay the last node visited */
+    template <typename Descriptor, bool Upper, typename T>
+    index_t bound_node(T const & x) const
+    {
+        auto const & compare = Descriptor::compare(this);
+        index_t result = nil;
+        index_t last = nil;
+        index_t t = roots[Descriptor::side];
+        while (t != nil) {
+            last = t;
+            if (Upper ? compare(x, Descriptor::value(this, t)) : !compare(Descriptor::value(this, t), x)) {
+                result = t;
+                t = link(Descriptor::side, t).child[0];
+            }
+            else {
+                t = link(Descriptor::side, t).child[1];
+            }
+        }
+        if (splaying && last != nil) {
+            splay(Descriptor::side, last);
+        }
+        return result;
+    }
+
+    /* Finds where a node holding x would hang, returns false if a value equivalent to x is present */
+    template <typename Descriptor, typename T>
+    bool find_place(T const & x, index_t & parent, size_t & direction) const
+    {
+        auto const & compare = Descriptor::compare(this);
+        parent = nil;
+        direction = 0;
+        index_t t = roots[Descriptor::side];
+        while (t != nil) {
+            parent = t;
+            if (compare(x, Descriptor::value(this, t))) {
+                direction = 0;
+            }
+            else if (compare(Descriptor::value(this, t), x)) {
+                direction = 1;
+            }
+            else {
+                if (splaying) {
+                    splay(Descriptor::side, t);
+                }
+                return false;
+            }
+            t = link(Descriptor::side, t).child[direction];
+        }
+        return true;
+    }
+
+    void hang(size_t side, index_t node, index_t parent, size_t direction) noexcept
+    {
+        tree_node_t & l = link(side, node);
+        l.child[0] = nil;
+        l.child[1] = nil;
+        l.parent = parent;
+        l.balance = 0;
+        if (parent == nil) {
+            roots[side] = node;
+        }
+        else {
+            link(side, parent).child[direction] = node;
+        }
+        if (splaying) {
+            splay(side, node);
+        }
+        else {
+            rebalance_inserted(side, node);
+        }
+    }
+
+    void unhang(size_t side, index_t z) noexcept
+    {
+        tree_node_t & lz = link(side, z);
+        if (lz.child[0] != nil && lz.child[1] != nil) {
+            /* Swaps z with its successor, which has no left child, so nodes and the values in them never move */
+            index_t s = extreme(side, lz.child[1], 0);
+            tree_node_t & ls = link(side, s);
+            tree_node_t const z_links = lz;
+            tree_node_t const s_links = ls;
+            replace_child(side, z_links.parent, z, s);
+            ls.parent = z_links.parent;
+            ls.balance = z_links.balance;
+            ls.child[0] = z_links.child[0];
+            link(side, z_links.child[0]).parent = s;
+            if (s == z_links.child[1]) {
+                ls.child[1] = z;
+                lz.parent = s;
+            }
+            else {
+                ls.child[1] = z_links.child[1];
+                link(side, z_links.child[1]).parent = s;
+                link(side, s_links.parent).child[0] = z;
+                lz.parent = s_links.parent;
+            }
+            lz.child[0] = nil;
+            lz.child[1] = s_links.child[1];
+            if (s_links.child[1] != nil) {
+                link(side, s_links.child[1]).parent = z;
+            }
+            lz.balance = s_links.balance;
+        }
+        index_t c = (lz.child[0] != nil ? lz.child[0] : lz.child[1]);
+        index_t p = lz.parent;
+        size_t d = (p != nil ? direction(side, z) : 0);
+        if (c != nil) {
+            link(side, c).parent = p;
+        }
+        replace_child(side, p, z, c);
+        if (splaying) {
+            if (p != nil) {
+                splay(side, p);
+            }
+        }
+        else {
+            rebalance_erased(side, p, d);
+        }
+    }
+
+    index_t take_node() noexcept
+    {
+        if (free_head != nil) {
+            index_t node = free_head;
+            free_head = nodes[node].trees[0].child[0];
+            return node;
+        }
+        return used++;
+    }
+
+    void release_node(index_t node) noexcept
+    {
+        nodes[node].trees[0].parent = node;
+        nodes[node].trees[0].child[0] = free_head;
+        free_head = node;
+    }
+
+    void destroy_values(index_t node) noexcept
+    {
+        left_value(node).~Left();
+        right_value(node).~Right();
+    }
+
+    template <typename L, typename R>
+    index_t insert_by_values(L && left, R && right)
+    {
+        index_t left_parent;
+        index_t right_parent;
+        size_t left_direction;
+        size_t right_direction;
+        if (!find_place<left_descriptor_t>(static_cast<Left const &>(left), left_parent, left_direction)
+            || !find_place<right_descriptor_t>(static_cast<Right const &>(right), right_parent, right_direction)
+            || count == N) {
+            return nil;
+        }
+        index_t node = take_node();
+        try {
+            new (nodes[node].left_bytes) Left(std::forward<L>(left));
+        }
+        catch (...) {
+            release_node(node);
+            throw;
+        }
+        try {
+            new (nodes[node].right_bytes) Right(std::forward<R>(right));
+        }
+        catch (...) {
+            left_value(node).~Left();
+            release_node(node);
+            throw;
+        }
+        hang(0, node, left_parent, left_direction);
+        hang(1, node, right_parent, right_direction);
+        ++count;
+        return node;
+    }
+
+    void erase_node(index_t node) noexcept
+    {
+        unhang(0, node);
+        unhang(1, node);
+        destroy_values(node);
+        release_node(node);
+        --count;
+    }
+
+    template <typename Descriptor, typename T>
+    bool erase_element(T const & key)
+    {
+        index_t node = find_node<Descriptor>(key);
+        if (node == nil) {
+            return false;
+        }
+        erase_node(node);
+        return true;
+    }
+
+    template <typename Descriptor, typename FlipDescriptor, typename T>
+    auto const & at_element(T const & key) const
+    {
+        index_t node = find_node<Descriptor>(key);
+        if (node == nil) {
+            throw std::out_of_range("No matching element.");
+        }
+        return FlipDescriptor::value(this, node);
+    }
+
+    /* Copies or moves the nodes of other to the same indices, so its links stay valid; the map must be empty */
+    template <typename Other>
+    void take_nodes(Other && other)
+    {
+        index_t node = 0;
+        try {
+            for (; node < other.used; ++node) {
+                nodes[node].trees[0] = other.nodes[node].trees[0];
+                nodes[node].trees[1] = other.nodes[node].trees[1];
+                if (!other.is_free(node)) {
+                    if (std::is_rvalue_reference<Other &&>::value) {
+                        new (nodes[node].left_bytes) Left(std::move(other.left_value(node)));
+                    }
+                    else {
+                        new (nodes[node].left_bytes) Left(other.left_value(node));
+                    }
+                    try {
+                        if (std::is_rvalue_reference<Other &&>::value) {
+                            new (nodes[node].right_bytes) Right(std::move(other.right_value(node)));
+                        }
+                        else {
+                            new (nodes[node].right_bytes) Right(other.right_value(node));
+                        }
+                    }
+                    catch (...) {
+                        left_value(node).~Left();
+                        throw;
+                    }
+                }
+            }
+        }
+        catch (...) {
+            while (node-- > 0) {
+                if (!other.is_free(node)) {
+                    destroy_values(node);
+                }
+            }
+            throw;
+        }
+        roots[0] = other.roots[0];
+        roots[1] = other.roots[1];
+        count = other.count;
+        used = other.used;
+        free_head = other.free_head;
+    }
+
+public:
+    explicit static_bimap(LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator()) noexcept
+        : left_compare(std::move(left_compare))
+        , right_compare(std::move(right_compare))
+        , roots{nil, nil}
+        , count(0)
+        , used(0)
+        , free_head(nil)
+    {
+    }
+
+    static_bimap(static_bimap const & other)
+        : static_bimap(other.left_compare, other.right_compare)
+    {
+        take_nodes(other);
+    }
+
+    static_bimap(static_bimap && other) noexcept(std::is_nothrow_move_constructible<Left>::value && std::is_nothrow_move_constructible<Right>::value)
+        : static_bimap(other.left_compare, other.right_compare)
+    {
+        take_nodes(std::move(other));
+        other.clear();
+    }
+
+    static_bimap & operator=(static_bimap const & other)
+    {
+        if (this != &other) {
+            clear();
+            left_compare = other.left_compare;
+            right_compare = other.right_compare;
+            take_nodes(other);
+        }
+        return *this;
+    }
+
+    static_bimap & operator=(static_bimap && other) noexcept(std::is_nothrow_move_constructible<Left>::value && std::is_nothrow_move_constructible<Right>::value)
+    {
+        if (this != &other) {
+            clear();
+            left_compare = other.left_compare;
+            right_compare = other.right_compare;
+            take_nodes(std::move(other));
+            other.clear();
+        }
+        return *this;
+    }
+
+    ~static_bimap()
+    {
+        clear();
+    }
+
+    left_iterator begin_left() const noexcept
+    {
+        return left_iterator(this, roots[0] != nil ? extreme(0, roots[0], 0) : nil);
+    }
+
+    left_iterator end_left() const noexcept
+    {
+        return left_iterator(this, nil);
+    }
+
+    right_iterator begin_right() const noexcept
+    {
+        return right_iterator(this, roots[1] != nil ? extreme(1, roots[1], 0) : nil);
+    }
+
+    right_iterator end_right() const noexcept
+    {
+        return right_iterator(this, nil);
+    }
+
+    bool empty() const noexcept
+    {
+        return (count == 0);
+    }
+
+    size_t size() const noexcept
+    {
+        return count;
+    }
+
+    /* Whether inserting a pair would fail for lack of room */
+    bool full() const noexcept
+    {
+        return (count == N);
+    }
+
+    static constexpr size_t capacity() noexcept
+    {
+        return N;
+    }
+
+    left_iterator find_left(Left const & desired) const
+    {
+        return left_iterator(this, find_node<left_descriptor_t>(desired));
+    }
+
+    right_iterator find_right(Right const & desired) const
+    {
+        return right_iterator(this, find_node<right_descriptor_t>(desired));
+    }
+
+    /* Returns end_left() if either value is present or the map is full */
+    left_iterator insert(Left const & left, Right const & right)
+    {
+        return left_iterator(this, insert_by_values(left, right));
+    }
+
+    left_iterator insert(Left const & left, Right && right)
+    {
+        return left_iterator(this, insert_by_values(left, std::move(right)));
+    }
+
+    left_iterator insert(Left && left, Right const & right)
+    {
+        return left_iterator(this, insert_by_values(std::move(left), right));
+    }
+
+    left_iterator insert(Left && left, Right && right)
+    {
+        return left_iterator(this, insert_by_values(std::move(left), std::move(right)));
+    }
+
+    bool erase_left(Left const & key)
+    {
+        return erase_element<left_descriptor_t>(key);
+    }
+
+    bool erase_right(Right const & key)
+    {
+        return erase_element<right_descriptor_t>(key);
+    }
+
+    left_iterator erase_left(left_iterator const & it) noexcept
+    {
+        index_t next = step(0, it.node, 1);
+        erase_node(it.node);
+        return left_iterator(this, next);
+    }
+
+    right_iterator erase_right(right_iterator const & it) noexcept
+    {
+        index_t next = step(1, it.node, 1);
+        erase_node(it.node);
+        return right_iterator(this, next);
+    }
+
+    left_iterator erase_left(left_iterator first, left_iterator const & last) noexcept
+    {
+        while (first != last) {
+            first = erase_left(first);
+        }
+        return first;
+    }
+
+    right_iterator erase_right(right_iterator first, right_iterator const & last) noexcept
+    {
+        while (first != last) {
+            first = erase_right(first);
+        }
+        return first;
+    }
+
+    left_iterator lower_bound_left(Left const & value) const
+    {
+        return left_iterator(this, bound_node<left_descriptor_t, false>(value));
+    }
+
+    left_iterator upper_bound_left(Left const & value) const
+    {
+        return left_iterator(this, bound_node<left_descriptor_t, true>(value));
+    }
+
+    right_iterator lower_bound_right(Right const & value) const
+    {
+        return right_iterator(this, bound_node<right_descriptor_t, false>(value));
+    }
+
+    right_iterator upper_bound_right(Right const & value) const
+    {
+        return right_iterator(this, bound_node<right_descriptor_t, true>(value));
+    }
+
+    Right const & at_left(Left const & key) const
+    {
+        return at_element<left_descriptor_t, right_descriptor_t>(key);
+    }
+
+    Left const & at_right(Right const & key) const
+    {
+        return at_element<right_descriptor_t, left_descriptor_t>(key);
+    }
+
+    void clear() noexcept
+    {
+        if (!trivially_destructible) {
+            for (index_t node = 0; node < used; ++node) {
+                if (!is_free(node)) {
+                    destroy_values(node);
+                }
+            }
+        }
+        roots[0] = nil;
+        roots[1] = nil;
+        count = 0;
+        used = 0;
+        free_head = nil;
+    }
+
+    bool operator==(static_bimap const & other) const
+    {
+        if (size() != other.size()) {
+            return false;
+        }
+        for (left_iterator first = begin_left(), second = other.begin_left(); first != end_left(); ++first, ++second) {
+            if (*first != *second || *first.flip() != *second.flip()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool operator!=(static_bimap const & other) const
+    {
+        return !(*this == other);
+    }
+};
@@ -0,0 +1,311 @@
+#pragma once
+
+#include "bimap.h"
+
+#include <chrono>     // std::chrono::milliseconds, std::chrono::steady_clock
+#include <cstddef>    // size_t
+#include <cstdint>    // uint64_t
+#include <functional> // std::function, std::less
+#include <utility>    // std::move
+
+/*
+ * Eviction policy for bimap, which erases every pair once its time to live has passed.
+ * Every node holds its deadline, Clock::now() plus the time to live when it was linked, and the links of a bucket
+ * in a hierarchical timing wheel: levels of 2^slot_bits slots, where a slot of level L spans 2^(slot_bits * L)
+ * ticks of the given resolution, so the wheel spans 2^(slot_bits * levels) ticks; farther deadlines wait
+ * in its farthest slot. A deadline goes to the lowest level whose span reaches it and moves at most once
+ * per level on its way down, so inserting and erasing take O(1) time and every pair at most levels moves.
+ * map.expire(now) advances the wheel tick by tick, skipping ticks where no level below a filled one changes,
+ * moves the due slots to a list and erases every pair on it; it returns their number and calls the evicted
+ * callback, if any, with both values of every pair first. Pairs are due at the first tick not before their deadline.
+ * Between expire() calls lookups check the deadline of what they find against Clock::now() and treat expired pairs
+ * as absent, inserts of their values erase them like expire() would, while size(), iterating and erase_* see them.
+ * Clock must have a static now() which never goes before its epoch, like std::chrono::steady_clock.
+ * The wheel is a part of the policy, (levels * 2^slot_bits + 1) pointers, and links nodes by raw pointers,
+ * so the storage policy must keep every node at one address.
+ * A copy of a policy keeps the time to live, the resolution and the callback, but links no nodes and counts
+ * from zero, so copies and loaded maps give every pair the full time to live again.
+ */
+
+template <typename Left, typename Right, typename Clock = std::chrono::steady_clock>
+class ttl_eviction
+{
+public:
+    using time_point = typename Clock::time_point;
+    using duration = typename Clock::duration;
+    using callback_t = std::function<void(Left const &, Right const &)>;
+
+    static constexpr size_t slot_bits = 6;
+    static constexpr size_t slots = size_t(1) << slot_bits;
+    static constexpr size_t levels = 4;
+
+    struct hook
+    {
+        hook() noexcept
+            : deadline()
+            , next(nullptr)
+            , where(nullptr)
+            , level(0)
+        {
+        }
+
+        time_point deadline;
+        hook * next;
+        /* The link pointing to this node, a slot or the next link of the previous node */
+        hook ** where;
+        /* Level of the slot holding this node, levels for the list of due nodes */
+        size_t level;
+    };
+
+    struct statistics_t
+    {
+        /* Pairs erased by expire() or by inserts of their values */
+        uint64_t expired;
+        /* Lookups and inserts which found a pair after its deadline, before expire() erased it */
+        uint64_t stale_hits;
+        /* Moves of a node to a lower level */
+        uint64_t cascaded;
+    };
+
+private:
+    duration time_to_live;
+    duration resolution;
+    /* Ticks since the epoch of Clock, up to which the wheel has advanced */
+    uint64_t current;
+    /* Slots of level L start at L * slots, the list of due nodes is the last one */
+    hook * heads[levels * slots + 1];
+    /* Nodes per level, the last one for the list of due nodes */
+    size_t counts[levels + 1];
+    callback_t callback;
+    mutable statistics_t counters;
+
+    static constexpr size_t due = levels * slots;
+
+    uint64_t floor_ticks(time_point time) const noexcept
+    {
+        return static_cast<uint64_t>(time.time_since_epoch() / resolution);
+    }
+
+    uint64_t ceil_ticks(time_point time) const noexcept
+    {
+        uint64_t ticks = floor_ticks(time);
+        return (resolution * ticks < time.time_since_epoch() ? ticks + 1 : ticks);
+    }
+
+    void push(size_t head, size_t level, hook * node) noexcept
+    {
+        hook *& first = heads[head];
+        node->next = first;
+        node->where = &first;
+        node->level = level;
+        if (first != nullptr) {
+            first->where = &node->next;
+        }
+        first = node;
+        ++counts[level];
+    }
+
+    void remove(hook * node) noexcept
+    {
+        *node->where = node->next;
+        if (node->next != nullptr) {
+            node->next->where = node->where;
+        }
+        --counts[node->level];
+    }
+
+    /* Puts node into the slot of its deadline tick, which must be after the current one */
+    void schedule(hook * node, uint64_t tick) noexcept
+    {
+        uint64_t delta = tick - current;
+        if ((delta >> (slot_bits * levels)) != 0) {
+            tick = current + (uint64_t(1) << (slot_bits * levels)) - 1;
+            delta = tick - current;
+        }
+        size_t level = 0;
+        while (level + 1 < levels && (delta >> (slot_bits * (level + 1))) != 0) {
+            ++level;
+        }
+        push(level * slots + ((tick >> (slot_bits * level)) & (slots - 1)), level, node);
+    }
+
+    /* Moves the nodes of a slot to lower levels, or to the list of due nodes */
+    void cascade(size_t head) noexcept
+    {
+        while (heads[head] != nullptr) {
+            hook * node = heads[head];
+            remove(node);
+            uint64_t tick = ceil_ticks(node->deadline);
+            if (tick <= current) {
+                push(due, levels, node);
+            }
+            else {
+                schedule(node, tick);
+                ++counters.cascaded;
+            }
+        }
+    }
+
+    void advance_to(uint64_t target) noexcept
+    {
+        while (current < target) {
+            /* Only the start of a slot of the lowest filled level may change anything */
+            size_t empty = 0;
+            while (empty < levels && counts[empty] == 0) {
+                ++empty;
+            }
+            if (empty == levels) {
+                current = target;
+                break;
+            }
+            uint64_t span = uint64_t(1) << (slot_bits * empty);
+            uint64_t next = (current | (span - 1)) + 1;
+            if (next > target) {
+                current = target;
+                break;
+            }
+            current = next;
+            size_t top = 0;
+            while (top + 1 < levels && (current & ((uint64_t(1) << (slot_bits * (top + 1))) - 1)) == 0) {
+                ++top;
+            }
+            for (size_t level = top; level > 0; --level) {
+                cascade(level * slots + ((current >> (slot_bits * level)) & (slots - 1)));
+            }
+            cascade(current & (slots - 1));
+        }
+    }
+
+    /* Takes the wheel of other, pointing the first node of every slot at the new one */
+    void take(ttl_eviction & other) noexcept
+    {
+        current = other.current;
+        for (size_t i = 0; i <= due; ++i) {
+            heads[i] = other.heads[i];
+            other.heads[i] = nullptr;
+            if (heads[i] != nullptr) {
+                heads[i]->where = &heads[i];
+            }
+        }
+        for (size_t level = 0; level <= levels; ++level) {
+            counts[level] = other.counts[level];
+            other.counts[level] = 0;
+        }
+    }
+
+public:
+    /* The resolution is at least one tick of Clock */
+    explicit ttl_eviction(duration time_to_live, duration resolution = std::chrono::milliseconds(1), callback_t expired_callback = nullptr)
+        : time_to_live(time_to_live)
+        , resolution(resolution > duration::zero() ? resolution : duration(1))
+        , current(floor_ticks(Clock::now()))
+        , heads()
+        , counts()
+        , callback(std::move(expired_callback))
+        , counters()
+    {
+    }
+
+    ttl_eviction(ttl_eviction const & other)
+        : ttl_eviction(other.time_to_live, other.resolution, other.callback)
+    {
+    }
+
+    ttl_eviction(ttl_eviction && other) noexcept
+        : time_to_live(other.time_to_live)
+        , resolution(other.resolution)
+        , callback(std::move(other.callback))
+        , counters(other.counters)
+    {
+        take(other);
+    }
+
+    ttl_eviction & operator=(ttl_eviction && other) noexcept
+    {
+        time_to_live = other.time_to_live;
+        resolution = other.resolution;
+        callback = std::move(other.callback);
+        counters = other.counters;
+        take(other);
+        return *this;
+    }
+
+    /* Deadlines are due no sooner than the next tick, so the pair inserted last is never a victim */
+    template <typename Node>
+    void linked(Node * node) noexcept
+    {
+        node->deadline = Clock::now() + time_to_live;
+        uint64_t tick = ceil_ticks(node->deadline);
+        schedule(node, (tick > current ? tick : current + 1));
+    }
+
+    template <typename Node>
+    void touched(Node *) const noexcept
+    {
+    }
+
+    void missed() const noexcept
+    {
+    }
+
+    template <typename Node>
+    void unlinked(Node * node) noexcept
+    {
+        remove(node);
+    }
+
+    template <typename Node>
+    bool stale(Node const * node) const noexcept
+    {
+        if (node->deadline <= Clock::now()) {
+            ++counters.stale_hits;
+            return true;
+        }
+        return false;
+    }
+
+    template <typename Node>
+    Node * victim(size_t) const noexcept
+    {
+        return static_cast<Node *>(heads[due]);
+    }
+
+    void evicted(Left const & left, Right const & right)
+    {
+        ++counters.expired;
+        if (callback) {
+            callback(left, right);
+        }
+    }
+
+    /* Called by map.expire(now), moves every node due by now to the list of victims */
+    void advance(time_point now) noexcept
+    {
+        advance_to(floor_ticks(now));
+    }
+
+    /* Time to live of the pairs linked from now on */
+    void set_time_to_live(duration new_time_to_live) noexcept
+    {
+        time_to_live = new_time_to_live;
+    }
+
+    duration get_time_to_live() const noexcept
+    {
+        return time_to_live;
+    }
+
+    statistics_t const & statistics() const noexcept
+    {
+        return counters;
+    }
+
+    void reset_statistics() noexcept
+    {
+        counters = statistics_t();
+    }
+};
+
+/* Bimap erasing pairs after their time to live, constructed as ttl_bimap<Left, Right>({}, {}, {}, {}, ttl_eviction<Left, Right>(ttl)) */
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>, typename Clock = std::chrono::steady_clock>
+using ttl_bimap = bimap<Left, Right, LeftComparator, RightComparator, heap_storage, no_observer, ttl_eviction<Left, Right, Clock>>;
@@ -0,0 +1,792 @@
+#pragma once
+
+#include "bimap.h"
+#include "snapshot.h"
+
+#include <algorithm>          // std::max, std::sort
+#include <condition_variable> // std::condition_variable
+#include <cstddef>            // size_t
+#include <cstdint>            // uint8_t, uint32_t, uint64_t
+#include <cstring>            // std::memcmp, std::memcpy
+#include <exception>          // std::exception_ptr, std::current_exception, std::rethrow_exception
+#include <filesystem>         // std::filesystem
+#include <fstream>            // std::ifstream
+#include <functional>         // std::less
+#include <iterator>           // std::istreambuf_iterator
+#include <map>                // std::map
+#include <memory>             // std::unique_ptr, std::make_unique
+#include <mutex>              // std::mutex, std::unique_lock
+#include <optional>           // std::optional
+#include <set>                // std::set
+#include <stdexcept>          // std::runtime_error
+#include <string>             // std::string, std::to_string
+#include <thread>             // std::thread
+#include <utility>            // std::move, std::swap
+#include <vector>             // std::vector
+
+#include <cerrno>     // errno, EINTR
+#include <fcntl.h>    // open
+#include <unistd.h>   // close, fdatasync, fsync, write
+
+/*
+ * Bimap, which survives crashes by a write-ahead log next to its snapshots, POSIX only.
+ * Every change (insert, erase_left or erase_right, unless it changes nothing) appends a compact binary record
+ * to the current log: its length, a checksum and the operation with its values, encoded by snapshot_codec.
+ * Files are numbered by generation: path.snapshot.G holds the state before the records of path.wal.G.
+ * Opening loads the latest snapshot and replays every later log, a torn record at the end of a log ends its replay;
+ * a snapshot which fails to verify is renamed to path.snapshot.G.corrupt and the previous one is loaded instead.
+ * checkpoint_async() saves the current state from a background thread while changes continue: the thread copies
+ * chunks of pairs in left order under the mutex, and every change meanwhile records the pair it inserts or erases
+ * beyond the last copied left value, so the thread skips inserted pairs and adds erased ones back.
+ * Compaction starts a new log and checkpoints the state before it, then removes the snapshots and logs
+ * before the previous snapshot, which stays as the fallback;
+ * it starts by itself when the current log exceeds max_log_bytes.
+ * A failed write or sync of the log starts the next generation from a snapshot of the current state, written
+ * under the mutex, since a record after a partial one would never be replayed; if that fails too, every later
+ * change throws std::runtime_error.
+ * The map is guarded by one mutex, so threads may share it; changes are visible to other threads
+ * before they are durable, a change returns once it is as durable as the sync mode promises.
+ * Requires O(log(size)) time on average for changing or finding one element, plus the log write,
+ * A checkpoint requires O(size * log(size)) time in the background, holding the mutex for checkpoint_batch pairs
+ * at a time, and (sizeof(Right) + 16) bytes per pair of temporary memory plus the pairs changed meanwhile.
+ */
+
+template <typename Left, typename Right, typename LeftComparator = std::less<>, typename RightComparator = std::less<>>
+class wal_bimap
+{
+public:
+    enum class sync_mode
+    {
+        /* Records are written in 64 KiB batches and synced only by sync(), compaction and closing */
+        none,
+        /* Concurrent changes share one fdatasync: whoever waits first syncs every record appended so far */
+        group_commit,
+        /* Every change writes its record and calls fdatasync before returning */
+        per_operation,
+    };
+
+    static constexpr uint64_t default_max_log_bytes = uint64_t(64) << 20;
+
+    /* Pairs a checkpoint copies per acquisition of the mutex */
+    static constexpr size_t checkpoint_batch = 1024;
+
+private:
+    using map_t = bimap<Left, Right, LeftComparator, RightComparator>;
+
+    enum operation_t : uint8_t
+    {
+        insert_operation = 1,
+        erase_left_operation = 2,
+        erase_right_operation = 3,
+    };
+
+    struct log_header_t
+    {
+        static constexpr char signature[8] = {'B', 'I', 'M', 'A', 'P', 'W', 'A', 'L'};
+        static constexpr uint32_t current_version = 1;
+
+        char magic[8];
+        uint32_t version;
+        uint32_t byte_order;
+        uint32_t left_size;
+        uint32_t right_size;
+        uint64_t generation;
+    };
+
+    struct record_header_t
+    {
+        uint32_t length;
+        uint32_t checksum;
+    };
+
+    /* Output for snapshot_codec, appending to a batch of records */
+    struct record_writer_t
+    {
+        std::vector<char> & bytes;
+
+        void write(void const * data, size_t size)
+        {
+            char const * begin = static_cast<char const *>(data);
+            bytes.insert(bytes.end(), begin, begin + size);
+        }
+    };
+
+    /* Input for snapshot_codec, reading one record */
+    struct record_reader_t
+    {
+        char const * position;
+        char const * end;
+
+        void read(void * data, size_t size)
+        {
+            if (size > static_cast<size_t>(end - position)) {
+                throw std::runtime_error("Corrupted log record.");
+            }
+            std::memcpy(data, position, size);
+            position += size;
+        }
+
+        uint64_t size() const noexcept
+        {
+            return static_cast<uint64_t>(end - position);
+        }
+    };
+
+    /* Changes since a running checkpoint started, for left values it hasn't copied yet */
+    struct checkpoint_t
+    {
+        /* Last left value copied */
+        std::optional<Left> cursor;
+        /* Left values of pairs inserted since */
+        std::set<Left, LeftComparator> inserted;
+        /* Pairs erased since */
+        std::map<Left, Right, LeftComparator> erased;
+    };
+
+    static constexpr size_t batch_bytes = size_t(1) << 16;
+
+    std::string file_path(char const * kind, uint64_t generation) const
+    {
+        return path + kind + std::to_string(generation);
+    }
+
+    /* Generations of the files named path + kind + generation */
+    std::vector<uint64_t> generations(char const * kind) const
+    {
+        std::filesystem::path target(path);
+        std::filesystem::path directory = target.parent_path().empty() ? std::filesystem::path(".") : target.parent_path();
+        std::string prefix = target.filename().string() + kind;
+        std::vector<uint64_t> result;
+        for (auto const & entry : std::filesystem::directory_iterator(directory)) {
+            std::string name = entry.path().filename().string();
+            if (name.size() > prefix.size() && name.compare(0, prefix.size(), prefix) == 0
+                && name.find_first_not_of("0123456789", prefix.size()) == std::string::npos) {
+                result.push_back(std::stoull(name.substr(prefix.size())));
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    static void write_all(int descriptor, char const * data, size_t size)
+    {
+        while (size > 0) {
+            ssize_t written = ::write(descriptor, data, size);
+            if (written < 0) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                throw std::runtime_error("Can't write log.");
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    static void sync_file(std::string const & name, bool directory)
+    {
+        int descriptor = open(name.c_str(), directory ? O_RDONLY | O_DIRECTORY : O_RDONLY);
+        if (descriptor < 0 || fsync(descriptor) != 0) {
+            if (descriptor >= 0) {
+                close(descriptor);
+            }
+            throw std::runtime_error("Can't sync " + name + ".");
+        }
+        close(descriptor);
+    }
+
+    void sync_directory() const
+    {
+        std::filesystem::path directory = std::filesystem::path(path).parent_path();
+        sync_file(directory.empty() ? std::string(".") : directory.string(), true);
+    }
+
+    /* Replays the records of one log, stops at a torn record */
+    void replay(uint64_t generation)
+    {
+        std::string name = file_path(".wal.", generation);
+        std::ifstream file(name, std::ios::binary);
+        std::vector<char> bytes((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+        if (!file.eof() && file.fail()) {
+            throw std::runtime_error("Can't read log " + name + ".");
+        }
+        log_header_t header;
+        if (bytes.size() < sizeof(header)) {
+            return;
+        }
+        std::memcpy(&header, bytes.data(), sizeof(header));
+        if (std::memcmp(header.magic, log_header_t::signature, sizeof(header.magic)) != 0 || header.version != log_header_t::current_version
+            || header.byte_order != snapshot_header::native_byte_order || header.generation != generation
+            || header.left_size != snapshot_codec<Left>::fixed_size || header.right_size != snapshot_codec<Right>::fixed_size) {
+            throw std::runtime_error("Log " + name + " doesn't match the value types or is corrupted.");
+        }
+        char const * position = bytes.data() + sizeof(header);
+        char const * end = bytes.data() + bytes.size();
+        record_header_t record;
+        while (static_cast<size_t>(end - position) >= sizeof(record)) {
+            std::memcpy(&record, position, sizeof(record));
+            char const * payload = position + sizeof(record);
+            if (record.length == 0 || record.length > static_cast<size_t>(end - payload)) {
+                break;
+            }
+            snapshot_checksum checksum;
+            checksum.update(payload, record.length);
+            if (static_cast<uint32_t>(checksum.value()) != record.checksum) {
+                break;
+            }
+            record_reader_t in{payload + 1, payload + record.length};
+            switch (static_cast<uint8_t>(payload[0])) {
+            case insert_operation: {
+                Left left = snapshot_codec<Left>::read(in);
+                Right right = snapshot_codec<Right>::read(in);
+                map.insert(std::move(left), std::move(right));
+                break;
+            }
+            case erase_left_operation:
+                map.erase_left(snapshot_codec<Left>::read(in));
+                break;
+            case erase_right_operation:
+                map.erase_right(snapshot_codec<Right>::read(in));
+                break;
+            default:
+                throw std::runtime_error("Corrupted log record.");
+            }
+            if (in.position != in.end) {
+                throw std::runtime_error("Corrupted log record.");
+            }
+            position = payload + record.length;
+        }
+    }
+
+    /* Removes the snapshots and logs older than the last snapshot before generation, which stays as a fallback */
+    void remove_before(uint64_t generation) const
+    {
+        uint64_t fallback = 0;
+        for (uint64_t old : generations(".snapshot.")) {
+            if (old < generation) {
+                fallback = old;
+            }
+        }
+        for (uint64_t old : generations(".snapshot.")) {
+            if (old < fallback) {
+                std::filesystem::remove(file_path(".snapshot.", old));
+            }
+        }
+        for (uint64_t old : generations(".wal.")) {
+            if (old < fallback) {
+                std::filesystem::remove(file_path(".wal.", old));
+            }
+        }
+    }
+
+    /* Whether the logs from generation on have no gaps, so they can be replayed on top of its snapshot */
+    static bool replayable_from(std::vector<uint64_t> const & logs, uint64_t generation)
+    {
+        uint64_t expected = std::max(generation, uint64_t(1));
+        for (uint64_t log : logs) {
+            if (log >= generation && log != expected++) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    /* Starts an empty log of the next generation, the current one must be written and synced */
+    void open_log(uint64_t new_generation)
+    {
+        std::string name = file_path(".wal.", new_generation);
+        int new_descriptor = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+        if (new_descriptor < 0) {
+            throw std::runtime_error("Can't create log " + name + ".");
+        }
+        log_header_t header = {};
+        std::memcpy(header.magic, log_header_t::signature, sizeof(header.magic));
+        header.version = log_header_t::current_version;
+        header.byte_order = snapshot_header::native_byte_order;
+        header.left_size = snapshot_codec<Left>::fixed_size;
+        header.right_size = snapshot_codec<Right>::fixed_size;
+        header.generation = new_generation;
+        try {
+            write_all(new_descriptor, reinterpret_cast<char const *>(&header), sizeof(header));
+            if (fdatasync(new_descriptor) != 0) {
+                throw std::runtime_error("Can't sync log " + name + ".");
+            }
+            sync_directory();
+        }
+        catch (...) {
+            close(new_descriptor);
+            throw;
+        }
+        if (descriptor >= 0) {
+            close(descriptor);
+        }
+        descriptor = new_descriptor;
+        generation = new_generation;
+        log_bytes = sizeof(header);
+    }
+
+    template <typename... Values>
+    void append(operation_t operation, Values const &... values)
+    {
+        size_t start = pending.size();
+        pending.resize(start + sizeof(record_header_t));
+        pending.push_back(static_cast<char>(operation));
+        record_writer_t out{pending};
+        (snapshot_codec<Values>::write(out, values), ...);
+        record_header_t record;
+        record.length = static_cast<uint32_t>(pending.size() - start - sizeof(record));
+        snapshot_checksum checksum;
+        checksum.update(pending.data() + start + sizeof(record), record.length);
+        record.checksum = static_cast<uint32_t>(checksum.value());
+        std::memcpy(pending.data() + start, &record, sizeof(record));
+        appended += pending.size() - start;
+        log_bytes += pending.size() - start;
+    }
+
+    /*
+     * After a failed write or sync the log may end in a partial record, which ends its replay, so nothing may follow it:
+     * starts the next generation from a snapshot of the current state, which makes every change so far durable.
+     * If that fails too, the map rejects further changes. Under the mutex, no other thread may be flushing.
+     */
+    void recover_log()
+    {
+        try {
+            open_log(generation + 1);
+            map.save(file_path(".snapshot.", generation));
+        }
+        catch (std::exception const &) {
+            failed = true;
+            throw std::runtime_error("Can't write log, the map rejects further changes.");
+        }
+        pending.clear();
+        written = appended;
+        durable = appended;
+    }
+
+    /* Writes every pending record, syncs if asked to; no other thread may be flushing */
+    void flush_locked(bool sync)
+    {
+        try {
+            write_all(descriptor, pending.data(), pending.size());
+            if (sync && fdatasync(descriptor) != 0) {
+                throw std::runtime_error("Can't sync log.");
+            }
+        }
+        catch (std::runtime_error const &) {
+            recover_log();
+            return;
+        }
+        pending.clear();
+        written = appended;
+        if (sync) {
+            durable = written;
+        }
+    }
+
+    void check_writable() const
+    {
+        if (failed) {
+            throw std::runtime_error("Can't write log, the map rejects further changes.");
+        }
+    }
+
+    void wait_for_flush(std::unique_lock<std::mutex> & lock)
+    {
+        while (flushing) {
+            flushed.wait(lock);
+        }
+    }
+
+    /* Returns once the records up to target are as durable as the mode promises */
+    void commit(std::unique_lock<std::mutex> & lock, uint64_t target)
+    {
+        if (mode == sync_mode::none) {
+            if (pending.size() >= batch_bytes) {
+                wait_for_flush(lock);
+                flush_locked(false);
+            }
+        }
+        else if (mode == sync_mode::per_operation) {
+            wait_for_flush(lock);
+            flush_locked(true);
+        }
+        else {
+            /* The first waiter syncs the whole group, the others wait for it */
+            while (durable < target) {
+                if (flushing) {
+                    flushed.wait(lock);
+                    continue;
+                }
+                flushing = true;
+                std::vector<char> batch;
+                batch.swap(pending);
+                uint64_t end = appended;
+                int target_descriptor = descriptor;
+                lock.unlock();
+                bool synced = false;
+                try {
+                    write_all(target_descriptor, batch.data(), batch.size());
+                    synced = (fdatasync(target_descriptor) == 0);
+                }
+                catch (std::runtime_error const &) {
+                }
+                lock.lock();
+                flushing = false;
+                flushed.notify_all();
+                if (!synced) {
+                    recover_log();
+                    break;
+                }
+                written = std::max(written, end);
+                durable = std::max(durable, end);
+                batch.clear();
+                if (pending.empty()) {
+                    pending.swap(batch);
+                }
+            }
+        }
+        if (log_bytes > max_log_bytes && !checkpointing) {
+            start_compaction(lock);
+        }
+    }
+
+    bool copied(Left const & left) const
+    {
+        return (checkpoint->cursor && !left_compare(*checkpoint->cursor, left));
+    }
+
+    void note_inserted(Left const & left)
+    {
+        if (checkpoint && !copied(left)) {
+            checkpoint->inserted.insert(left);
+        }
+    }
+
+    void note_erased(Left const & left, Right const & right)
+    {
+        if (checkpoint && !copied(left) && checkpoint->inserted.erase(left) == 0) {
+            checkpoint->erased.emplace(left, right);
+        }
+    }
+
+    /*
+     * Copies the state at the start of the checkpoint chunk by chunk, merging erased pairs back in left order.
+     * Chunks are found without splaying, so the sweep in order doesn't leave the left tree a path.
+     */
+    void copy_checkpoint(snapshot_builder<Left, Right, RightComparator> & builder)
+    {
+        std::vector<std::pair<Left, Right>> batch;
+        batch.reserve(checkpoint_batch);
+        bool done = false;
+        while (!done) {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                checkpoint_t & state = *checkpoint;
+                auto it = (state.cursor ? map.search_upper_bound_left(*state.cursor) : map.begin_left());
+                while (batch.size() < checkpoint_batch) {
+                    bool live = (it != map.end_left());
+                    if (!live && state.erased.empty()) {
+                        done = true;
+                        break;
+                    }
+                    if (live && (state.erased.empty() || left_compare(*it, state.erased.begin()->first))) {
+                        state.cursor = *it;
+                        if (state.inserted.erase(*it) == 0) {
+                            batch.emplace_back(*it, *it.flip());
+                        }
+                        ++it;
+                    }
+                    else {
+                        auto first = state.erased.begin();
+                        state.cursor = first->first;
+                        batch.emplace_back(first->first, std::move(first->second));
+                        state.erased.erase(first);
+                    }
+                }
+                if (state.cursor) {
+                    state.inserted.erase(state.inserted.begin(), state.inserted.upper_bound(*state.cursor));
+                }
+            }
+            for (auto const & pair : batch) {
+                builder.add(pair.first, pair.second);
+            }
+            batch.clear();
+        }
+    }
+
+    /*
+     * Starts saving the current state to target from a background thread, under the mutex,
+     * no checkpoint may be running. A compaction removes the files older than its generation afterwards.
+     */
+    void start_checkpoint(std::string target, uint64_t compacted_generation)
+    {
+        if (checkpointer.joinable()) {
+            checkpointer.join();
+        }
+        checkpoint.emplace(checkpoint_t{std::nullopt, std::set<Left, LeftComparator>(left_compare), std::map<Left, Right, LeftComparator>(left_compare)});
+        checkpointing = true;
+        checkpointer = std::thread([this, target = std::move(target), compacted_generation] {
+            std::exception_ptr error;
+            try {
+                snapshot_builder<Left, Right, RightComparator> builder(target, right_compare);
+                copy_checkpoint(builder);
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    checkpoint.reset();
+                }
+                builder.finish();
+                if (compacted_generation != 0) {
+                    remove_before(compacted_generation);
+                }
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(mutex);
+            checkpoint.reset();
+            checkpoint_error = error;
+            checkpointing = false;
+        });
+    }
+
+    /* Rotates the log and checkpoints the state before the new one */
+    void start_compaction(std::unique_lock<std::mutex> & lock)
+    {
+        wait_for_flush(lock);
+        flush_locked(true);
+        open_log(generation + 1);
+        start_checkpoint(file_path(".snapshot.", generation), generation);
+    }
+
+    std::string path;
+    sync_mode mode;
+    uint64_t max_log_bytes;
+    LeftComparator left_compare;
+    RightComparator right_compare;
+    map_t map;
+    mutable std::mutex mutex;
+    std::condition_variable flushed;
+    int descriptor;
+    uint64_t generation;
+    /* Records appended, written to the log and synced, counted in bytes since opening */
+    uint64_t appended;
+    uint64_t written;
+    uint64_t durable;
+    uint64_t log_bytes;
+    std::vector<char> pending;
+    bool flushing;
+    bool checkpointing;
+    /* Set when neither the log nor a new generation could be written */
+    bool failed;
+    std::optional<checkpoint_t> checkpoint;
+    std::thread checkpointer;
+    std::exception_ptr checkpoint_error;
+
+public:
+    /* Recovers the map from the files of path, or starts an empty one */
+    explicit wal_bimap(std::string path, sync_mode mode = sync_mode::group_commit, uint64_t max_log_bytes = default_max_log_bytes, LeftComparator left_compare = LeftComparator(), RightComparator right_compare = RightComparator())
+        : path(std::move(path))
+        , mode(mode)
+        , max_log_bytes(max_log_bytes)
+        , left_compare(left_compare)
+        , right_compare(right_compare)
+        , map(left_compare, right_compare)
+        , descriptor(-1)
+        , generation(0)
+        , appended(0)
+        , written(0)
+        , durable(0)
+        , log_bytes(0)
+        , flushing(false)
+        , checkpointing(false)
+        , failed(false)
+    {
+        std::vector<uint64_t> snapshots = generations(".snapshot.");
+        std::vector<uint64_t> logs = generations(".wal.");
+        uint64_t base = 0;
+        std::exception_ptr error;
+        while (!snapshots.empty()) {
+            try {
+                map = map_t::load(file_path(".snapshot.", snapshots.back()), left_compare, right_compare);
+                base = snapshots.back();
+                break;
+            }
+            catch (std::runtime_error const &) {
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            if (!replayable_from(logs, snapshots.size() > 1 ? snapshots[snapshots.size() - 2] : 0)) {
+                std::rethrow_exception(error);
+            }
+            /* Keeps the snapshot which failed to verify aside, out of the generations */
+            std::filesystem::rename(file_path(".snapshot.", snapshots.back()), file_path(".snapshot.", snapshots.back()) + ".corrupt");
+            snapshots.pop_back();
+        }
+        if (error) {
+            sync_directory();
+        }
+        for (uint64_t log : logs) {
+            if (log >= base) {
+                replay(log);
+            }
+        }
+        remove_before(base);
+        open_log(std::max(base, logs.empty() ? uint64_t(0) : logs.back()) + 1);
+    }
+
+    wal_bimap(wal_bimap const &) = delete;
+    wal_bimap & operator=(wal_bimap const &) = delete;
+
+    /* Waits for a running checkpoint and syncs the log */
+    ~wal_bimap()
+    {
+        try {
+            wait_for_checkpoint();
+        }
+        catch (std::exception const &) {
+        }
+        try {
+            std::unique_lock<std::mutex> lock(mutex);
+            wait_for_flush(lock);
+            flush_locked(true);
+        }
+        catch (std::runtime_error const &) {
+        }
+        close(descriptor);
+    }
+
+    bool empty() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return map.empty();
+    }
+
+    size_t size() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return map.size();
+    }
+
+    bool insert(Left const & left, Right const & right)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        check_writable();
+        if (map.insert(left, right) == map.end_left()) {
+            return false;
+        }
+        note_inserted(left);
+        append(insert_operation, left, right);
+        commit(lock, appended);
+        return true;
+    }
+
+    bool erase_left(Left const & key)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        check_writable();
+        auto it = map.find_left(key);
+        if (it == map.end_left()) {
+            return false;
+        }
+        note_erased(*it, *it.flip());
+        map.erase_left(it);
+        append(erase_left_operation, key);
+        commit(lock, appended);
+        return true;
+    }
+
+    bool erase_right(Right const & key)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        check_writable();
+        auto it = map.find_right(key);
+        if (it == map.end_right()) {
+            return false;
+        }
+        note_erased(*it.flip(), *it);
+        map.erase_right(it);
+        append(erase_right_operation, key);
+        commit(lock, appended);
+        return true;
+    }
+
+    std::optional<Right> find_left(Left const & key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = map.find_left(key);
+        if (it == map.end_left()) {
+            return std::nullopt;
+        }
+        return *it.flip();
+    }
+
+    std::optional<Left> find_right(Right const & key) const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto it = map.find_right(key);
+        if (it == map.end_right()) {
+            return std::nullopt;
+        }
+        return *it.flip();
+    }
+
+    /* Makes every change so far durable */
+    void sync()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        wait_for_flush(lock);
+        flush_locked(true);
+    }
+
+    /* Bytes of the current log */
+    uint64_t current_log_bytes() const
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return log_bytes;
+    }
+
+    /* Starts compaction unless a checkpoint is running */
+    void compact()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (!checkpointing) {
+            start_compaction(lock);
+        }
+    }
+
+    /*
+     * Saves the current state to a snapshot at path, loadable by bimap::load(), from a background thread;
+     * waits for a running checkpoint first. Changes continue meanwhile and aren't part of the snapshot.
+     */
+    void checkpoint_async(std::string const & target)
+    {
+        for (;;) {
+            wait_for_checkpoint();
+            std::lock_guard<std::mutex> lock(mutex);
+            if (!checkpointing) {
+                start_checkpoint(target, 0);
+                return;
+            }
+        }
+    }
+
+    /* Waits for a running checkpoint or compaction, rethrows its error */
+    void wait_for_checkpoint()
+    {
+        std::thread running;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            running.swap(checkpointer);
+        }
+        if (running.joinable()) {
+            running.join();
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        std::exception_ptr error;
+        std::swap(error, checkpoint_error);
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+};